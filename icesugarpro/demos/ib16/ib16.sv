@@ -80,7 +80,8 @@ module top(input clk,
 
 	// ### UART ###
 
-    logic [15:0] baud_div = (`FREQ * 1_000_000) / 230_400;
+    localparam BAUD_DIV_DEFAULT = (`FREQ * 1_000_000) / 230_400;
+    logic [15:0] baud_div;          // writing FFFE sets it (0 restores the 230.4K default)
     logic uart_tx_start;
     logic [7:0] uart_tx_data_in;
     logic uart_tx_fifo_full;
@@ -291,6 +292,7 @@ module top(input clk,
             int_enable     		<= 0;
             int_pending    		<= 0;
             lrg_mode			<= 1'b0;
+            baud_div            <= BAUD_DIV_DEFAULT;
         end else begin
 			// tick counter logic
             if (cycle_counter == (CYCLES_PER_TICK-1)) begin
@@ -382,9 +384,11 @@ module top(input clk,
                     ib16_bus_ready    <= 1;
                 end 
 
-                // UART Status register
+                // UART Status register (writes set the baud divisor)
                 if (ib16_bus_address == UART_STS_ADDR) begin
-					if (!ib16_bus_wr_en) begin
+					if (ib16_bus_wr_en) begin
+						baud_div <= (ib16_bus_data_in[7:0] != 0) ? {8'b0, ib16_bus_data_in[7:0]} : BAUD_DIV_DEFAULT;
+					end else begin
 						ib16_bus_data_out_reg <= {13'b0, uart_tx_fifo_empty, uart_tx_fifo_full, uart_rx_ready};
 					end
                     ib16_bus_ready    <= 1;
@@ -497,29 +501,121 @@ module top(input clk,
 						8'h12: ib16_bus_data_out_reg <= 16'h0fff;
 						8'h14: ib16_bus_data_out_reg <= 16'h0cfb;
 						8'h16: ib16_bus_data_out_reg <= 16'h0dff;
-						8'h18: ib16_bus_data_out_reg <= 16'h0100;
-						8'h1a: ib16_bus_data_out_reg <= 16'h045a;
-						8'h1c: ib16_bus_data_out_reg <= 16'h93fe;
-						8'h1e: ib16_bus_data_out_reg <= 16'h6134;
-						8'h20: ib16_bus_data_out_reg <= 16'hd5fd;
-						8'h22: ib16_bus_data_out_reg <= 16'h92fe;
-						8'h24: ib16_bus_data_out_reg <= 16'h93fe;
-						8'h26: ib16_bus_data_out_reg <= 16'ha3fe;
-						8'h28: ib16_bus_data_out_reg <= 16'ha310;
-						8'h2a: ib16_bus_data_out_reg <= 16'h7050;
-						8'h2c: ib16_bus_data_out_reg <= 16'hd5fb;
-						8'h2e: ib16_bus_data_out_reg <= 16'h7151;
-						8'h30: ib16_bus_data_out_reg <= 16'h7b71;
-						8'h32: ib16_bus_data_out_reg <= 16'habdc;
-						8'h34: ib16_bus_data_out_reg <= 16'h6112;
-						8'h36: ib16_bus_data_out_reg <= 16'hd402;
-						8'h38: ib16_bus_data_out_reg <= 16'h3000;
-						8'h3a: ib16_bus_data_out_reg <= 16'he008;
-						8'h3c: ib16_bus_data_out_reg <= 16'h93fe;
-						8'h3e: ib16_bus_data_out_reg <= 16'ha310;
-						8'h40: ib16_bus_data_out_reg <= 16'h7050;
-						8'h42: ib16_bus_data_out_reg <= 16'hd5fc;
-						8'h44: ib16_bus_data_out_reg <= 16'hd1f4;
+						8'h18: ib16_bus_data_out_reg <= 16'h045a;
+						8'h1a: ib16_bus_data_out_reg <= 16'h07a5;
+						8'h1c: ib16_bus_data_out_reg <= 16'h0810;
+						8'h1e: ib16_bus_data_out_reg <= 16'h0921;
+						8'h20: ib16_bus_data_out_reg <= 16'h93fe;
+						8'h22: ib16_bus_data_out_reg <= 16'h6137;
+						8'h24: ib16_bus_data_out_reg <= 16'hd218;
+						8'h26: ib16_bus_data_out_reg <= 16'h02b5;
+						8'h28: ib16_bus_data_out_reg <= 16'h6132;
+						8'h2a: ib16_bus_data_out_reg <= 16'hd244;
+						8'h2c: ib16_bus_data_out_reg <= 16'h6134;
+						8'h2e: ib16_bus_data_out_reg <= 16'hd5f8;
+						8'h30: ib16_bus_data_out_reg <= 16'h0100;
+						8'h32: ib16_bus_data_out_reg <= 16'h92fe;
+						8'h34: ib16_bus_data_out_reg <= 16'h93fe;
+						8'h36: ib16_bus_data_out_reg <= 16'ha3fe;
+						8'h38: ib16_bus_data_out_reg <= 16'ha310;
+						8'h3a: ib16_bus_data_out_reg <= 16'h7050;
+						8'h3c: ib16_bus_data_out_reg <= 16'hd5fb;
+						8'h3e: ib16_bus_data_out_reg <= 16'h7151;
+						8'h40: ib16_bus_data_out_reg <= 16'h7b71;
+						8'h42: ib16_bus_data_out_reg <= 16'habdc;
+						8'h44: ib16_bus_data_out_reg <= 16'h6112;
+						8'h46: ib16_bus_data_out_reg <= 16'hd402;
+						8'h48: ib16_bus_data_out_reg <= 16'h3000;
+						8'h4a: ib16_bus_data_out_reg <= 16'he008;
+						8'h4c: ib16_bus_data_out_reg <= 16'h93fe;
+						8'h4e: ib16_bus_data_out_reg <= 16'ha310;
+						8'h50: ib16_bus_data_out_reg <= 16'h7050;
+						8'h52: ib16_bus_data_out_reg <= 16'hd5fc;
+						8'h54: ib16_bus_data_out_reg <= 16'hd1f4;
+						8'h56: ib16_bus_data_out_reg <= 16'h91fe;
+						8'h58: ib16_bus_data_out_reg <= 16'h9afe;
+						8'h5a: ib16_bus_data_out_reg <= 16'h3aa1;
+						8'h5c: ib16_bus_data_out_reg <= 16'h7a7a;
+						8'h5e: ib16_bus_data_out_reg <= 16'hd9e0;
+						8'h60: ib16_bus_data_out_reg <= 16'h7b71;
+						8'h62: ib16_bus_data_out_reg <= 16'habdc;
+						8'h64: ib16_bus_data_out_reg <= 16'hd622;
+						8'h66: ib16_bus_data_out_reg <= 16'h0ae8;
+						8'h68: ib16_bus_data_out_reg <= 16'h601a;
+						8'h6a: ib16_bus_data_out_reg <= 16'hd5da;
+						8'h6c: ib16_bus_data_out_reg <= 16'h05ff;
+						8'h6e: ib16_bus_data_out_reg <= 16'h06ff;
+						8'h70: ib16_bus_data_out_reg <= 16'h0000;
+						8'h72: ib16_bus_data_out_reg <= 16'h93fe;
+						8'h74: ib16_bus_data_out_reg <= 16'ha3a0;
+						8'h76: ib16_bus_data_out_reg <= 16'h3553;
+						8'h78: ib16_bus_data_out_reg <= 16'h0208;
+						8'h7a: ib16_bus_data_out_reg <= 16'h1666;
+						8'h7c: ib16_bus_data_out_reg <= 16'h2555;
+						8'h7e: ib16_bus_data_out_reg <= 16'hd402;
+						8'h80: ib16_bus_data_out_reg <= 16'h3558;
+						8'h82: ib16_bus_data_out_reg <= 16'h3669;
+						8'h84: ib16_bus_data_out_reg <= 16'h7262;
+						8'h86: ib16_bus_data_out_reg <= 16'hd9f9;
+						8'h88: ib16_bus_data_out_reg <= 16'h7050;
+						8'h8a: ib16_bus_data_out_reg <= 16'hd5f3;
+						8'h8c: ib16_bus_data_out_reg <= 16'h93fe;
+						8'h8e: ib16_bus_data_out_reg <= 16'h3553;
+						8'h90: ib16_bus_data_out_reg <= 16'h93fe;
+						8'h92: ib16_bus_data_out_reg <= 16'h3663;
+						8'h94: ib16_bus_data_out_reg <= 16'h0315;
+						8'h96: ib16_bus_data_out_reg <= 16'h5556;
+						8'h98: ib16_bus_data_out_reg <= 16'hd805;
+						8'h9a: ib16_bus_data_out_reg <= 16'h93a0;
+						8'h9c: ib16_bus_data_out_reg <= 16'ha310;
+						8'h9e: ib16_bus_data_out_reg <= 16'h7050;
+						8'ha0: ib16_bus_data_out_reg <= 16'hd5fc;
+						8'ha2: ib16_bus_data_out_reg <= 16'h0306;
+						8'ha4: ib16_bus_data_out_reg <= 16'ha3fe;
+						8'ha6: ib16_bus_data_out_reg <= 16'ha1fe;
+						8'ha8: ib16_bus_data_out_reg <= 16'hd1bb;
+						8'haa: ib16_bus_data_out_reg <= 16'h0306;
+						8'hac: ib16_bus_data_out_reg <= 16'ha3fe;
+						8'hae: ib16_bus_data_out_reg <= 16'ha1fe;
+						8'hb0: ib16_bus_data_out_reg <= 16'h3000;
+						8'hb2: ib16_bus_data_out_reg <= 16'he008;
+						8'hb4: ib16_bus_data_out_reg <= 16'h9afe;
+						8'hb6: ib16_bus_data_out_reg <= 16'ha3fe;
+						8'hb8: ib16_bus_data_out_reg <= 16'haafe;
+						8'hba: ib16_bus_data_out_reg <= 16'h0cf9;
+						8'hbc: ib16_bus_data_out_reg <= 16'ha0dc;
+						8'hbe: ib16_bus_data_out_reg <= 16'h93dc;
+						8'hc0: ib16_bus_data_out_reg <= 16'h0202;
+						8'hc2: ib16_bus_data_out_reg <= 16'h6032;
+						8'hc4: ib16_bus_data_out_reg <= 16'hd3fc;
+						8'hc6: ib16_bus_data_out_reg <= 16'h0efe;
+						8'hc8: ib16_bus_data_out_reg <= 16'haafe;
+						8'hca: ib16_bus_data_out_reg <= 16'ha0dc;
+						8'hcc: ib16_bus_data_out_reg <= 16'h0b55;
+						8'hce: ib16_bus_data_out_reg <= 16'h93dc;
+						8'hd0: ib16_bus_data_out_reg <= 16'h0264;
+						8'hd2: ib16_bus_data_out_reg <= 16'h6032;
+						8'hd4: ib16_bus_data_out_reg <= 16'hd410;
+						8'hd6: ib16_bus_data_out_reg <= 16'h93fe;
+						8'hd8: ib16_bus_data_out_reg <= 16'h0201;
+						8'hda: ib16_bus_data_out_reg <= 16'h4332;
+						8'hdc: ib16_bus_data_out_reg <= 16'hd7f8;
+						8'hde: ib16_bus_data_out_reg <= 16'h0eff;
+						8'he0: ib16_bus_data_out_reg <= 16'h93fe;
+						8'he2: ib16_bus_data_out_reg <= 16'h0efe;
+						8'he4: ib16_bus_data_out_reg <= 16'h613b;
+						8'he6: ib16_bus_data_out_reg <= 16'hd407;
+						8'he8: ib16_bus_data_out_reg <= 16'h7b7b;
+						8'hea: ib16_bus_data_out_reg <= 16'h60b3;
+						8'hec: ib16_bus_data_out_reg <= 16'hd5f0;
+						8'hee: ib16_bus_data_out_reg <= 16'h0eff;
+						8'hf0: ib16_bus_data_out_reg <= 16'habfe;
+						8'hf2: ib16_bus_data_out_reg <= 16'ha3fe;
+						8'hf4: ib16_bus_data_out_reg <= 16'hd001;
+						8'hf6: ib16_bus_data_out_reg <= 16'ha0fe;
+						8'hf8: ib16_bus_data_out_reg <= 16'h0eff;
+						8'hfa: ib16_bus_data_out_reg <= 16'h0cfb;
+						8'hfc: ib16_bus_data_out_reg <= 16'hd191;
                         default: ib16_bus_data_out_reg <= 16'h0000;
                     endcase
                     ib16_bus_ready <= 1;
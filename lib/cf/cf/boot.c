@@ -22,6 +22,8 @@ asm {
 }
 
 #define USE_BIOS
+#define SD_MULTI
+#define FAT16_MULTI
 #include <cflea.h>
 #include "cf/lib/time.c"
 #include "cf/lib/memset.c"
@@ -45,6 +47,14 @@ uint16_t sector_op(uint16_t sector[2], uint8_t *data, uint16_t wr_en)
 	sd_sector_op(off, data, 0);
 }
 
+// whole sector runs of a file for fat16_fread(), one CMD18 each
+uint16_t sector_rdmulti(uint16_t sector[2], uint8_t *data, uint16_t count)
+{
+	uint16_t off[2];
+	off[1] = sector[1] + (((off[0] = sector[0] + fat16_lba[0]) < fat16_lba[0]) ? 1 : 0) + fat16_lba[1];
+	return sd_read_multi(off, data, count);
+}
+
 boot_app(char *name)
 {
 	struct fat16_volinfo *fv;
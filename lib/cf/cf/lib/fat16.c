@@ -83,6 +83,16 @@ uint16_t fat16_n_c(struct fat16_volinfo *fv, uint16_t cluster)
 	};
 }
 
+#ifndef FAT16_TINY
+// give the volume a 512 byte buffer of its own to cache FAT sectors in
+void fat16_fatbuf(struct fat16_volinfo *fv, uint8_t *buf)
+{
+	asm {
+		JMP FAT16_FATBUF
+	};
+}
+#endif
+
 // open a directory 'fat16_de' that can be used with fat16_nextdir()
 // cluster==0 means use the root directory
 void fat16_opendir(struct fat16_volinfo *fv, uint16_t cluster)
@@ -101,6 +111,14 @@ uint16_t fat16_nextdir(struct fat16_volinfo *fv)
 	};
 }
 
+// format a path component as a dirent name, returns the rest of the path or NULL
+char *fat16_fname(char *path, char *filename)
+{
+	asm {
+		JMP FAT16_FNAME
+	};
+}
+
 // walk a directory with a path, returns a dirent on success or NULL on error
 // paths start from the root and must begin with /
 uint16_t fat16_wpath(struct fat16_volinfo *fv, char *path)
@@ -127,6 +145,14 @@ uint16_t fat16_fread(struct fat16_volinfo *fv, uint8_t *dst, uint16_t len)
 	};
 }
 
+// find the ncluster'th cluster of the open file, 0xFFFF if the chain is shorter
+uint16_t fat16_walk(struct fat16_volinfo *fv, uint16_t ncluster, uint16_t alloc)
+{
+	asm {
+		JMP FAT16_WALK
+	};
+}
+
 #else
 // convert a directory starting cluster to a data cluster
 uint16_t fat16_sc2dc(struct fat16_volinfo *fv, uint16_t scluster)
@@ -182,6 +208,9 @@ int fat16_cmp_32(uint16_t a[2], uint16_t b[2])
 uint16_t fat16_initvol(struct fat16_volinfo *fv, uint8_t *secbuf)
 {
 	uint16_t sector[2];
+#ifdef FAT16_WRITE
+	uint16_t x;
+#endif
 	
 	memset(fv, 0, sizeof(struct fat16_volinfo));
 	fv->secbuf = secbuf;
@@ -215,17 +244,80 @@ uint16_t fat16_initvol(struct fat16_volinfo *fv, uint8_t *secbuf)
 	fv->lg2_bpc2 = 16 - fv->lg2_bpc;
 	fv->lg2_spc  = fv->lg2_bpc - 9;
 	fv->lg2_spc2 = 16 - fv->lg2_spc;
+
+#ifdef FAT16_WRITE
+	// # of clusters from the total sector count (16-bit field, or the 32-bit one if that's 0)
+	sector[0] = *((uint16_t*)(secbuf+0x13));
+	sector[1] = 0;
+	if (!sector[0]) {
+		sector[0] = *((uint16_t*)(secbuf+0x20));
+		sector[1] = *((uint16_t*)(secbuf+0x22));
+	}
+	x = fv->data_c << fv->lg2_spc;						// sectors in front of the data region
+	sector[1] -= sector[0] < x;
+	sector[0] -= x;
+	for (x = 0; x < fv->lg2_spc; x++) {
+		sector[0] = (sector[0] >> 1) | (sector[1] << 15);
+		sector[1] >>= 1;
+	}
+	if (sector[1] || sector[0] > 0xFFF4) {
+		sector[0] = 0xFFF4;
+	}
+	fv->n_clust = sector[0] + 2;
+	// and no more than the FAT has entries for
+	if (fv->sec_fat < 256 && fv->n_clust > (fv->sec_fat << 8)) {
+		fv->n_clust = fv->sec_fat << 8;
+	}
+	fv->free_hint = 2;
+#endif
 	
 	return 0;
 }
 
-// given a cluster find the next cluster according to the FAT
-// values >= 0xFFF8 mean end of chain.
-uint16_t fat16_n_c(struct fat16_volinfo *fv, uint16_t cluster)
+#ifndef FAT16_TINY
+#ifdef FAT16_WRITE
+// write a dirty fat_buf back to every copy of the FAT, returns 0 on success
+uint16_t fat16_fatsync(struct fat16_volinfo *fv)
+{
+	uint16_t sector[2], x;
+
+	if (fv->fat_dirty) {
+		sector[0] = fv->fat_sec;
+		sector[1] = 0;
+		for (x = 0; x < fv->no_fats; x++) {
+			if (sector_op(sector, fv->fat_buf, 1)) {
+				return 0xFFFF;
+			}
+			fat16_add_16(sector, fv->sec_fat);
+		}
+		fv->fat_dirty = 0;
+	}
+	return 0;
+}
+#endif
+
+// load FAT sector 'sector' into fat_buf, returns 0 on success
+uint16_t fat16_fatload(struct fat16_volinfo *fv, uint16_t sector[2])
+{
+#ifdef FAT16_WRITE
+	if (fat16_fatsync(fv)) {
+		return 0xFFFF;
+	}
+#endif
+	if (sector_op(sector, fv->fat_buf, 0)) {
+		fv->fat_sec = 0;
+		return 0xFFFF;
+	}
+	fv->fat_sec = sector[0];
+	return 0;
+}
+#endif
+
+// find the sector of the first FAT holding the entry for 'cluster', returns the entry's index in it
+uint16_t fat16_fatpos(struct fat16_volinfo *fv, uint16_t cluster, uint16_t sector[2])
 {
-	uint16_t sector[2];
 	uint16_t off;
-	
+
 /*
  * 'cluster' is an index into a table starting at sector (fv->fat_c * fv->sec_cluster * 512 + cluster * 2) / 512 */
  
@@ -238,11 +330,102 @@ uint16_t fat16_n_c(struct fat16_volinfo *fv, uint16_t cluster)
 	
 	off = (sector[0] >> 1) & 0xFF;  // byte offset into sector
 	fat16_b_to_s(sector);
+	return off;
+}
+
+// given a cluster find the next cluster according to the FAT
+// values >= 0xFFF8 mean end of chain.
+uint16_t fat16_n_c(struct fat16_volinfo *fv, uint16_t cluster)
+{
+	uint16_t sector[2];
+	uint16_t off;
+	
+	off = fat16_fatpos(fv, cluster, sector);
+#ifndef FAT16_TINY
+	// the FAT sits well inside the first 64K sectors so the low half is enough to tag it
+	if (fv->fat_buf) {
+		if (fv->fat_sec != sector[0] && fat16_fatload(fv, sector)) {
+			return 0xFFFF;
+		}
+		return ((uint16_t *)fv->fat_buf)[off];
+	}
+#endif
 	sector_op(sector, fv->secbuf, 0);
 	//DEBUG("next cluster of 0x%04x is 0x%04x\n", cluster, ((uint16_t *)fv->secbuf)[off]);
 	return ((uint16_t *)fv->secbuf)[off];
 }
 
+#ifndef FAT16_TINY
+// give the volume a 512 byte buffer of its own to cache FAT sectors in, FAT lookups then
+// only hit the card when they move to another FAT sector and leave secbuf alone.  buf
+// must not be shared with anything else, NULL turns the cache off
+void fat16_fatbuf(struct fat16_volinfo *fv, uint8_t *buf)
+{
+#ifdef FAT16_WRITE
+	fat16_fatsync(fv);
+#endif
+	fv->fat_buf = buf;
+	fv->fat_sec = 0;
+}
+#endif
+
+#ifdef FAT16_WRITE
+// point the FAT entry of 'cluster' at 'next' (0 frees it, 0xFFFF ends the chain there)
+// returns 0 on success
+uint16_t fat16_set_c(struct fat16_volinfo *fv, uint16_t cluster, uint16_t next)
+{
+	uint16_t sector[2];
+	uint16_t off, x;
+
+	off = fat16_fatpos(fv, cluster, sector);
+#ifndef FAT16_TINY
+	if (fv->fat_buf) {
+		// written back by fat16_fatsync() when we move off this FAT sector or flush
+		if (fv->fat_sec != sector[0] && fat16_fatload(fv, sector)) {
+			return 0xFFFF;
+		}
+		((uint16_t *)fv->fat_buf)[off] = next;
+		fv->fat_dirty = 1;
+		return 0;
+	}
+#endif
+	if (sector_op(sector, fv->secbuf, 0)) {
+		return 0xFFFF;
+	}
+	((uint16_t *)fv->secbuf)[off] = next;
+	for (x = 0; x < fv->no_fats; x++) {
+		if (sector_op(sector, fv->secbuf, 1)) {
+			return 0xFFFF;
+		}
+		fat16_add_16(sector, fv->sec_fat);
+	}
+	return 0;
+}
+
+// find a free cluster, starting at the hint and wrapping around, and mark it as the end
+// of a chain.  Returns the cluster or 0xFFFF if the volume is full
+uint16_t fat16_alloc(struct fat16_volinfo *fv)
+{
+	uint16_t cluster, x;
+
+	cluster = fv->free_hint;
+	for (x = 2; x < fv->n_clust; x++) {
+		if (cluster < 2 || cluster >= fv->n_clust) {
+			cluster = 2;
+		}
+		if (!fat16_n_c(fv, cluster)) {
+			if (fat16_set_c(fv, cluster, 0xFFFF)) {
+				return 0xFFFF;
+			}
+			fv->free_hint = cluster + 1;
+			return cluster;
+		}
+		++cluster;
+	}
+	return 0xFFFF;
+}
+#endif
+
 // open a directory 'fat16_de' that can be used with fat16_nextdir()
 // cluster==0 means use the root directory
 void fat16_opendir(struct fat16_volinfo *fv, uint16_t cluster)
@@ -259,11 +442,21 @@ void fat16_opendir(struct fat16_volinfo *fv, uint16_t cluster)
 	sector[0] = cluster;
 	fat16_c_to_s(fv, sector);
 	sector_op(sector, fv->secbuf, 0);		// read dirent
+#ifdef FAT16_WRITE
+	fv->de_sec[0] = sector[0];
+	fv->de_sec[1] = sector[1];
+#endif
 }
 
+#ifdef FAT16_WRITE
+// fat16_nextdir() but with 'unused' set it stops at the next free entry instead (deleted
+// or the end marker).  At the end of the directory de_cluster is left on its last cluster
+uint16_t fat16_nextde(struct fat16_volinfo *fv, uint16_t unused)
+#else
 // return the next directory entry for the currently open directory
 // or NULL if we hit the end
 uint16_t fat16_nextdir(struct fat16_volinfo *fv) 
+#endif
 {
 	uint16_t sector[2];
 
@@ -275,22 +468,47 @@ top:
 		if (D_FNAME(fv)[0] == 0) {
 			//DEBUG("filename[0] is zero...\n");
 			// end of this directory
+#ifdef FAT16_WRITE
+			if (unused) {
+				return 0;
+			}
+#endif
 			return 0xFFFF;
 		} else if (D_FNAME(fv)[0] == 0xE5) {
 			//DEBUG("filename[0] is 0xE5\n");
 			// this entry is a deleted file
+#ifdef FAT16_WRITE
+			if (unused) {
+				return 0;
+			}
+#endif
 			goto top;
 		}
+#ifdef FAT16_WRITE
+		if (unused) {
+			goto top;
+		}
+#endif
 		return 0;
 	}
 	// we're at the end of the sector so we need to get the next
 	if (fv->de_sector == (fv->sec_cluster - 1)) {
-		// we're at the end of this cluster so we need to read the FAT to find the next in the chain
-		fv->de_cluster = fat16_n_c(fv, fv->de_cluster);
-		if (fv->de_cluster >= 0xFFF8) {
-			// end of cluster chain
-			//DEBUG("de->cluser is >= 0xFFF8\n");
-			return 0xFFFF;
+		if (fv->de_cluster < fv->data_c) {
+			// the root directory is a fixed run of clusters right in front of the data region
+			if (fv->de_cluster + 1 >= fv->data_c) {
+				return 0xFFFF;
+			}
+			++(fv->de_cluster);
+		} else {
+			// we're at the end of this cluster so we need to read the FAT to find the next in the chain,
+			// de_cluster is in data cluster terms so map it back to its FAT index first
+			sector[0] = fat16_n_c(fv, fv->de_cluster - fv->data_c + 2);
+			if (sector[0] < 2 || sector[0] >= 0xFFF8) {
+				// end of cluster chain
+				//DEBUG("de->cluser is >= 0xFFF8\n");
+				return 0xFFFF;
+			}
+			fv->de_cluster = fat16_sc2dc(fv, sector[0]);
 		}
 		fv->de_sector = 0;
 	} else {
@@ -307,26 +525,36 @@ top:
 		++sector[1];
 	}
 	sector_op(sector, fv->secbuf, 0);
+	fv->de_entry = 0;
+#ifdef FAT16_WRITE
+	fv->de_sec[0] = sector[0];
+	fv->de_sec[1] = sector[1];
+#endif
 	
 	// go back to top 
 	goto top;
 }
 
-// walk a directory with a path, returns a dirent on success or NULL on error
-// paths start from the root and must begin with /
-uint16_t fat16_wpath(struct fat16_volinfo *fv, char *path)
+#ifdef FAT16_WRITE
+// return the next directory entry for the currently open directory
+// or NULL if we hit the end
+uint16_t fat16_nextdir(struct fat16_volinfo *fv) 
 {
-	char pathname[13]; // 8 . 3
-	char filename[11];
-	uint16_t x, y, dircluster;
+	return fat16_nextde(fv, 0);
+}
+#endif
 
-	dircluster = 0;
-top:
+// format the path component after the leading / as a dirent name (8.3, space padded)
+// returns the rest of the path or NULL if there's no / or the name is too long
+char *fat16_fname(char *path, char *filename)
+{
+	char pathname[13]; // 8 . 3
+	uint16_t x, y;
 
 	//DEBUG("Starting with [%s]\n", path);
 
 	// check for leading /
-	if (*path++ != '/') return 0xFFFF;
+	if (*path++ != '/') return 0;
 
 	// extract fname
 	x = 0;
@@ -341,7 +569,7 @@ top:
 	// sanity check
 	if (x == 12 && *path && *path != '/') {
 		//DEBUG("Error: pathname is too long\n");
-		return 0xFFFF;
+		return 0;
 	}
 	
 	// format filename/ext
@@ -362,6 +590,23 @@ top:
 	
 	//DEBUG("filename = [%c%c%c%c%c%c%c%c]\n", filename[0], filename[1], filename[2], filename[3], filename[4], filename[5], filename[6], filename[7]);
 	//DEBUG("ext = [%c%c%c]\n", ext[0], ext[1], ext[2]);
+	return path;
+}
+
+// walk a directory with a path, returns a dirent on success or NULL on error
+// paths start from the root and must begin with /
+uint16_t fat16_wpath(struct fat16_volinfo *fv, char *path)
+{
+	char filename[11];
+	uint16_t dircluster;
+
+	dircluster = 0;
+#ifdef FAT16_WRITE
+	fv->de_dir = 0xFFFF;
+#endif
+top:
+	path = fat16_fname(path, filename);
+	if (!path) return 0xFFFF;
 	
 	// now let's open the directory
 	fat16_opendir(fv, dircluster);
@@ -371,8 +616,8 @@ top:
 			// found it, but do we need to loop?
 			if (*path == '/') {
 				if (D_ATTRIB(fv) & 0x10) {
-					// it's a directory so loop
-					dircluster = fat16_sc2dc(fv, D_CLUSTER(fv));
+					// it's a directory so loop (a '..' back to the root has cluster 0)
+					dircluster = D_CLUSTER(fv) ? fat16_sc2dc(fv, D_CLUSTER(fv)) : 0;
 					goto top;
 				} else {
 					// it's not a directory so error
@@ -384,12 +629,24 @@ top:
 			}
 		}
 	}
+#ifdef FAT16_WRITE
+	if (!*path) {
+		// only the last name is missing, remember where it would go for fat16_fcreate()
+		fv->de_dir = dircluster;
+	}
+#endif
 	return 0xFFFF;
 }
 
 // open a file, populates 'file' with the handle, returns 0 on success
 uint16_t fat16_fopen(struct fat16_volinfo *fv, char *path)
 {
+#ifdef FAT16_WRITE
+	// finish off the last file first
+	if (fat16_fflush(fv)) {
+		return 0xFFFF;
+	}
+#endif
 	// walk path from root
 	if (!fat16_wpath(fv, path)) {
 		fv->f_cluster = D_CLUSTER(fv);
@@ -397,11 +654,68 @@ uint16_t fat16_fopen(struct fat16_volinfo *fv, char *path)
 		fv->f_size[1] = D_FZ1(fv);
 		fv->f_pos[0]  = 0;
 		fv->f_pos[1]  = 0;
+#ifndef FAT16_TINY
+		fv->f_cur_c   = 0;
+		fv->f_cur_n   = 0;
+#endif
+#ifdef FAT16_WRITE
+		fv->f_de_sec[0] = fv->de_sec[0];
+		fv->f_de_sec[1] = fv->de_sec[1];
+		fv->f_de_off    = fv->dirent - fv->secbuf;
+#endif
 		return 0;
 	}
 	return 0xFFFF;
 }
 
+// find the ncluster'th cluster (0 based) of the open file by walking its chain, from the
+// read cursor when it's at or before it.  Returns 0xFFFF if the chain is shorter unless
+// alloc is set (FAT16_WRITE) in which case the chain is grown to reach it
+uint16_t fat16_walk(struct fat16_volinfo *fv, uint16_t ncluster, uint16_t alloc)
+{
+	uint16_t cluster, next, n;
+
+	cluster = fv->f_cluster;
+	n = ncluster;
+#ifndef FAT16_TINY
+	if (fv->f_cur_c && ncluster >= fv->f_cur_n) {
+		// pick up where the last read left off
+		cluster = fv->f_cur_c;
+		n -= fv->f_cur_n;
+	}
+	fv->f_cur_c = 0;
+#endif
+#ifdef FAT16_WRITE
+	if (cluster < 2) {
+		// empty file, it gets its first cluster here
+		if (!alloc || (cluster = fat16_alloc(fv)) == 0xFFFF) {
+			return 0xFFFF;
+		}
+		fv->f_cluster = cluster;
+		fv->f_dirty   = 1;
+	}
+#endif
+	while (n--) {
+		next = fat16_n_c(fv, cluster);
+#ifdef FAT16_WRITE
+		if (next >= 0xFFF8 && alloc) {
+			if ((next = fat16_alloc(fv)) == 0xFFFF || fat16_set_c(fv, cluster, next)) {
+				return 0xFFFF;
+			}
+		}
+#endif
+		if (next >= 0xFFF8) {
+			return 0xFFFF;
+		}
+		cluster = next;
+	}
+#ifndef FAT16_TINY
+	fv->f_cur_c = cluster;
+	fv->f_cur_n = ncluster;
+#endif
+	return cluster;
+}
+
 // read from a file upto either len bytes or the end of the file whichever comes first
 // returns the # of bytes actually read
 uint16_t fat16_fread(struct fat16_volinfo *fv, uint8_t *dst, uint16_t len)
@@ -420,11 +734,12 @@ uint16_t fat16_fread(struct fat16_volinfo *fv, uint8_t *dst, uint16_t len)
 	}
 
 /*
- * The loop below could be optimized by caching the current cluster address/sector contents
- * but since this is meant for small memory environments where you could have multiple files
- * open at once we brute force the FAT cluster walk and sector read even if you're just reading
- * 1 byte at a time.  This allows fv->secbuf to be reused across other file accesses.
- * Which means you really should minimize the # of calls to this function.
+ * The data sector is read into fv->secbuf on every call even if you're just reading 1 byte
+ * at a time, this allows fv->secbuf to be shared with other file accesses.  Which means you
+ * really should minimize the # of calls to this function.  Unless FAT16_TINY is defined the
+ * cluster the last read ended in is remembered (f_cur_c/f_cur_n) so moving forward only walks
+ * the FAT from there, with FAT16_TINY every sector walks the chain from the file's first
+ * cluster.  Moving f_pos backwards is fine either way, the walk just starts over.
  */
 
 	// now we loop reading len bytes which may span multiple sectors or clusters
@@ -443,13 +758,10 @@ uint16_t fat16_fread(struct fat16_volinfo *fv, uint8_t *dst, uint16_t len)
 		//DEBUG("len==%x, secoff==%x, n==%x, filepos==%04x%04x, ncluster=%x\n", len, secoff, n, fv->f_pos[1], fv->f_pos[0], ncluster);
 		
 		// now walk the FAT until we find this sector 
-		cluster = fv->f_cluster;
-		while (ncluster--) {
-			cluster = fat16_n_c(fv, cluster);
-			if (cluster >= 0xFFF8) {
-				// somehow we hit a terminal FAT cluster so return
-				return bread;
-			}
+		cluster = fat16_walk(fv, ncluster, 0);
+		if (cluster == 0xFFFF) {
+			// somehow we hit a terminal FAT cluster so return
+			return bread;
 		}
 		
 		// now we have the cluster to read let's map that to a sector
@@ -460,12 +772,43 @@ uint16_t fat16_fread(struct fat16_volinfo *fv, uint8_t *dst, uint16_t len)
 		// now add the sector number in this cluster (this will work upto 16K clusters)
 		fat16_add_16(tmp, (fv->f_pos[0] >> 9) & (fv->sec_cluster - 1)); // add the # of sectors into this cluster we are
 		
+#ifdef FAT16_MULTI
+		// two or more whole sectors are wanted so stream the rest of this cluster, and the
+		// clusters after it while the chain runs straight on, into dst in one go instead of
+		// bouncing each sector through secbuf
+		if (!secoff && len >= 1024) {
+			n = fv->sec_cluster - ((fv->f_pos[0] >> 9) & (fv->sec_cluster - 1));
+			while (n < (len >> 9) && fat16_n_c(fv, cluster) == cluster + 1) {
+				++cluster;
+#ifndef FAT16_TINY
+				fv->f_cur_c = cluster;
+				++(fv->f_cur_n);
+#endif
+				n += fv->sec_cluster;
+			}
+			if (n > (len >> 9)) {
+				n = len >> 9;
+			}
+			if (n > 1) {
+				if (sector_rdmulti(tmp, dst, n)) {
+					return bread;
+				}
+				n <<= 9;
+				goto advance;
+			}
+			n = 512;
+		}
+#endif
+
 		// now we have the sector on disk to read...
 		sector_op(tmp, fv->secbuf, 0);
 		
 		// now copy out based on the offset inside the sector
 		memcpy(dst, fv->secbuf + secoff, n);
 		
+#ifdef FAT16_MULTI
+advance:
+#endif
 		// update pointers/counters
 		dst += n;
 		len -= n;
@@ -475,4 +818,200 @@ uint16_t fat16_fread(struct fat16_volinfo *fv, uint8_t *dst, uint16_t len)
 
 	return bread;
 }
+
+#ifdef FAT16_WRITE
+// write the open file's first cluster and size to its dirent (if they changed) and the
+// cached FAT sector back to the card, returns 0 on success
+uint16_t fat16_fflush(struct fat16_volinfo *fv)
+{
+#ifndef FAT16_TINY
+	// FAT first so the dirent never points at a chain that isn't on the card
+	if (fat16_fatsync(fv)) {
+		return 0xFFFF;
+	}
+#endif
+	if (fv->f_dirty) {
+		if (sector_op(fv->f_de_sec, fv->secbuf, 0)) {
+			return 0xFFFF;
+		}
+		fv->dirent = fv->secbuf + fv->f_de_off;
+		fv->dirent[0x0B] |= 0x20;					// archive
+		fv->dirent[0x1A] = fv->f_cluster;
+		fv->dirent[0x1B] = fv->f_cluster >> 8;
+		fv->dirent[0x1C] = fv->f_size[0];
+		fv->dirent[0x1D] = fv->f_size[0] >> 8;
+		fv->dirent[0x1E] = fv->f_size[1];
+		fv->dirent[0x1F] = fv->f_size[1] >> 8;
+		if (sector_op(fv->f_de_sec, fv->secbuf, 1)) {
+			return 0xFFFF;
+		}
+		fv->f_dirty = 0;
+	}
+	return 0;
+}
+
+// create a file (or truncate it if it's already there) and open it, the directory it goes
+// in has to exist.  Names are 8.3 and upper case same as fat16_wpath().  Returns 0 on success
+uint16_t fat16_fcreate(struct fat16_volinfo *fv, char *path)
+{
+	char filename[11];
+	uint16_t cluster, next, x, sector[2];
+
+	if (!fat16_fopen(fv, path)) {
+		if (D_ATTRIB(fv) & 0x18) {
+			// a directory or the volume label
+			return 0xFFFF;
+		}
+		// already there, give its clusters back
+		cluster = fv->f_cluster;
+		while (cluster >= 2 && cluster < 0xFFF8) {
+			next = fat16_n_c(fv, cluster);
+			if (fat16_set_c(fv, cluster, 0)) {
+				return 0xFFFF;
+			}
+			if (cluster < fv->free_hint) {
+				fv->free_hint = cluster;
+			}
+			cluster = next;
+		}
+		fv->f_cluster = 0;
+		fv->f_size[0] = fv->f_size[1] = 0;
+		fv->f_dirty   = 1;
+		return fat16_fflush(fv);
+	}
+	if (fv->de_dir == 0xFFFF) {
+		// the directory isn't there (or the path is bad)
+		return 0xFFFF;
+	}
+	
+	// the name is the last part of the path
+	for (x = next = 0; path[x]; x++) {
+		if (path[x] == '/') {
+			next = x;
+		}
+	}
+	fat16_fname(path + next, filename);
+	if (filename[0] == ' ') {
+		return 0xFFFF;
+	}
+
+	// find a free dirent
+	fat16_opendir(fv, fv->de_dir);
+	if (fat16_nextde(fv, 1)) {
+		// the directory is full, the root directory can't grow but a sub directory
+		// gets another (zeroed) cluster on the end of its chain
+		if (fv->de_cluster < fv->data_c || (cluster = fat16_alloc(fv)) == 0xFFFF) {
+			return 0xFFFF;
+		}
+		if (fat16_set_c(fv, fv->de_cluster - fv->data_c + 2, cluster)) {
+			return 0xFFFF;
+		}
+		memset(fv->secbuf, 0, 512);
+		sector[1] = 0;
+		sector[0] = fat16_sc2dc(fv, cluster);
+		fat16_c_to_s(fv, sector);
+		fv->de_sec[0] = sector[0];
+		fv->de_sec[1] = sector[1];
+		for (x = 0; x < fv->sec_cluster; x++) {
+			if (sector_op(sector, fv->secbuf, 1)) {
+				return 0xFFFF;
+			}
+			fat16_add_16(sector, 1);
+		}
+		fv->dirent = fv->secbuf;
+	}
+
+	// fill it in, an empty file has no clusters
+	memset(fv->dirent, 0, 32);
+	memcpy(fv->dirent, filename, 11);
+	fv->dirent[0x0B] = 0x20;
+	if (sector_op(fv->de_sec, fv->secbuf, 1)) {
+		return 0xFFFF;
+	}
+	fv->f_cluster   = 0;
+	fv->f_size[0]   = fv->f_size[1] = 0;
+	fv->f_pos[0]    = fv->f_pos[1] = 0;
+#ifndef FAT16_TINY
+	fv->f_cur_c     = 0;
+	fv->f_cur_n     = 0;
+#endif
+	fv->f_de_sec[0] = fv->de_sec[0];
+	fv->f_de_sec[1] = fv->de_sec[1];
+	fv->f_de_off    = fv->dirent - fv->secbuf;
+	fv->f_dirty     = 0;
+	return 0;
+}
+
+// open a file with f_pos at its end so fat16_fwrite() adds to it, it's created if it
+// isn't there.  Returns 0 on success
+uint16_t fat16_fappend(struct fat16_volinfo *fv, char *path)
+{
+	if (fat16_fopen(fv, path) && fat16_fcreate(fv, path)) {
+		return 0xFFFF;
+	}
+	fv->f_pos[0] = fv->f_size[0];
+	fv->f_pos[1] = fv->f_size[1];
+	return 0;
+}
+
+// write len bytes at f_pos, overwriting what's there and growing the file (and its chain)
+// past its end.  Returns the # of bytes written, short if the volume filled up or the card
+// failed.  Whole sectors go straight from src, partial ones are merged in secbuf
+uint16_t fat16_fwrite(struct fat16_volinfo *fv, uint8_t *src, uint16_t len)
+{
+	uint16_t bwritten, tmp[2], pos[2], n, secoff, cluster;
+
+	bwritten = 0;
+	while (len) {
+		// how many bytes go in this sector
+		secoff = fv->f_pos[0] & 0x1FF;
+		if (len > 512 - secoff) {
+			n = 512 - secoff;
+		} else {
+			n = len;
+		}
+
+		// find (or add) the cluster f_pos is in and map it to the sector
+		cluster = fat16_walk(fv, (fv->f_pos[0] >> fv->lg2_bpc) | (fv->f_pos[1] << fv->lg2_bpc2), 1);
+		if (cluster == 0xFFFF) {
+			break;
+		}
+		tmp[1] = 0;
+		tmp[0] = fat16_sc2dc(fv, cluster);
+		fat16_c_to_s(fv, tmp);
+		fat16_add_16(tmp, (fv->f_pos[0] >> 9) & (fv->sec_cluster - 1));
+
+		if (n != 512) {
+			// keep the rest of the sector unless it's all past the end of the file
+			pos[0] = fv->f_pos[0] & 0xFE00;
+			pos[1] = fv->f_pos[1];
+			if (fat16_cmp_32(fv->f_size, pos) == 1) {
+				if (sector_op(tmp, fv->secbuf, 0)) {
+					break;
+				}
+			} else {
+				memset(fv->secbuf, 0, 512);
+			}
+			memcpy(fv->secbuf + secoff, src, n);
+			if (sector_op(tmp, fv->secbuf, 1)) {
+				break;
+			}
+		} else if (sector_op(tmp, src, 1)) {
+			break;
+		}
+
+		// update pointers/counters
+		src += n;
+		len -= n;
+		bwritten += n;
+		fat16_add_16(fv->f_pos, n);
+		if (fat16_cmp_32(fv->f_pos, fv->f_size) == 1) {
+			fv->f_size[0] = fv->f_pos[0];
+			fv->f_size[1] = fv->f_pos[1];
+			fv->f_dirty   = 1;
+		}
+	}
+	return bwritten;
+}
+#endif
 #endif
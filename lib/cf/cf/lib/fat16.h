@@ -14,16 +14,43 @@
 // 3. It only supports 16 bit data types
 
 // With that in mind ... I present you this madness that is simply meant to be able
-// to walk a FAT16 tree, find a file, and read from it.  Kinda bare bones.  No writing
-// support (yet?)
+// to walk a FAT16 tree, find a file, and read from it.  Kinda bare bones.  Writing is
+// optional, see FAT16_WRITE below.
 
 // Meant to be used with <= 16K cluster devices (<= 1GB)
 // Given this is, you know, a 16-bit ISA from the 90s .... How much space do you really need?
 
+// fat16_fread() remembers which cluster the file position is in so reading a file front to
+// back only walks the FAT once per cluster, and fat16_fatbuf() can give the volume its own
+// 512 byte buffer to keep the last FAT sector in.  Define FAT16_TINY to drop both and go
+// back to walking the chain from the start on every read with no extra RAM.  Apps built
+// with USE_BOOT share the boot loader's code so they must agree with it on FAT16_TINY.
+
+// Define FAT16_WRITE for fat16_fcreate()/fat16_fappend()/fat16_fwrite().  Clusters are
+// allocated from a next free cluster hint and FAT updates go through the fat16_fatbuf()
+// sector (write-back, only written to the card, and the other FAT copies, when another
+// FAT sector is needed or on fat16_fflush()) so appending a few bytes at a time doesn't
+// rewrite the FAT every call.  The directory entry (size/first cluster) is written on
+// fat16_fflush() too, which fat16_fopen()/fat16_fcreate()/fat16_fappend() do for the
+// previous file.  Data sectors are written through.  Without a fat16_fatbuf() (or with
+// FAT16_TINY) every FAT update is written straight to all the FAT copies.  The boot loader
+// is built without it so FAT16_WRITE can't be used with USE_BOOT.
+
+#ifdef FAT16_HOST
+// building on a PC (stuff/fat16), use the real fixed width types
+#include <stdint.h>
+#include <string.h>
+#else
 #define uint8_t unsigned char
 #define uint16_t unsigned
+#endif
 
 extern uint16_t sector_op(uint16_t sector[2], uint8_t *data, uint16_t wr_en);
+#ifdef FAT16_MULTI
+// with FAT16_MULTI fat16_fread() reads runs of whole sectors inside a cluster straight into
+// the caller's buffer with this (e.g. on top of sd_read_multi()), returns 0 on success
+extern uint16_t sector_rdmulti(uint16_t sector[2], uint8_t *data, uint16_t count);
+#endif
 
 // our structure holding info about the volume
 struct fat16_volinfo {
@@ -57,6 +84,29 @@ struct fat16_volinfo {
 	uint16_t f_cluster;
 	uint16_t f_size[2];
 	uint16_t f_pos[2];
+
+#ifndef FAT16_TINY
+// read cursor, the cluster f_pos was in on the last read and its index in the chain
+	uint16_t f_cur_c;
+	uint16_t f_cur_n;
+
+// FAT sector cache (optional)
+	uint8_t *fat_buf;
+	uint16_t fat_sec;								// sector held in fat_buf, 0 for none
+#ifdef FAT16_WRITE
+	uint8_t fat_dirty;								// fat_buf differs from the card
+#endif
+#endif
+
+#ifdef FAT16_WRITE
+	uint16_t n_clust;								// clusters 2..n_clust-1 are usable
+	uint16_t free_hint;								// where the next free cluster search starts
+	uint16_t de_sec[2];								// sector the directory walker has in secbuf
+	uint16_t de_dir;								// where fat16_wpath() didn't find the last name, 0xFFFF if not that
+	uint16_t f_de_sec[2];							// sector/offset of the open file's dirent
+	uint16_t f_de_off;
+	uint8_t f_dirty;								// f_cluster/f_size not written to the dirent yet
+#endif
 };
 
 #define D_FNAME(fv)   (&fv->dirent[0])
@@ -78,14 +128,29 @@ int fat16_cmp_32(uint16_t a[2], uint16_t b[2]);						// compare 32-bit a to 32-b
 uint16_t fat16_initvol(struct fat16_volinfo *fv, uint8_t *secbuf);	// init the volinfo structure
 uint16_t fat16_sc2dc(struct fat16_volinfo *fv, uint16_t scluster);	// convert starting cluster to data cluster
 uint16_t fat16_n_c(struct fat16_volinfo *fv, uint16_t cluster);		// find the next cluster
+#ifndef FAT16_TINY
+void fat16_fatbuf(struct fat16_volinfo *fv, uint8_t *buf);			// cache FAT sectors in buf
+#endif
 
 // directory related
 void fat16_opendir(struct fat16_volinfo *fv, uint16_t cluster);		// open a directory
 uint16_t fat16_nextdir(struct fat16_volinfo *fv);					// walk to next entry
 uint16_t fat16_wpath(struct fat16_volinfo *fv, char *path);			// walk a file system path to a dirent
+char *fat16_fname(char *path, char *filename);						// format a path component as a dirent name
 
 // file related
 uint16_t fat16_fopen(struct fat16_volinfo *fv, char *path);
 uint16_t fat16_fread(struct fat16_volinfo *fv, uint8_t *dst, uint16_t len);
+uint16_t fat16_walk(struct fat16_volinfo *fv, uint16_t ncluster, uint16_t alloc);	// find the ncluster'th cluster of the file
+
+#ifdef FAT16_WRITE
+uint16_t fat16_nextde(struct fat16_volinfo *fv, uint16_t unused);	// walk to next entry or free slot
+uint16_t fat16_set_c(struct fat16_volinfo *fv, uint16_t cluster, uint16_t next);	// set a FAT entry
+uint16_t fat16_alloc(struct fat16_volinfo *fv);						// allocate a free cluster as end of chain
+uint16_t fat16_fflush(struct fat16_volinfo *fv);					// write back the dirent and FAT sector
+uint16_t fat16_fcreate(struct fat16_volinfo *fv, char *path);		// create or truncate a file
+uint16_t fat16_fappend(struct fat16_volinfo *fv, char *path);		// open (or create) a file at its end
+uint16_t fat16_fwrite(struct fat16_volinfo *fv, uint8_t *src, uint16_t len);
+#endif
 
 #endif
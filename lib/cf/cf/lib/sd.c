@@ -49,6 +49,12 @@ unsigned sd_cmd(unsigned cmd, unsigned ph, unsigned pl, unsigned crc)
 		JMP SD_CMD
 	}
 }
+sd_xfer_block(unsigned char *dst, unsigned char *src, unsigned len)
+{
+	asm {
+		JMP SD_XFER_BLOCK
+	}
+}
 int sd_read_block(unsigned char *dst, unsigned len)
 {
 	asm {
@@ -80,6 +86,17 @@ unsigned sd_sector_op(unsigned sector[2], unsigned char *dst, int wr_en)
 // Direction Mode POrt
 #define SD_SPI_PORT2 (SD_PMOD + PORT_PMOD_DIR_BASE)
 
+#ifdef SPI_ACCEL
+// SPI byte port, OUT [divider:data] and the byte from the card comes back in the ACC
+#define SD_SPI_BYTE (SD_PMOD + $F0)
+
+// SCK divider for sd_xfer_block(), FREQ / (2 * (div + 1)) so 8.4MHz at 135MHz.  The
+// commands stay on the slow $1F one, blocks only move once the card is out of idle.
+#ifndef SD_SPI_BLOCK_DIV
+#define SD_SPI_BLOCK_DIV $0700
+#endif
+#endif
+
 #ifdef SD_BIOS
 // 0xFFD0..0xFFEF for BIOS based SD lib
 #define sd_is_init *((unsigned char*)sd_is_init_addr)
@@ -120,7 +137,7 @@ unsigned sd_spi_transfer(unsigned out)
 	asm {
 		LDB 2,S					* load out
 		OR #$1F00               * set SPI timer divider to 2 * (3 + 1)
-		OUT $F0					* use SPI GPIO0
+		OUT SD_SPI_BYTE			* use SPI GPIO0
 		RET						* OUTing to this port puts the return value in the ACC
 	}
 #else
@@ -170,6 +187,228 @@ unsigned sd_spi_recv()
 #endif
 }
 
+// transfer len bytes, src NULL clocks out 0xFF into dst and dst NULL drops what comes back
+// (sd.c only ever moves a sector one way, so one of them has to be NULL).  This is what moves
+// the 512 bytes of a sector so the bit loop is unrolled (or with SPI_ACCEL the byte port runs
+// at SD_SPI_BLOCK_DIV with a tight loop around it, kept small since it's in the BIOS ROM)
+sd_xfer_block(unsigned char *dst, unsigned char *src, unsigned len)
+{
+#ifdef SPI_ACCEL
+	// dst/src/len are at 6,S/4,S/2,S
+	asm {
+		LD 2,S
+		SJZ ?sd_xb_done
+		LD 4,S
+		SJZ ?sd_xb_rx			* no src, clock out 0xFF
+		DEC
+		TNI TAR0				* R0 = src - 1
+		LD 2,S
+		TNI TAR1				* R1 = len
+?sd_xb_txtop EQU *
+		TNI INCR0I				* I = ++src
+		LDB I
+		OR #SD_SPI_BLOCK_DIV
+		OUT SD_SPI_BYTE
+		TNI DECR1A
+		SJNZ ?sd_xb_txtop
+		SJMP ?sd_xb_done
+?sd_xb_rx EQU *
+		LD 6,S
+		DEC
+		TNI TAR1				* R1 = dst - 1
+		LD 2,S
+		TNI TAR0				* R0 = len
+?sd_xb_rxtop EQU *
+		LD #SD_SPI_BLOCK_DIV+$FF
+		OUT SD_SPI_BYTE
+		TNI INCR1I				* I = ++dst
+		STB I
+		TNI DECR0A
+		SJNZ ?sd_xb_rxtop
+?sd_xb_done EQU *
+	}
+#else
+	// dst/src/len are at 6,S/4,S/2,S and len counts down in place
+	// the tx loop: R0 == src - 1 (I follows it), R1 == the byte coming in
+	// the rx loop: R1 == dst - 1, R0 == the byte coming in
+	asm {
+		LD 2,S
+		JZ ?sd_xb_done
+		LD 4,S
+		JZ ?sd_xb_rx			* no src, clock out 0xFF
+		DEC
+		TNI TAR0				* R0 = src - 1
+?sd_xb_tx EQU *
+		TNI INCR0I				* I = ++src
+		CLR
+		TNI TAR1				* R1 = 0, the MISO bits are added in
+		LDB I					* bit 7 of *src
+		SHR #5
+		ANDB #4
+		OR #$FA00
+		OUT SD_SPI_PORT
+		LD #$0100
+		IN SD_SPI_PORT
+		ANDB #2
+		SHL #6
+		TNI ADAR1
+		LDB I					* bit 6 of *src
+		SHR #4
+		ANDB #4
+		OR #$FA00
+		OUT SD_SPI_PORT
+		LD #$0100
+		IN SD_SPI_PORT
+		ANDB #2
+		SHL #5
+		TNI ADAR1
+		LDB I					* bit 5 of *src
+		SHR #3
+		ANDB #4
+		OR #$FA00
+		OUT SD_SPI_PORT
+		LD #$0100
+		IN SD_SPI_PORT
+		ANDB #2
+		SHL #4
+		TNI ADAR1
+		LDB I					* bit 4 of *src
+		SHR #2
+		ANDB #4
+		OR #$FA00
+		OUT SD_SPI_PORT
+		LD #$0100
+		IN SD_SPI_PORT
+		ANDB #2
+		SHL #3
+		TNI ADAR1
+		LDB I					* bit 3 of *src
+		SHR #1
+		ANDB #4
+		OR #$FA00
+		OUT SD_SPI_PORT
+		LD #$0100
+		IN SD_SPI_PORT
+		ANDB #2
+		SHL #2
+		TNI ADAR1
+		LDB I					* bit 2 of *src
+		ANDB #4
+		OR #$FA00
+		OUT SD_SPI_PORT
+		LD #$0100
+		IN SD_SPI_PORT
+		ANDB #2
+		SHL #1
+		TNI ADAR1
+		LDB I					* bit 1 of *src
+		SHL #1
+		ANDB #4
+		OR #$FA00
+		OUT SD_SPI_PORT
+		LD #$0100
+		IN SD_SPI_PORT
+		ANDB #2
+		TNI ADAR1
+		LDB I					* bit 0 of *src
+		SHL #2
+		ANDB #4
+		OR #$FA00
+		OUT SD_SPI_PORT
+		LD #$0100
+		IN SD_SPI_PORT
+		ANDB #2
+		SHR #1
+		TNI ADAR1
+		LD 6,S
+		SJZ ?sd_xb_txnext		* no dst, drop it
+		TAI
+		ADD #1
+		ST 6,S					* dst++
+		TNI TR1A
+		STB I
+?sd_xb_txnext EQU *
+		LD 2,S
+		DEC
+		ST 2,S
+		JNZ ?sd_xb_tx
+		JMP ?sd_xb_done
+?sd_xb_rx EQU *
+		LD 6,S
+		DEC
+		TNI TAR1				* R1 = dst - 1
+?sd_xb_rxtop EQU *
+		CLR
+		TNI TAR0				* R0 = 0, the MISO bits are added in
+		LD #$FA04				* bit 7, MOSI high
+		OUT SD_SPI_PORT
+		LD #$0100
+		IN SD_SPI_PORT
+		ANDB #2
+		SHL #6
+		TNI ADAR0
+		LD #$FA04				* bit 6, MOSI high
+		OUT SD_SPI_PORT
+		LD #$0100
+		IN SD_SPI_PORT
+		ANDB #2
+		SHL #5
+		TNI ADAR0
+		LD #$FA04				* bit 5, MOSI high
+		OUT SD_SPI_PORT
+		LD #$0100
+		IN SD_SPI_PORT
+		ANDB #2
+		SHL #4
+		TNI ADAR0
+		LD #$FA04				* bit 4, MOSI high
+		OUT SD_SPI_PORT
+		LD #$0100
+		IN SD_SPI_PORT
+		ANDB #2
+		SHL #3
+		TNI ADAR0
+		LD #$FA04				* bit 3, MOSI high
+		OUT SD_SPI_PORT
+		LD #$0100
+		IN SD_SPI_PORT
+		ANDB #2
+		SHL #2
+		TNI ADAR0
+		LD #$FA04				* bit 2, MOSI high
+		OUT SD_SPI_PORT
+		LD #$0100
+		IN SD_SPI_PORT
+		ANDB #2
+		SHL #1
+		TNI ADAR0
+		LD #$FA04				* bit 1, MOSI high
+		OUT SD_SPI_PORT
+		LD #$0100
+		IN SD_SPI_PORT
+		ANDB #2
+		TNI ADAR0
+		LD #$FA04				* bit 0, MOSI high
+		OUT SD_SPI_PORT
+		LD #$0100
+		IN SD_SPI_PORT
+		ANDB #2
+		SHR #1
+		TNI ADAR0
+		TNI INCR1I				* I = ++dst
+		TNI TR0A
+		STB I
+		LD 2,S
+		DEC
+		ST 2,S
+		JNZ ?sd_xb_rxtop
+?sd_xb_done EQU *
+		LD #$FE00				* SCK bit enable, write 0
+		OUT SD_SPI_PORT
+	}
+#endif
+}
+
 sd_init()
 {
 	sd_is_hc = sd_is_init = 0;
@@ -219,9 +458,7 @@ int sd_read_block(unsigned char *dst, unsigned len)
 #ifdef DEBUG
 	printf("sd_read_block: Got READ_TOKEN at x==%u\n", x);
 #endif
-			for (x = len+1; --x; ) {
-				*dst++ = sd_spi_recv();
-			}
+			sd_xfer_block(dst, 0, len);
 			sd_spi_recv(); // skip CRC
 			sd_spi_recv();
 			return 0;
@@ -358,9 +595,7 @@ retry:
 #ifndef SD_NO_WRITE
 	if (wr_en) {
 		sd_spi_transfer(0xFE);
-		for (x = 0; x < 512; x++) {
-			sd_spi_transfer(dst[x]);
-		}
+		sd_xfer_block(0, dst, 512);
 		sd_spi_recv();
 		sd_spi_recv();
 		if ((sd_spi_recv() & 0x1F) != 0x05) { goto error; }
@@ -388,5 +623,53 @@ error:
 	return ret;
 }
 
+#endif
+
+#ifdef SD_MULTI
+// read count consecutive sectors starting at sector with one CMD18 instead of a CMD17 per
+// sector, the blocks stream straight into dst (count * 512 bytes) and CMD12 ends the stream.
+// Built on sd_cmd()/sd_read_block() so it works against the BIOS too without taking up ROM.
+unsigned sd_read_multi(unsigned sector[2], unsigned char *dst, unsigned count)
+{
+	unsigned ret, r, x, n;
+	unsigned char *p;
+
+	ret = 0xFFFF;
+	r = 0;
+
+retry:
+	sd_spi_set_cs(0);
+	if (sd_cmd(18, sector[1], sector[0], 0) != 0) { goto error; }
+	p = dst;
+	for (n = count; n; --n) {
+		if (sd_read_block(p, 512) != 0) { goto stop; }
+		p += 512;
+	}
+	ret = 0;
+stop:
+	// CMD12, the card may still be sending data while it comes in
+	sd_spi_transfer(0x40 + 12);
+	sd_spi_transfer(0);
+	sd_spi_transfer(0);
+	sd_spi_transfer(0);
+	sd_spi_transfer(0);
+	sd_spi_transfer(0x61);
+	sd_spi_recv();						// stuff byte, may look like an R1
+	for (x = 256; --x; ) {
+		if (!(sd_spi_recv() & 0x80)) { break; }
+	}
+	for (x = 8193; --x; ) {
+		if (sd_spi_recv()) { break; }	// busy while MISO is held low
+	}
+error:
+	sd_spi_set_cs(1);
+	sd_spi_recv();
+	sd_spi_recv();
+	if (ret != 0 && r++ < 32) {
+		wait_ms(250);
+		goto retry;
+	}
+	return ret;
+}
 #endif
 #endif
@@ -143,4 +143,198 @@ unsigned spi_recv()
 #endif
 }
 
+// transfer len bytes, src NULL clocks out 0xFF and dst NULL drops what comes back (not both)
+// with SPI_FIXED the bit loop is unrolled and the byte stays in memory instead of a shift register
+spi_xfer_block(unsigned char *dst, unsigned char *src, unsigned len)
+{
+#ifdef SPI_FIXED
+	// dst/src/len are at 6,S/4,S/2,S and len counts down in place
+	// the tx loop: R0 == src - 1 (I follows it), R1 == the byte coming in
+	// the rx loop: R1 == dst - 1, R0 == the byte coming in
+	asm {
+		LD 2,S
+		JZ ?spi_xb_done
+		LD 4,S
+		JZ ?spi_xb_rx			* no src, clock out 0xFF
+		DEC
+		TNI TAR0				* R0 = src - 1
+?spi_xb_tx EQU *
+		TNI INCR0I				* I = ++src
+		CLR
+		TNI TAR1				* R1 = 0, the MISO bits are added in
+		LDB I					* bit 7 of *src
+		SHR #5
+		ANDB #4
+		OR #$FA00
+		OUT SPI_PORT
+		LD #$0100
+		IN SPI_PORT
+		ANDB #2
+		SHL #6
+		TNI ADAR1
+		LDB I					* bit 6 of *src
+		SHR #4
+		ANDB #4
+		OR #$FA00
+		OUT SPI_PORT
+		LD #$0100
+		IN SPI_PORT
+		ANDB #2
+		SHL #5
+		TNI ADAR1
+		LDB I					* bit 5 of *src
+		SHR #3
+		ANDB #4
+		OR #$FA00
+		OUT SPI_PORT
+		LD #$0100
+		IN SPI_PORT
+		ANDB #2
+		SHL #4
+		TNI ADAR1
+		LDB I					* bit 4 of *src
+		SHR #2
+		ANDB #4
+		OR #$FA00
+		OUT SPI_PORT
+		LD #$0100
+		IN SPI_PORT
+		ANDB #2
+		SHL #3
+		TNI ADAR1
+		LDB I					* bit 3 of *src
+		SHR #1
+		ANDB #4
+		OR #$FA00
+		OUT SPI_PORT
+		LD #$0100
+		IN SPI_PORT
+		ANDB #2
+		SHL #2
+		TNI ADAR1
+		LDB I					* bit 2 of *src
+		ANDB #4
+		OR #$FA00
+		OUT SPI_PORT
+		LD #$0100
+		IN SPI_PORT
+		ANDB #2
+		SHL #1
+		TNI ADAR1
+		LDB I					* bit 1 of *src
+		SHL #1
+		ANDB #4
+		OR #$FA00
+		OUT SPI_PORT
+		LD #$0100
+		IN SPI_PORT
+		ANDB #2
+		TNI ADAR1
+		LDB I					* bit 0 of *src
+		SHL #2
+		ANDB #4
+		OR #$FA00
+		OUT SPI_PORT
+		LD #$0100
+		IN SPI_PORT
+		ANDB #2
+		SHR #1
+		TNI ADAR1
+		LD 6,S
+		SJZ ?spi_xb_txnext		* no dst, drop it
+		TAI
+		ADD #1
+		ST 6,S					* dst++
+		TNI TR1A
+		STB I
+?spi_xb_txnext EQU *
+		LD 2,S
+		DEC
+		ST 2,S
+		JNZ ?spi_xb_tx
+		JMP ?spi_xb_done
+?spi_xb_rx EQU *
+		LD 6,S
+		DEC
+		TNI TAR1				* R1 = dst - 1
+?spi_xb_rxtop EQU *
+		CLR
+		TNI TAR0				* R0 = 0, the MISO bits are added in
+		LD #$FA04				* bit 7, MOSI high
+		OUT SPI_PORT
+		LD #$0100
+		IN SPI_PORT
+		ANDB #2
+		SHL #6
+		TNI ADAR0
+		LD #$FA04				* bit 6, MOSI high
+		OUT SPI_PORT
+		LD #$0100
+		IN SPI_PORT
+		ANDB #2
+		SHL #5
+		TNI ADAR0
+		LD #$FA04				* bit 5, MOSI high
+		OUT SPI_PORT
+		LD #$0100
+		IN SPI_PORT
+		ANDB #2
+		SHL #4
+		TNI ADAR0
+		LD #$FA04				* bit 4, MOSI high
+		OUT SPI_PORT
+		LD #$0100
+		IN SPI_PORT
+		ANDB #2
+		SHL #3
+		TNI ADAR0
+		LD #$FA04				* bit 3, MOSI high
+		OUT SPI_PORT
+		LD #$0100
+		IN SPI_PORT
+		ANDB #2
+		SHL #2
+		TNI ADAR0
+		LD #$FA04				* bit 2, MOSI high
+		OUT SPI_PORT
+		LD #$0100
+		IN SPI_PORT
+		ANDB #2
+		SHL #1
+		TNI ADAR0
+		LD #$FA04				* bit 1, MOSI high
+		OUT SPI_PORT
+		LD #$0100
+		IN SPI_PORT
+		ANDB #2
+		TNI ADAR0
+		LD #$FA04				* bit 0, MOSI high
+		OUT SPI_PORT
+		LD #$0100
+		IN SPI_PORT
+		ANDB #2
+		SHR #1
+		TNI ADAR0
+		TNI INCR1I				* I = ++dst
+		TNI TR0A
+		STB I
+		LD 2,S
+		DEC
+		ST 2,S
+		JNZ ?spi_xb_rxtop
+?spi_xb_done EQU *
+		LD #$FE00				* SCK bit enable, write 0
+		OUT SPI_PORT
+	}
+#else
+	unsigned c;
+	while (len--) {
+		c = spi_transfer(src ? *src++ : 0xFF);
+		if (dst) {
+			*dst++ = c;
+		}
+	}
+#endif
+}
+
 #endif
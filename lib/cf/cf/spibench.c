@@ -0,0 +1,133 @@
+/*
+ * SPI block transfer benchmark, RDTSC cycles for moving BENCH_LEN bytes a byte
+ * at a time against spi_xfer_block()/sd_xfer_block(), then a sector read.
+ */
+#define USE_BIOS
+#include <cflea.h>
+
+#define SPI_FIXED
+#define SPI_PMOD 1						// keep the bit banging off the SD card on PMOD0
+#include "cf/lib/time.c"
+#include "cf/lib/spi.c"
+#include "cf/lib/sd.c"
+
+// small enough that the slowest test stays inside the 16-bit cycle counter
+#define BENCH_LEN 64
+
+unsigned char buf[512];
+unsigned tsc_free;
+
+unsigned rdtsc(void)
+{
+	asm {
+		FCB $EE
+	}
+}
+
+unsigned rtl_version(void)
+{
+	asm {
+		FCB $ED
+	}
+}
+
+// cycles since rdtsc() returned t, cf.v clears the count on each read and cf_mca.v doesn't
+unsigned tsc_since(unsigned t)
+{
+	unsigned n;
+	n = rdtsc();
+	return tsc_free ? n - t : n;
+}
+
+unsigned bench(unsigned test)
+{
+	unsigned t, x;
+	unsigned char *p;
+
+	p = buf;
+	t = rdtsc();
+	switch (test) {
+		case 0:
+			break;
+		case 1:
+			for (x = BENCH_LEN + 1; --x; ) {
+				*p++ = spi_recv();
+			}
+			break;
+		case 2:
+			for (x = BENCH_LEN + 1; --x; ) {
+				spi_transfer(*p++);
+			}
+			break;
+		case 3:
+			spi_xfer_block(buf, 0, BENCH_LEN);
+			break;
+		case 4:
+			spi_xfer_block(0, buf, BENCH_LEN);
+			break;
+		case 5:
+			spi_xfer_block(buf, buf, BENCH_LEN);
+			break;
+		case 6:
+			for (x = BENCH_LEN + 1; --x; ) {
+				*p++ = sd_spi_recv();
+			}
+			break;
+		case 7:
+			sd_xfer_block(buf, 0, BENCH_LEN);
+			break;
+		case 8:
+			sd_xfer_block(0, buf, BENCH_LEN);
+			break;
+	}
+	return tsc_since(t);
+}
+
+const char *tests[] = {
+	"overhead",
+	"spi_recv() loop",
+	"spi_transfer() loop",
+	"spi_xfer_block() rx",
+	"spi_xfer_block() tx",
+	"spi_xfer_block() rx/tx",
+	"sd_spi_recv() loop",
+	"sd_xfer_block() rx",
+	"sd_xfer_block() tx",
+	NULL
+};
+
+main()
+{
+	unsigned x, y, z;
+
+	tsc_free = (rtl_version() & 0xFF) == 0x10;
+	spi_setup_fixed();
+	sd_spi_setup();
+	sd_spi_set_cs(1);
+
+	printf("\nSPI cycles for %u bytes:\n", BENCH_LEN);
+	for (z = x = 0; tests[x]; x++) {
+		y = bench(x) - z;
+		if (x == 0) {
+			z = y;
+		}
+		printf("\t%s: %u (%u/byte)\n", tests[x], y, y / BENCH_LEN);
+	}
+
+	sd_init();
+	if (!sd_reset()) {
+		since_us();
+		for (x = 0; x < 16; x++) {
+			sd_sector_op(fat16_lba, buf, 0);
+		}
+		y = since_us();
+		printf("16 sector reads: %u us\n", y);
+	} else {
+		printf("No SD card\n");
+	}
+
+	wait_ms(2000);
+	asm {
+		JMP $F000
+	}
+}
@@ -0,0 +1,833 @@
+/* C-FLEA machine model, see cf_cpu.h */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "cf_cpu.h"
+
+const char *cf_stop_names[] = {
+	"running", "limit reached", "halted", "UART RX empty", "store lockup", "event"
+};
+
+// extra cycles on top of cf_cpu.cyc[] (top.sv: the text buffer is single
+// ported so every access to it costs two more cycles than main memory)
+#define WAIT_TEXT		2
+#define WAIT_UART_RX	2
+#define SWITCH_ENTRY	8
+
+// VGA timing the video status port follows (25MHz pixel clock, 800x525 total)
+#define VGA_HZ			25000000
+#define VGA_H_TOTAL		800
+#define VGA_V_TOTAL		525
+
+// what the SPI_ACCEL BIOS spends per byte on the wire: the F0 transfer at
+// divider 1F plus the sd_spi_recv() call and the loop around it, charged by
+// the SD fast path so emulated time stays close to the real thing.  The
+// payload goes through sd_xfer_block() at SD_SPI_BLOCK_DIV (07) instead.
+#define FAST_SPI_BYTE	(16 * (0x1F + 1) + 60)
+#define FAST_SPI_BLOCK	(16 * (0x07 + 1) + 36)
+
+// a read of the UART with no input left for this long stops the run
+#define RX_IDLE_MS		1000
+
+// per opcode cycles from the measurements in top.sv (LD/ADD/... share the ALU
+// timing, ST/STB/STI/LEAI share the store timing), memory waits are added on
+// top as the operands are fetched
+static void cf_timing(struct cf_cpu *m)
+{
+	static const uint8_t alu16[8]  = { 8, 12, 7, 8, 8, 8, 12, 12 };
+	static const uint8_t alu8[8]   = { 5, 12, 7, 8, 8, 8, 12, 12 };
+	static const uint8_t store[8]  = { 0, 11, 7, 8, 8, 0, 11, 11 };
+	int op;
+
+	for (op = 0; op < 256; op++) {
+		if (op <= 0x97 || (op >= 0xB8 && op <= 0xC7)) {
+			m->cyc[op] = (op >= 0xB8 || (op & 8)) ? alu8[op & 7] : alu16[op & 7];
+			if ((op & 0xF0) == 0x30) {
+				++(m->cyc[op]);				// MUL latches its operands first
+			}
+		} else if (op <= 0xB7) {
+			m->cyc[op] = store[op & 7];
+		} else {
+			m->cyc[op] = 4;
+		}
+	}
+	m->cyc[0xD0] = m->cyc[0xD1] = m->cyc[0xD2] = 8;		// JMP/JZ/JNZ aaaa
+	m->cyc[0xD3] = m->cyc[0xD4] = m->cyc[0xD5] = 5;		// SJMP/SJZ/SJNZ
+	m->cyc[0xD7] = 6;									// SWITCH, plus SWITCH_ENTRY per entry
+	m->cyc[0xD8] = 11;									// CALL
+	m->cyc[0xD9] = 8;									// RET
+	m->cyc[0xDA] = m->cyc[0xDB] = 5;					// ALLOC/FREE
+	m->cyc[0xDC] = m->cyc[0xDD] = 8;					// PUSHA/PUSHI
+	m->cyc[0xEA] = m->cyc[0xEB] = 7;					// OUT/IN
+	m->cyc[0xEE] = 3;									// RDTSC
+}
+
+void cf_init(struct cf_cpu *m)
+{
+	memset(m, 0, sizeof *m);
+	m->freq_mhz = CF_FREQ_MHZ;
+	m->cycles_per_byte = (uint64_t)m->freq_mhz * 1000000 / CF_BAUD * 10;
+	m->limit = m->event_at = UINT64_MAX;
+	cf_timing(m);
+	cf_reset(m);
+}
+
+static void cf_schedule(struct cf_cpu *m)
+{
+	uint64_t n;
+
+	n = m->limit;
+	if (m->wdt_at < n) {
+		n = m->wdt_at;
+	}
+	if (m->event_at < n) {
+		n = m->event_at;
+	}
+	m->next_event = n;
+}
+
+static void cf_wdt_arm(struct cf_cpu *m)
+{
+	uint64_t period, tick;
+
+	if (!m->wdt) {
+		m->wdt_at = UINT64_MAX;
+	} else {
+		// the next time the 16-bit tick counter equals wdt
+		period = (uint64_t)65536 * m->freq_mhz;
+		tick = m->timer_base + (uint64_t)m->wdt * m->freq_mhz;
+		while (tick <= m->cycles) {
+			tick += period;
+		}
+		m->wdt_at = tick;
+	}
+	cf_schedule(m);
+}
+
+// rst_n: registers and the SoC go back to power on, memory is kept
+void cf_reset(struct cf_cpu *m)
+{
+	int x;
+
+	m->pc = CF_ROM_MEM_BOT;
+	m->sp = m->acc = m->index = m->alt = 0;
+	m->r[0] = m->r[1] = 0;
+	m->flags = 0;
+	m->tsc = m->cycles;
+	for (x = 0; x < 4; x++) {
+		m->gpio_out[x] = 0xFF;
+		m->gpio_oe[x] = 0x00;
+	}
+	if (m->sd) {
+		cf_sd_cs(m->sd, 1);
+	}
+	m->timer_base = m->cycles;
+	m->wdt = 0;
+	m->lrg_mode = 0;
+	m->text_dirty = 1;
+	cf_wdt_arm(m);
+}
+
+// load a raw image (.cf or a bios.cf) at addr, returns its length
+int cf_load_image(struct cf_cpu *m, const char *fname, uint16_t addr)
+{
+	FILE *f;
+	int n;
+
+	f = fopen(fname, "rb");
+	if (!f) {
+		fprintf(stderr, "Could not open image file '%s'\n", fname);
+		exit(-1);
+	}
+	n = fread(m->mem + addr, 1, 65536 - addr, f);
+	fclose(f);
+	if (addr <= CF_ROM_MEM_TOP && addr + n > CF_ROM_MEM_BOT) {
+		m->rom_loaded = 1;
+	}
+	return n;
+}
+
+// the state boot.c leaves a .CF app in: entry point from the word at 0000,
+// stack just below the entry point and the header cleared
+void cf_boot_app(struct cf_cpu *m)
+{
+	m->pc = m->mem[0] | (m->mem[1] << 8);
+	m->sp = m->pc;
+	m->acc = m->pc;
+	m->mem[0] = m->mem[1] = 0;
+}
+
+// scripted UART input, bytes arrive back to back at the line rate
+void cf_set_rx(struct cf_cpu *m, const uint8_t *data, size_t len)
+{
+	m->rx = data;
+	m->rx_len = len;
+	m->rx_pos = 0;
+	m->rx_arrive = m->cycles + m->cycles_per_byte;
+	m->rx_eof = 1;
+	m->rx_idle_at = 0;
+}
+
+// have cf_run() return CF_EVENT once the cycle count reaches at
+void cf_set_event(struct cf_cpu *m, uint64_t at)
+{
+	m->event_at = at;
+	cf_schedule(m);
+}
+
+static void cf_events(struct cf_cpu *m)
+{
+	if (m->cycles >= m->wdt_at) {
+		++(m->wdt_resets);
+		cf_reset(m);
+	}
+	if (m->cycles >= m->event_at) {
+		m->event_at = UINT64_MAX;
+		m->stop = CF_EVENT;
+	}
+	if (m->cycles >= m->limit) {
+		m->stop = CF_LIMIT;
+	}
+	cf_schedule(m);
+}
+
+// memory, the text buffer costs extra cycles and the ROM ignores writes
+static inline uint8_t cf_rd8(struct cf_cpu *m, uint16_t a)
+{
+	if (a >= CF_TEXT_MEM_BOT) {
+		m->cycles += WAIT_TEXT;
+	}
+	return m->mem[a];
+}
+
+static inline uint16_t cf_rd16(struct cf_cpu *m, uint16_t a)
+{
+	if (a >= CF_TEXT_MEM_BOT) {
+		m->cycles += WAIT_TEXT;
+	}
+	return m->mem[a] | (m->mem[(uint16_t)(a + 1)] << 8);
+}
+
+static inline void cf_wr8(struct cf_cpu *m, uint16_t a, uint8_t v)
+{
+	if (a >= CF_ROM_MEM_BOT) {
+		if (a >= CF_TEXT_MEM_BOT) {
+			m->cycles += WAIT_TEXT;
+			m->text_dirty = 1;
+		} else if (m->rom_loaded) {
+			return;
+		}
+	}
+	m->mem[a] = v;
+}
+
+static inline void cf_wr16(struct cf_cpu *m, uint16_t a, uint16_t v)
+{
+	cf_wr8(m, a, v & 0xFF);
+	if (a >= CF_TEXT_MEM_BOT) {
+		m->cycles -= WAIT_TEXT;			// one burst
+	}
+	cf_wr8(m, a + 1, v >> 8);
+}
+
+// code fetches (the immediate/address/offset bytes after the opcode)
+static inline uint8_t cf_fetch8(struct cf_cpu *m)
+{
+	return m->mem[m->pc++];
+}
+
+static inline uint16_t cf_fetch16(struct cf_cpu *m)
+{
+	uint16_t v;
+
+	v = m->mem[m->pc] | (m->mem[(uint16_t)(m->pc + 1)] << 8);
+	m->pc += 2;
+	return v;
+}
+
+// the pins of GPIO block n as IN sees them, the SD card drives MISO on PMOD0
+// and everything else not driven is pulled up
+static uint8_t cf_gpio_pins(struct cf_cpu *m, int n)
+{
+	uint8_t in = 0xFF;
+
+	if (n == 0 && m->sd && !cf_sd_miso(m->sd)) {
+		in &= ~CF_SPI_MISO;
+	}
+	return (m->gpio_out[n] & m->gpio_oe[n]) | (in & ~m->gpio_oe[n]);
+}
+
+// tell the SD card about CS/SCK changes on PMOD0
+static void cf_gpio_update(struct cf_cpu *m, uint8_t before)
+{
+	uint8_t now;
+
+	if (!m->sd) {
+		return;
+	}
+	now = cf_gpio_pins(m, 0);
+	if ((now ^ before) & CF_SPI_CS) {
+		cf_sd_cs(m->sd, now & CF_SPI_CS);
+	}
+	if (!(before & CF_SPI_SCK) && (now & CF_SPI_SCK)) {
+		cf_sd_clock(m->sd, (now & CF_SPI_MOSI) ? 1 : 0);
+	}
+}
+
+// OUT to F0..F3: shift a byte out MSB first on PMOD n, data[15:8] sets SCK to
+// FREQ / (2 * (div + 1)), the byte read back on MISO ends up in ACC
+static uint16_t cf_spi(struct cf_cpu *m, int n, uint16_t v)
+{
+	uint8_t r = 0xFF;
+
+	if (n == 0 && m->sd && !(cf_gpio_pins(m, 0) & CF_SPI_CS)) {
+		r = cf_sd_xfer(m->sd, v & 0xFF);
+	}
+	m->gpio_out[n] = (m->gpio_out[n] & ~(CF_SPI_SCK | CF_SPI_MOSI)) | ((v & 1) ? CF_SPI_MOSI : 0);
+	m->cycles += 16 * ((v >> 8) + 1);
+	++(m->spi_bytes);
+	return r;
+}
+
+// a key typed on the host, returns 0 if the queue is full
+int cf_push_key(struct cf_cpu *m, uint8_t c)
+{
+	if (m->key_head - m->key_tail == sizeof m->keys) {
+		return 0;
+	}
+	m->keys[m->key_head++ % sizeof m->keys] = c;
+	return 1;
+}
+
+static int cf_rx_ready(struct cf_cpu *m)
+{
+	if (m->rx_pos < m->rx_len) {
+		return m->rx_arrive <= m->cycles;
+	}
+	return m->key_head != m->key_tail;
+}
+
+static uint16_t cf_uart_status(struct cf_cpu *m)
+{
+	uint16_t v = 0;
+
+	if (cf_rx_ready(m)) {
+		v |= 4;
+	}
+	if (m->tx_done_at <= m->cycles) {
+		v |= 2;
+	}
+	if (m->tx_done_at >= m->cycles + CF_UART_FIFO_DEPTH * m->cycles_per_byte) {
+		v |= 1;
+	}
+	return v;
+}
+
+static uint16_t cf_uart_read(struct cf_cpu *m)
+{
+	if (!cf_rx_ready(m)) {
+		if (m->rx_eof) {
+			// polling for input that will never come
+			if (!m->rx_idle_at) {
+				m->rx_idle_at = m->cycles;
+			} else if (m->cycles - m->rx_idle_at >= (uint64_t)RX_IDLE_MS * 1000 * m->freq_mhz) {
+				m->stop = CF_RX_EMPTY;
+			}
+		}
+		return 0xFFFF;
+	}
+	m->cycles += WAIT_UART_RX;
+	m->rx_idle_at = 0;
+	if (m->rx_pos >= m->rx_len) {
+		return m->keys[m->key_tail++ % sizeof m->keys];
+	}
+	if (m->rx_arrive < m->cycles) {
+		m->rx_arrive = m->cycles;
+	}
+	m->rx_arrive += m->cycles_per_byte;
+	return m->rx[m->rx_pos++];
+}
+
+// a TX write blocks while the FIFO is full
+static void cf_uart_write(struct cf_cpu *m, uint8_t v)
+{
+	uint64_t full;
+
+	full = m->cycles + CF_UART_FIFO_DEPTH * m->cycles_per_byte;
+	if (m->tx_done_at > full) {
+		m->stall_cycles += m->tx_done_at - full;
+		m->cycles = m->tx_done_at - CF_UART_FIFO_DEPTH * m->cycles_per_byte;
+	}
+	m->tx_done_at = (m->tx_done_at > m->cycles ? m->tx_done_at : m->cycles) + m->cycles_per_byte;
+	if (m->tx) {
+		fputc(v, m->tx);
+	}
+}
+
+static uint16_t cf_video_status(struct cf_cpu *m)
+{
+	uint64_t pix;
+	unsigned x, y;
+
+	pix = m->cycles * (VGA_HZ / 1000000) / m->freq_mhz;
+	x = pix % VGA_H_TOTAL;
+	y = (pix / VGA_H_TOTAL) % VGA_V_TOTAL;
+	return ((x < 640 && y < 480) << 3) |
+		(!(x >= 656 && x < 752) << 2) |
+		(!(y >= 490 && y < 492) << 1) |
+		m->lrg_mode;
+}
+
+static void cf_out(struct cf_cpu *m, uint8_t port)
+{
+	uint8_t before;
+	int n;
+
+	if (port == CF_PORT_UART) {
+		cf_uart_write(m, m->acc & 0xFF);
+	} else if (port >= CF_PORT_GPIO0 && port < CF_PORT_GPIO0 + 4) {
+		// data[15:8] is a write mask, a 0 bit writes the matching pin
+		n = port - CF_PORT_GPIO0;
+		before = cf_gpio_pins(m, 0);
+		m->gpio_out[n] = (m->gpio_out[n] & (m->acc >> 8)) | (~(m->acc >> 8) & m->acc & 0xFF);
+		if (!n) {
+			cf_gpio_update(m, before);
+		}
+	} else if (port >= CF_PORT_GPIO0_OE && port < CF_PORT_GPIO0_OE + 4) {
+		n = port - CF_PORT_GPIO0_OE;
+		before = cf_gpio_pins(m, 0);
+		m->gpio_oe[n] = m->acc & 0xFF;
+		if (!n) {
+			cf_gpio_update(m, before);
+		}
+	} else if (port == CF_PORT_TIMER) {
+		m->timer_base = m->cycles;
+		cf_wdt_arm(m);
+	} else if (port == CF_PORT_VIDEO) {
+		m->lrg_mode = m->acc & 1;
+		m->text_dirty = 1;
+	} else if (port == CF_PORT_WDT) {
+		m->wdt = m->acc;
+		cf_wdt_arm(m);
+	} else if ((port & 0xFC) == CF_PORT_SPI0) {
+		m->acc = cf_spi(m, port & 3, m->acc);
+	}
+}
+
+static uint16_t cf_in(struct cf_cpu *m, uint8_t port)
+{
+	uint8_t before, pins;
+	int n;
+
+	if (port == CF_PORT_UART) {
+		return cf_uart_read(m);
+	} else if (port >= CF_PORT_GPIO0 && port < CF_PORT_GPIO0 + 4) {
+		// data[15:8] toggles output bits, the pins are read before the toggle
+		n = port - CF_PORT_GPIO0;
+		before = pins = cf_gpio_pins(m, n);
+		m->gpio_out[n] ^= m->acc >> 8;
+		if (!n) {
+			cf_gpio_update(m, before);
+		}
+		return (pins ^ (m->acc >> 8)) & 0xFF;
+	} else if (port >= CF_PORT_GPIO0_OE && port < CF_PORT_GPIO0_OE + 4) {
+		return m->gpio_oe[port - CF_PORT_GPIO0_OE];
+	} else if (port == CF_PORT_UART_STATUS) {
+		return cf_uart_status(m);
+	} else if (port == CF_PORT_TIMER) {
+		return ((m->cycles - m->timer_base) / m->freq_mhz) & 0xFFFF;
+	} else if (port == CF_PORT_VIDEO) {
+		return cf_video_status(m);
+	} else if (port == CF_PORT_WDT) {
+		return m->wdt;
+	}
+	return m->acc;
+}
+
+// service sd_sector_op()/sd_read_block() at their entry points instead of
+// running them byte by byte, -1 leaves that one to the real code
+void cf_sd_fast(struct cf_cpu *m, int sector_op, int read_block)
+{
+	if (sector_op >= 0) {
+		m->trap[sector_op] = CF_TRAP_SECTOR_OP;
+	}
+	if (read_block >= 0) {
+		m->trap[read_block] = CF_TRAP_READ_BLOCK;
+	}
+}
+
+static void cf_copy_out(struct cf_cpu *m, uint8_t *buf, uint16_t src, int len)
+{
+	int x;
+
+	for (x = 0; x < len; x++) {
+		buf[x] = m->mem[(uint16_t)(src + x)];
+	}
+}
+
+static void cf_copy_in(struct cf_cpu *m, uint16_t dst, const uint8_t *buf, int len)
+{
+	uint16_t a;
+	int x;
+
+	for (x = 0; x < len; x++) {
+		a = dst + x;
+		if (a >= CF_ROM_MEM_BOT && a <= CF_ROM_MEM_TOP && m->rom_loaded) {
+			continue;
+		}
+		if (a >= CF_TEXT_MEM_BOT) {
+			m->text_dirty = 1;
+		}
+		m->mem[a] = buf[x];
+	}
+}
+
+// run a trapped SD routine and return from it, 0 if it has to run for real
+// (no card, or a card sd_reset() has not taken through CMD0 and ACMD41 yet).  Micro-C
+// pushes arguments left to right so the last one is at 2,S.
+static int cf_trap(struct cf_cpu *m)
+{
+	struct cf_sd *sd = m->sd;
+	uint8_t buf[512];
+	uint16_t sector, dst, wr, len;
+	uint32_t lba;
+	int r;
+
+	if (!sd || !sd->spi || sd->idle) {
+		return 0;
+	}
+	switch (m->trap[m->pc]) {
+		case CF_TRAP_SECTOR_OP:
+			// unsigned sd_sector_op(unsigned sector[2], unsigned char *dst, int wr_en)
+			wr     = cf_rd16(m, m->sp + 2);
+			dst    = cf_rd16(m, m->sp + 4);
+			sector = cf_rd16(m, m->sp + 6);
+			lba    = cf_rd16(m, sector) | ((uint32_t)cf_rd16(m, sector + 2) << 16);
+			if (wr) {
+				cf_copy_out(m, buf, dst, 512);
+			}
+			r = cf_sd_sector(sd, lba, buf, wr);
+			if (!r && !wr) {
+				cf_copy_in(m, dst, buf, 512);
+			}
+			m->acc = r ? 0xFFFF : 0;
+			// the routine finishes with CS raised
+			m->gpio_out[0] |= CF_SPI_CS;
+			cf_sd_cs(sd, (cf_gpio_pins(m, 0) & CF_SPI_CS) != 0);
+			m->cycles += (2 + 6 + 1 + 1 + 2 + 2) * FAST_SPI_BYTE + 512 * FAST_SPI_BLOCK;
+			++(m->fast_sectors);
+			break;
+		case CF_TRAP_READ_BLOCK:
+			// int sd_read_block(unsigned char *dst, unsigned len)
+			len = cf_rd16(m, m->sp + 2);
+			dst = cf_rd16(m, m->sp + 4);
+			if (len > sizeof buf || cf_sd_read_block(sd, buf, len)) {
+				return 0;
+			}
+			cf_copy_in(m, dst, buf, len);
+			m->acc = 0;
+			m->cycles += (1 + 2) * FAST_SPI_BYTE + len * FAST_SPI_BLOCK;
+			++(m->fast_blocks);
+			break;
+		default:
+			return 0;
+	}
+	m->pc = cf_rd16(m, m->sp);
+	m->sp += 2;
+	++(m->insns);
+	return 1;
+}
+
+// serial_divide.v: num < denom (or denom == 0) is answered right away,
+// otherwise it normalizes and then subtracts one bit per two cycles
+static unsigned cf_div_cycles(uint16_t num, uint16_t denom)
+{
+	int k = 0;
+
+	if (num < denom || !denom) {
+		return 4;
+	}
+	while ((uint32_t)denom << (k + 1) <= num) {
+		++k;
+	}
+	return 11 + 2 * (k + 1);
+}
+
+static inline void cf_alu(struct cf_cpu *m, uint8_t op)
+{
+	uint16_t v, a;
+	int word;
+	uint32_t p;
+
+	word = !(op & 8) && op < 0xB8;
+	switch (op & 7) {
+		case 0: v = word ? cf_fetch16(m) : cf_fetch8(m); goto have_v;
+		case 1: a = cf_fetch16(m); break;
+		case 2: a = m->index; break;
+		case 3: a = m->index + cf_fetch8(m); break;
+		case 4: a = m->sp + cf_fetch8(m); break;
+		case 5: v = cf_rd16(m, m->sp); m->sp += 2; goto have_v;
+		case 6: a = cf_rd16(m, m->sp); m->sp += 2; break;
+		default: a = cf_rd16(m, m->sp); break;
+	}
+	v = word ? cf_rd16(m, a) : cf_rd8(m, a);
+have_v:
+	switch (op >> 4) {
+		case 0x0: m->acc = v; break;
+		case 0x1: m->acc += v; break;
+		case 0x2: m->acc -= v; break;
+		case 0x3:
+			p = (uint32_t)m->acc * v;
+			m->acc = p;
+			m->alt = p >> 16;
+			break;
+		case 0x4:
+			m->cycles += cf_div_cycles(m->acc, v);
+			if (v) {
+				m->alt = m->acc % v;
+				m->acc = m->acc / v;
+			} else {
+				m->acc = m->alt = 0;
+			}
+			break;
+		case 0x5: m->acc &= v; break;
+		case 0x6: m->acc |= v; break;
+		case 0x7: m->acc ^= v; break;
+		case 0x8:
+			m->flags = 0;
+			if (m->acc == v) {
+				m->flags |= CF_FLAG_EQ;
+			}
+			if (word) {
+				m->flags |= ((int16_t)m->acc < (int16_t)v) ? CF_FLAG_SLT : 0;
+				m->flags |= ((int16_t)m->acc > (int16_t)v) ? CF_FLAG_SGT : 0;
+			} else {
+				m->flags |= ((int8_t)m->acc < (int8_t)v) ? CF_FLAG_SLT : 0;
+				m->flags |= ((int8_t)m->acc > (int8_t)v) ? CF_FLAG_SGT : 0;
+			}
+			m->flags |= (m->acc < v) ? CF_FLAG_ULT : 0;
+			m->flags |= (m->acc > v) ? CF_FLAG_UGT : 0;
+			m->acc = m->acc == v;
+			break;
+		case 0x9: m->index = v; break;
+		// SHR/SHL through the barrel shifter only look at the low 4 bits
+		case 0xB: m->acc >>= v & 15; break;
+		default: m->acc <<= v & 15; break;
+	}
+}
+
+// LEAI/ST/STB/STI, there is no immediate or S+ form of these
+static inline int cf_store(struct cf_cpu *m, uint8_t op)
+{
+	uint16_t a;
+
+	switch (op & 7) {
+		case 1: a = cf_fetch16(m); break;
+		case 2: a = m->index; break;
+		case 3: a = m->index + cf_fetch8(m); break;
+		case 4: a = m->sp + cf_fetch8(m); break;
+		case 6:
+			a = cf_rd16(m, m->sp);
+			if ((op & 0xF8) != 0x98) {
+				m->sp += 2;
+			}
+			break;
+		case 7: a = cf_rd16(m, m->sp); break;
+		default: return CF_LOCKUP;
+	}
+	switch (op & 0xF8) {
+		case 0x98: m->index = a; break;
+		case 0xA0: cf_wr16(m, a, m->acc); break;
+		case 0xA8: cf_wr8(m, a, m->acc & 0xFF); break;
+		default:   cf_wr16(m, a, m->index); break;
+	}
+	return 0;
+}
+
+// take a branch, a jump to itself can never be left since there are no IRQs
+// (only the WDT could still reset the machine)
+#define BRANCH(t) do { uint16_t _t = (t); if (_t == pc_at && m->wdt_at == UINT64_MAX) { m->stop = CF_HALT; } m->pc = _t; } while (0)
+
+static inline int cf_exec(struct cf_cpu *restrict m)
+{
+	uint16_t pc_at, t, e;
+	uint8_t op;
+	int8_t rel;
+
+	if (m->cycles >= m->next_event) {
+		cf_events(m);
+		if (m->stop) {
+			return m->stop;
+		}
+	}
+
+	if (m->trap[m->pc] && cf_trap(m)) {
+		return m->stop;
+	}
+
+	pc_at = m->pc;
+	op = m->mem[m->pc++];
+	m->cycles += m->cyc[op];
+	++(m->insns);
+
+	if (op <= 0x97 || (op >= 0xB8 && op <= 0xC7)) {
+		cf_alu(m, op);
+		return m->stop;
+	}
+	if (op <= 0xB7) {
+		if (cf_store(m, op)) {
+			m->pc = pc_at;
+			m->stop = CF_LOCKUP;
+		}
+		return m->stop;
+	}
+	switch (op) {
+		// LT, LE, GT, GE, ULT, ULE, UGT, UGE
+		case 0xC8: m->acc = !!(m->flags & CF_FLAG_SLT); break;
+		case 0xC9: m->acc = !!(m->flags & (CF_FLAG_SLT | CF_FLAG_EQ)); break;
+		case 0xCA: m->acc = !!(m->flags & CF_FLAG_SGT); break;
+		case 0xCB: m->acc = !!(m->flags & (CF_FLAG_SGT | CF_FLAG_EQ)); break;
+		case 0xCC: m->acc = !!(m->flags & CF_FLAG_ULT); break;
+		case 0xCD: m->acc = !!(m->flags & (CF_FLAG_ULT | CF_FLAG_EQ)); break;
+		case 0xCE: m->acc = !!(m->flags & CF_FLAG_UGT); break;
+		case 0xCF: m->acc = !!(m->flags & (CF_FLAG_UGT | CF_FLAG_EQ)); break;
+
+		// jumps
+		case 0xD0: BRANCH(cf_fetch16(m)); break;
+		case 0xD1:
+			t = cf_fetch16(m);
+			if (!m->acc) {
+				BRANCH(t);
+			}
+			break;
+		case 0xD2:
+			t = cf_fetch16(m);
+			if (m->acc) {
+				BRANCH(t);
+			}
+			break;
+		case 0xD3:
+			rel = cf_fetch8(m);
+			BRANCH(m->pc + rel);
+			break;
+		case 0xD4:
+			rel = cf_fetch8(m);
+			if (!m->acc) {
+				BRANCH(m->pc + rel);
+			}
+			break;
+		case 0xD5:
+			rel = cf_fetch8(m);
+			if (m->acc) {
+				BRANCH(m->pc + rel);
+			}
+			break;
+		case 0xD6: BRANCH(m->acc); break;
+		case 0xD7:
+			// SWITCH: (address, value) pairs at INDEX, address 0 ends the table
+			// with the default address in the value slot
+			for (e = m->index;; e += 4) {
+				m->cycles += SWITCH_ENTRY;
+				t = cf_rd16(m, e);
+				if (!t) {
+					m->pc = cf_rd16(m, e + 2);
+					break;
+				}
+				if (cf_rd16(m, e + 2) == m->acc) {
+					m->pc = t;
+					break;
+				}
+			}
+			break;
+		case 0xD8:
+			t = cf_fetch16(m);
+			m->sp -= 2;
+			cf_wr16(m, m->sp, m->pc);
+			m->pc = t;
+			break;
+		case 0xD9:
+			m->pc = cf_rd16(m, m->sp);
+			m->sp += 2;
+			break;
+
+		// stack
+		case 0xDA: m->sp -= cf_fetch8(m); break;
+		case 0xDB: m->sp += cf_fetch8(m); break;
+		case 0xDC:
+			m->sp -= 2;
+			cf_wr16(m, m->sp, m->acc);
+			break;
+		case 0xDD:
+			m->sp -= 2;
+			cf_wr16(m, m->sp, m->index);
+			break;
+		case 0xDE: m->sp = m->acc; break;
+		case 0xDF: m->acc = m->sp; break;
+
+		// misc
+		case 0xE0: m->acc = 0; break;
+		case 0xE1: m->acc = ~m->acc; break;
+		case 0xE2: m->acc = -m->acc; break;
+		case 0xE3: m->acc = !m->acc; break;
+		case 0xE4: ++(m->acc); break;
+		case 0xE5: --(m->acc); break;
+		case 0xE6: m->index = m->acc; break;
+		case 0xE7: m->acc = m->index; break;
+		case 0xE8: m->index += m->acc; break;
+		case 0xE9: m->acc = m->alt; break;
+		case 0xEA: cf_out(m, cf_fetch8(m)); break;
+		case 0xEB:
+			t = cf_fetch8(m);
+			m->acc = cf_in(m, t);
+			break;
+
+		// CFLEA-TNI (cf/lib/tni.h)
+		case 0xED: m->acc = (CF_TOP_VER << 8) | CF_CORE_VER; break;
+		case 0xEE:
+			// cf.v clears cycle_count on every read
+			m->acc = (m->cycles - m->cyc[op] - m->tsc) & 0xFFFF;
+			m->tsc = m->cycles - m->cyc[op];
+			break;
+		case 0xEF: m->r[0] = m->acc; break;
+		case 0xF0: m->r[1] = m->acc; break;
+		case 0xF1: m->acc = m->r[0]; break;
+		case 0xF2: m->acc = m->r[1]; break;
+		case 0xF3: t = m->acc; m->acc = m->r[0]; m->r[0] = t; break;
+		case 0xF4: t = m->acc; m->acc = m->r[1]; m->r[1] = t; break;
+		case 0xF5: m->acc = --(m->r[0]); break;
+		case 0xF6: m->acc = --(m->r[1]); break;
+		case 0xF7: m->r[0] += m->acc; break;
+		case 0xF8: m->r[1] += m->acc; break;
+		case 0xF9: m->index = ++(m->r[0]); break;
+		case 0xFA: m->index = ++(m->r[1]); break;
+		default: break;								// EC, FB..FF are NOPs
+	}
+	return m->stop;
+}
+
+int cf_step(struct cf_cpu *m)
+{
+	m->stop = CF_RUNNING;
+	return cf_exec(m);
+}
+
+int cf_run(struct cf_cpu *m, uint64_t max_insns, uint64_t max_cycles)
+{
+	// the cycle budget rides along with the WDT/front end events so the loop only has one compare
+	if (!max_insns) {
+		return m->stop = CF_LIMIT;
+	}
+	m->stop = CF_RUNNING;
+	m->limit = max_cycles;
+	cf_schedule(m);
+	while (!cf_exec(m)) {
+		if (!--max_insns) {
+			m->stop = CF_LIMIT;
+			break;
+		}
+	}
+	m->limit = UINT64_MAX;
+	cf_schedule(m);
+	return m->stop;
+}
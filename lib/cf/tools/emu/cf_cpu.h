@@ -0,0 +1,127 @@
+// C-FLEA machine model used by the cflea emulator
+//
+// Models the cf.v core (CPUID 0306, USE_BARREL=1) inside the Primer 25K SoC
+// (primer25k/demos/cflea/src/top.sv): 60K of main memory, the F000 boot ROM,
+// the F800 text/LRG buffer and the I/O ports (UART, GPIO/PMODs, 1us timer,
+// video status, WDT and the F0..F3 SPI block).  Cycle counts are estimates
+// from the measured timings in top.sv, not a per state model of the RTL.
+#ifndef CF_CPU_H
+#define CF_CPU_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cf_sd.h"
+
+// Primer 25K defaults
+#define CF_FREQ_MHZ				135
+#define CF_TOP_VER				0x03
+#define CF_CORE_VER				0x06
+#define CF_BAUD					230400
+#define CF_UART_FIFO_DEPTH		8
+
+#define CF_MAIN_MEM_TOP			0xEFFF
+#define CF_ROM_MEM_BOT			0xF000
+#define CF_ROM_MEM_TOP			0xF7FF
+#define CF_TEXT_MEM_BOT			0xF800
+#define CF_TEXT_MEM_TOP			0xFFFF
+
+// I/O ports (cf/lib/io.h)
+#define CF_PORT_UART			0x00
+#define CF_PORT_GPIO0			0x01
+#define CF_PORT_GPIO0_OE		0x05
+#define CF_PORT_UART_STATUS		0x10
+#define CF_PORT_TIMER			0x11
+#define CF_PORT_VIDEO			0x12
+#define CF_PORT_WDT				0x13
+#define CF_PORT_SPI0			0xF0
+
+// Digilent SD PMOD pins on each GPIO block
+#define CF_SPI_SCK				0x01
+#define CF_SPI_MISO				0x02
+#define CF_SPI_MOSI				0x04
+#define CF_SPI_CS				0x08
+
+// flags set by CMP
+#define CF_FLAG_EQ				0x01
+#define CF_FLAG_SLT				0x02
+#define CF_FLAG_SGT				0x04
+#define CF_FLAG_ULT				0x08
+#define CF_FLAG_UGT				0x10
+
+// BIOS entry points cf_sd_fast() services in one step (cf/lib/sd.c)
+#define CF_TRAP_SECTOR_OP		1
+#define CF_TRAP_READ_BLOCK		2
+
+// why cf_run() returned
+enum {
+	CF_RUNNING = 0,
+	CF_LIMIT,				// hit the instruction/cycle budget
+	CF_HALT,				// jump to itself, nothing can ever change that
+	CF_RX_EMPTY,			// UART input ran out and the program kept polling for more
+	CF_LOCKUP,				// store with an immediate/S+ operand, the RTL FSM never leaves it
+	CF_EVENT				// something for the front end (a screen refresh or keyboard poll)
+};
+
+struct cf_cpu {
+	// architectural state
+	uint16_t pc, sp, acc, index, alt;
+	uint16_t r[2];					// TNI R0/R1
+	uint8_t flags;
+	uint64_t tsc;					// cycle count the last RDTSC cleared cycle_count at
+
+	// memory, F000..F7FF ignores writes once the ROM is loaded
+	uint8_t mem[65536];
+	int rom_loaded;
+	uint8_t cyc[256];				// cycles per opcode not counting memory/I/O waits
+
+	// GPIO, SD card on PMOD0
+	uint8_t gpio_out[4], gpio_oe[4];
+	struct cf_sd *sd;
+	uint8_t trap[65536];			// CF_TRAP_* at the SD routines the fast path replaces
+
+	// timer/video/WDT
+	int freq_mhz;
+	uint64_t timer_base;			// cycle the 1us timer was last written at
+	uint16_t wdt;
+	uint64_t wdt_at;				// cycle the WDT fires at, UINT64_MAX if disabled
+	uint64_t wdt_resets;
+	uint8_t lrg_mode;
+	uint8_t text_dirty;
+
+	// UART, RX bytes arrive back to back at the line rate after rx_arrive
+	uint64_t cycles_per_byte;
+	const uint8_t *rx;
+	size_t rx_len, rx_pos;
+	uint64_t rx_arrive;
+	int rx_eof;						// no more input will ever come
+	uint64_t rx_idle_at;			// cycle the program first polled after the input ran out
+	uint8_t keys[64];				// interactive input pushed by the front end
+	unsigned key_head, key_tail;
+	uint64_t tx_done_at;			// cycle the TX FIFO drains at
+	FILE *tx;
+
+	// budget and front end events
+	uint64_t limit, next_event, event_at;
+	int stop;
+
+	// accounting
+	uint64_t cycles, insns;
+	uint64_t stall_cycles;
+	uint64_t spi_bytes;
+	uint64_t fast_sectors, fast_blocks;
+};
+
+extern const char *cf_stop_names[];
+
+void cf_init(struct cf_cpu *m);
+void cf_reset(struct cf_cpu *m);
+int cf_load_image(struct cf_cpu *m, const char *fname, uint16_t addr);
+void cf_boot_app(struct cf_cpu *m);
+void cf_set_rx(struct cf_cpu *m, const uint8_t *data, size_t len);
+int cf_push_key(struct cf_cpu *m, uint8_t c);
+void cf_sd_fast(struct cf_cpu *m, int sector_op, int read_block);
+void cf_set_event(struct cf_cpu *m, uint64_t at);
+int cf_step(struct cf_cpu *m);
+int cf_run(struct cf_cpu *m, uint64_t max_insns, uint64_t max_cycles);
+
+#endif
@@ -0,0 +1,367 @@
+/* SPI mode SD card model, see cf_sd.h */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cf_sd.h"
+
+#define R1_IDLE			0x01
+#define R1_ILLEGAL		0x04
+#define R1_PARAM		0x40
+
+struct cf_sd *cf_sd_open(const char *fname, int part, int writable)
+{
+	struct cf_sd *sd;
+	struct stat st;
+	uint32_t lba, n;
+
+	sd = calloc(1, sizeof *sd);
+	sd->writable = writable;
+	sd->fd = open(fname, writable ? O_RDWR : O_RDONLY);
+	if (sd->fd < 0 || fstat(sd->fd, &st)) {
+		fprintf(stderr, "Could not open disk image '%s'\n", fname);
+		exit(-1);
+	}
+	if (st.st_size < 512) {
+		fprintf(stderr, "Disk image '%s' is smaller than a sector\n", fname);
+		exit(-1);
+	}
+	sd->img_len = st.st_size & ~511;
+	sd->img = mmap(NULL, sd->img_len, PROT_READ | PROT_WRITE, writable ? MAP_SHARED : MAP_PRIVATE, sd->fd, 0);
+	if (sd->img == MAP_FAILED) {
+		fprintf(stderr, "Could not map disk image '%s'\n", fname);
+		exit(-1);
+	}
+	n = sd->img_len / 512;
+	if (part) {
+		// one type 6 (FAT16) partition covering the image, CHS fields are left
+		// as the LBA-only FF FE FF style values
+		sd->base = CF_SD_PART_LBA;
+		lba = CF_SD_PART_LBA;
+		sd->mbr[0x1BE] = 0x00;
+		sd->mbr[0x1BF] = 0xFE; sd->mbr[0x1C0] = 0xFF; sd->mbr[0x1C1] = 0xFF;
+		sd->mbr[0x1C2] = 0x06;
+		sd->mbr[0x1C3] = 0xFE; sd->mbr[0x1C4] = 0xFF; sd->mbr[0x1C5] = 0xFF;
+		sd->mbr[0x1C6] = lba; sd->mbr[0x1C7] = lba >> 8; sd->mbr[0x1C8] = lba >> 16; sd->mbr[0x1C9] = lba >> 24;
+		sd->mbr[0x1CA] = n; sd->mbr[0x1CB] = n >> 8; sd->mbr[0x1CC] = n >> 16; sd->mbr[0x1CD] = n >> 24;
+		sd->mbr[0x1FE] = 0x55;
+		sd->mbr[0x1FF] = 0xAA;
+	}
+	// whole MiB like the CSD can describe
+	sd->sectors = ((sd->base + n + 1023) / 1024) * 1024;
+	sd->cs = 1;
+	sd->idle = 1;					// powered up, waiting for CMD0 and ACMD41
+	return sd;
+}
+
+void cf_sd_close(struct cf_sd *sd)
+{
+	if (!sd) {
+		return;
+	}
+	if (sd->writable) {
+		msync(sd->img, sd->img_len, MS_SYNC);
+	}
+	munmap(sd->img, sd->img_len);
+	close(sd->fd);
+	free(sd);
+}
+
+// the sector at lba or NULL for the unbacked gap between the MBR and the image
+static uint8_t *sd_sector(struct cf_sd *sd, uint32_t lba)
+{
+	if (sd->base && lba == 0) {
+		return sd->mbr;
+	}
+	if (lba < sd->base || (size_t)(lba - sd->base) * 512 >= sd->img_len) {
+		return NULL;
+	}
+	return sd->img + (size_t)(lba - sd->base) * 512;
+}
+
+static void sd_queue(struct cf_sd *sd, const uint8_t *p, int len)
+{
+	memcpy(sd->out + sd->out_len, p, len);
+	sd->out_len += len;
+}
+
+static void sd_queue1(struct cf_sd *sd, uint8_t v)
+{
+	sd->out[sd->out_len++] = v;
+}
+
+// a data block: start token, payload and a (don't care) CRC
+static void sd_queue_block(struct cf_sd *sd, const uint8_t *p, int len)
+{
+	sd_queue1(sd, 0xFE);
+	if (p) {
+		sd_queue(sd, p, len);
+	} else {
+		memset(sd->out + sd->out_len, 0, len);
+		sd->out_len += len;
+	}
+	sd_queue1(sd, 0xFF);
+	sd_queue1(sd, 0xFF);
+}
+
+static void sd_command(struct cf_sd *sd)
+{
+	uint8_t csd[16];
+	uint32_t arg, c_size;
+	int cmd, app;
+
+	cmd = sd->cmd[0] & 0x3F;
+	arg = ((uint32_t)sd->cmd[1] << 24) | ((uint32_t)sd->cmd[2] << 16) | ((uint32_t)sd->cmd[3] << 8) | sd->cmd[4];
+	app = sd->app;
+	sd->app = 0;
+	sd->out_pos = sd->out_len = 0;
+	sd->rd_multi = 0;
+	++(sd->cmds);
+	if (!sd->spi && cmd) {
+		return;						// still in SD mode, MISO stays high
+	}
+
+	switch (cmd) {
+		case 0: // GO_IDLE_STATE
+			sd->spi = 1;
+			sd->idle = 1;
+			sd_queue1(sd, R1_IDLE);
+			break;
+		case 8: // SEND_IF_COND, echo the voltage/check pattern
+			sd_queue1(sd, sd->idle);
+			sd_queue1(sd, 0x00);
+			sd_queue1(sd, 0x00);
+			sd_queue1(sd, sd->cmd[3] & 0x0F);
+			sd_queue1(sd, sd->cmd[4]);
+			break;
+		case 55: // APP_CMD
+			sd->app = 1;
+			sd_queue1(sd, sd->idle);
+			break;
+		case 41: // SD_SEND_OP_COND, ready on the first try
+			if (!app) {
+				sd_queue1(sd, sd->idle | R1_ILLEGAL);
+				break;
+			}
+			sd->idle = 0;
+			sd_queue1(sd, 0x00);
+			break;
+		case 58: // READ_OCR, powered up and CCS (SDHC)
+			sd_queue1(sd, sd->idle);
+			sd_queue1(sd, sd->idle ? 0x40 : 0xC0);
+			sd_queue1(sd, 0xFF);
+			sd_queue1(sd, 0x80);
+			sd_queue1(sd, 0x00);
+			break;
+		case 16: // SET_BLOCKLEN, SDHC is always 512
+			sd_queue1(sd, sd->idle | (arg != 512 ? R1_PARAM : 0));
+			break;
+		case 9: // SEND_CSD, version 2.0 layout with C_SIZE in bits 69:48
+			memset(csd, 0, sizeof csd);
+			c_size = sd->sectors / 1024 - 1;
+			csd[0]  = 0x40;
+			csd[1]  = 0x0E;
+			csd[3]  = 0x32;
+			csd[4]  = 0x5B;
+			csd[5]  = 0x59;
+			csd[7]  = (c_size >> 16) & 0x3F;
+			csd[8]  = c_size >> 8;
+			csd[9]  = c_size;
+			csd[10] = 0x7F;
+			csd[11] = 0x80;
+			csd[12] = 0x0A;
+			csd[13] = 0x40;
+			csd[15] = 0x01;
+			sd_queue1(sd, sd->idle);
+			sd_queue_block(sd, csd, 16);
+			break;
+		case 17: // READ_SINGLE_BLOCK, arg is the LBA on SDHC
+			if (arg >= sd->sectors) {
+				sd_queue1(sd, R1_PARAM);
+				break;
+			}
+			sd_queue1(sd, 0x00);
+			sd_queue_block(sd, sd_sector(sd, arg), 512);
+			++(sd->reads);
+			break;
+		case 18: // READ_MULTIPLE_BLOCK, blocks follow each other until CMD12
+			if (arg >= sd->sectors) {
+				sd_queue1(sd, R1_PARAM);
+				break;
+			}
+			sd_queue1(sd, 0x00);
+			sd_queue_block(sd, sd_sector(sd, arg), 512);
+			++(sd->reads);
+			sd->rd_multi = 1;
+			sd->rd_lba = arg + 1;
+			break;
+		case 12: // STOP_TRANSMISSION, a stuff byte, R1 and a cycle of busy
+			sd->rd_multi = 0;
+			sd_queue1(sd, 0xFF);
+			sd_queue1(sd, 0x00);
+			sd_queue1(sd, 0x00);
+			break;
+		case 24: // WRITE_BLOCK
+			if (arg >= sd->sectors) {
+				sd_queue1(sd, R1_PARAM);
+				break;
+			}
+			sd_queue1(sd, 0x00);
+			sd->wr_state = 1;
+			sd->wr_lba = arg;
+			break;
+		default:
+			sd_queue1(sd, sd->idle | R1_ILLEGAL);
+			break;
+	}
+}
+
+// once a CMD18 block has gone out queue the next one after a gap byte, the stream
+// stops at the end of the card
+static void sd_refill(struct cf_sd *sd)
+{
+	if (!sd->rd_multi || sd->out_pos < sd->out_len) {
+		return;
+	}
+	sd->out_pos = sd->out_len = 0;
+	if (sd->rd_lba >= sd->sectors) {
+		sd->rd_multi = 0;
+		return;
+	}
+	sd_queue1(sd, 0xFF);
+	sd_queue_block(sd, sd_sector(sd, sd->rd_lba), 512);
+	++(sd->rd_lba);
+	++(sd->reads);
+}
+
+// the host finished sending a CMD24 block, commit it and answer data accepted
+// followed by one busy byte
+static void sd_write_done(struct cf_sd *sd)
+{
+	cf_sd_sector(sd, sd->wr_lba, sd->wr_buf, 1);
+	sd->wr_state = 0;
+	sd->out_pos = sd->out_len = 0;
+	sd_queue1(sd, 0x05);
+	sd_queue1(sd, 0x00);
+}
+
+// a whole CMD17/CMD24 in one go for the emulator's fast paths, the gap
+// between the MBR and the image reads as zeros and drops writes
+int cf_sd_sector(struct cf_sd *sd, uint32_t lba, uint8_t *buf, int wr)
+{
+	uint8_t *p;
+
+	if (lba >= sd->sectors) {
+		return -1;
+	}
+	p = sd_sector(sd, lba);
+	if (wr) {
+		if (p && p != sd->mbr) {
+			memcpy(p, buf, 512);
+		}
+		++(sd->writes);
+	} else {
+		if (p) {
+			memcpy(buf, p, 512);
+		} else {
+			memset(buf, 0, 512);
+		}
+		++(sd->reads);
+	}
+	return 0;
+}
+
+// sd_read_block() in one go: skip to the start token already queued by the
+// last command and take len bytes plus the CRC, -1 if no block is queued
+int cf_sd_read_block(struct cf_sd *sd, uint8_t *dst, int len)
+{
+	int x;
+
+	if (sd->cs) {
+		return -1;
+	}
+	sd_refill(sd);
+	for (x = sd->out_pos; x < sd->out_len && sd->out[x] != 0xFE; x++);
+	if (x + 1 + len + 2 > sd->out_len) {
+		return -1;
+	}
+	memcpy(dst, sd->out + x + 1, len);
+	sd->out_pos = x + 1 + len + 2;
+	sd->bits = 0;
+	return 0;
+}
+
+void cf_sd_cs(struct cf_sd *sd, int cs)
+{
+	if (cs && !sd->cs) {
+		// deselect drops whatever was in flight
+		sd->cmd_len = 0;
+		sd->out_pos = sd->out_len = 0;
+		sd->wr_state = 0;
+		sd->rd_multi = 0;
+		sd->bits = 0;
+	}
+	sd->cs = cs;
+}
+
+// one byte each way, the card answers with what it queued before seeing in
+uint8_t cf_sd_xfer(struct cf_sd *sd, uint8_t in)
+{
+	uint8_t ret;
+
+	if (sd->cs) {
+		return 0xFF;
+	}
+	sd_refill(sd);
+	ret = sd->out_pos < sd->out_len ? sd->out[sd->out_pos++] : 0xFF;
+
+	if (sd->wr_state == 1) {
+		if (in == 0xFE) {
+			sd->wr_state = 2;
+			sd->wr_pos = 0;
+		}
+	} else if (sd->wr_state == 2) {
+		sd->wr_buf[sd->wr_pos++] = in;
+		if (sd->wr_pos == 512 + 2) {
+			sd_write_done(sd);
+		}
+	} else if (sd->cmd_len || (in & 0xC0) == 0x40) {
+		// commands start with 01 in the top bits, the FF filler never does
+		sd->cmd[sd->cmd_len++] = in;
+		if (sd->cmd_len == 6) {
+			sd->cmd_len = 0;
+			sd_command(sd);
+		}
+	}
+	return ret;
+}
+
+// MISO while SCK is low: MSB first of the byte the card is shifting out
+int cf_sd_miso(struct cf_sd *sd)
+{
+	uint8_t v;
+
+	if (sd->cs) {
+		return 1;
+	}
+	sd_refill(sd);
+	v = sd->out_pos < sd->out_len ? sd->out[sd->out_pos] : 0xFF;
+	return (v >> (7 - sd->bits)) & 1;
+}
+
+// SCK rising edge with CS low, the card samples MOSI
+void cf_sd_clock(struct cf_sd *sd, int mosi)
+{
+	if (sd->cs) {
+		return;
+	}
+	sd->sr = (sd->sr << 1) | (mosi & 1);
+	if (++(sd->bits) == 8) {
+		sd->bits = 0;
+		cf_sd_xfer(sd, sd->sr);
+	}
+}
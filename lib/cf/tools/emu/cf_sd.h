@@ -0,0 +1,63 @@
+// SPI mode SD card model for the cflea emulator
+//
+// Answers the SDHC command set cf/lib/sd.c uses (CMD0/8/55/ACMD41/58/16/9/17/18/12/24)
+// one byte per SPI transfer.  The disk image is mmap'd, privately unless the
+// card was opened writable.  Images made by the populate_fs target are a bare
+// FAT16 partition so the card can put a synthetic MBR in front of it with
+// partition 1 at CF_SD_PART_LBA like the real card is set up.
+#ifndef CF_SD_H
+#define CF_SD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CF_SD_PART_LBA			2048
+#define CF_SD_QUEUE				(2 + 512 + 2 + 8)
+
+struct cf_sd {
+	uint8_t *img;
+	size_t img_len;
+	int fd, writable;
+	uint32_t base;					// LBA the image starts at (0, or CF_SD_PART_LBA with an MBR)
+	uint32_t sectors;				// card size in sectors
+	uint8_t mbr[512];
+
+	// command framing
+	uint8_t cmd[6];
+	int cmd_len;
+	int idle, app;
+	int spi;						// CMD0 has been seen, the card answers nothing before it
+
+	// bytes the card shifts out on the next transfers
+	uint8_t out[CF_SD_QUEUE];
+	int out_pos, out_len;
+
+	// CMD18 stream, the next block goes out once the last one has been clocked out
+	int rd_multi;
+	uint32_t rd_lba;
+
+	// CMD24 data phase
+	int wr_state;					// 0 idle, 1 waiting for the start token, 2 receiving
+	uint32_t wr_lba;
+	uint8_t wr_buf[512 + 2];
+	int wr_pos;
+
+	// bit level (GPIO bit banged) shift register
+	uint8_t sr;
+	int bits;
+	int cs;							// CS pin level
+
+	// accounting
+	uint64_t cmds, reads, writes;
+};
+
+struct cf_sd *cf_sd_open(const char *fname, int part, int writable);
+void cf_sd_close(struct cf_sd *sd);
+void cf_sd_cs(struct cf_sd *sd, int cs);
+uint8_t cf_sd_xfer(struct cf_sd *sd, uint8_t in);
+int cf_sd_sector(struct cf_sd *sd, uint32_t lba, uint8_t *buf, int wr);
+int cf_sd_read_block(struct cf_sd *sd, uint8_t *dst, int len);
+int cf_sd_miso(struct cf_sd *sd);
+void cf_sd_clock(struct cf_sd *sd, int mosi);
+
+#endif
@@ -0,0 +1,391 @@
+/* C-FLEA emulator, boots bios.cf off an SD card image or runs a .CF app directly */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include "cf_cpu.h"
+
+// the front end gets control back this often (emulated time) to poll the
+// keyboard, keep pace with the wall clock and repaint the --live screen
+#define EVENT_US		1000
+#define LIVE_MS			20
+
+static double time_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static uint8_t *read_file(const char *fname, size_t *len)
+{
+	FILE *f;
+	uint8_t *buf = NULL;
+	size_t n, size = 0;
+
+	f = strcmp(fname, "-") ? fopen(fname, "rb") : stdin;
+	if (!f) {
+		fprintf(stderr, "Could not open UART input file '%s'\n", fname);
+		exit(-1);
+	}
+	*len = 0;
+	do {
+		if (*len == size) {
+			size = size ? size * 2 : 4096;
+			buf = realloc(buf, size);
+		}
+		n = fread(buf + *len, 1, size - *len, f);
+		*len += n;
+	} while (n);
+	if (f != stdin) {
+		fclose(f);
+	}
+	return buf;
+}
+
+// a FAT boot sector at LBA 0 means the image is a bare partition (what the
+// populate_fs target builds) rather than a whole card with an MBR
+static int is_bare_fs(const char *fname)
+{
+	FILE *f;
+	uint8_t s[512];
+	int bare = 0;
+
+	f = fopen(fname, "rb");
+	if (f && fread(s, 1, sizeof s, f) == sizeof s) {
+		bare = !memcmp(s + 0x36, "FAT", 3) || !memcmp(s + 0x52, "FAT", 3);
+	}
+	if (f) {
+		fclose(f);
+	}
+	return bare;
+}
+
+// address of a symbol in a sym_to_biosh header (cf/lib/bios.h, cf/lib/boot.h)
+// made of "#define NAME $ADDR" lines, -1 if it is not there
+static int find_sym(const char *fname, const char *name)
+{
+	FILE *f;
+	char line[256], sym[128];
+	unsigned addr;
+	int r = -1;
+
+	f = fopen(fname, "r");
+	if (!f) {
+		fprintf(stderr, "Could not open symbol file '%s'\n", fname);
+		exit(-1);
+	}
+	while (fgets(line, sizeof line, f)) {
+		if (sscanf(line, "#define %127s $%x", sym, &addr) == 2 && !strcmp(sym, name)) {
+			r = addr & 0xFFFF;
+		}
+	}
+	fclose(f);
+	return r;
+}
+
+static void dump_screen(struct cf_cpu *m, FILE *f)
+{
+	int x, y;
+	uint8_t ch;
+
+	fprintf(f, "+--------------------------------------------------------------------------------+\n");
+	for (y = 0; y < 25; y++) {
+		fprintf(f, "|");
+		for (x = 0; x < 80; x++) {
+			ch = m->mem[CF_TEXT_MEM_BOT + y * 80 + x];
+			fputc((ch >= 0x20 && ch < 0x7F) ? ch : (ch ? '.' : ' '), f);
+		}
+		fprintf(f, "|\n");
+	}
+	fprintf(f, "+--------------------------------------------------------------------------------+\n");
+}
+
+static void print_stats(struct cf_cpu *m, double t)
+{
+	double ms;
+
+	ms = m->cycles / (m->freq_mhz * 1000.0);
+	fprintf(stderr, "\ncflea: %s at PC=%04x\n", cf_stop_names[m->stop], m->pc);
+	fprintf(stderr, "  %" PRIu64 " instructions, %" PRIu64 " cycles (%.3f ms at %d MHz), %.3f CPI\n",
+		m->insns, m->cycles, ms, m->freq_mhz, m->insns ? (double)m->cycles / m->insns : 0.0);
+	fprintf(stderr, "  host %.3f ms, %.1f M instructions/s, %.1fx real time\n",
+		t, t > 0 ? m->insns / (t * 1000.0) : 0.0, t > 0 ? ms / t : 0.0);
+	fprintf(stderr, "  %" PRIu64 " cycles stalled on the UART, %" PRIu64 " SPI block bytes, %" PRIu64 " WDT resets\n",
+		m->stall_cycles, m->spi_bytes, m->wdt_resets);
+	if (m->sd) {
+		fprintf(stderr, "  SD: %" PRIu64 " commands, %" PRIu64 " sectors read, %" PRIu64 " written",
+			m->sd->cmds, m->sd->reads, m->sd->writes);
+		fprintf(stderr, " (%" PRIu64 " sector ops and %" PRIu64 " blocks on the fast path)\n",
+			m->fast_sectors, m->fast_blocks);
+	}
+	fprintf(stderr, "  ACC=%04x INDEX=%04x SP=%04x ALT=%04x R0=%04x R1=%04x\n",
+		m->acc, m->index, m->sp, m->alt, m->r[0], m->r[1]);
+}
+
+// interactive stdin: no line buffering/echo and non-blocking reads, Ctrl-C still works
+static struct termios tty_saved;
+static int tty_fl, tty_raw;
+
+static void tty_restore(void)
+{
+	if (tty_raw) {
+		tcsetattr(0, TCSADRAIN, &tty_saved);
+		fcntl(0, F_SETFL, tty_fl);
+		tty_raw = 0;
+	}
+}
+
+static void tty_setup(void)
+{
+	struct termios t;
+
+	if (tcgetattr(0, &tty_saved)) {
+		return;
+	}
+	t = tty_saved;
+	t.c_lflag &= ~(ICANON | ECHO);
+	t.c_cc[VMIN] = 1;
+	t.c_cc[VTIME] = 0;
+	tcsetattr(0, TCSADRAIN, &t);
+	tty_fl = fcntl(0, F_GETFL);
+	fcntl(0, F_SETFL, tty_fl | O_NONBLOCK);
+	tty_raw = 1;
+	atexit(tty_restore);
+}
+
+static void tty_poll(struct cf_cpu *m)
+{
+	uint8_t c;
+
+	// leave anything that does not fit in the UART queue for next time
+	while (m->key_head - m->key_tail < sizeof m->keys && read(0, &c, 1) == 1) {
+		cf_push_key(m, c);
+	}
+}
+
+static void trace(struct cf_cpu *m, FILE *f)
+{
+	fprintf(f, "%04x: %02x %02x %02x  ACC=%04x INDEX=%04x SP=%04x ALT=%04x R0=%04x R1=%04x F=%02x %10" PRIu64 "\n",
+		m->pc, m->mem[m->pc], m->mem[(uint16_t)(m->pc + 1)], m->mem[(uint16_t)(m->pc + 2)],
+		m->acc, m->index, m->sp, m->alt, m->r[0], m->r[1], m->flags, m->cycles);
+}
+
+struct emu_options {
+	int screen, live, quiet, realtime, write, part, trace, app, sd_slow;
+	uint64_t max_insns, max_cycles;
+	char *rom, *disk, *uart_in, *uart_out, *syms;
+};
+
+int main(int argc, char **argv)
+{
+	struct emu_options o;
+	struct cf_cpu *m;
+	uint8_t *rx = NULL;
+	size_t rx_len;
+	uint16_t org = 0, pc = 0;
+	int i, set_pc = 0, interactive, rc;
+	uint64_t left;
+	double t, t_live = 0;
+	FILE *tx = stdout;
+
+	memset(&o, 0, sizeof o);
+	o.part = -1;
+	o.realtime = -1;
+	o.max_insns = o.max_cycles = UINT64_MAX;
+
+	m = calloc(1, sizeof *m);
+	cf_init(m);
+
+	// images are loaded in argv order so --org applies to the --bin after it
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--screen")) {
+			o.screen = 1;
+			continue;
+		} else if (!strcmp(argv[i], "--live")) {
+			o.live = 1;
+			continue;
+		} else if (!strcmp(argv[i], "--quiet")) {
+			o.quiet = 1;
+			continue;
+		} else if (!strcmp(argv[i], "--realtime")) {
+			o.realtime = 1;
+			continue;
+		} else if (!strcmp(argv[i], "--fast")) {
+			o.realtime = 0;
+			continue;
+		} else if (!strcmp(argv[i], "--write")) {
+			o.write = 1;
+			continue;
+		} else if (!strcmp(argv[i], "--part")) {
+			o.part = 1;
+			continue;
+		} else if (!strcmp(argv[i], "--no-part")) {
+			o.part = 0;
+			continue;
+		} else if (!strcmp(argv[i], "--trace")) {
+			o.trace = 1;
+			continue;
+		} else if (!strcmp(argv[i], "--sd-slow")) {
+			o.sd_slow = 1;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			fprintf(stderr, "%s requires a parameter\n", argv[i]);
+			exit(-1);
+		}
+		if (!strcmp(argv[i], "--rom")) {
+			o.rom = argv[++i];
+			cf_load_image(m, o.rom, CF_ROM_MEM_BOT);
+		} else if (!strcmp(argv[i], "--app")) {
+			cf_load_image(m, argv[++i], 0x0000);
+			o.app = 1;
+		} else if (!strcmp(argv[i], "--org")) {
+			org = strtol(argv[++i], NULL, 16);
+		} else if (!strcmp(argv[i], "--bin")) {
+			cf_load_image(m, argv[++i], org);
+		} else if (!strcmp(argv[i], "--pc")) {
+			pc = strtol(argv[++i], NULL, 16);
+			set_pc = 1;
+		} else if (!strcmp(argv[i], "--disk")) {
+			o.disk = argv[++i];
+		} else if (!strcmp(argv[i], "--syms")) {
+			o.syms = argv[++i];
+		} else if (!strcmp(argv[i], "--uart-in")) {
+			o.uart_in = argv[++i];
+		} else if (!strcmp(argv[i], "--uart-out")) {
+			o.uart_out = argv[++i];
+		} else if (!strcmp(argv[i], "--insns")) {
+			o.max_insns = strtoull(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "--cycles")) {
+			o.max_cycles = strtoull(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "--ms")) {
+			o.max_cycles = strtod(argv[++i], NULL) * m->freq_mhz * 1000.0;
+		} else {
+			fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+			exit(-1);
+		}
+	}
+
+	if (o.disk) {
+		if (o.part < 0) {
+			o.part = is_bare_fs(o.disk);
+		}
+		m->sd = cf_sd_open(o.disk, o.part, o.write);
+		// the BIOS SD routines run natively unless we want to see every bit
+		if (o.syms && !o.sd_slow) {
+			cf_sd_fast(m, find_sym(o.syms, "SD_SECTOR_OP"), find_sym(o.syms, "SD_READ_BLOCK"));
+		}
+	}
+
+	// where to start: an explicit --pc, a .CF app the way boot.c starts it, or the ROM
+	if (set_pc) {
+		m->pc = pc;
+	} else if (o.app) {
+		cf_boot_app(m);
+	} else if (!m->rom_loaded) {
+		fprintf(stderr, "Nothing to run, give a --rom, --app or --bin with --pc\n");
+		exit(-1);
+	}
+
+	// UART: scripted input from a file (or a pipe), otherwise the terminal
+	interactive = 0;
+	if (o.uart_in || !isatty(0)) {
+		rx = read_file(o.uart_in ? o.uart_in : "-", &rx_len);
+		cf_set_rx(m, rx, rx_len);
+	} else {
+		tty_setup();
+		interactive = 1;
+	}
+	if (o.realtime < 0) {
+		o.realtime = interactive;
+	}
+	if (o.uart_out) {
+		tx = fopen(o.uart_out, "wb");
+		if (!tx) {
+			fprintf(stderr, "Could not open UART output file '%s'\n", o.uart_out);
+			exit(-1);
+		}
+	} else if (o.live) {
+		tx = NULL;						// would scribble over the screen
+	}
+	m->tx = tx;
+	if (o.live) {
+		printf("\033[2J");
+	}
+
+	t = time_ms();
+	left = o.max_insns;
+	for (;;) {
+		if ((interactive || o.realtime || o.live) && m->event_at == UINT64_MAX) {
+			cf_set_event(m, m->cycles + (uint64_t)EVENT_US * m->freq_mhz);
+		}
+		if (o.trace) {
+			trace(m, stderr);
+			cf_step(m);
+			if (!m->stop && !--left) {
+				m->stop = CF_LIMIT;
+			}
+			if (!m->stop && m->cycles >= o.max_cycles) {
+				m->stop = CF_LIMIT;
+			}
+		} else {
+			uint64_t insns = m->insns;
+			cf_run(m, left, o.max_cycles);
+			left -= m->insns - insns;
+		}
+		if (m->stop != CF_EVENT && m->stop != CF_RUNNING) {
+			break;
+		}
+		if (interactive) {
+			tty_poll(m);
+		}
+		if (o.realtime) {
+			// emulated time ahead of the wall clock, sleep it off
+			double ahead = m->cycles / (m->freq_mhz * 1000.0) - (time_ms() - t);
+			if (ahead > 1.0) {
+				usleep(ahead * 1000);
+			}
+		}
+		if (o.live && m->text_dirty && time_ms() - t_live >= LIVE_MS) {
+			t_live = time_ms();
+			m->text_dirty = 0;
+			printf("\033[H");
+			dump_screen(m, stdout);
+			fflush(stdout);
+		}
+		if (tx) {
+			fflush(tx);
+		}
+	}
+	t = time_ms() - t;
+	tty_restore();
+	if (tx) {
+		fflush(tx);
+	}
+
+	if (o.screen || o.live) {
+		if (o.live) {
+			printf("\033[H");
+		} else {
+			printf("\n");
+		}
+		dump_screen(m, stdout);
+	}
+	if (!o.quiet) {
+		print_stats(m, t);
+	}
+	rc = m->stop == CF_LOCKUP ? 1 : 0;
+	if (tx && tx != stdout) {
+		fclose(tx);
+	}
+	cf_sd_close(m->sd);
+	free(rx);
+	free(m);
+	return rc;
+}
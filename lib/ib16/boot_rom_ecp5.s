@@ -1,9 +1,22 @@
-; ECP5 fast boot loader (only echo back the first 256 bytes)
-.PROG_SIZE 0x30
+; ECP5 boot loader
+;
+; The first byte picks the protocol:
+;   0x5A  legacy: # of pages, then the pages back to back (only the first 256 bytes are echoed)
+;   0xA5  framed: [A5][page][~page][256 data bytes][CRC hi][CRC lo] per page, each answered with
+;         [06 ACK or 15 NAK][page] so the host can stream several frames ahead of the acks and
+;         only resend the ones that got NAK'ed.  Page FF (~page 00) boots the app.
+;         The CRC is CRC16-CCITT (poly 1021, init FFFF) over the 256 data bytes.  The data is staged in
+;         the E800 text buffer and only copied to the page once the CRC matches.
+;   0xB5  baud: [B5][divisor] is echoed at the current rate, then the UART switches to F_CLK/divisor and
+;         waits 100ms for [55][AA] which is echoed back at the new rate.  Anything else (or nothing) puts
+;         the 230.4K default back.  Either way it then waits for the next A5/5A/B5.
+.PROG_SIZE 0x80
 .BIN_START F000
 
 .EQU UART_ADDR 0xFFFF   ; Blocking 8N1 230.4K baud UART
+.EQU UART_STS_ADDR 0xFFFE	; reads status, writes set the baud divisor
 .EQU GPIO0_ADDR 0xFFFB
+.EQU TIMER_ADDR 0xFFF9	; 1ms ticks, any write restarts it
 .EQU INT_ADDR 0xFFFC
 .EQU INTEN_ADDR 0xFFFD
 
@@ -19,24 +32,32 @@
 	LDI 15,<INTEN_ADDR
 	LDI 14,>INTEN_ADDR
 	STM 0,15,14				; disable all interrupts
-	
+
 	; configure loader
 	LDI 14,>UART_ADDR		; R15:R14 points to UART
 	LDI 15,<UART_ADDR
 	LDI 12,>GPIO0_ADDR
 	LDI 13,<GPIO0_ADDR
-	LDI 1,0					; start writing to 0
-	LDI 4,0x5A				; magic constant we wait for before reading data bytes
+	LDI 4,0x5A				; legacy magic constant we wait for before reading data bytes
+	LDI 7,0xA5				; start of a frame
+	LDI 8,0x10				; R8:R9 is the CRC polynomial
+	LDI 9,0x21
 :FLUSH
 	LDM 3,15,14
+	CMPEQ 3,7
+	JC FRAME
+	LDI 2,0xB5
+	CMPEQ 3,2
+	JC BAUD
 	CMPEQ 3,4				; compare R3 to R4 (uart byte to 0x5A)
-	JNC FLUSH				; dump 
+	JNC FLUSH				; dump
+	LDI 1,0					; start writing to 0, a FRAME or BAUD exchange before this leaves R1 dirty
 	LDM 2,15,14				; load number of pages from UART
 
 :LOOP
 	LDM 3,15,14				; read from UART
 	STM 3,15,14				; echo char back
-	STM 3,1,0				; store 
+	STM 3,1,0				; store
 	INC 0,0					; increment base
 	JNC LOOP
 :ELOOP2						; this is where we test if there's another 256 byte page
@@ -50,7 +71,105 @@
 	SRES 8					; boot user app
 :LOOP2						; don't echo back for offset >= 256
 	LDM 3,15,14				; read from UART
-	STM 3,1,0				; store 
+	STM 3,1,0				; store
 	INC 0,0					; increment base
 	JNC LOOP2
 	JMP ELOOP2
+
+:FRAME
+	LDM 1,15,14				; page number
+	LDM 10,15,14			; and its complement
+	XOR 10,10,1
+	NOT 10,10				; zero if they agree
+	JNZ FLUSH				; otherwise wait for the next frame
+	NOT 11,1				; show the page on the LEDs, zero for page FF
+	STM 11,13,12
+	JZ BOOT
+	LDI 10,0xE8				; only pages below the text buffer
+	CMPLT 1,10
+	JNC FLUSH
+	LDI 5,0xFF				; R5:R6 is the CRC
+	LDI 6,0xFF
+	LDI 0,0
+:BYTE
+	LDM 3,15,14				; read from UART
+	STM 3,10,0				; stage it in the text buffer (R10 is still E8)
+	XOR 5,5,3				; CRC ^= byte << 8
+	LDI 2,8
+:BIT
+	ADD 6,6,6				; CRC <<= 1
+	ADC 5,5,5
+	JNC NOXOR
+	XOR 5,5,8				; CRC ^= 0x1021 if a 1 fell out the top
+	XOR 6,6,9
+:NOXOR
+	DEC 2,2
+	JNZ BIT
+	INC 0,0
+	JNC BYTE
+	LDM 3,15,14				; XOR in the CRC that was sent, zero if it matches
+	XOR 5,5,3
+	LDM 3,15,14
+	XOR 6,6,3
+	LDI 3,0x15				; NAK
+	OR 5,5,6
+	JNZ REPLY				; a bad frame never touches the page, which may already hold good data
+:COPY						; R0 is back at 0, move the staged page into place
+	LDM 3,10,0
+	STM 3,1,0
+	INC 0,0
+	JNC COPY
+	LDI 3,0x06				; ACK
+:REPLY
+	STM 3,15,14
+	STM 1,15,14
+	JMP FLUSH
+:BOOT
+	LDI 3,0x06				; ACK the boot frame
+	STM 3,15,14
+	STM 1,15,14
+	XOR 0,0,0				; ensure r0 is zero before boot using app
+	SRES 8					; boot user app
+
+:BAUD
+	LDM 10,15,14			; proposed divisor
+	STM 3,15,14				; echo it at the current rate
+	STM 10,15,14
+	LDI 12,>TIMER_ADDR		; R13:R12 points to the timer for now
+	STM 0,13,12
+:DRAIN						; give the echo 2ms to leave the shifter
+	LDM 3,13,12
+	LDI 2,2
+	CMPLT 3,2
+	JC DRAIN
+	LDI 14,>UART_STS_ADDR	; R15:R14 points to the divisor/status
+	STM 10,15,14			; switch
+	STM 0,13,12				; restart the timer for the sync timeout
+	LDI 11,0x55				; expect 55 then AA
+:SYNC
+	LDM 3,13,12
+	LDI 2,0x64				; 100ms
+	CMPLT 3,2
+	JNC REVERT				; timed out
+	LDM 3,15,14
+	LDI 2,0x01				; RX ready?
+	AND 3,3,2
+	JZ SYNC
+	LDI 14,>UART_ADDR
+	LDM 3,15,14
+	LDI 14,>UART_STS_ADDR
+	CMPEQ 3,11
+	JNC REVERT
+	NOT 11,11				; 55 -> AA -> 55
+	CMPLT 11,3				; done once we got the AA
+	JNC SYNC
+	LDI 14,>UART_ADDR
+	STM 11,15,14			; echo 55 AA at the new rate
+	STM 3,15,14
+	JMP RESTORE
+:REVERT
+	STM 0,15,14				; 0 restores the default divisor
+:RESTORE
+	LDI 14,>UART_ADDR
+	LDI 12,>GPIO0_ADDR
+	JMP FLUSH
@@ -6,35 +6,185 @@
 #include <ctype.h>
 #include <inttypes.h>
 #include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
 
 // max program size is the full 64KB though in practice smaller than that since you want stack/ISR/mmio
 #define MAX_PROG_SIZE 32768
 
+// strings (labels, targets, source lines) are carved out of a chunked arena that only
+// grows with what the program actually uses and is never freed
+#define ARENA_CHUNK 16384
+struct arena {
+	struct arena *next;
+	size_t used, size;
+	char data[];
+};
+
+// a symbol (.EQU/.REG/.IREG constant or a program label)
+struct symbol {
+	char *label;
+	uint16_t value;			// constant value (symbols) or word address (labels)
+	int local;				// .REG/.IREG, deleted by .POPREGS
+	int save;				// .REG, pushed/popped by .PUSHREGS/.POPREGS
+	int live;
+};
+
+// an open addressed (linear probe) hash table of symbols keyed on the label
+// entries live in syms[] so their index is stable across rehashing, hash[] holds
+// the index or one of the SYM_ markers below
+#define SYM_EMPTY	-1
+#define SYM_DELETED	-2
+struct symtab {
+	struct symbol *syms;
+	int nsyms, maxsyms;
+	int *hash;
+	int hsize, hused;		// hsize is a power of 2, hused counts live + deleted slots
+};
+
+// a library file, the labels it exports and the targets it references
+struct lib_file {
+	char *path;
+	long mtime, size;
+	char **exports;
+	int nexports, maxexports;
+	char **imports;
+	int nimports, maximports;
+	int scanned;			// exports/imports are valid
+	int linked;				// already compiled into the program
+	struct object *obj;		// archive member to place instead of compiling path
+};
+
+// index of a --lib directory, cached in LIB_INDEX_NAME inside it keyed on file mtime/size
+#define LIB_INDEX_NAME	".ib16_as.idx"
+#define LIB_INDEX_MAGIC	"ib16_as library index v1"
+struct lib_index {
+	struct lib_file *files;
+	int nfiles, maxfiles;
+	struct symtab exports;	// label -> index into files[]
+};
+
+// a relocatable object (-c) is the assembled words of one source file split into sections,
+// every .ORG starts an absolute section and the start of the file, every .ALIGN and the code
+// after an .INC start one that follows whatever the linker placed before it.  .INC'd files are
+// only read for their .EQUs and become a section the linker fills with that file's object.
+// Every label/symbol target is left as a relocation (the word with the field zeroed) which the
+// link step resolves exactly like a plain assembly would, so the image comes out the same.
+#define OBJ_MAGIC		"ib16_as object v1"
+#define AR_MAGIC		"ib16_as archive v1"
+#define SEC_ORG			0		// arg is the word address
+#define SEC_ALIGN		1		// arg is the alignment in words, 1 follows on directly
+#define SEC_INC			2		// path is the .INC'd source file
+struct obj_section {
+	int kind;
+	uint16_t arg;
+	uint16_t start;			// PC the section started at (-c only)
+	uint16_t len;			// words the PC moved on by
+	char *path;
+};
+
+struct obj_label {
+	int sec;
+	uint16_t off;
+	char *name;
+};
+
+struct obj_word {
+	int sec;
+	uint16_t off;
+	uint16_t value;
+	int opidx;
+	int half;				// 1 == '<' top half, 2 == '>' bottom half
+	char *tgt;
+	int line_number;
+	char *line;
+};
+
+struct obj_symbol {
+	char *name;
+	uint16_t value;
+};
+
+struct object {
+	char *fname;			// .o/.a it was read from
+	char *path;				// source file
+	int prog_size, bin_start;		// -1 if the source didn't set them
+	struct obj_section *sections;
+	int nsections, maxsections;
+	struct obj_label *labels;
+	int nlabels, maxlabels;
+	struct obj_word *words;
+	int nwords, maxwords;
+	struct obj_symbol *symbols;
+	int nsymbols, maxsymbols;
+	int placed;
+	int included;			// placed through another object's .INC section
+	int member;				// from an archive, only placed if link() needs it
+};
+
+// lookup/timing counters for --stats
+struct compiler_stats {
+	unsigned long sym_lookups, label_lookups, probes;
+	unsigned long resolve_passes, link_files, index_scanned, index_cached;
+	double t_assemble, t_link, t_emit;
+};
+
+// an emitted word, only the words the program actually emits get one of these
+struct word {
+	uint16_t addr;			// word address
+	int opidx;
+	int line_number;
+	char *fname;
+	char *line;				// source line that emitted this word ("" for the 2nd+ word of a line)
+	char *tgt;				// label/symbol to resolve or NULL
+	int use_top_half;
+	int use_bottom_half;
+	int sec;				// -c: section the word was emitted in
+};
+
 // a compiler state
 struct compiler_state {
 	int prog_size;
 	char *cur_filename;
+	char *cur_line;			// line being compiled, copied to the arena by the first word it emits
+	int cur_line_used;
 	int reg_idx;
 
-	// the entire program can only be upto PROG_SIZE bytes so just make a simple map here
-	struct {
-		uint16_t opcode;
-		char label[64];
-		char tgt[64];
-		int use_top_half;
-		int use_bottom_half;
-		int line_number;
-		char *fname;
-		int opidx;
-		char line[512];
-	} program[MAX_PROG_SIZE];
-
-	struct {
-		char label[64];
-		uint16_t value;
-		int local;
-		int save;
-	} symbols[MAX_PROG_SIZE];
+	// the program image is a flat word map, everything else about a word is in words[]
+	uint16_t image[MAX_PROG_SIZE];
+	uint16_t wordidx[MAX_PROG_SIZE];	// 1 + index into words[], 0 if not programmed
+	struct word *words;
+	int nwords, maxwords;
+
+	// words with a target to resolve as (addr << 16) | index into words[]
+	uint32_t *relocs;
+	int nrelocs, maxrelocs, relocs_sorted;
+
+	struct arena *arena;
+
+	struct symtab symbols;	// .EQU/.REG/.IREG/--define constants
+	struct symtab labels;	// ':' labels
+
+	// .REG/.IREG symbols (index into symbols.syms) in the order they were declared
+	int locals[16];
+	int nlocals;
+
+	// targets resolve_labels() couldn't find, in address order
+	char **missing;
+	int nmissing, maxmissing;
+
+	struct lib_index *libidx;
+
+	// -c: the object being assembled, scan_only > 0 while reading an .INC'd file for its .EQUs
+	int objmode, scan_only;
+	int prog_size_set, bin_start_set;
+	struct object obj;
+
+	// link: the .o files given on the command line
+	struct object **objects;
+	int nobjects, maxobjects;
+
+	struct compiler_stats stats;
 
 	int line_number;
 	uint16_t PC;
@@ -138,26 +288,268 @@ void consume_fname(char *dest, char **s)
 	*dest++ = 0;
 }
 
-int find_symbol(struct compiler_state *state, char *line, int only_sym)
+// copy len characters of s (plus a NUL) into the arena
+char *arena_strdup(struct compiler_state *state, const char *s, int len)
 {
-	int y;
-	char sym[512], *s;
+	struct arena *a = state->arena;
+	char *r;
+
+	if (!a || a->used + len + 1 > a->size) {
+		size_t size = (len + 1) > ARENA_CHUNK ? (len + 1) : ARENA_CHUNK;
+		a = malloc(sizeof *a + size);
+		if (!a) {
+			fprintf(stderr, "Out of memory for arena\n");
+			exit(-1);
+		}
+		a->next = state->arena;
+		a->used = 0;
+		a->size = size;
+		state->arena = a;
+	}
+	r = &a->data[a->used];
+	memcpy(r, s, len);
+	r[len] = 0;
+	a->used += len + 1;
+	return r;
+}
+
+// make room for one more element in a growable array
+static void *grow(void *p, int n, int *max, size_t size, const char *what)
+{
+	if (n == *max) {
+		*max = *max ? *max * 2 : 64;
+		p = realloc(p, *max * size);
+		if (!p) {
+			fprintf(stderr, "Out of memory for %s\n", what);
+			exit(-1);
+		}
+	}
+	return p;
+}
+
+// move the PC for an .ORG/.ALIGN/.INC, with -c this also ends the current section and starts a new one at pc
+static void start_section(struct compiler_state *state, int kind, uint16_t arg, char *path, uint16_t pc)
+{
+	struct object *o = &state->obj;
+	struct obj_section *sec;
+
+	if (state->objmode && !state->scan_only) {
+		if (o->nsections) {
+			o->sections[o->nsections - 1].len = state->PC - o->sections[o->nsections - 1].start;
+		}
+		o->sections = grow(o->sections, o->nsections, &o->maxsections, sizeof *o->sections, "object");
+		sec = &o->sections[o->nsections++];
+		memset(sec, 0, sizeof *sec);
+		sec->kind = kind;
+		sec->arg = arg;
+		sec->start = pc;
+		sec->path = path ? arena_strdup(state, path, strlen(path)) : NULL;
+	}
+	state->PC = pc;
+}
+
+// the word programmed at a word address or NULL if it hasn't been programmed
+struct word *word_at(struct compiler_state *state, int addr)
+{
+	if (addr >= 0 && addr < MAX_PROG_SIZE && state->wordidx[addr]) {
+		return &state->words[state->wordidx[addr] - 1];
+	}
+	return NULL;
+}
+
+// program a new word at PC, the caller must have checked that PC wasn't already programmed
+struct word *new_word(struct compiler_state *state, uint16_t opcode, int opidx)
+{
+	struct word *w;
+
+	if (state->PC >= MAX_PROG_SIZE) {
+		fprintf(stderr, "Line %s:%d: PC==%04X is past the end of memory\n", state->cur_filename, state->line_number, state->PC);
+		exit(-1);
+	}
+	if (state->nwords == state->maxwords) {
+		state->maxwords = state->maxwords ? state->maxwords * 2 : 256;
+		state->words = realloc(state->words, state->maxwords * sizeof *state->words);
+		if (!state->words) {
+			fprintf(stderr, "Out of memory for program\n");
+			exit(-1);
+		}
+	}
+	w = &state->words[state->nwords++];
+	memset(w, 0, sizeof *w);
+	w->addr = state->PC;
+	w->opidx = opidx;
+	w->line_number = state->line_number;
+	w->fname = state->cur_filename;
+	w->sec = state->obj.nsections - 1;
+	if (!state->cur_line_used && state->cur_line) {
+		w->line = arena_strdup(state, state->cur_line, strlen(state->cur_line));
+		state->cur_line_used = 1;
+	} else {
+		w->line = "";
+	}
+	state->image[state->PC] = opcode;
+	state->wordidx[state->PC] = state->nwords;
+	return w;
+}
+
+// queue a word with a target to be patched by resolve_labels()
+static void add_reloc(struct compiler_state *state, struct word *w)
+{
+	uint32_t key;
+
+	// relocs are (addr << 16) | word index so sorting them sorts by address
+	if (state->nrelocs == state->maxrelocs) {
+		state->maxrelocs = state->maxrelocs ? state->maxrelocs * 2 : 256;
+		state->relocs = realloc(state->relocs, state->maxrelocs * sizeof *state->relocs);
+		if (!state->relocs) {
+			fprintf(stderr, "Out of memory for relocations\n");
+			exit(-1);
+		}
+	}
+	key = ((uint32_t)w->addr << 16) | (uint32_t)(w - state->words);
+	if (state->nrelocs && state->relocs[state->nrelocs - 1] > key) {
+		state->relocs_sorted = 0;
+	}
+	state->relocs[state->nrelocs++] = key;
+}
 
-	s = sym;
-	memset(sym, 0, sizeof sym);
-	while (!iswhitespace(line) && *line) {
-		*s++ = *line++;
+// parse a label/symbol target with an optional '<' (top half) or '>' (bottom half) prefix
+// and queue the word to be patched by resolve_labels()
+void consume_target(struct compiler_state *state, struct word *w, char **line)
+{
+	char tgt[256];
+
+	if (**line == '<') {
+		w->use_top_half = 1;
+		++(*line);
+	} else if (**line == '>') {
+		w->use_bottom_half = 1;
+		++(*line);
+	}
+	consume_label(tgt, line);
+	if (!tgt[0]) {
+		return;
+	}
+	w->tgt = arena_strdup(state, tgt, strlen(tgt));
+	add_reloc(state, w);
+}
+
+// FNV-1a over the first len characters of the label
+static uint32_t hash_label(const char *s, int len)
+{
+	uint32_t h = 2166136261UL;
+	while (len--) {
+		h = (h ^ (uint8_t)*s++) * 16777619UL;
+	}
+	return h;
+}
+
+static void symtab_rehash(struct symtab *t, int hsize)
+{
+	int x, y;
+	free(t->hash);
+	t->hsize = hsize;
+	t->hused = 0;
+	t->hash = malloc(hsize * sizeof *t->hash);
+	if (!t->hash) {
+		fprintf(stderr, "Out of memory for symbol table\n");
+		exit(-1);
 	}
-	for (y = 0; y < MAX_PROG_SIZE; y++) {
-		if (!memcmp(state->symbols[y].label, sym, strlen(state->symbols[y].label))) {
-			int n = strlen(state->symbols[y].label);
-			char *l = sym + n;
-			if (*l == 0 || iswhitespace(l) || *l == ',') {
-				return state->symbols[y].value; // symbols are literal constants and should be returned verbatim
+	for (x = 0; x < hsize; x++) {
+		t->hash[x] = SYM_EMPTY;
+	}
+	// re-insert in declaration order so the first declared duplicate is still found first
+	for (x = 0; x < t->nsyms; x++) {
+		if (t->syms[x].live) {
+			y = hash_label(t->syms[x].label, strlen(t->syms[x].label)) & (hsize - 1);
+			while (t->hash[y] != SYM_EMPTY) {
+				y = (y + 1) & (hsize - 1);
 			}
+			t->hash[y] = x;
+			++(t->hused);
+		}
+	}
+}
+
+// find the first declared live symbol whose label is exactly the first len characters of label
+struct symbol *symtab_find(struct compiler_state *state, struct symtab *t, const char *label, int len)
+{
+	int y, idx;
+	if (!t->hsize) {
+		return NULL;
+	}
+	y = hash_label(label, len) & (t->hsize - 1);
+	while ((idx = t->hash[y]) != SYM_EMPTY) {
+		++(state->stats.probes);
+		if (idx >= 0 && !memcmp(t->syms[idx].label, label, len) && t->syms[idx].label[len] == 0) {
+			return &t->syms[idx];
+		}
+		y = (y + 1) & (t->hsize - 1);
+	}
+	return NULL;
+}
+
+// append a new symbol, duplicates are allowed but only the first declared one is found by symtab_find
+int symtab_insert(struct compiler_state *state, struct symtab *t, const char *label)
+{
+	int y, idx;
+	if (t->nsyms == t->maxsyms) {
+		t->maxsyms = t->maxsyms ? t->maxsyms * 2 : 256;
+		t->syms = realloc(t->syms, t->maxsyms * sizeof *t->syms);
+		if (!t->syms) {
+			fprintf(stderr, "Out of memory for symbol table\n");
+			exit(-1);
+		}
+	}
+	// keep the load (including deleted slots) under 50%
+	if ((t->hused + 1) * 2 > t->hsize) {
+		y = t->hsize ? t->hsize : 512;
+		while ((t->nsyms + 1) * 2 > y) {
+			y *= 2;
 		}
+		symtab_rehash(t, y);
 	}
-	if (!only_sym && sscanf(sym, "%x", &y) == 1) {
+	idx = t->nsyms++;
+	memset(&t->syms[idx], 0, sizeof t->syms[idx]);
+	t->syms[idx].label = arena_strdup(state, label, strlen(label));
+	t->syms[idx].live = 1;
+
+	// new entries go at the end of their probe chain (never into a deleted slot)
+	// so an earlier declared duplicate keeps precedence
+	y = hash_label(t->syms[idx].label, strlen(t->syms[idx].label)) & (t->hsize - 1);
+	while (t->hash[y] != SYM_EMPTY) {
+		y = (y + 1) & (t->hsize - 1);
+	}
+	t->hash[y] = idx;
+	++(t->hused);
+	return idx;
+}
+
+void symtab_delete(struct symtab *t, int idx)
+{
+	int y;
+	y = hash_label(t->syms[idx].label, strlen(t->syms[idx].label)) & (t->hsize - 1);
+	while (t->hash[y] != idx) {
+		y = (y + 1) & (t->hsize - 1);
+	}
+	t->hash[y] = SYM_DELETED;
+	t->syms[idx].live = 0;
+}
+
+int find_symbol(struct compiler_state *state, char *line, int only_sym)
+{
+	int y, n;
+	struct symbol *sym;
+
+	// the symbol name runs upto white space, a ',' or the end of the line
+	for (n = 0; line[n] && line[n] != ',' && !iswhitespace(&line[n]); n++);
+
+	++(state->stats.sym_lookups);
+	sym = symtab_find(state, &state->symbols, line, n);
+	if (sym) {
+		return sym->value; // symbols are literal constants and should be returned verbatim
+	}
+	if (!only_sym && sscanf(line, "%x", &y) == 1) {
 		return y;
 	}
 	return -1;
@@ -194,20 +586,18 @@ static unsigned str_to_op(struct compiler_state *state, char **line)
 void compile_opcodes(struct compiler_state *state, char *line)
 {
 	int x;
+	struct word *w;
 	for (x = 0; e1_opcodes[x].opname; x++) {
 		if (!memcmp(line, e1_opcodes[x].opname, strlen(e1_opcodes[x].opname)) && (!line[strlen(e1_opcodes[x].opname)] || iswhitespace(&line[strlen(e1_opcodes[x].opname)]))) {
 			// matched an opcode
 			line += strlen(e1_opcodes[x].opname);
 			consume_whitespace(&line);
-			state->program[state->PC].opcode = e1_opcodes[x].opcode;
-			state->program[state->PC].opidx = x;
-			if (state->program[state->PC].line_number == -1) {
-				state->program[state->PC].line_number = state->line_number;
-				state->program[state->PC].fname = state->cur_filename;
-			} else {
-				fprintf(stderr, "line %s:%d: byte location %x already was programmed on line %s:%d\n", state->cur_filename, state->line_number, state->PC, state->program[state->PC].fname, state->program[state->PC].line_number);
+			w = word_at(state, state->PC);
+			if (w) {
+				fprintf(stderr, "line %s:%d: byte location %x already was programmed on line %s:%d\n", state->cur_filename, state->line_number, state->PC, w->fname, w->line_number);
 				exit(-1);
 			}
+			w = new_word(state, e1_opcodes[x].opcode, x);
 			switch (e1_opcodes[x].fmt) {
 				case OP_FMT_3OP: // "d, a, b"
 				{
@@ -218,7 +608,7 @@ void compile_opcodes(struct compiler_state *state, char *line)
 					r_d &= 0xF;
 					r_a &= 0xF;
 					r_b &= 0xF;
-					state->program[state->PC].opcode |= (r_d << 8) | (r_a << 4) | r_b;
+					state->image[state->PC] |= (r_d << 8) | (r_a << 4) | r_b;
 					break;
 				}
 				case OP_FMT_2OP: // "d, a"
@@ -228,7 +618,7 @@ void compile_opcodes(struct compiler_state *state, char *line)
 					r_a = str_to_op(state, &line);
 					r_d &= 0xF;
 					r_a &= 0xF;
-					state->program[state->PC].opcode |= (r_d << 8) | r_a;
+					state->image[state->PC] |= (r_d << 8) | r_a;
 					break;
 				}
 				case OP_FMT_2OPALU: // "a, b"
@@ -238,7 +628,7 @@ void compile_opcodes(struct compiler_state *state, char *line)
 					r_b = str_to_op(state, &line);
 					r_a &= 0xF;
 					r_b &= 0xF;
-					state->program[state->PC].opcode |= (r_a << 4) | r_b;
+					state->image[state->PC] |= (r_a << 4) | r_b;
 					break;
 				}
 				case OP_FMT_2OPMOV: // "a, b"
@@ -248,7 +638,7 @@ void compile_opcodes(struct compiler_state *state, char *line)
 					r_b = str_to_op(state, &line);
 					r_a &= 0xF;
 					r_b &= 0xF;
-					state->program[state->PC].opcode |= (r_a << 8) | (r_b << 4) | r_b;
+					state->image[state->PC] |= (r_a << 8) | (r_b << 4) | r_b;
 					break;
 				}
 				case OP_FMT_1OP: // "d"
@@ -256,7 +646,7 @@ void compile_opcodes(struct compiler_state *state, char *line)
 					unsigned r_d;
 					r_d = str_to_op(state, &line);
 					r_d &= 0xF;
-					state->program[state->PC].opcode |= (r_d << 8);
+					state->image[state->PC] |= (r_d << 8);
 					break;
 				}
 				case OP_FMT_8IMM: // hex val
@@ -272,26 +662,19 @@ void compile_opcodes(struct compiler_state *state, char *line)
 								exit(-1);
 							}
 						}
-						state->program[state->PC].opcode |= (r_a&0xF) << 8;
+						state->image[state->PC] |= (r_a&0xF) << 8;
 						while (line && *line != ',') ++line;
 						++line;
 					}
 
 					if (islabel(line)) {
 						// it's a label
-						if (*line == '<') {
-							state->program[state->PC].use_top_half = 1;
-							++line;
-						} else if (*line == '>') {
-							state->program[state->PC].use_bottom_half = 1;
-							++line;
-						}
-						consume_label(state->program[state->PC].tgt, &line);
+						consume_target(state, w, &line);
 					} else {
 						uint8_t r;
 						// it's a value
 						sscanf(line, "%"SCNx8, &r);
-						state->program[state->PC].opcode |= r & 0xFF;
+						state->image[state->PC] |= r & 0xFF;
 					}
 					break;
 				}
@@ -299,19 +682,12 @@ void compile_opcodes(struct compiler_state *state, char *line)
 				{
 					if (islabel(line)) {
 						// it's a label
-						if (*line == '<') {
-							state->program[state->PC].use_top_half = 1;
-							++line;
-						} else if (*line == '>') {
-							state->program[state->PC].use_bottom_half = 1;
-							++line;
-						}
-						consume_label(state->program[state->PC].tgt, &line);
+						consume_target(state, w, &line);
 					} else {
 						uint16_t r;
 						// it's a value
 						sscanf(line, "%"SCNx16, &r);
-						state->program[state->PC].opcode |= ((r >> 4) & 0xFFF);
+						state->image[state->PC] |= ((r >> 4) & 0xFFF);
 					}
 					break;
 				}
@@ -319,22 +695,20 @@ void compile_opcodes(struct compiler_state *state, char *line)
 				{
 					if (islabel(line)) {
 						// it's a label
-						if (*line == '<') {
-							state->program[state->PC].use_top_half = 1;
-							++line;
-						} else if (*line == '>') {
-							state->program[state->PC].use_bottom_half = 1;
-							++line;
-						}
-						consume_label(state->program[state->PC].tgt, &line);
+						consume_target(state, w, &line);
 					} else {
 						int16_t r;
 						int16_t off;
 						// it's a value
 						sscanf(line, "%"SCNx16, &r);
+						if (state->objmode) {
+							// PC is only an offset into the section here, the linker hasn't placed it yet
+							fprintf(stderr, "Line %s:%d: Jump target '%s' can't be relocated with -c, use a label or a hex address\n", state->cur_filename, state->line_number, line);
+							exit(-1);
+						}
 						// need to compute offset from PC+2 as a halved signed 9-bit value
 						off = ((r / 2) - state->PC - 1)  & 0x1FF;
-						state->program[state->PC].opcode |= off & 0xFFF;
+						state->image[state->PC] |= off & 0xFFF;
 					}
 					break;
 				}
@@ -356,37 +730,60 @@ void compile_opcodes(struct compiler_state *state, char *line)
 void insert_symbol(struct compiler_state *state, char *line, int reg)
 {
 	int x;
-	for (x = 0; x < MAX_PROG_SIZE; x++) {
-		if (state->symbols[x].label[0] == 0) {
-			consume_label(state->symbols[x].label, &line);
-			state->symbols[x].local = reg > 0 ? 1 : 0;
-			state->symbols[x].save  = reg == 1;
-			if (reg) {
-				// assign new register
-				if (state->reg_idx < 16) {
-					state->symbols[x].value = state->reg_idx++;
-				} else {
-					fprintf(stderr, "%s:%d Out of registers\n", state->cur_filename, state->line_number);
-					exit(-1);
-				}
-			} else {
-				consume_whitespace(&line);
-				sscanf(line, "%"SCNx16, &state->symbols[x].value);
-			}
-			break;
+	char label[256];
+	struct symbol *sym;
+
+	consume_label(label, &line);
+	x = symtab_insert(state, &state->symbols, label);
+	sym = &state->symbols.syms[x];
+	sym->local = reg > 0 ? 1 : 0;
+	sym->save  = reg == 1;
+	if (reg) {
+		// assign new register
+		if (state->reg_idx < 16) {
+			sym->value = state->reg_idx++;
+			state->locals[state->nlocals++] = x;
+		} else {
+			fprintf(stderr, "%s:%d Out of registers\n", state->cur_filename, state->line_number);
+			exit(-1);
 		}
+	} else {
+		consume_whitespace(&line);
+		sscanf(line, "%"SCNx16, &sym->value);
 	}
 }
 
 void compile(struct compiler_state *state, char *line)
 {
-	strcpy(state->program[state->PC].line, line);
+	struct word *w;
+
+	state->cur_line = line;
+	state->cur_line_used = 0;
 	// skip leading white space
 	consume_whitespace(&line);
 	if (!*line || *line == ';') {
 		// blank line or comment
 		return;
 	}
+	if (state->scan_only) {
+		// an .INC'd file under -c, only its symbols matter
+		if (!memcmp(line, ".EQU ", 5)) {
+			line += 5;
+			consume_whitespace(&line);
+			insert_symbol(state, line, 0);
+		} else if (!memcmp(line, ".INC ", 5)) {
+			char *tmpfname = state->cur_filename;
+			int tmpln = state->line_number;
+			char newfname[512];
+			line += 5;
+			consume_whitespace(&line);
+			consume_fname(newfname, &line);
+			compile_file(state, newfname);
+			state->cur_filename = tmpfname;
+			state->line_number = tmpln;
+		}
+		return;
+	}
 	// is it .ORG ?
 	if (!memcmp(line, ".ORG ", 5)) {
 		int y;
@@ -394,7 +791,7 @@ void compile(struct compiler_state *state, char *line)
 		consume_whitespace(&line);
 		y = find_symbol(state, line, 0);
 		if (y >= 0) {
-			state->PC = y >> 1;
+			start_section(state, SEC_ORG, y >> 1, NULL, y >> 1);
 		} else {
 			fprintf(stderr, "Line %s:%d: Undefined symbol for ORG '%s'\n", state->cur_filename, state->line_number, line);
 			exit(-1);
@@ -405,6 +802,7 @@ void compile(struct compiler_state *state, char *line)
 		y = find_symbol(state, line, 0);
 		if (y >= 0) {
 			state->prog_size = y;
+			state->prog_size_set = 1;
 		} else {
 			fprintf(stderr, "Line %s:%d: Undefined symbol for PROG_SIZE '%s'\n", state->cur_filename, state->line_number, line);
 			exit(-1);
@@ -413,6 +811,7 @@ void compile(struct compiler_state *state, char *line)
 		line += 11;
 		sscanf(line, "%"SCNx16, &state->bin_start);
 		state->bin_start >>= 1;
+		state->bin_start_set = 1;
 	} else if (!memcmp(line, ".EQU ", 5)) {
 		line += 5;
 		consume_whitespace(&line);
@@ -426,37 +825,34 @@ void compile(struct compiler_state *state, char *line)
 		consume_whitespace(&line);
 		insert_symbol(state, line, 2);
 	} else if (!memcmp(line, ".PUSHREGS", 9)) {
-		int x, y;
+		int x;
 		line += 9;
-		for (y = 1, x = 0; x < MAX_PROG_SIZE; x++) {
-			if (state->symbols[x].local) {
-				if (state->symbols[x].save) {
-					char tmpline[32];
-					sprintf(tmpline, "PUSH %d\n", y);
-					compile_opcodes(state, tmpline);
-				}
-				++y;
+		for (x = 0; x < state->nlocals; x++) {
+			struct symbol *sym = &state->symbols.syms[state->locals[x]];
+			if (sym->save) {
+				char tmpline[32];
+				sprintf(tmpline, "PUSH %d\n", x + 1);
+				compile_opcodes(state, tmpline);
 			}
 		}
 		consume_whitespace(&line);
 	} else if (!memcmp(line, ".POPREGS", 8)) {
-		int x, y;
+		int x;
 		line += 8;
-		for (y = state->reg_idx - 1, x = MAX_PROG_SIZE - 1; x >= 0; x--) {
-			if (state->symbols[x].local) {
-				if (state->symbols[x].save) {
-					char tmpline[32];
-					sprintf(tmpline, "POP %d\n", y);
-					compile_opcodes(state, tmpline);
-				}
-				--y;
-				memset(&state->symbols[x], 0, sizeof state->symbols[x]);
-				//state->symbols[x].label[0] = 0; // delete local
+		for (x = state->nlocals - 1; x >= 0; x--) {
+			struct symbol *sym = &state->symbols.syms[state->locals[x]];
+			if (sym->save) {
+				char tmpline[32];
+				sprintf(tmpline, "POP %d\n", x + 1);
+				compile_opcodes(state, tmpline);
 			}
+			symtab_delete(&state->symbols, state->locals[x]); // delete local
 		}
+		state->nlocals = 0;
 		state->reg_idx = 1;
 	} else if (!memcmp(line, ".ALIGN ", 7)) {
 		uint8_t x;
+		uint16_t pc;
 		line += 7;
 		consume_whitespace(&line);
 		sscanf(line, "%"SCNx8, &x);
@@ -464,35 +860,26 @@ void compile(struct compiler_state *state, char *line)
 			fprintf(stderr, "Line %s:%d: Invalid alignment %x specified\n", state->cur_filename, state->line_number, x);
 			exit(-1);
 		}
-		while (state->PC % x) {
-			++state->PC;
-		}
+		for (pc = state->PC; pc % x; ++pc);
+		start_section(state, SEC_ALIGN, x, NULL, pc);
 	} else if (!memcmp(line, ".DW ", 4)) {
-		if (state->program[state->PC].line_number == -1) {
+		w = word_at(state, state->PC);
+		if (!w) {
+			w = new_word(state, 0, 0);
 			line += 4;
 			consume_whitespace(&line);
 			if (islabel(line)) {
 				// it's a label
-				if (*line == '<') {
-					state->program[state->PC].use_top_half = 1;
-					++line;
-				} else if (*line == '>') {
-					state->program[state->PC].use_bottom_half = 1;
-					++line;
-				}
-				consume_label(state->program[state->PC].tgt, &line);
+				consume_target(state, w, &line);
 			} else {
 				uint16_t r;
 				// it's a value
 				sscanf(line, "%"SCNx16, &r);
-				state->program[state->PC].opcode = r;
+				state->image[state->PC] = r;
 			}
-			state->program[state->PC].line_number = state->line_number;
-			state->program[state->PC].fname = state->cur_filename;
-			state->program[state->PC].opidx = 0;
 			++(state->PC);
 		} else {
-			fprintf(stderr, "Line %s:%d PC==%04X was already programmed by %s:%d\n", state->cur_filename, state->line_number, state->PC, state->program[state->PC].fname, state->program[state->PC].line_number);
+			fprintf(stderr, "Line %s:%d PC==%04X was already programmed by %s:%d\n", state->cur_filename, state->line_number, state->PC, w->fname, w->line_number);
 			exit(-1);
 		}
 	} else if (!memcmp(line, ".DS ", 4)) {
@@ -512,17 +899,15 @@ void compile(struct compiler_state *state, char *line)
 		++slen;				  // include NUL byte
 		if (slen & 1) ++slen; // force even
 		for (dsi = 0; dsi < slen; dsi += 2) {
-			if (state->program[state->PC].line_number == -1) {
+			w = word_at(state, state->PC);
+			if (!w) {
 				uint16_t r;
 				// it's a value
 				r = ((uint16_t)buf[dsi+1] << 8) | buf[dsi];
-				state->program[state->PC].opcode = r;
-				state->program[state->PC].line_number = state->line_number;
-				state->program[state->PC].fname = state->cur_filename;
-				state->program[state->PC].opidx = 0;
+				new_word(state, r, 0);
 				++(state->PC);
 			} else {
-				fprintf(stderr, "Line %s:%d: .DS directive on address that was already programmed on line %d\n", state->cur_filename, state->line_number, state->program[state->PC].line_number);
+				fprintf(stderr, "Line %s:%d: .DS directive on address that was already programmed on line %d\n", state->cur_filename, state->line_number, w->line_number);
 				exit(-1);
 			}
 		}
@@ -533,14 +918,12 @@ void compile(struct compiler_state *state, char *line)
 		sscanf(line, "%x", &slen); // # of bytes
 		if (slen & 1) ++slen; // force even
 		for (x = 0; x < slen; x += 2) {
-			if (state->program[state->PC].line_number == -1) {
-				state->program[state->PC].opcode = 0;
-				state->program[state->PC].line_number = state->line_number;
-				state->program[state->PC].fname = state->cur_filename;
-				state->program[state->PC].opidx = 0;
+			w = word_at(state, state->PC);
+			if (!w) {
+				new_word(state, 0, 0);
 				++(state->PC);
 			} else {
-				fprintf(stderr, "Line %s:%d: .DUP directive on address that was already programmed on line %d\n", state->cur_filename, state->line_number, state->program[state->PC].line_number);
+				fprintf(stderr, "Line %s:%d: .DUP directive on address that was already programmed on line %d\n", state->cur_filename, state->line_number, w->line_number);
 				exit(-1);
 			}
 		}
@@ -555,125 +938,154 @@ void compile(struct compiler_state *state, char *line)
 		
 		// consume filename
 		consume_fname(newfname, &line);
-		compile_file(state, newfname);
+		if (state->objmode) {
+			// the linker places newfname's own object here, we only want its symbols
+			start_section(state, SEC_INC, 0, newfname, state->PC);
+			++(state->scan_only);
+			compile_file(state, newfname);
+			--(state->scan_only);
+			start_section(state, SEC_ALIGN, 1, NULL, state->PC);
+		} else {
+			compile_file(state, newfname);
+		}
 		
 		// resume parent file
 		state->cur_filename = tmpfname;
 		state->line_number = tmpln;
+		state->cur_line = NULL;
 	} else if (line[0] == ':') {
 		// it's a label
+		char label[256];
+		int x;
 		++line;
-		consume_label(state->program[state->PC].label, &line);
+		consume_label(label, &line);
+		x = symtab_insert(state, &state->labels, label);
+		state->labels.syms[x].value = state->PC;
+		if (state->objmode) {
+			struct object *o = &state->obj;
+			o->labels = grow(o->labels, o->nlabels, &o->maxlabels, sizeof *o->labels, "object");
+			o->labels[o->nlabels].sec = o->nsections - 1;
+			o->labels[o->nlabels].off = state->PC - o->sections[o->nsections - 1].start;
+			o->labels[o->nlabels++].name = state->labels.syms[x].label;
+		}
 	} else {
 		compile_opcodes(state, line);
 	}
 }
 
-int find_target(struct compiler_state *state, int x, char **missing_symbol)
+int find_target(struct compiler_state *state, struct word *w, char **missing_symbol)
 {
-	int y;
 	uint16_t d;
+	struct symbol *sym;
 
 	*missing_symbol = NULL;
-	for (y = 0; y < MAX_PROG_SIZE; y++) {
-		if (!strcmp(state->program[y].label, state->program[x].tgt)) {
-			return y << 1; // labels are placed in the stream at word offsets so return the byte offset
-		}
+	++(state->stats.label_lookups);
+	sym = symtab_find(state, &state->labels, w->tgt, strlen(w->tgt));
+	if (sym) {
+		return sym->value << 1; // labels are placed in the stream at word offsets so return the byte offset
 	}
-	for (y = 0; y < MAX_PROG_SIZE; y++) {
-		if (!strcmp(state->symbols[y].label, state->program[x].tgt)) {
-			return state->symbols[y].value; // symbols are literal constants and should be returned verbatim
-		}
+	++(state->stats.sym_lookups);
+	sym = symtab_find(state, &state->symbols, w->tgt, strlen(w->tgt));
+	if (sym) {
+		return sym->value; // symbols are literal constants and should be returned verbatim
 	}
-	if (sscanf(state->program[x].tgt, "%"SCNx16, &d) == 1) {
+	if (sscanf(w->tgt, "%"SCNx16, &d) == 1) {
 		return d;
 	}
-	*missing_symbol = state->program[x].tgt;
+	*missing_symbol = w->tgt;
 	return -1;
 }
 
-int resolve_labels(struct compiler_state *state, char **missing_symbol)
+static int cmp_reloc(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+// patch every word that has a target, returns the number of targets that couldn't be
+// found which are listed in state->missing[] in address order
+int resolve_labels(struct compiler_state *state)
 {
 	int16_t y;
-	int x, z;
-	
-	for (x = 0; x < MAX_PROG_SIZE; x++) {
-		switch (e1_opcodes[state->program[x].opidx].fmt) {
+	int i, x, z;
+	struct word *w;
+	char *missing_symbol;
+
+	++(state->stats.resolve_passes);
+	state->nmissing = 0;
+
+	// resolve in address order so the first missing symbol (and hence the link order) doesn't
+	// depend on the order the words were emitted in
+	if (!state->relocs_sorted) {
+		qsort(state->relocs, state->nrelocs, sizeof *state->relocs, cmp_reloc);
+		state->relocs_sorted = 1;
+	}
+	for (i = 0; i < state->nrelocs; i++) {
+		w = &state->words[state->relocs[i] & 0xFFFF];
+		x = w->addr;
+		y = z = find_target(state, w, &missing_symbol);
+		if (z < 0) {
+			// symbol not found
+			if (state->nmissing == state->maxmissing) {
+				state->maxmissing = state->maxmissing ? state->maxmissing * 2 : 64;
+				state->missing = realloc(state->missing, state->maxmissing * sizeof *state->missing);
+				if (!state->missing) {
+					fprintf(stderr, "Out of memory for missing symbols\n");
+					exit(-1);
+				}
+			}
+			state->missing[state->nmissing++] = missing_symbol;
+			continue;
+		}
+		switch (e1_opcodes[w->opidx].fmt) {
 			case OP_FMT_8IMM:
-				if (state->program[x].tgt[0]) {
-					y = z = find_target(state, x, missing_symbol);
-					if (z < 0) {
-						// symbol not found
-						return -1;
-					}
-					if (state->program[x].use_top_half) {
-						y >>= 8;
-					} else if (state->program[x].use_bottom_half) {
-						y &= 0xFF;
-					}
-					state->program[x].opcode |= y & 0xFF;
+				if (w->use_top_half) {
+					y >>= 8;
+				} else if (w->use_bottom_half) {
+					y &= 0xFF;
 				}
+				state->image[x] |= y & 0xFF;
 				break;
 			case OP_FMT_12IMMT: //CALL
-				if (state->program[x].tgt[0]) {
-					// jumping to a target 
-					y = z = find_target(state, x, missing_symbol);
-					if (z < 0) {
-						// symbol not found
-						return -1;
-					}
-					if (state->program[x].use_top_half) {
-						y >>= 8;
-					} else if (state->program[x].use_bottom_half) {
-						y &= 0xFF;
-					}
-					if (y & 0xF) { 
-						fprintf(stderr, "Line %s:%d: Error, LCALL target must be 16-byte aligned\n", state->cur_filename, state->line_number);
-						exit(-1);
-					}
-					state->program[x].opcode |= (y >> 4) & 0xFFF;
+				// jumping to a target 
+				if (w->use_top_half) {
+					y >>= 8;
+				} else if (w->use_bottom_half) {
+					y &= 0xFF;
+				}
+				if (y & 0xF) { 
+					fprintf(stderr, "Line %s:%d: Error, LCALL target must be 16-byte aligned\n", w->fname, w->line_number);
+					exit(-1);
 				}
+				state->image[x] |= (y >> 4) & 0xFFF;
 				break;
 			case OP_FMT_9SIMM: // Jumps
-				if (state->program[x].tgt[0]) {
-					int16_t off;
-					// jumping to a target 
-					y = z = find_target(state, x, missing_symbol);
-					if (z < 0) {
-						// symbol not found
-						return -1;
-					}
-					y >>= 1; // convert to word offset from byte offset
-					if (state->program[x].use_top_half) {
-						y >>= 8;
-					} else if (state->program[x].use_bottom_half) {
-						y &= 0xFF;
-					}
-					off = (y - x - 1)  & 0x1FF;
-					state->program[x].opcode |= off;
+			{
+				int16_t off;
+				// jumping to a target 
+				y >>= 1; // convert to word offset from byte offset
+				if (w->use_top_half) {
+					y >>= 8;
+				} else if (w->use_bottom_half) {
+					y &= 0xFF;
 				}
+				off = (y - x - 1)  & 0x1FF;
+				state->image[x] |= off;
 				break;
+			}
 			case OP_FMT_LITERAL:
-				if (state->program[x].tgt[0]) {
-					// jumping to a target 
-					y = z = find_target(state, x, missing_symbol);
-					if (z < 0) {
-						// symbol not found
-						return -1;
-					}					
-					if (state->program[x].use_top_half) {
-						y >>= 8;
-					} else if (state->program[x].use_bottom_half) {
-						y &= 0xFF;
-					}
-					state->program[x].opcode = y;
+				if (w->use_top_half) {
+					y >>= 8;
+				} else if (w->use_bottom_half) {
+					y &= 0xFF;
 				}
+				state->image[x] = y;
 				break;
 			default:
 				break;
 		}
 	}
-	return 0;
+	return state->nmissing;
 }
 
 void compile_file(struct compiler_state *state, char *fname)
@@ -686,12 +1098,12 @@ void compile_file(struct compiler_state *state, char *fname)
 		exit(-1);
 	}
 	memset(linebuf, 0, sizeof linebuf);
-	printf("Compiling %s...\n", fname);
+	printf(state->scan_only ? "Reading symbols from %s...\n" : "Compiling %s...\n", fname);
 	state->line_number = 1;
 	state->cur_filename = strdup(fname);
 	while (fgets(linebuf, sizeof(linebuf) - 1, f)) {
 		int n = strlen(linebuf) - 1;
-		while (linebuf[n] == '\r' || linebuf[n] == '\n') {
+		while (n >= 0 && (linebuf[n] == '\r' || linebuf[n] == '\n')) {
 			linebuf[n--] = 0;
 		}
 		compile(state, linebuf);
@@ -700,63 +1112,650 @@ void compile_file(struct compiler_state *state, char *fname)
 	fclose(f);
 }
 
-int scan_file(char *fname, char *missing_symbol)
+// find the opcode table entry a line (with leading white space removed) starts with, -1 if none
+int match_opcode(char *line)
+{
+	int x, n;
+	for (x = 0; e1_opcodes[x].opname; x++) {
+		n = strlen(e1_opcodes[x].opname);
+		if (!memcmp(line, e1_opcodes[x].opname, n) && (!line[n] || iswhitespace(&line[n]))) {
+			return x;
+		}
+	}
+	return -1;
+}
+
+static void add_name(struct compiler_state *state, char ***list, int *n, int *max, char *name)
+{
+	if (*n == *max) {
+		*max = *max ? *max * 2 : 16;
+		*list = realloc(*list, *max * sizeof **list);
+		if (!*list) {
+			fprintf(stderr, "Out of memory for library index\n");
+			exit(-1);
+		}
+	}
+	(*list)[(*n)++] = arena_strdup(state, name, strlen(name));
+}
+
+// scan a library file for the labels it exports (':' lines) and the targets it imports
+// (label operands of LDI/SRES/LCALL/jumps and .DW), this mirrors what compile_opcodes()
+// treats as a target without assembling anything
+void scan_lib_file(struct compiler_state *state, struct lib_file *lf)
 {
 	FILE *f;
-	char linebuf[512], *line;
-	
-	f = fopen(fname, "r");
+	char linebuf[512], name[512], *line;
+	int x, y, z;
+	uint16_t d;
+
+	f = fopen(lf->path, "r");
 	if (!f) {
-		fprintf(stderr, "Cannot open linker file %s\n", fname);
+		fprintf(stderr, "Cannot open linker file %s\n", lf->path);
 		exit(-1);
 	}
 	memset(linebuf, 0, sizeof linebuf);
 	while (fgets(linebuf, sizeof(linebuf)-1, f)) {
 		line = &linebuf[0];
 		consume_whitespace(&line);
-		if (line[0] == ':' && !memcmp(line+1, missing_symbol, strlen(missing_symbol))) {
-			return 1;
+		if (line[0] == ':') {
+			++line;
+			consume_label(name, &line);
+			if (name[0]) {
+				add_name(state, &lf->exports, &lf->nexports, &lf->maxexports, name);
+			}
+			continue;
+		}
+		if (!memcmp(line, ".DW ", 4)) {
+			line += 4;
+		} else if ((x = match_opcode(line)) > 0) {
+			if (e1_opcodes[x].fmt != OP_FMT_8IMM && e1_opcodes[x].fmt != OP_FMT_12IMMT && e1_opcodes[x].fmt != OP_FMT_9SIMM) {
+				continue;
+			}
+			line += strlen(e1_opcodes[x].opname);
+			if (e1_opcodes[x].fmt == OP_FMT_8IMM && strstr(line, ",")) {
+				line = strstr(line, ",") + 1;
+			}
+		} else {
+			continue;
+		}
+		consume_whitespace(&line);
+		if (*line == '<' || *line == '>') {
+			++line;
+		}
+		consume_label(name, &line);
+		if (name[0] && sscanf(name, "%"SCNx16, &d) != 1) {
+			// hex looking names never get linked (find_target takes them as values)
+			for (x = 0; x < lf->nimports && strcmp(lf->imports[x], name); x++);
+			if (x == lf->nimports) {
+				add_name(state, &lf->imports, &lf->nimports, &lf->maximports, name);
+			}
 		}
 	}
-	return 0;
+	fclose(f);
+
+	// drop references to the file's own labels
+	for (x = y = 0; x < lf->nimports; x++) {
+		for (z = 0; z < lf->nexports && strcmp(lf->exports[z], lf->imports[x]); z++);
+		if (z == lf->nexports) {
+			lf->imports[y++] = lf->imports[x];
+		}
+	}
+	lf->nimports = y;
 }
 
-int link(struct compiler_state *state, char *libdir, char *missing_symbol)
+// collect the .s files under dir (recursively)
+static void find_lib_files(struct compiler_state *state, struct lib_index *idx, char *dir)
 {
 	DIR *d;
 	struct dirent *de;
-	
-	// we scan libdir for any file that has a line starting with ":%s" (missing_symbol)
-	d = opendir(libdir);
-	if (!d) { 
-		fprintf(stderr, "Could not open directory '%s'\n", libdir);
+	char path[512];
+
+	d = opendir(dir);
+	if (!d) {
+		fprintf(stderr, "Could not open directory '%s'\n", dir);
 		exit(-1);
 	}
-	
 	while ((de = readdir(d))) {
+		if (de->d_name[0] == '.') {
+			// ., .. and the index cache
+			continue;
+		}
 		if (de->d_type == DT_DIR) {
-			// directories
-			if (strcmp(de->d_name, ".") && strcmp(de->d_name, "..")) {
-				char newdir[512];
-				sprintf(newdir, "%s%s/", libdir, de->d_name);
-				if (!link(state, newdir, missing_symbol)) {
-					closedir(d);
-					return 0;
-				}
-			}
+			sprintf(path, "%s%s/", dir, de->d_name);
+			find_lib_files(state, idx, path);
 		} else if (de->d_type == DT_REG) {
-			// regular file
-			char fname[512];
-			sprintf(fname, "%s%s", libdir, de->d_name);
-			if (scan_file(fname, missing_symbol)) {
-				compile_file(state, fname);
-				closedir(d);
-				return 0;
+			char *s = strstr(de->d_name, ".s");
+			if (s && s[2] == 0) {
+				struct stat st;
+				struct lib_file *lf;
+				sprintf(path, "%s%s", dir, de->d_name);
+				if (stat(path, &st)) {
+					continue;
+				}
+				if (idx->nfiles == idx->maxfiles) {
+					idx->maxfiles = idx->maxfiles ? idx->maxfiles * 2 : 64;
+					idx->files = realloc(idx->files, idx->maxfiles * sizeof *idx->files);
+					if (!idx->files) {
+						fprintf(stderr, "Out of memory for library index\n");
+						exit(-1);
+					}
+				}
+				lf = &idx->files[idx->nfiles++];
+				memset(lf, 0, sizeof *lf);
+				lf->path = arena_strdup(state, path, strlen(path));
+				lf->mtime = st.st_mtime;
+				lf->size = st.st_size;
 			}
 		}
 	}
 	closedir(d);
-	return -1;
+}
+
+static int cmp_lib_file(const void *a, const void *b)
+{
+	return strcmp(((const struct lib_file *)a)->path, ((const struct lib_file *)b)->path);
+}
+
+// read the index cache, any file whose path, mtime and size match a cached entry
+// takes its exports/imports from the cache
+static void load_lib_cache(struct compiler_state *state, struct lib_index *idx, char *cachename)
+{
+	FILE *f;
+	char linebuf[512], path[512], name[512];
+	long mtime, size;
+	struct lib_file key, *lf = NULL;
+
+	f = fopen(cachename, "r");
+	if (!f) {
+		return;
+	}
+	if (!fgets(linebuf, sizeof linebuf, f) || strcmp(linebuf, LIB_INDEX_MAGIC "\n")) {
+		fclose(f);
+		return;
+	}
+	while (fgets(linebuf, sizeof linebuf, f)) {
+		if (sscanf(linebuf, "F %ld %ld %511s", &mtime, &size, path) == 3) {
+			key.path = path;
+			lf = bsearch(&key, idx->files, idx->nfiles, sizeof *idx->files, cmp_lib_file);
+			if (lf && (lf->scanned || lf->mtime != mtime || lf->size != size)) {
+				lf = NULL;
+			}
+			if (lf) {
+				lf->scanned = 1;
+				++(state->stats.index_cached);
+			}
+		} else if (lf && sscanf(linebuf, "E %511s", name) == 1) {
+			add_name(state, &lf->exports, &lf->nexports, &lf->maxexports, name);
+		} else if (lf && sscanf(linebuf, "I %511s", name) == 1) {
+			add_name(state, &lf->imports, &lf->nimports, &lf->maximports, name);
+		}
+	}
+	fclose(f);
+}
+
+static void save_lib_cache(struct lib_index *idx, char *cachename)
+{
+	FILE *f;
+	char tmpname[600];
+	int x, y;
+
+	// write to a temp file and rename so a concurrent build never sees half an index
+	sprintf(tmpname, "%s.tmp", cachename);
+	f = fopen(tmpname, "w");
+	if (!f) {
+		// read-only library directories just don't get a cache
+		return;
+	}
+	fprintf(f, "%s\n", LIB_INDEX_MAGIC);
+	for (x = 0; x < idx->nfiles; x++) {
+		fprintf(f, "F %ld %ld %s\n", idx->files[x].mtime, idx->files[x].size, idx->files[x].path);
+		for (y = 0; y < idx->files[x].nexports; y++) {
+			fprintf(f, "E %s\n", idx->files[x].exports[y]);
+		}
+		for (y = 0; y < idx->files[x].nimports; y++) {
+			fprintf(f, "I %s\n", idx->files[x].imports[y]);
+		}
+	}
+	if (fclose(f) || rename(tmpname, cachename)) {
+		remove(tmpname);
+	}
+}
+
+// map every exported label to the first file (in index order) that exports it
+static void index_exports(struct compiler_state *state, struct lib_index *idx)
+{
+	int x, y, z;
+
+	for (x = 0; x < idx->nfiles; x++) {
+		for (y = 0; y < idx->files[x].nexports; y++) {
+			if (!symtab_find(state, &idx->exports, idx->files[x].exports[y], strlen(idx->files[x].exports[y]))) {
+				z = symtab_insert(state, &idx->exports, idx->files[x].exports[y]);
+				idx->exports.syms[z].value = x;
+			}
+		}
+	}
+}
+
+// build the index for a library directory, files are visited in path order so when two
+// files export the same label the first one by path wins
+struct lib_index *build_lib_index(struct compiler_state *state, char *libdir)
+{
+	struct lib_index *idx;
+	char cachename[512];
+	int x, dirty = 0;
+
+	idx = calloc(1, sizeof *idx);
+	if (!idx) {
+		fprintf(stderr, "Out of memory for library index\n");
+		exit(-1);
+	}
+	find_lib_files(state, idx, libdir);
+	qsort(idx->files, idx->nfiles, sizeof *idx->files, cmp_lib_file);
+
+	sprintf(cachename, "%s%s", libdir, LIB_INDEX_NAME);
+	load_lib_cache(state, idx, cachename);
+	for (x = 0; x < idx->nfiles; x++) {
+		if (!idx->files[x].scanned) {
+			scan_lib_file(state, &idx->files[x]);
+			idx->files[x].scanned = 1;
+			++(state->stats.index_scanned);
+			dirty = 1;
+		}
+	}
+	if (dirty || state->stats.index_cached != (unsigned long)idx->nfiles) {
+		save_lib_cache(idx, cachename);
+	}
+	index_exports(state, idx);
+	return idx;
+}
+
+// write the object assembled with -c
+void emit_objfile(struct compiler_state *state, char *fname)
+{
+	FILE *f;
+	struct object *o = &state->obj;
+	struct symbol *sym;
+	struct word *w;
+	int x;
+
+	f = fopen(fname, "w");
+	if (!f) {
+		fprintf(stderr, "Could not open the object output file '%s'\n", fname);
+		exit(-1);
+	}
+	o->sections[o->nsections - 1].len = state->PC - o->sections[o->nsections - 1].start;
+
+	fprintf(f, "%s\nO %s\n", OBJ_MAGIC, o->path);
+	if (state->prog_size_set) {
+		fprintf(f, "P %x\n", state->prog_size);
+	}
+	if (state->bin_start_set) {
+		fprintf(f, "B %x\n", state->bin_start);
+	}
+	// every constant we know (ours, the .INC'd files' and --define's) so relocations against them resolve
+	for (x = 0; x < state->symbols.nsyms; x++) {
+		sym = &state->symbols.syms[x];
+		if (sym->live && !sym->local) {
+			fprintf(f, "Q %s %x\n", sym->label, sym->value);
+		}
+	}
+	for (x = 0; x < o->nsections; x++) {
+		fprintf(f, "S %d %x %x %s\n", o->sections[x].kind, o->sections[x].arg, o->sections[x].len,
+			o->sections[x].path ? o->sections[x].path : "-");
+	}
+	for (x = 0; x < o->nlabels; x++) {
+		fprintf(f, "L %d %x %s\n", o->labels[x].sec, o->labels[x].off, o->labels[x].name);
+	}
+	for (x = 0; x < state->nwords; x++) {
+		w = &state->words[x];
+		fprintf(f, "W %d %x %x %d %d %s %d\t%s\n", w->sec, w->addr - o->sections[w->sec].start,
+			state->image[w->addr], w->opidx, w->use_top_half ? 1 : w->use_bottom_half ? 2 : 0,
+			w->tgt ? w->tgt : "-", w->line_number, w->line);
+	}
+	fclose(f);
+}
+
+// bundle objects into an archive the link step can pull members out of like a --lib directory
+void emit_arfile(char *fname, int argc, char **argv)
+{
+	FILE *f, *in;
+	char linebuf[1024];
+	int i;
+
+	f = fopen(fname, "w");
+	if (!f) {
+		fprintf(stderr, "Could not open the archive output file '%s'\n", fname);
+		exit(-1);
+	}
+	fprintf(f, "%s\n", AR_MAGIC);
+	for (i = 1; i < argc; i++) {
+		char *s = strstr(argv[i], ".o");
+		if (!s || s[2] || argv[i] == fname) {
+			continue;
+		}
+		in = fopen(argv[i], "r");
+		if (!in || !fgets(linebuf, sizeof linebuf, in) || strcmp(linebuf, OBJ_MAGIC "\n")) {
+			fprintf(stderr, "'%s' is not an object file\n", argv[i]);
+			exit(-1);
+		}
+		do {
+			fputs(linebuf, f);
+		} while (fgets(linebuf, sizeof linebuf, in));
+		fclose(in);
+	}
+	fclose(f);
+}
+
+// read a .o (one object) or .a (any number of them) into state->objects
+void load_objects(struct compiler_state *state, char *fname, int member)
+{
+	FILE *f;
+	char linebuf[1024], name[512];
+	struct object *o = NULL;
+	int ln = 0, n, sec, off, value, opidx, half, line_number;
+
+	f = fopen(fname, "r");
+	if (!f) {
+		fprintf(stderr, "File '%s' not found!\n", fname);
+		exit(-1);
+	}
+	if (!fgets(linebuf, sizeof linebuf, f) || (strcmp(linebuf, OBJ_MAGIC "\n") && strcmp(linebuf, AR_MAGIC "\n"))) {
+		fprintf(stderr, "'%s' is not an object file or archive\n", fname);
+		exit(-1);
+	}
+	do {
+		++ln;
+		n = strlen(linebuf);
+		while (n && (linebuf[n - 1] == '\n' || linebuf[n - 1] == '\r')) {
+			linebuf[--n] = 0;
+		}
+		if (!strcmp(linebuf, OBJ_MAGIC)) {
+			o = calloc(1, sizeof *o);
+			if (!o) {
+				fprintf(stderr, "Out of memory for objects\n");
+				exit(-1);
+			}
+			o->fname = arena_strdup(state, fname, strlen(fname));
+			o->path = o->fname;
+			o->prog_size = o->bin_start = -1;
+			o->member = member;
+			state->objects = grow(state->objects, state->nobjects, &state->maxobjects, sizeof *state->objects, "objects");
+			state->objects[state->nobjects++] = o;
+			continue;
+		}
+		if (!o) {
+			continue;				// archive header
+		}
+		switch (linebuf[0]) {
+			case 'O':
+				if (sscanf(linebuf, "O %511s", name) == 1) {
+					o->path = arena_strdup(state, name, strlen(name));
+					continue;
+				}
+				break;
+			case 'P':
+				if (sscanf(linebuf, "P %x", &o->prog_size) == 1) {
+					continue;
+				}
+				break;
+			case 'B':
+				if (sscanf(linebuf, "B %x", &o->bin_start) == 1) {
+					continue;
+				}
+				break;
+			case 'Q':
+				if (sscanf(linebuf, "Q %511s %x", name, &value) == 2) {
+					o->symbols = grow(o->symbols, o->nsymbols, &o->maxsymbols, sizeof *o->symbols, "objects");
+					o->symbols[o->nsymbols].name = arena_strdup(state, name, strlen(name));
+					o->symbols[o->nsymbols++].value = value;
+					continue;
+				}
+				break;
+			case 'S':
+				if (sscanf(linebuf, "S %d %x %x %511s", &sec, &value, &off, name) == 4 && sec >= SEC_ORG && sec <= SEC_INC &&
+				    (sec != SEC_ALIGN || value > 0)) {
+					struct obj_section *s;
+					o->sections = grow(o->sections, o->nsections, &o->maxsections, sizeof *o->sections, "objects");
+					s = &o->sections[o->nsections++];
+					memset(s, 0, sizeof *s);
+					s->kind = sec;
+					s->arg = value;
+					s->len = off;
+					s->path = sec == SEC_INC ? arena_strdup(state, name, strlen(name)) : NULL;
+					continue;
+				}
+				break;
+			case 'L':
+				if (sscanf(linebuf, "L %d %x %511s", &sec, &off, name) == 3 && sec >= 0 && sec < o->nsections) {
+					o->labels = grow(o->labels, o->nlabels, &o->maxlabels, sizeof *o->labels, "objects");
+					o->labels[o->nlabels].sec = sec;
+					o->labels[o->nlabels].off = off;
+					o->labels[o->nlabels++].name = arena_strdup(state, name, strlen(name));
+					continue;
+				}
+				break;
+			case 'W':
+				if (sscanf(linebuf, "W %d %x %x %d %d %511s %d%n", &sec, &off, &value, &opidx, &half, name, &line_number, &n) == 7 &&
+				    sec >= 0 && sec < o->nsections && opidx >= 0 && opidx < (int)(sizeof e1_opcodes / sizeof e1_opcodes[0]) - 1 &&
+				    linebuf[n] == '\t') {
+					struct obj_word *w;
+					o->words = grow(o->words, o->nwords, &o->maxwords, sizeof *o->words, "objects");
+					w = &o->words[o->nwords++];
+					w->sec = sec;
+					w->off = off;
+					w->value = value;
+					w->opidx = opidx;
+					w->half = half;
+					w->tgt = strcmp(name, "-") ? arena_strdup(state, name, strlen(name)) : NULL;
+					w->line_number = line_number;
+					w->line = linebuf[n + 1] ? arena_strdup(state, &linebuf[n + 1], strlen(&linebuf[n + 1])) : "";
+					continue;
+				}
+				break;
+		}
+		fprintf(stderr, "%s:%d: corrupt object record '%s'\n", fname, ln, linebuf);
+		exit(-1);
+	} while (fgets(linebuf, sizeof linebuf, f));
+	fclose(f);
+}
+
+// the object built from an .INC'd source file
+static struct object *find_object(struct compiler_state *state, char *path)
+{
+	int x;
+	for (x = 0; x < state->nobjects; x++) {
+		if (!strcmp(state->objects[x]->path, path)) {
+			return state->objects[x];
+		}
+	}
+	return NULL;
+}
+
+// lay an object out at the PC the same way compiling its source here would have
+void place_object(struct compiler_state *state, struct object *o)
+{
+	struct object *inc;
+	struct obj_section *sec;
+	struct obj_word *ow;
+	struct word *w;
+	int s, x, y, li = 0, wi = 0;
+	uint16_t base;
+
+	if (o->member) {
+		printf("Linking %s(%s)...\n", o->fname, o->path);
+	} else {
+		printf("Linking %s...\n", o->fname);
+	}
+	o->placed = 1;
+	if (o->prog_size >= 0) {
+		state->prog_size = o->prog_size;
+	}
+	if (o->bin_start >= 0) {
+		state->bin_start = o->bin_start;
+	}
+	for (x = 0; x < o->nsymbols; x++) {
+		if (!symtab_find(state, &state->symbols, o->symbols[x].name, strlen(o->symbols[x].name))) {
+			y = symtab_insert(state, &state->symbols, o->symbols[x].name);
+			state->symbols.syms[y].value = o->symbols[x].value;
+		}
+	}
+	state->cur_filename = o->path;
+	for (s = 0; s < o->nsections; s++) {
+		sec = &o->sections[s];
+		if (sec->kind == SEC_INC) {
+			inc = find_object(state, sec->path);
+			if (!inc) {
+				fprintf(stderr, "%s: no object for the .INC'd file '%s'\n", o->fname, sec->path);
+				exit(-1);
+			}
+			if (inc->placed) {
+				fprintf(stderr, "%s: '%s' was already linked\n", o->fname, sec->path);
+				exit(-1);
+			}
+			place_object(state, inc);
+			state->cur_filename = o->path;
+			continue;
+		}
+		if (sec->kind == SEC_ORG) {
+			state->PC = sec->arg;
+		} else {
+			while (state->PC % sec->arg) {
+				++state->PC;
+			}
+		}
+		base = state->PC;
+		for (; li < o->nlabels && o->labels[li].sec == s; li++) {
+			x = symtab_insert(state, &state->labels, o->labels[li].name);
+			state->labels.syms[x].value = base + o->labels[li].off;
+		}
+		for (; wi < o->nwords && o->words[wi].sec == s; wi++) {
+			ow = &o->words[wi];
+			state->PC = base + ow->off;
+			state->line_number = ow->line_number;
+			state->cur_line = ow->line;
+			state->cur_line_used = !ow->line[0];
+			if ((w = word_at(state, state->PC))) {
+				fprintf(stderr, "%s: %s:%d: word address %x already was programmed on line %s:%d\n", o->fname, o->path, ow->line_number, state->PC, w->fname, w->line_number);
+				exit(-1);
+			}
+			w = new_word(state, ow->value, ow->opidx);
+			if (ow->tgt) {
+				w->tgt = ow->tgt;
+				w->use_top_half = ow->half == 1;
+				w->use_bottom_half = ow->half == 2;
+				add_reloc(state, w);
+			}
+		}
+		state->PC = base + sec->len;
+	}
+	state->cur_line = NULL;
+}
+
+// an index over the archive members loaded so far, members are searched in the order
+// they were archived so (like a --lib directory) the first one exporting a label wins
+struct lib_index *build_archive_index(struct compiler_state *state)
+{
+	struct lib_index *idx;
+	struct lib_file *lf;
+	struct object *o;
+	uint16_t d;
+	int x, y, z;
+
+	idx = calloc(1, sizeof *idx);
+	if (!idx) {
+		fprintf(stderr, "Out of memory for library index\n");
+		exit(-1);
+	}
+	for (x = 0; x < state->nobjects; x++) {
+		o = state->objects[x];
+		if (!o->member || o->placed) {
+			continue;
+		}
+		idx->files = grow(idx->files, idx->nfiles, &idx->maxfiles, sizeof *idx->files, "library index");
+		lf = &idx->files[idx->nfiles++];
+		memset(lf, 0, sizeof *lf);
+		lf->path = o->path;
+		lf->obj = o;
+		lf->scanned = 1;
+		for (y = 0; y < o->nlabels; y++) {
+			add_name(state, &lf->exports, &lf->nexports, &lf->maxexports, o->labels[y].name);
+		}
+		// imports are the targets that aren't our own labels (hex looking names never get linked)
+		for (y = 0; y < o->nwords; y++) {
+			if (!o->words[y].tgt || sscanf(o->words[y].tgt, "%"SCNx16, &d) == 1) {
+				continue;
+			}
+			for (z = 0; z < lf->nexports && strcmp(lf->exports[z], o->words[y].tgt); z++);
+			if (z < lf->nexports) {
+				continue;
+			}
+			for (z = 0; z < lf->nimports && strcmp(lf->imports[z], o->words[y].tgt); z++);
+			if (z == lf->nimports) {
+				add_name(state, &lf->imports, &lf->nimports, &lf->maximports, o->words[y].tgt);
+			}
+		}
+	}
+	index_exports(state, idx);
+	return idx;
+}
+
+// is a target name already satisfied (same rules as find_target)
+static int name_defined(struct compiler_state *state, char *name)
+{
+	uint16_t d;
+	return symtab_find(state, &state->labels, name, strlen(name)) ||
+	       symtab_find(state, &state->symbols, name, strlen(name)) ||
+	       sscanf(name, "%"SCNx16, &d) == 1;
+}
+
+// link in the library files needed for the missing symbols and everything they need in
+// turn.  Names are processed first come first served (the missing symbols in address order
+// then the imports of each file as it is compiled) which is the same order repeatedly
+// resolving and linking the lowest missing symbol would give.  Returns -1 and points
+// missing_symbol at the culprit if a name can't be found in the library.
+int link(struct compiler_state *state, char *libdir, char **missing_symbol)
+{
+	char **queue = NULL;
+	int head, n = 0, max = 0, x;
+	struct symbol *sym;
+	struct lib_file *lf;
+
+	if (!state->libidx) {
+		state->libidx = build_lib_index(state, libdir);
+	}
+	for (x = 0; x < state->nmissing; x++) {
+		add_name(state, &queue, &n, &max, state->missing[x]);
+	}
+	for (head = 0; head < n; head++) {
+		if (name_defined(state, queue[head])) {
+			continue;
+		}
+		sym = symtab_find(state, &state->libidx->exports, queue[head], strlen(queue[head]));
+		if (!sym || state->libidx->files[sym->value].linked) {
+			*missing_symbol = queue[head];
+			free(queue);
+			return -1;
+		}
+		lf = &state->libidx->files[sym->value];
+		lf->linked = 1;
+		++(state->stats.link_files);
+		if (lf->obj) {
+			place_object(state, lf->obj);
+		} else {
+			compile_file(state, lf->path);
+		}
+		for (x = 0; x < lf->nimports; x++) {
+			add_name(state, &queue, &n, &max, lf->imports[x]);
+		}
+	}
+	free(queue);
+	return 0;
+}
+
+// image word at a word address, anything outside the 64KB space reads as zero
+static uint16_t image_word(struct compiler_state *state, int x)
+{
+	return (x >= 0 && x < MAX_PROG_SIZE) ? state->image[x] : 0;
 }
 
 void emit_hexfile(struct compiler_state *state, char *fname)
@@ -771,8 +1770,8 @@ void emit_hexfile(struct compiler_state *state, char *fname)
 	
 	fprintf(f, "#File_format=Hex\n#Address_depth=%d\n#Data_width=16\n", state->prog_size);
 	for (x = state->bin_start; x < state->bin_start + state->prog_size; x++) {
-		fprintf(f, "%02X", (state->program[x].opcode>>8)&0xFF);
-		fprintf(f, "%02X\n", (state->program[x].opcode)&0xFF);
+		fprintf(f, "%02X", (image_word(state, x)>>8)&0xFF);
+		fprintf(f, "%02X\n", (image_word(state, x))&0xFF);
 	}
 	fclose(f);
 }
@@ -788,10 +1787,10 @@ void emit_monfile(struct compiler_state *state, char *fname)
 	}
 	
 	for (x = state->bin_start; x < state->bin_start + state->prog_size; x++) {
-		if (state->program[x].line_number != -1) {
+		if (word_at(state, x)) {
 			fprintf(f, "E%04X %02X %02X\n", x*2, 
-				state->program[x].opcode>>8,
-				state->program[x].opcode&0xFF); // x is the word address so double to get byte addr
+				state->image[x]>>8,
+				state->image[x]&0xFF); // x is the word address so double to get byte addr
 		}
 	}
 	fclose(f);
@@ -809,8 +1808,8 @@ void emit_binfile(struct compiler_state *state, char *fname)
 	}
 
 	for (x = state->bin_start; x < state->bin_start + state->prog_size; x++) {
-		fputc(state->program[x].opcode&0xFF, f);
-		fputc((state->program[x].opcode>>8)&0xFF, f);
+		fputc(image_word(state, x)&0xFF, f);
+		fputc((image_word(state, x)>>8)&0xFF, f);
 	}
 	fclose(f);
 }
@@ -826,9 +1825,9 @@ void emit_romfile(struct compiler_state *state, char *fname)
 	}
 
 	for (z = x = 0; z < state->prog_size && x < MAX_PROG_SIZE; x++) {
-		if (state->program[x].line_number != -1) {
+		if (word_at(state, x)) {
 			++z;
-			fprintf(f, "8'h%02x: ib16_bus_data_out_reg <= 16'h%02x%02x;\n", (x*2)&0xFF, state->program[x].opcode>>8, state->program[x].opcode&0xFF);
+			fprintf(f, "8'h%02x: ib16_bus_data_out_reg <= 16'h%02x%02x;\n", (x*2)&0xFF, state->image[x]>>8, state->image[x]&0xFF);
 		}
 	}
 	fclose(f);
@@ -838,7 +1837,9 @@ void emit_lstfile(struct compiler_state *state, char *fname)
 {
 	FILE *f;
 	int x, y, z;
-	char linebuf[512];
+	char linebuf[32];
+	char **labels;
+	struct word *w;
 	
 	f = fopen(fname, "w");
 	if (!f) {
@@ -846,15 +1847,25 @@ void emit_lstfile(struct compiler_state *state, char *fname)
 		exit(-1);
 	}
 
+	// map word addresses to labels, the last label placed at an address is the one listed
+	labels = calloc(MAX_PROG_SIZE, sizeof *labels);
+	if (!labels) {
+		fprintf(stderr, "Out of memory for listing\n");
+		exit(-1);
+	}
+	for (x = 0; x < state->labels.nsyms; x++) {
+		labels[state->labels.syms[x].value] = state->labels.syms[x].label;
+	}
+
 	for (z = x = 0; z < state->prog_size && x < MAX_PROG_SIZE; x++) {
-		if (state->program[x].line_number != -1) {
+		if ((w = word_at(state, x))) {
 			++z;
-			if (state->program[x].label[0]) {
-				fprintf(f, "[%-15s ", state->program[x].label);
+			if (labels[x] && labels[x][0]) {
+				fprintf(f, "[%-15s ", labels[x]);
 			} else {
 				fprintf(f, "[%16s", "");
 			}
-			strcpy(linebuf, state->program[x].line);
+			strncpy(linebuf, w->line, 20);
 			linebuf[20] = 0;
 			for (y = 0; linebuf[y]; y++) {
 				if (linebuf[y] == '\r' || linebuf[y] == '\n') {
@@ -865,28 +1876,83 @@ void emit_lstfile(struct compiler_state *state, char *fname)
 					linebuf[y] = ' ';
 				}
 			}
-			fprintf(f, "0x%04X]: 0x%04X ; %-20s (%s:%d)\n", x*2, state->program[x].opcode, linebuf, state->program[x].fname, state->program[x].line_number);
+			fprintf(f, "0x%04X]: 0x%04X ; %-20s (%s:%d)\n", x*2, state->image[x], linebuf, w->fname, w->line_number);
 		}
 	}
+	free(labels);
 	fclose(f);
 }
 
-int main(int argc, char **argv)
+// monotonic time in milliseconds for --stats
+static double time_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+void print_stats(struct compiler_state *state)
+{
+	unsigned long lookups = state->stats.sym_lookups + state->stats.label_lookups;
+	printf("Assemble: %8.3f ms\n", state->stats.t_assemble);
+	printf("Link:     %8.3f ms (%lu resolve passes, %lu library files)\n", state->stats.t_link, state->stats.resolve_passes, state->stats.link_files);
+	if (state->libidx) {
+		printf("Library:  %d files indexed (%lu scanned, %lu from cache)\n", state->libidx->nfiles, state->stats.index_scanned, state->stats.index_cached);
+	}
+	printf("Emit:     %8.3f ms\n", state->stats.t_emit);
+	printf("Lookups:  %lu symbol, %lu label, %lu probes (%.2f probes/lookup)\n",
+		state->stats.sym_lookups, state->stats.label_lookups, state->stats.probes,
+		lookups ? (double)state->stats.probes / lookups : 0.0);
+	printf("Symbols:  %d symbols, %d labels\n", state->symbols.nsyms, state->labels.nsyms);
+}
+
+// does a file name end in ext
+static int has_ext(char *fname, char *ext)
+{
+	int n = strlen(fname), m = strlen(ext);
+	return n > m && !strcmp(fname + n - m, ext);
+}
+
+// a fresh compiler state with the --define's applied
+static struct compiler_state *new_state(int argc, char **argv)
 {
-	int i;
 	struct compiler_state *state;
-	char *libdir = "lib/";
-	char *missing_symbol = NULL;
-	
+	int i;
+
 	state = calloc(1, sizeof *state);
+	if (!state) {
+		fprintf(stderr, "Out of memory for compiler state\n");
+		exit(-1);
+	}
 	state->prog_size    = 4096;				// default to 8KB programs
 	state->line_number  = 1;
-	
-	for (i = 0; i < MAX_PROG_SIZE; i++) {
-		state->program[i].opcode = 0x0000;
-		state->program[i].line_number = -1;
-	}
 	state->reg_idx = 1;
+	state->relocs_sorted = 1;
+	for (i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--define")) {
+			if (i + 2 < argc) {
+				char line[512];
+				sprintf(line, "%s %s", argv[i+1], argv[i+2]);
+				insert_symbol(state, line, 0);
+				i += 2;
+			} else {
+				fprintf(stderr, "--define requires two parameters\n");
+				exit(-1);
+			}
+		}
+	}
+	return state;
+}
+
+int main(int argc, char **argv)
+{
+	int i, x, y, stats = 0, objmode = 0, archives = 0, nsrc = 0;
+	double t;
+	struct compiler_state *state;
+	struct object *o;
+	char *libdir = "lib/";
+	char *outname = NULL, *arname = NULL, oname[512];
+	char *missing_symbol = NULL;
 	
 	// options pass
 	for (i = 0; i < argc; i++) {
@@ -898,48 +1964,113 @@ int main(int argc, char **argv)
 				fprintf(stderr, "--lib requires a parameter\n");
 				exit(-1);
 			}
-		} else if (!strcmp(argv[i], "--define")) {
-			if (i + 2 < argc) {
-				char line[512];
-				sprintf(line, "%s %s", argv[i+1], argv[i+2]);
-				insert_symbol(state, line, 0);
-				i += 2;
+		} else if (!strcmp(argv[i], "-o") || !strcmp(argv[i], "--ar")) {
+			if (i + 1 < argc) {
+				*(argv[i][1] == 'o' ? &outname : &arname) = argv[i+1];
+				++i;
 			} else {
-				fprintf(stderr, "--define requires two parameters\n");
+				fprintf(stderr, "%s requires a parameter\n", argv[i]);
 				exit(-1);
 			}
+		} else if (!strcmp(argv[i], "-c")) {
+			objmode = 1;
+		} else if (!strcmp(argv[i], "--stats")) {
+			stats = 1;
+		} else if (has_ext(argv[i], ".s")) {
+			++nsrc;
 		}
 	}
-	
-	// assemble files pass
-	for (i = 0; i < argc; i++) {
-		char *s = strstr(argv[i], ".s");
-		if (s && s[2] == 0) { 
+
+	if (arname) {
+		emit_arfile(arname, argc, argv);
+		return 0;
+	}
+
+	if (objmode) {
+		// assemble every source file on its own into an object
+		if (outname && nsrc > 1) {
+			fprintf(stderr, "-o needs a single source file\n");
+			exit(-1);
+		}
+		for (i = 1; i < argc; i++) {
+			if (!has_ext(argv[i], ".s") || argv[i] == outname) {
+				continue;
+			}
+			state = new_state(argc, argv);
+			state->objmode = 1;
+			state->obj.path = argv[i];
+			start_section(state, SEC_ALIGN, 1, NULL, 0);
+			t = time_ms();
+			compile_file(state, argv[i]);
+			state->stats.t_assemble = time_ms() - t;
+			if (!outname) {
+				snprintf(oname, sizeof oname, "%s.o", argv[i]);
+			}
+			emit_objfile(state, outname ? outname : oname);
+			printf("Assembled %d words into %s\n", state->nwords, outname ? outname : oname);
+			if (stats) {
+				print_stats(state);
+			}
+		}
+		return 0;
+	}
+
+	state = new_state(argc, argv);
+
+	// read the objects and archives up front so .INC sections can find their objects in any order
+	for (i = 1; i < argc; i++) {
+		if (has_ext(argv[i], ".o")) {
+			load_objects(state, argv[i], 0);
+		} else if (has_ext(argv[i], ".a")) {
+			load_objects(state, argv[i], 1);
+			archives = 1;
+		}
+	}
+	for (x = 0; x < state->nobjects; x++) {
+		for (y = 0; y < state->objects[x]->nsections; y++) {
+			if (state->objects[x]->sections[y].kind == SEC_INC && (o = find_object(state, state->objects[x]->sections[y].path))) {
+				o->included = 1;
+			}
+		}
+	}
+
+	// assemble files pass, objects are placed where their source would have been compiled
+	t = time_ms();
+	for (i = 1; i < argc; i++) {
+		if (has_ext(argv[i], ".s")) {
 			// .s file so compile it
 			compile_file(state, argv[i]);
+		} else if (has_ext(argv[i], ".o")) {
+			for (x = 0; x < state->nobjects; x++) {
+				o = state->objects[x];
+				if (!o->member && !o->included && !o->placed && !strcmp(o->fname, argv[i])) {
+					place_object(state, o);
+					break;
+				}
+			}
 		}
 	}
+	if (archives) {
+		state->libidx = build_archive_index(state);
+	}
 	
+	state->stats.t_assemble = time_ms() - t;
+
 	// linking pass
+	t = time_ms();
 	missing_symbol = NULL;
-	while (resolve_labels(state, &missing_symbol) != 0) {
-		if (link(state, libdir, missing_symbol) < 0) {
+	while (resolve_labels(state)) {
+		if (link(state, libdir, &missing_symbol) < 0) {
 			fprintf(stderr, "Could not link in symbol '%s'\n", missing_symbol);
 			exit(-1);
 		}
 	}
+	state->stats.t_link = time_ms() - t;
 	
 	// determine memory usage
-	{
-		int y = 0;
-		for (i = 0; i < MAX_PROG_SIZE; i++) {
-			if (state->program[i].line_number != -1) {
-				++y;
-			}
-		}
-		printf("Used %d (%d %%) of %d words.\n", y, (y * 100) / state->prog_size, state->prog_size);
-	}
+	printf("Used %d (%d %%) of %d words.\n", state->nwords, (state->nwords * 100) / state->prog_size, state->prog_size);
 
+	t = time_ms();
 	for (i = 0; i < argc; i++) {
 		if (!strcmp(argv[i], "--hex")) {
 			if (i + 1 < argc) {
@@ -983,5 +2114,10 @@ int main(int argc, char **argv)
 			}
 		}
 	}
+	state->stats.t_emit = time_ms() - t;
+
+	if (stats) {
+		print_stats(state);
+	}
 	return 0;
 }
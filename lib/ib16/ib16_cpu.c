@@ -0,0 +1,1028 @@
+/* IttyBitty (ib16) machine model, see ib16_cpu.h */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include "ib16_cpu.h"
+
+const char *ib16_opcode_names[16] = {
+	"LDI", "ADD", "ADC", "XOR", "AND", "OR", "CMP", "SHF",
+	"AJMP", "LDM", "STM", "LCALL", "RET", "JMP", "SRES", "RETI"
+};
+
+const char *ib16_stop_names[] = {
+	"running", "limit reached", "halted", "UART RX empty", "bus hang", "reboot to missing ROM"
+};
+
+// bus latency in cycles from the CPU raising bus_enable to it seeing bus_ready
+// (ib16.sv: main memory is a 2 cycle BRAM, registers/ROM are answered on the
+// next edge, the text buffer latches the address first)
+#define LAT_RAM		3
+#define LAT_TEXT	4
+#define LAT_TEXT16	5
+#define LAT_REG		2
+#define LAT_UART_TX	3
+#define LAT_UART_RX	4
+
+// threaded engine handlers, the ALU/CMP/SHF/JMP variants are split at decode time
+enum {
+	UOP_DECODE = 0, UOP_WRAP, UOP_INTERP,
+	UOP_LDI, UOP_ADD, UOP_ADC, UOP_XOR, UOP_AND, UOP_OR,
+	UOP_CMPLT, UOP_CMPEQ, UOP_CMPGT, UOP_CMPNONE,
+	UOP_SHR, UOP_SAR, UOP_ROR, UOP_ROL, UOP_SWAP, UOP_INC, UOP_DEC, UOP_NOT, UOP_NEG,
+	UOP_SCC, UOP_SNZ, UOP_ROLB, UOP_RORB, UOP_SHFNONE,
+	UOP_AJMP, UOP_AJMPR, UOP_LDM, UOP_POP, UOP_STM, UOP_PUSH, UOP_LCALL, UOP_RET,
+	UOP_JMP, UOP_JC, UOP_JNC, UOP_JZ, UOP_JNZ, UOP_JNEVER, UOP_HALT,
+	UOP_SRES, UOP_RETI, UOP_MAX
+};
+
+void ib16_default_config(struct ib16_config *cfg)
+{
+	memset(cfg, 0, sizeof *cfg);
+	cfg->freq_mhz      = IB16_FREQ_MHZ;
+	cfg->blocks        = IB16_BLOCKS;
+	cfg->stack_pwidth  = IB16_STACK_PWIDTH;
+	cfg->boot_rom_addr = IB16_BOOT_ROM_ADDR;
+	cfg->two_cycle     = 1;
+	cfg->baud          = IB16_BAUD;
+	// stack_address/irq_vector of 0 are derived from the RAM size like ib16.sv does
+}
+
+static void ib16_schedule(struct ib16_cpu *m)
+{
+	uint64_t n;
+
+	n = m->limit;
+	if (m->next_tick < n) {
+		n = m->next_tick;
+	}
+	if (m->next_vsync < n) {
+		n = m->next_vsync;
+	}
+	if (m->rx_edge && m->rx_arrive < n) {
+		n = m->rx_arrive;
+	}
+	if (m->tx_edge && m->tx_done_at - m->cycles_per_byte < n) {
+		n = m->tx_done_at - m->cycles_per_byte;
+	}
+	m->next_event = n;
+}
+
+// the SoC sets a pending bit to the matching enable bit on each event
+static inline void ib16_pend(struct ib16_cpu *m, int irq)
+{
+	m->int_pending = (m->int_pending & ~(1 << irq)) | (m->int_enable & (1 << irq));
+}
+
+static void ib16_events(struct ib16_cpu *m)
+{
+	uint64_t t = m->cycles;
+
+	while (m->next_tick <= t) {
+		ib16_pend(m, IB16_IRQ_TIMER);
+		++(m->ticks);
+		m->next_tick += m->cycles_per_tick;
+	}
+	while (m->next_vsync <= t) {
+		ib16_pend(m, IB16_IRQ_VSYNC);
+		m->next_vsync += m->cycles_per_frame;
+	}
+	if (m->rx_edge && m->rx_arrive <= t) {
+		ib16_pend(m, IB16_IRQ_UART_RX_READY);
+		m->rx_edge = 0;
+	}
+	if (m->tx_edge && m->tx_done_at - m->cycles_per_byte <= t) {
+		ib16_pend(m, IB16_IRQ_UART_TX_EMPTY);
+		m->tx_edge = 0;
+	}
+	if (t >= m->limit) {
+		m->stop = IB16_LIMIT;
+	}
+	ib16_schedule(m);
+}
+
+void ib16_init(struct ib16_cpu *m, const struct ib16_config *cfg)
+{
+	int x;
+
+	memset(m, 0, sizeof *m);
+	m->cfg = *cfg;
+	if (m->cfg.blocks < 1 || m->cfg.blocks > IB16_TEXT_MEM_BOT / 0x800) {
+		fprintf(stderr, "BLOCKS must be between 1 and %d\n", IB16_TEXT_MEM_BOT / 0x800);
+		exit(-1);
+	}
+	m->ram_top = m->cfg.blocks * 0x800;
+	m->sp_mask = (1 << m->cfg.stack_pwidth) - 1;
+	if (!m->cfg.stack_address) {
+		m->cfg.stack_address = m->ram_top - (1 << m->cfg.stack_pwidth);
+	}
+	if (!m->cfg.irq_vector) {
+		m->cfg.irq_vector = m->cfg.stack_address - 256;
+	}
+
+	// code can only be fetched from RAM, the text buffer or the ROM
+	for (x = 0; x < 256; x++) {
+		if (x * 256 < m->ram_top) {
+			m->fetch_lat[x] = LAT_RAM;
+		} else if (x * 256 >= IB16_TEXT_MEM_BOT && x * 256 <= IB16_TEXT_MEM_TOP) {
+			m->fetch_lat[x] = LAT_TEXT16;
+		} else if (x * 256 == IB16_ROM_MEM_BOT) {
+			m->fetch_lat[x] = LAT_REG;
+		}
+	}
+
+	m->uops[32768].op = UOP_WRAP;
+	m->odd_uop.op = UOP_INTERP;
+	m->limit = UINT64_MAX;
+	m->cycles_per_tick  = (uint64_t)m->cfg.freq_mhz * 1000;
+	m->cycles_per_byte  = (uint64_t)m->cfg.freq_mhz * 1000000 / m->cfg.baud * 10;
+	m->cycles_per_frame = (uint64_t)m->cfg.freq_mhz * 1000000 * (800 * 525) / 25175000;	// 640x480@60
+	ib16_reset(m);
+}
+
+void ib16_reset(struct ib16_cpu *m)
+{
+	memset(m->r, 0, sizeof m->r);
+	m->pc = m->cfg.boot_rom_addr;
+	m->irq_pc = 0;
+	m->sp = 0;
+	m->sreg = m->irq_sreg = 0;
+	m->ri = m->wi = m->irq_ri = m->irq_wi = 0;
+	m->mask_irq = 1;
+
+	m->int_pending = m->int_enable = 0;
+	m->gpio[0] = m->gpio[1] = 0xFF;
+	m->lrg_mode = 0;
+	m->ticks = 0;
+	m->next_tick = m->cycles + m->cycles_per_tick;
+	m->next_vsync = m->cycles + m->cycles_per_frame;
+	m->tx_edge = 0;
+	ib16_schedule(m);
+}
+
+// the state the boot ROM leaves behind after SRES 8
+void ib16_boot_app(struct ib16_cpu *m, uint16_t pc)
+{
+	m->pc = pc;
+	m->sp = 0;
+	m->sreg = 0;
+	m->mask_irq = 0;
+	m->r[0] = 0;
+}
+
+// the first byte finishes arriving delay cycles from now
+void ib16_set_rx(struct ib16_cpu *m, const uint8_t *data, size_t len, uint64_t delay)
+{
+	m->rx = data;
+	m->rx_len = len;
+	m->rx_pos = 0;
+	m->rx_head = m->rx_count = 0;
+	m->rx_dropped = 0;
+	m->rx_arrive = m->cycles + delay + m->cycles_per_byte;
+	m->rx_edge = len > 0;
+	ib16_schedule(m);
+}
+
+// forget the predecoded copy of anything written behind the simulator's back
+void ib16_invalidate(struct ib16_cpu *m, uint16_t addr, int len)
+{
+	int x;
+
+	for (x = addr >> 1; x <= (addr + len) >> 1 && x < 32768; x++) {
+		m->uops[x].op = UOP_DECODE;
+	}
+}
+
+// load a --bin (raw little endian) or --hex (ib16_as hex words) image at addr
+int ib16_load_image(struct ib16_cpu *m, const char *fname, int hex, uint16_t addr)
+{
+	FILE *f;
+	char line[256];
+	int n, a, w;
+
+	f = fopen(fname, hex ? "r" : "rb");
+	if (!f) {
+		fprintf(stderr, "Could not open image file '%s'\n", fname);
+		exit(-1);
+	}
+	a = addr;
+	if (!hex) {
+		n = fread(m->mem + a, 1, 65536 - a, f);
+		a += n;
+	} else {
+		while (fgets(line, sizeof line, f)) {
+			if (line[0] == '#' || !isxdigit((unsigned char)line[0])) {
+				continue;
+			}
+			if (a + 1 >= 65536) {
+				fprintf(stderr, "Image '%s' does not fit at %04x\n", fname, addr);
+				exit(-1);
+			}
+			sscanf(line, "%x", &w);
+			m->mem[a++] = w & 0xFF;
+			m->mem[a++] = (w >> 8) & 0xFF;
+		}
+	}
+	fclose(f);
+	ib16_invalidate(m, addr, a - addr);
+	if (addr <= IB16_ROM_MEM_TOP && a > IB16_ROM_MEM_BOT) {
+		m->rom_loaded = 1;
+	}
+	return a - addr;
+}
+
+// move whatever came down the wire by cycle t into the RX FIFO
+static void ib16_rx_fill(struct ib16_cpu *m, uint64_t t)
+{
+	while (m->rx_pos < m->rx_len && m->rx_arrive <= t) {
+		if (m->rx_count < IB16_UART_FIFO_DEPTH) {
+			m->rx_fifo[(m->rx_head + m->rx_count++) % IB16_UART_FIFO_DEPTH] = m->rx[m->rx_pos];
+		} else {
+			++(m->rx_dropped);
+		}
+		++(m->rx_pos);
+		m->rx_arrive += m->cycles_per_byte;
+	}
+}
+
+// slow path for anything outside main memory, t is the cycle the access is
+// issued on, returns the latency or 0 if the bus would hang
+static unsigned ib16_io_read(struct ib16_cpu *m, uint16_t addr, uint64_t t, uint8_t *v)
+{
+	uint64_t wait;
+
+	switch (addr) {
+		case IB16_VIDEO_FLAG_ADDR: *v = m->lrg_mode; return LAT_REG;
+		case IB16_TIMER_ADDR: *v = m->ticks + (t >= m->next_tick); return LAT_REG;		// the tick may land mid instruction
+		case IB16_GPIO1_ADDR: *v = m->gpio[1]; return LAT_REG;			// open drain, nothing else drives the pins
+		case IB16_GPIO0_ADDR: *v = m->gpio[0]; return LAT_REG;
+		case IB16_INT_ADDR: *v = m->int_pending; return LAT_REG;
+		case IB16_INTEN_ADDR: *v = m->int_enable; return LAT_REG;
+		case IB16_UART_STS_ADDR:
+			*v = 0;
+			if (t + m->cycles_per_byte >= m->tx_done_at) {
+				*v |= 4;												// tx fifo empty
+			}
+			if (m->tx_done_at > t + IB16_UART_FIFO_DEPTH * m->cycles_per_byte) {
+				*v |= 2;												// tx fifo full
+			}
+			ib16_rx_fill(m, t);
+			if (m->rx_count) {
+				*v |= 1;												// rx ready
+			}
+			return LAT_REG;
+		case IB16_UART_ADDR:
+			// blocking read, if the FIFO is empty wait for the next byte to come down the wire
+			ib16_rx_fill(m, t);
+			wait = 0;
+			if (!m->rx_count) {
+				if (m->rx_pos >= m->rx_len) {
+					m->stop = IB16_RX_EMPTY;
+					m->stop_addr = addr;
+					return 0;
+				}
+				wait = m->rx_arrive - t;
+				ib16_rx_fill(m, m->rx_arrive);
+			}
+			m->stall_cycles += wait;
+			*v = m->rx_fifo[m->rx_head];
+			m->rx_head = (m->rx_head + 1) % IB16_UART_FIFO_DEPTH;
+			--(m->rx_count);
+			// ready only rises again if the FIFO ran dry
+			m->rx_edge = !m->rx_count && m->rx_pos < m->rx_len;
+			ib16_schedule(m);
+			return LAT_UART_RX + wait;
+	}
+	if (addr >= IB16_TEXT_MEM_BOT && addr <= IB16_TEXT_MEM_TOP) {
+		*v = m->mem[addr];
+		return LAT_TEXT;
+	}
+	if (addr >= IB16_ROM_MEM_BOT && addr <= IB16_ROM_MEM_TOP) {
+		*v = m->mem[addr];
+		return LAT_REG;
+	}
+	m->stop = IB16_BUS_HANG;
+	m->stop_addr = addr;
+	return 0;
+}
+
+static unsigned ib16_io_write(struct ib16_cpu *m, uint16_t addr, uint64_t t, uint8_t v)
+{
+	uint64_t wait;
+
+	switch (addr) {
+		case IB16_VIDEO_FLAG_ADDR: m->lrg_mode = v & 1; return LAT_REG;
+		case IB16_TIMER_ADDR:
+			// any write restarts the tick counter
+			m->ticks = 0;
+			m->next_tick = t + m->cycles_per_tick;
+			ib16_schedule(m);
+			return LAT_REG;
+		case IB16_GPIO1_ADDR: m->gpio[1] = v; return LAT_REG;
+		case IB16_GPIO0_ADDR: m->gpio[0] = v; return LAT_REG;
+		case IB16_INT_ADDR: m->int_pending &= ~v; return LAT_REG;
+		case IB16_INTEN_ADDR: m->int_enable = v; return LAT_REG;
+		case IB16_UART_STS_ADDR:
+			// baud divisor, 0 puts back the default, what already arrived came in at the old rate
+			ib16_rx_fill(m, t);
+			m->cycles_per_byte = v ? (uint64_t)v * 10 : (uint64_t)m->cfg.freq_mhz * 1000000 / m->cfg.baud * 10;
+			return LAT_REG;
+		case IB16_UART_ADDR:
+			// wait for a FIFO slot, tx_done_at is when the last queued byte leaves the shifter
+			wait = 0;
+			if (m->tx_done_at > t + IB16_UART_FIFO_DEPTH * m->cycles_per_byte) {
+				wait = m->tx_done_at - IB16_UART_FIFO_DEPTH * m->cycles_per_byte - t;
+			}
+			m->stall_cycles += wait;
+			t += wait;
+			m->tx_done_at = (m->tx_done_at > t ? m->tx_done_at : t) + m->cycles_per_byte;
+			m->tx_edge = 1;
+			ib16_schedule(m);
+			if (m->tx_skip > 0) {
+				--(m->tx_skip);
+			} else if (m->tx) {
+				fputc(v, m->tx);
+			}
+			return LAT_UART_TX + wait;
+	}
+	if (addr >= IB16_TEXT_MEM_BOT && addr <= IB16_TEXT_MEM_TOP) {
+		m->mem[addr] = v;
+		m->uops[addr >> 1].op = UOP_DECODE;
+		return LAT_TEXT;
+	}
+	if (addr >= IB16_ROM_MEM_BOT && addr <= IB16_ROM_MEM_TOP) {
+		return LAT_REG;
+	}
+	m->stop = IB16_BUS_HANG;
+	m->stop_addr = addr;
+	return 0;
+}
+
+static inline unsigned ib16_read16(struct ib16_cpu *m, uint16_t addr, uint64_t t, uint16_t *v)
+{
+	uint8_t lo, hi;
+
+	if (addr + 1 < m->ram_top) {
+		*v = m->mem[addr] | (m->mem[addr + 1] << 8);
+		return LAT_RAM;
+	}
+	// a stack wrapping at the top of RAM straddles into the text buffer
+	if (addr < m->ram_top) {
+		lo = m->mem[addr];
+	} else if (!ib16_io_read(m, addr, t, &lo)) {
+		return 0;
+	}
+	if (!ib16_io_read(m, addr + 1, t, &hi)) {
+		return 0;
+	}
+	*v = lo | (hi << 8);
+	return LAT_TEXT16;
+}
+
+static inline unsigned ib16_write16(struct ib16_cpu *m, uint16_t addr, uint64_t t, uint16_t v)
+{
+	if (addr + 1 < m->ram_top) {
+		m->mem[addr] = v & 0xFF;
+		m->mem[addr + 1] = v >> 8;
+		m->uops[addr >> 1].op = UOP_DECODE;
+		m->uops[(addr + 1) >> 1].op = UOP_DECODE;
+		return LAT_RAM;
+	}
+	if (addr < m->ram_top) {
+		m->mem[addr] = v & 0xFF;
+		m->uops[addr >> 1].op = UOP_DECODE;
+	} else if (!ib16_io_write(m, addr, t, v & 0xFF)) {
+		return 0;
+	}
+	if (!ib16_io_write(m, addr + 1, t, v >> 8)) {
+		return 0;
+	}
+	return LAT_TEXT16;
+}
+
+// IRQs are taken in place of the next fetch so entry itself is free
+static inline void ib16_irq(struct ib16_cpu *m)
+{
+	m->irq_pc = m->pc;
+	m->irq_sreg = m->sreg;
+	m->irq_ri = m->ri;
+	m->irq_wi = m->wi;
+	m->mask_irq = 1;
+	m->pc = m->cfg.irq_vector;
+	++(m->irq_count);
+}
+
+// taken[condition][{carry, zero}] for JMP, JC, JNC, JZ, JNZ
+static const uint8_t jcc_taken[8][4] = {
+	{ 1, 1, 1, 1 }, { 0, 0, 1, 1 }, { 1, 1, 0, 0 }, { 0, 1, 0, 1 }, { 1, 0, 1, 0 }
+};
+
+// execute one instruction, returns m->stop
+//
+// cycles per instruction (fetch latency F, data latency D):
+//   ALU (LDI..SHF)        F + 1 (+1 with TWO_CYCLE)
+//   AJMP, SRES            F + 2
+//   JMP/Jcc, RETI         F + 1  (they start the next fetch themselves so no IRQ is taken after them)
+//   LDM, STM, LCALL, RET  F + D + 2
+static inline int ib16_exec(struct ib16_cpu *restrict m)
+{
+	uint16_t pc = m->pc, pc_at = m->pc, op, addr, w;
+	uint8_t *restrict rr = m->r + (m->mask_irq << 4);
+	unsigned isn, rd, ra, rb, res, lat, d, cyc, c;
+	int irq_ok = 1;
+	uint8_t v;
+
+	lat = m->fetch_lat[pc >> 8];
+	if (!lat) {
+		m->stop = IB16_BUS_HANG;
+		m->stop_addr = pc;
+		return m->stop;
+	}
+	op  = m->mem[pc] | (m->mem[(uint16_t)(pc + 1)] << 8);
+	isn = op >> 12;
+	rd  = (op >> 8) & 15;
+	ra  = rr[(op >> 4) & 15];
+	rb  = rr[op & 15];
+	pc += 2;
+
+	switch (isn) {
+		case IB16_LDI: res = op & 0xFF; goto alu;
+		case IB16_ADD: res = ra + rb; goto alu;
+		case IB16_ADC: res = ra + rb + (m->sreg >> 7); goto alu;
+		case IB16_XOR: res = ra ^ rb; goto alu;
+		case IB16_AND: res = ra & rb; goto alu;
+		case IB16_OR:  res = ra | rb; goto alu;
+		case IB16_CMP:
+			// only the carry changes
+			switch (rd) {
+				case 0: c = ra < rb; break;
+				case 1: c = ra == rb; break;
+				case 2: c = ra > rb; break;
+				default: c = 0; break;
+			}
+			m->sreg = (m->sreg & ~IB16_CARRY_FLAG) | (c ? IB16_CARRY_FLAG : 0);
+			cyc = lat + 1 + m->cfg.two_cycle;
+			break;
+		case IB16_SHF:
+			// res[8] is the new carry
+			switch ((op >> 4) & 15) {
+				case 0: res = rb >> 1; break;									// SHR
+				case 1: res = (rb >> 1) | (rb & 0x80); break;					// SAR
+				case 2: res = ((rb & 1) << 8) | (m->sreg & 0x80) | (rb >> 1); break;	// ROR
+				case 3: res = (rb << 1) | (m->sreg >> 7); break;				// ROL
+				case 4: res = ((rb << 4) | (rb >> 4)) & 0xFF; break;			// SWAP
+				case 5: res = rb + 1; break;									// INC
+				case 6: res = (rb - 1) & 0x1FF; break;							// DEC
+				case 7: res = ~rb & 0xFF; break;								// NOT
+				case 8: res = -rb & 0xFF; break;								// NEG
+				case 9: res = m->sreg >> 7; break;								// SCC
+				case 10: res = (m->sreg >> 6) & 1; break;						// SNZ
+				case 11: res = (rb << 1) | (rb >> 7); break;					// ROLB
+				case 12: res = ((rb & 1) << 8) | ((rb & 1) << 7) | (rb >> 1); break;	// RORB
+				default: res = 0; break;
+			}
+alu:
+			rr[rd] = res;
+			m->sreg = (m->sreg & 0x3F) | ((res >> 1) & IB16_CARRY_FLAG) | ((res & 0xFF) ? 0 : IB16_ZERO_FLAG);
+			cyc = lat + 1 + m->cfg.two_cycle;
+			break;
+		case IB16_AJMP:
+			pc = (ra << 8) | rb;
+			if (rd & 1) {
+				// AJMPR
+				m->sp = 0;
+				m->sreg = 0;
+			}
+			cyc = lat + 2;
+			break;
+		case IB16_LDM:
+			if ((op & 0xFF) == 0xFF) {
+				addr = m->cfg.stack_address + ((m->sp - 1) & m->sp_mask);		// pop
+			} else {
+				addr = ((ra << 8) | rb) + ((m->sreg & IB16_READ_INCR) ? m->ri : 0);
+			}
+			if (addr < m->ram_top) {
+				v = m->mem[addr];
+				d = LAT_RAM;
+			} else if (!(d = ib16_io_read(m, addr, m->cycles + lat + 1, &v))) {
+				return m->stop;
+			}
+			if ((op & 0xFF) == 0xFF) {
+				m->sp = (m->sp - 1) & m->sp_mask;
+			} else {
+				++(m->ri);
+			}
+			rr[rd] = v;
+			m->sreg = (m->sreg & 0x3F) | (v ? 0 : IB16_ZERO_FLAG);
+			cyc = lat + d + 2;
+			break;
+		case IB16_STM:
+			if ((op & 0xFF) == 0xFF) {
+				addr = m->cfg.stack_address + m->sp;							// push
+			} else {
+				addr = ((ra << 8) | rb) + ((m->sreg & IB16_WRITE_INCR) ? m->wi : 0);
+			}
+			if (addr < m->ram_top) {
+				m->mem[addr] = rr[rd];
+				m->uops[addr >> 1].op = UOP_DECODE;
+				d = LAT_RAM;
+			} else if (!(d = ib16_io_write(m, addr, m->cycles + lat + 1, rr[rd]))) {
+				return m->stop;
+			}
+			if ((op & 0xFF) == 0xFF) {
+				m->sp = (m->sp + 1) & m->sp_mask;
+			} else {
+				++(m->wi);
+			}
+			cyc = lat + d + 2;
+			break;
+		case IB16_LCALL:
+			if (!(d = ib16_write16(m, m->cfg.stack_address + m->sp, m->cycles + lat + 1, pc))) {
+				return m->stop;
+			}
+			m->sp = (m->sp + 2) & m->sp_mask;
+			pc = (op & 0xFFF) << 4;
+			cyc = lat + d + 2;
+			break;
+		case IB16_RET:
+			if (!(d = ib16_read16(m, m->cfg.stack_address + ((m->sp - 2) & m->sp_mask), m->cycles + lat + 1, &w))) {
+				return m->stop;
+			}
+			m->sp = (m->sp - 2) & m->sp_mask;
+			pc = w;
+			cyc = lat + d + 2;
+			break;
+		case IB16_JMP:
+			c = jcc_taken[(op >> 9) & 7][m->sreg >> 6];
+			if (c) {
+				pc += ((op & 0x100) ? (op | 0xFE00) : (op & 0x1FF)) << 1;
+			}
+			irq_ok = 0;
+			cyc = lat + 1;
+			if (op == 0xD1FF) {
+				// JMP to itself never checks for IRQs so this is the end of the program
+				m->stop = IB16_HALT;
+				m->stop_addr = m->pc;
+			}
+			break;
+		case IB16_SRES:
+			if (op & 0x18) {
+				// boot the app (bit 3) or the boot ROM (bit 4)
+				if (!(op & 8) && !m->rom_loaded) {
+					m->stop = IB16_REBOOT;
+					m->stop_addr = m->pc;
+					return m->stop;
+				}
+				m->sreg = 0;
+				m->sp = 0;
+				pc = (op & 8) ? 0 : m->cfg.boot_rom_addr;
+				m->mask_irq = !(op & 8);
+			} else {
+				m->sreg = (m->sreg & 0xC0 & ~op) | (op & 0x3F);
+				m->ri = m->wi = 0;
+				m->mask_irq = (op >> 2) & 1;
+			}
+			cyc = lat + 2;
+			break;
+		default:
+			// RETI
+			m->mask_irq = 0;
+			pc = m->irq_pc;
+			m->sreg = m->irq_sreg;
+			m->ri = m->irq_ri;
+			m->wi = m->irq_wi;
+			irq_ok = 0;
+			cyc = lat + 1;
+			break;
+	}
+
+	m->pc = pc;
+	m->cycles += cyc;
+	++(m->insns);
+	++(m->class_count[isn]);
+	m->class_cycles[isn] += cyc;
+	if (m->cycles >= m->next_event) {
+		ib16_events(m);
+	}
+	if (irq_ok && m->int_pending && !m->mask_irq) {
+		ib16_irq(m);
+	}
+	if (m->hook) {
+		m->hook(m, pc_at, isn, cyc);
+	}
+	return m->stop;
+}
+
+int ib16_step(struct ib16_cpu *m)
+{
+	m->stop = IB16_RUNNING;
+	return ib16_exec(m);
+}
+
+int ib16_run(struct ib16_cpu *m, uint64_t max_insns, uint64_t max_cycles)
+{
+	// the cycle budget rides along with the IRQ sources so the loop only has one compare
+	if (!max_insns) {
+		return m->stop = IB16_LIMIT;
+	}
+	m->stop = IB16_RUNNING;
+	m->limit = max_cycles;
+	ib16_schedule(m);
+	while (!ib16_exec(m)) {
+		if (!--max_insns) {
+			m->stop = IB16_LIMIT;
+			break;
+		}
+	}
+	m->limit = UINT64_MAX;
+	ib16_schedule(m);
+	return m->stop;
+}
+
+// threaded engine: each word is decoded once into m->uops[] and handlers
+// jump straight to the next one with computed gotos.  Decoding runs to the
+// end of the basic block (JMP/Jcc/LCALL/RET/AJMP/SRES/RETI), every store
+// resets the uop of the word it hits so uploaded or patched code is decoded
+// again the next time it runs.
+
+static inline struct ib16_uop *ib16_uop_at(struct ib16_cpu *m, uint16_t pc)
+{
+	if (pc & 1) {
+		m->odd_pc = pc;
+		return &m->odd_uop;
+	}
+	return &m->uops[pc >> 1];
+}
+
+static inline uint16_t ib16_uop_pc(struct ib16_cpu *m, struct ib16_uop *u)
+{
+	// the wrap entry past the end truncates to 0000
+	return u == &m->odd_uop ? m->odd_pc : (uint16_t)((u - m->uops) << 1);
+}
+
+// decode the block starting at pc, returns 0 if pc is unmapped
+static int ib16_decode(struct ib16_cpu *m, uint16_t pc)
+{
+	struct ib16_uop *u;
+	uint16_t op;
+	unsigned lat, isn, rd, n;
+	int end = 0;
+
+	lat = m->fetch_lat[pc >> 8];
+	if (!lat) {
+		return 0;
+	}
+	for (n = 0; !end && n < 128; n++) {
+		u = &m->uops[pc >> 1];
+		op = m->mem[pc] | (m->mem[pc + 1] << 8);
+		isn = op >> 12;
+		rd = (op >> 8) & 15;
+		u->isn = isn;
+		u->rd = rd;
+		u->ra = (op >> 4) & 15;
+		u->rb = op & 15;
+		u->lat = lat;
+		u->imm = op & 0xFF;
+		u->cyc = lat + 1 + m->cfg.two_cycle;
+		switch (isn) {
+			case IB16_LDI: u->op = UOP_LDI; break;
+			case IB16_ADD: u->op = UOP_ADD; break;
+			case IB16_ADC: u->op = UOP_ADC; break;
+			case IB16_XOR: u->op = UOP_XOR; break;
+			case IB16_AND: u->op = UOP_AND; break;
+			case IB16_OR:  u->op = UOP_OR; break;
+			case IB16_CMP: u->op = rd < 3 ? UOP_CMPLT + rd : UOP_CMPNONE; break;
+			case IB16_SHF: u->op = u->ra <= 12 ? UOP_SHR + u->ra : UOP_SHFNONE; break;
+			case IB16_AJMP:
+				u->op = (rd & 1) ? UOP_AJMPR : UOP_AJMP;
+				u->cyc = lat + 2;
+				end = 1;
+				break;
+			case IB16_LDM:
+				u->op = (op & 0xFF) == 0xFF ? UOP_POP : UOP_LDM;
+				u->cyc = lat + 2;
+				break;
+			case IB16_STM:
+				u->op = (op & 0xFF) == 0xFF ? UOP_PUSH : UOP_STM;
+				u->cyc = lat + 2;
+				break;
+			case IB16_LCALL:
+				u->op = UOP_LCALL;
+				u->imm = (op & 0xFFF) << 4;
+				u->cyc = lat + 2;
+				end = 1;
+				break;
+			case IB16_RET:
+				u->op = UOP_RET;
+				u->cyc = lat + 2;
+				end = 1;
+				break;
+			case IB16_JMP:
+				u->imm = pc + 2 + (((op & 0x100) ? (op | 0xFE00) : (op & 0x1FF)) << 1);
+				u->cyc = lat + 1;
+				switch ((op >> 9) & 7) {
+					case 0: u->op = op == 0xD1FF ? UOP_HALT : UOP_JMP; break;
+					case 1: u->op = UOP_JC; break;
+					case 2: u->op = UOP_JNC; break;
+					case 3: u->op = UOP_JZ; break;
+					case 4: u->op = UOP_JNZ; break;
+					default: u->op = UOP_JNEVER; break;
+				}
+				end = 1;
+				break;
+			case IB16_SRES:
+				u->op = UOP_SRES;
+				u->cyc = lat + 2;
+				end = 1;
+				break;
+			default:
+				u->op = UOP_RETI;
+				u->cyc = lat + 1;
+				end = 1;
+				break;
+		}
+		pc += 2;
+		// stop at the page end (the latency may change) or where we decoded before
+		if (!(pc & 0xFF) || m->uops[pc >> 1].op != UOP_DECODE) {
+			break;
+		}
+	}
+	return 1;
+}
+
+int ib16_run_threaded(struct ib16_cpu *m, uint64_t max_insns, uint64_t max_cycles)
+{
+	static void *dispatch[UOP_MAX] = {
+		[UOP_DECODE] = &&op_decode, [UOP_WRAP] = &&op_wrap, [UOP_INTERP] = &&op_interp,
+		[UOP_LDI] = &&op_ldi, [UOP_ADD] = &&op_add, [UOP_ADC] = &&op_adc, [UOP_XOR] = &&op_xor,
+		[UOP_AND] = &&op_and, [UOP_OR] = &&op_or,
+		[UOP_CMPLT] = &&op_cmplt, [UOP_CMPEQ] = &&op_cmpeq, [UOP_CMPGT] = &&op_cmpgt, [UOP_CMPNONE] = &&op_cmpnone,
+		[UOP_SHR] = &&op_shr, [UOP_SAR] = &&op_sar, [UOP_ROR] = &&op_ror, [UOP_ROL] = &&op_rol,
+		[UOP_SWAP] = &&op_swap, [UOP_INC] = &&op_inc, [UOP_DEC] = &&op_dec, [UOP_NOT] = &&op_not,
+		[UOP_NEG] = &&op_neg, [UOP_SCC] = &&op_scc, [UOP_SNZ] = &&op_snz, [UOP_ROLB] = &&op_rolb,
+		[UOP_RORB] = &&op_rorb, [UOP_SHFNONE] = &&op_shfnone,
+		[UOP_AJMP] = &&op_ajmp, [UOP_AJMPR] = &&op_ajmpr, [UOP_LDM] = &&op_ldm, [UOP_POP] = &&op_pop,
+		[UOP_STM] = &&op_stm, [UOP_PUSH] = &&op_push, [UOP_LCALL] = &&op_lcall, [UOP_RET] = &&op_ret,
+		[UOP_JMP] = &&op_jmp, [UOP_JC] = &&op_jc, [UOP_JNC] = &&op_jnc, [UOP_JZ] = &&op_jz,
+		[UOP_JNZ] = &&op_jnz, [UOP_JNEVER] = &&op_jnever, [UOP_HALT] = &&op_halt,
+		[UOP_SRES] = &&op_sres, [UOP_RETI] = &&op_reti,
+	};
+	struct ib16_uop *u;
+	uint8_t *mem = m->mem, *rr, v;
+	uint64_t cycles, insns, end_insns;
+	uint16_t addr, w;
+	unsigned res, c, d;
+	int irq_ok = 1;
+
+// retire the instruction in u and go to next, the event/IRQ/budget checks
+// share one branch and everything else is left to the slow path
+#define RETIRE(cost, next, irqok) do {											\
+		c = (cost);																\
+		cycles += c;															\
+		++insns;																\
+		++(m->class_count[u->isn]);												\
+		m->class_cycles[u->isn] += c;											\
+		u = (next);																\
+		irq_ok = (irqok);														\
+		if (cycles >= m->next_event || insns >= end_insns ||					\
+			(irq_ok && m->int_pending && !m->mask_irq)) {						\
+			goto slow;															\
+		}																		\
+		goto *dispatch[u->op];													\
+	} while (0)
+#define ALU(expr) do {															\
+		res = (expr);															\
+		rr[u->rd] = res;														\
+		m->sreg = (m->sreg & 0x3F) | ((res >> 1) & IB16_CARRY_FLAG) | ((res & 0xFF) ? 0 : IB16_ZERO_FLAG);	\
+		RETIRE(u->cyc, u + 1, 1);												\
+	} while (0)
+#define CMP(expr) do {															\
+		m->sreg = (m->sreg & ~IB16_CARRY_FLAG) | ((expr) ? IB16_CARRY_FLAG : 0);	\
+		RETIRE(u->cyc, u + 1, 1);												\
+	} while (0)
+#define JCC(cond) RETIRE(u->cyc, (cond) ? &m->uops[u->imm >> 1] : u + 1, 0)
+#define RA rr[u->ra]
+#define RB rr[u->rb]
+
+	if (m->hook) {
+		return ib16_run(m, max_insns, max_cycles);
+	}
+	if (!max_insns) {
+		return m->stop = IB16_LIMIT;
+	}
+	m->stop = IB16_RUNNING;
+	m->limit = max_cycles;
+	ib16_schedule(m);
+	cycles = m->cycles;
+	insns = m->insns;
+	end_insns = insns + max_insns < insns ? UINT64_MAX : insns + max_insns;
+	rr = m->r + (m->mask_irq << 4);
+	u = ib16_uop_at(m, m->pc);
+	goto *dispatch[u->op];
+
+op_decode:
+	if (!ib16_decode(m, ib16_uop_pc(m, u))) {
+		m->stop = IB16_BUS_HANG;
+		m->stop_addr = ib16_uop_pc(m, u);
+		goto stop;
+	}
+	goto *dispatch[u->op];
+op_wrap:
+	u = &m->uops[0];
+	goto *dispatch[u->op];
+op_interp:
+	// odd PC, let the switch interpreter take this one
+	m->cycles = cycles;
+	m->insns = insns;
+	m->pc = m->odd_pc;
+	ib16_exec(m);
+	cycles = m->cycles;
+	insns = m->insns;
+	rr = m->r + (m->mask_irq << 4);
+	u = ib16_uop_at(m, m->pc);
+	if (m->stop) {
+		goto out;
+	}
+	if (insns >= end_insns) {
+		m->stop = IB16_LIMIT;
+		goto out;
+	}
+	goto *dispatch[u->op];
+
+op_ldi:  ALU(u->imm);
+op_add:  ALU(RA + RB);
+op_adc:  ALU(RA + RB + (m->sreg >> 7));
+op_xor:  ALU(RA ^ RB);
+op_and:  ALU(RA & RB);
+op_or:   ALU(RA | RB);
+op_cmplt:   CMP(RA < RB);
+op_cmpeq:   CMP(RA == RB);
+op_cmpgt:   CMP(RA > RB);
+op_cmpnone: CMP(0);
+op_shr:  ALU(RB >> 1);
+op_sar:  ALU((RB >> 1) | (RB & 0x80));
+op_ror:  ALU(((RB & 1) << 8) | (m->sreg & 0x80) | (RB >> 1));
+op_rol:  ALU((RB << 1) | (m->sreg >> 7));
+op_swap: ALU(((RB << 4) | (RB >> 4)) & 0xFF);
+op_inc:  ALU(RB + 1);
+op_dec:  ALU((RB - 1) & 0x1FF);
+op_not:  ALU(~RB & 0xFF);
+op_neg:  ALU(-RB & 0xFF);
+op_scc:  ALU(m->sreg >> 7);
+op_snz:  ALU((m->sreg >> 6) & 1);
+op_rolb: ALU((RB << 1) | (RB >> 7));
+op_rorb: ALU(((RB & 1) << 8) | ((RB & 1) << 7) | (RB >> 1));
+op_shfnone: ALU(0);
+
+op_ajmp:
+	RETIRE(u->cyc, ib16_uop_at(m, (RA << 8) | RB), 1);
+op_ajmpr:
+	addr = (RA << 8) | RB;
+	m->sp = 0;
+	m->sreg = 0;
+	RETIRE(u->cyc, ib16_uop_at(m, addr), 1);
+op_ldm:
+	addr = ((RA << 8) | RB) + ((m->sreg & IB16_READ_INCR) ? m->ri : 0);
+	if (addr < m->ram_top) {
+		v = mem[addr];
+		d = LAT_RAM;
+	} else if (!(d = ib16_io_read(m, addr, cycles + u->lat + 1, &v))) {
+		goto stop;
+	}
+	++(m->ri);
+	rr[u->rd] = v;
+	m->sreg = (m->sreg & 0x3F) | (v ? 0 : IB16_ZERO_FLAG);
+	RETIRE(u->cyc + d, u + 1, 1);
+op_pop:
+	addr = m->cfg.stack_address + ((m->sp - 1) & m->sp_mask);
+	if (addr < m->ram_top) {
+		v = mem[addr];
+		d = LAT_RAM;
+	} else if (!(d = ib16_io_read(m, addr, cycles + u->lat + 1, &v))) {
+		goto stop;
+	}
+	m->sp = (m->sp - 1) & m->sp_mask;
+	rr[u->rd] = v;
+	m->sreg = (m->sreg & 0x3F) | (v ? 0 : IB16_ZERO_FLAG);
+	RETIRE(u->cyc + d, u + 1, 1);
+op_stm:
+	addr = ((RA << 8) | RB) + ((m->sreg & IB16_WRITE_INCR) ? m->wi : 0);
+	if (addr < m->ram_top) {
+		mem[addr] = rr[u->rd];
+		m->uops[addr >> 1].op = UOP_DECODE;
+		d = LAT_RAM;
+	} else if (!(d = ib16_io_write(m, addr, cycles + u->lat + 1, rr[u->rd]))) {
+		goto stop;
+	}
+	++(m->wi);
+	RETIRE(u->cyc + d, u + 1, 1);
+op_push:
+	addr = m->cfg.stack_address + m->sp;
+	if (addr < m->ram_top) {
+		mem[addr] = rr[u->rd];
+		m->uops[addr >> 1].op = UOP_DECODE;
+		d = LAT_RAM;
+	} else if (!(d = ib16_io_write(m, addr, cycles + u->lat + 1, rr[u->rd]))) {
+		goto stop;
+	}
+	m->sp = (m->sp + 1) & m->sp_mask;
+	RETIRE(u->cyc + d, u + 1, 1);
+op_lcall:
+	if (!(d = ib16_write16(m, m->cfg.stack_address + m->sp, cycles + u->lat + 1, ib16_uop_pc(m, u) + 2))) {
+		goto stop;
+	}
+	m->sp = (m->sp + 2) & m->sp_mask;
+	RETIRE(u->cyc + d, &m->uops[u->imm >> 1], 1);
+op_ret:
+	if (!(d = ib16_read16(m, m->cfg.stack_address + ((m->sp - 2) & m->sp_mask), cycles + u->lat + 1, &w))) {
+		goto stop;
+	}
+	m->sp = (m->sp - 2) & m->sp_mask;
+	RETIRE(u->cyc + d, ib16_uop_at(m, w), 1);
+
+op_jmp:    JCC(1);
+op_jc:     JCC(m->sreg & IB16_CARRY_FLAG);
+op_jnc:    JCC(!(m->sreg & IB16_CARRY_FLAG));
+op_jz:     JCC(m->sreg & IB16_ZERO_FLAG);
+op_jnz:    JCC(!(m->sreg & IB16_ZERO_FLAG));
+op_jnever: JCC(0);
+op_halt:
+	// JMP to itself, retire it and leave through the slow path
+	m->stop = IB16_HALT;
+	m->stop_addr = ib16_uop_pc(m, u);
+	c = u->cyc;
+	cycles += c;
+	++insns;
+	++(m->class_count[u->isn]);
+	m->class_cycles[u->isn] += c;
+	irq_ok = 0;
+	goto slow;
+
+op_sres:
+	if (u->imm & 0x18) {
+		// boot the app (bit 3) or the boot ROM (bit 4)
+		if (!(u->imm & 8) && !m->rom_loaded) {
+			m->stop = IB16_REBOOT;
+			m->stop_addr = ib16_uop_pc(m, u);
+			goto stop;
+		}
+		m->sreg = 0;
+		m->sp = 0;
+		m->mask_irq = !(u->imm & 8);
+		addr = (u->imm & 8) ? 0 : m->cfg.boot_rom_addr;
+	} else {
+		m->sreg = (m->sreg & 0xC0 & ~u->imm) | (u->imm & 0x3F);
+		m->ri = m->wi = 0;
+		m->mask_irq = (u->imm >> 2) & 1;
+		addr = ib16_uop_pc(m, u) + 2;
+	}
+	rr = m->r + (m->mask_irq << 4);
+	RETIRE(u->cyc, ib16_uop_at(m, addr), 1);
+op_reti:
+	m->mask_irq = 0;
+	m->sreg = m->irq_sreg;
+	m->ri = m->irq_ri;
+	m->wi = m->irq_wi;
+	rr = m->r;
+	RETIRE(u->cyc, ib16_uop_at(m, m->irq_pc), 0);
+
+slow:
+	// same order as ib16_exec(): events, then the IRQ, then the budget
+	m->cycles = cycles;
+	m->insns = insns;
+	m->pc = ib16_uop_pc(m, u);
+	if (cycles >= m->next_event) {
+		ib16_events(m);
+	}
+	if (irq_ok && m->int_pending && !m->mask_irq) {
+		ib16_irq(m);
+		rr = m->r + 16;
+		u = ib16_uop_at(m, m->pc);
+	}
+	if (m->stop) {
+		goto out;
+	}
+	if (insns >= end_insns) {
+		m->stop = IB16_LIMIT;
+		goto out;
+	}
+	goto *dispatch[u->op];
+
+stop:
+	// the instruction in u did not execute
+	m->cycles = cycles;
+	m->insns = insns;
+	m->pc = ib16_uop_pc(m, u);
+out:
+	m->limit = UINT64_MAX;
+	ib16_schedule(m);
+	return m->stop;
+
+#undef RETIRE
+#undef ALU
+#undef CMP
+#undef JCC
+#undef RA
+#undef RB
+}
@@ -0,0 +1,161 @@
+// IttyBitty (ib16) machine model used by the instruction set simulator
+//
+// Models the ib16_v2.v core (TWO_CYCLE=1) inside the ECP5 demo SoC
+// (icesugarpro/demos/ib16/ib16.sv): BRAM main memory, the E800 text buffer,
+// the F000 boot ROM and the MMIO block at FFF8..FFFF.  Cycle counts follow
+// the RTL state machine plus the bus controller latency of each region.
+#ifndef IB16_CPU_H
+#define IB16_CPU_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// ECP5 demo defaults
+#define IB16_FREQ_MHZ			50
+#define IB16_BLOCKS				29			// main memory is BLOCKS * 0x800 bytes
+#define IB16_STACK_PWIDTH		10
+#define IB16_BOOT_ROM_ADDR		0xF000
+#define IB16_BAUD				230400
+
+#define IB16_TEXT_MEM_BOT		0xE800
+#define IB16_TEXT_MEM_TOP		0xEFFF
+#define IB16_ROM_MEM_BOT		0xF000
+#define IB16_ROM_MEM_TOP		0xF0FF
+
+#define IB16_VIDEO_FLAG_ADDR	0xFFF8
+#define IB16_TIMER_ADDR			0xFFF9
+#define IB16_GPIO1_ADDR			0xFFFA
+#define IB16_GPIO0_ADDR			0xFFFB
+#define IB16_INT_ADDR			0xFFFC
+#define IB16_INTEN_ADDR			0xFFFD
+#define IB16_UART_STS_ADDR		0xFFFE
+#define IB16_UART_ADDR			0xFFFF
+
+#define IB16_IRQ_UART_RX_READY	0
+#define IB16_IRQ_UART_TX_EMPTY	1
+#define IB16_IRQ_TIMER			2
+#define IB16_IRQ_VSYNC			3
+
+#define IB16_UART_FIFO_DEPTH	64
+
+// SREG bits
+#define IB16_CARRY_FLAG			0x80
+#define IB16_ZERO_FLAG			0x40
+#define IB16_WRITE_INCR			0x02
+#define IB16_READ_INCR			0x01
+
+// major opcodes
+enum {
+	IB16_LDI = 0, IB16_ADD, IB16_ADC, IB16_XOR, IB16_AND, IB16_OR, IB16_CMP, IB16_SHF,
+	IB16_AJMP, IB16_LDM, IB16_STM, IB16_LCALL, IB16_RET, IB16_JMP, IB16_SRES, IB16_RETI
+};
+
+// why ib16_run() returned
+enum {
+	IB16_RUNNING = 0,
+	IB16_LIMIT,				// hit the instruction/cycle budget
+	IB16_HALT,				// JMP to itself with no IRQ that could ever fire
+	IB16_RX_EMPTY,			// blocking UART read with no input left
+	IB16_BUS_HANG,			// access to an unmapped address (the real bus never goes ready)
+	IB16_REBOOT				// SRES into the boot ROM but no ROM was loaded
+};
+
+struct ib16_config {
+	int freq_mhz;
+	int blocks;
+	int stack_pwidth;
+	uint16_t stack_address;
+	uint16_t irq_vector;
+	uint16_t boot_rom_addr;
+	int two_cycle;
+	int baud;
+};
+
+// a predecoded instruction for the threaded engine, uops[pc/2] holds the
+// word at pc, op 0 means it has not been decoded (or was stored to since)
+struct ib16_uop {
+	uint8_t op;						// handler
+	uint8_t isn;					// major opcode for the per class counters
+	uint8_t rd, ra, rb;
+	uint8_t lat;					// fetch latency
+	uint8_t cyc;					// cycles not counting the data access
+	uint16_t imm;					// immediate, jump/call target
+};
+
+struct ib16_cpu {
+	// architectural state
+	uint16_t pc, irq_pc;
+	uint16_t sp, sp_mask;
+	uint8_t sreg, irq_sreg;
+	uint8_t ri, wi, irq_ri, irq_wi;
+	uint8_t mask_irq;
+	uint8_t r[32];					// r[0..15] app bank, r[16..31] IRQ bank
+
+	// memory map
+	struct ib16_config cfg;
+	uint16_t ram_top;
+	uint8_t fetch_lat[256];			// fetch latency per 256 byte page, 0 == unmapped
+	int rom_loaded;
+	uint8_t mem[65536];
+
+	// predecoded image, one past the end wraps the PC to 0000 and odd_uop
+	// hands an odd PC to the switch interpreter
+	struct ib16_uop uops[32768 + 1];
+	struct ib16_uop odd_uop;
+	uint16_t odd_pc;
+
+	// MMIO
+	uint8_t int_pending, int_enable;
+	uint8_t gpio[2];
+	uint8_t lrg_mode;
+	uint8_t ticks;
+	uint64_t cycles_per_tick, cycles_per_frame, cycles_per_byte;
+
+	// UART, RX bytes arrive back to back at the line rate (rx_arrive is when rx[rx_pos]
+	// is in) and wait in a IB16_UART_FIFO_DEPTH FIFO, anything that arrives while it's
+	// full is dropped like on the SoC
+	const uint8_t *rx;
+	size_t rx_len, rx_pos;
+	uint64_t rx_arrive;
+	uint8_t rx_fifo[IB16_UART_FIFO_DEPTH];
+	int rx_head, rx_count;
+	uint64_t rx_dropped;
+	int rx_edge;
+	uint64_t tx_done_at;
+	int tx_edge;
+	long tx_skip;					// drop this many TX bytes (e.g. boot ROM echo)
+	FILE *tx;
+
+	// pending interrupt sources and the cycle budget
+	uint64_t next_event, next_tick, next_vsync;
+	uint64_t limit;
+
+	// accounting
+	uint64_t cycles, insns;
+	uint64_t class_count[16], class_cycles[16];
+	uint64_t irq_count, stall_cycles;
+	int stop;
+	uint16_t stop_addr;
+
+	// called after every instruction retires (and after any IRQ it let in) with
+	// its PC, major opcode and cycles, only the switch engine has the hook so
+	// ib16_run_threaded() hands over to ib16_run() while one is set
+	void (*hook)(struct ib16_cpu *m, uint16_t pc, unsigned isn, unsigned cyc);
+	void *hook_ctx;
+};
+
+extern const char *ib16_opcode_names[16];
+extern const char *ib16_stop_names[];
+
+void ib16_default_config(struct ib16_config *cfg);
+void ib16_init(struct ib16_cpu *m, const struct ib16_config *cfg);
+void ib16_reset(struct ib16_cpu *m);
+void ib16_boot_app(struct ib16_cpu *m, uint16_t pc);
+void ib16_set_rx(struct ib16_cpu *m, const uint8_t *data, size_t len, uint64_t delay);
+int ib16_load_image(struct ib16_cpu *m, const char *fname, int hex, uint16_t addr);
+void ib16_invalidate(struct ib16_cpu *m, uint16_t addr, int len);
+int ib16_step(struct ib16_cpu *m);
+int ib16_run(struct ib16_cpu *m, uint64_t max_insns, uint64_t max_cycles);
+int ib16_run_threaded(struct ib16_cpu *m, uint64_t max_insns, uint64_t max_cycles);
+
+#endif
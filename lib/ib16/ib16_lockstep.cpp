@@ -0,0 +1,682 @@
+// Lock-step differential harness for ib16_v2.v
+//
+// Runs the RTL (built with Verilator, see the ib16_lockstep target in the
+// Makefile) next to the ib16_cpu.c reference model and compares PC, SREG, SP,
+// RI/WI, the IRQ mask and the active register bank every time the RTL fetches
+// an opcode, stopping at the first divergence with the last few instructions.
+//
+//   ./ib16_lockstep --bin ecp5_demo.s.bin --uart-in name.txt --insns 1000000
+//   ./ib16_lockstep --fuzz 500 --seed 1
+//
+// The RTL gets a bus controller like the one in ib16_v2_tb.v (ready the cycle
+// after enable) backed by its own copy of memory, so memory differences show
+// up as soon as something loads or fetches them.  MMIO reads are replayed from
+// the model since the RTL cycle counts don't match the SoC's, and outside of
+// fuzz mode the IRQ line follows the model: it is raised when the model takes
+// an IRQ and the RTL has to take it at the same instruction boundary.
+//
+// Fuzz mode writes random programs (ALU, loads/stores, push/pop, SRES, forward
+// branches, counted loops, AJMP, LCALL) as assembly, builds them with ib16_as
+// and runs them to their final JMP.  The harness raises a spare IRQ line at
+// random boundaries, the ISR acks it through the int pending register.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include "verilated.h"
+#include "Vib16.h"
+#include "Vib16___024root.h"
+extern "C" {
+#include "ib16_cpu.h"
+}
+
+#define FSM_FETCH		0			// ib16_v2.v states
+#define FSM_RETIRE		2
+
+#define IRQ_LINE		0x80		// pending/enable bit the harness drives, nothing in the SoC uses it
+#define HANG_CYCLES		1000		// no fetch for this long and the RTL is stuck
+#define MAX_WINDOW		256
+#define ROM_STUB		0xE008		// SRES 8, boot straight into the app at 0000
+
+#define FUZZ_NAME		"lockstep_fuzz.s"
+#define FUZZ_SUBS		4
+
+struct retired {
+	uint64_t n;
+	uint16_t pc = 0, op = 0;
+	uint16_t sp;
+	uint8_t sreg, ri, wi, mask_irq;
+	int irq;						// the model took an IRQ right after this one
+};
+
+struct lockstep {
+	VerilatedContext *ctx;
+	Vib16 *top;
+	struct ib16_cpu *m;
+	uint8_t mem[65536];				// what the RTL sees on its bus
+	uint8_t irq_line;				// bus_irq
+	uint8_t mmio_read;				// what the model's last LDM returned
+	int fuzz;
+	uint64_t rtl_cycles, insns, irqs;
+	struct retired trace[MAX_WINDOW];
+	int window;
+};
+
+static uint64_t rnd(uint64_t *s)
+{
+	// xorshift64*
+	*s ^= *s >> 12;
+	*s ^= *s << 25;
+	*s ^= *s >> 27;
+	return (*s * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+static void disasm(uint16_t op, char *buf)
+{
+	static const char *shf[16] = {
+		"SHR", "SAR", "ROR", "ROL", "SWAP", "INC", "DEC", "NOT", "NEG", "SCC", "SNZ", "ROLB", "RORB", "SHF13", "SHF14", "SHF15" };
+	static const char *cmp[4] = { "CMPLT", "CMPEQ", "CMPGT", "CMP3" };
+	static const char *jcc[8] = { "JMP", "JC", "JNC", "JZ", "JNZ", "J5", "J6", "J7" };
+	unsigned isn = op >> 12, d = (op >> 8) & 15, a = (op >> 4) & 15, b = op & 15;
+	int off;
+
+	switch (isn) {
+		case IB16_LDI: sprintf(buf, "LDI %u,0x%02X", d, op & 0xFF); break;
+		case IB16_CMP: sprintf(buf, "%s %u,%u", cmp[d & 3], a, b); break;
+		case IB16_SHF: sprintf(buf, "%s %u,%u", shf[a], d, b); break;
+		case IB16_AJMP: sprintf(buf, "%s %u,%u", (d & 1) ? "AJMPR" : "AJMP", a, b); break;
+		case IB16_LCALL: sprintf(buf, "LCALL %04X", (op & 0xFFF) << 4); break;
+		case IB16_RET: sprintf(buf, "RET"); break;
+		case IB16_RETI: sprintf(buf, "RETI"); break;
+		case IB16_SRES: sprintf(buf, "SRES 0x%02X", op & 0xFF); break;
+		case IB16_JMP:
+			off = (op & 0x100) ? (int)(op & 0x1FF) - 0x200 : (op & 0x1FF);
+			sprintf(buf, "%s .%+d", jcc[(op >> 9) & 7], off * 2 + 2);
+			break;
+		case IB16_LDM:
+		case IB16_STM:
+			if ((op & 0xFF) == 0xFF) {
+				sprintf(buf, "%s %u", isn == IB16_LDM ? "POP" : "PUSH", d);
+				break;
+			}
+			// fall through
+		default:
+			sprintf(buf, "%s %u,%u,%u", ib16_opcode_names[isn], d, a, b);
+			break;
+	}
+}
+
+// one clock, the bus controller samples what the CPU drove last cycle just
+// like the always block in ib16_v2_tb.v, returns 1 if an opcode fetch
+// completed on this edge
+static int tick(struct lockstep *s, uint16_t *pc, uint16_t *op)
+{
+	Vib16 *t = s->top;
+	uint8_t ready = t->bus_ready;
+	uint16_t data = t->bus_data_out, a = t->bus_address;
+	int fetched;
+
+	fetched = (t->rootp->ib16__DOT__state == FSM_FETCH || t->rootp->ib16__DOT__state == FSM_RETIRE) &&
+		t->bus_enable && t->bus_ready;
+	if (fetched) {
+		*pc = a;
+		*op = t->bus_data_out;
+	}
+
+	if (t->bus_enable && !t->bus_ready) {
+		if (a >= IB16_VIDEO_FLAG_ADDR) {
+			// MMIO, the model already did the access
+			if (t->bus_wr_en) {
+				if (a == IB16_INT_ADDR) {
+					s->irq_line &= ~t->bus_data_in;
+				}
+			} else {
+				data = s->mmio_read;
+			}
+		} else if (t->bus_wr_en) {
+			if (a < IB16_ROM_MEM_BOT || a > IB16_ROM_MEM_TOP) {
+				s->mem[a] = t->bus_data_in & 0xFF;
+				if (t->bus_burst) {
+					s->mem[(uint16_t)(a + 1)] = t->bus_data_in >> 8;
+				}
+			}
+		} else {
+			data = s->mem[a];
+			if (t->bus_burst) {
+				data |= s->mem[(uint16_t)(a + 1)] << 8;
+			}
+		}
+		ready = 1;
+	} else if (!t->bus_enable && t->bus_ready) {
+		ready = 0;
+	}
+
+	t->bus_irq = s->irq_line;
+	t->clk = 1;
+	t->eval();
+	t->bus_ready = ready;
+	t->bus_data_out = data;
+	t->clk = 0;
+	t->eval();
+	s->ctx->timeInc(1);
+	++(s->rtl_cycles);
+	return fetched;
+}
+
+static int next_fetch(struct lockstep *s, uint16_t *pc, uint16_t *op)
+{
+	int x;
+
+	for (x = 0; x < HANG_CYCLES; x++) {
+		if (tick(s, pc, op)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void reset_rtl(struct lockstep *s)
+{
+	Vib16 *t = s->top;
+	int x;
+
+	t->clk = 0;
+	t->rst_n = 0;
+	t->bus_ready = 0;
+	t->bus_data_out = 0;
+	t->bus_irq = 0;
+	t->eval();
+	for (x = 0; x < 3; x++) {
+		t->clk = 1;
+		t->eval();
+		t->clk = 0;
+		t->eval();
+	}
+	// the register file has no reset, start it where the model starts
+	for (x = 0; x < 32; x++) {
+		t->rootp->ib16__DOT__reg_rr[x] = 0;
+	}
+	t->rootp->ib16__DOT__reg_irq_sreg = 0;
+	t->rootp->ib16__DOT__reg_irq_ri = 0;
+	t->rootp->ib16__DOT__reg_irq_wi = 0;
+	t->rst_n = 1;
+	t->eval();
+}
+
+static void record(struct lockstep *s, uint16_t pc, uint16_t op)
+{
+	Vib16___024root *r = s->top->rootp;
+	struct retired *e = &s->trace[s->insns % s->window];
+
+	e->n = s->insns;
+	e->pc = pc;
+	e->op = op;
+	e->sreg = r->ib16__DOT__reg_sreg;
+	e->sp = r->ib16__DOT__reg_sp;
+	e->ri = r->ib16__DOT__reg_ri;
+	e->wi = r->ib16__DOT__reg_wi;
+	e->mask_irq = r->ib16__DOT__mask_irq;
+	e->irq = 0;
+}
+
+static void dump_trace(struct lockstep *s)
+{
+	uint64_t n;
+	struct retired *e;
+	char buf[32];
+
+	fprintf(stderr, "\n  last instructions (RTL state before each one)\n");
+	n = s->insns >= (uint64_t)s->window ? s->insns - s->window + 1 : 0;
+	for (; n <= s->insns; n++) {
+		e = &s->trace[n % s->window];
+		disasm(e->op, buf);
+		fprintf(stderr, "  %10" PRIu64 "  %04x: %04x  %-16s SREG=%02x SP=%03x RI=%02x WI=%02x %s%s\n",
+			e->n, e->pc, e->op, buf, e->sreg, e->sp, e->ri, e->wi, e->mask_irq ? "irq" : "app",
+			e->irq ? "  -> IRQ" : "");
+	}
+}
+
+static void dump_regs(struct lockstep *s)
+{
+	Vib16___024root *r = s->top->rootp;
+	int x;
+
+	fprintf(stderr, "\n  reg   RTL   model\n");
+	for (x = 0; x < 32; x++) {
+		fprintf(stderr, "  r%-2d%s  %02x    %02x%s\n", x & 15, x < 16 ? " " : "'",
+			r->ib16__DOT__reg_rr[x], s->m->r[x], r->ib16__DOT__reg_rr[x] != s->m->r[x] ? "  <--" : "");
+	}
+}
+
+// returns the number of fields that differ, listing them on out if not NULL
+static int compare(struct lockstep *s, uint16_t pc, uint16_t op, FILE *out)
+{
+	Vib16___024root *r = s->top->rootp;
+	struct ib16_cpu *m = s->m;
+	uint16_t mop;
+	int x, bank, bad = 0;
+
+#define CHECK(name, rtl, model, fmt) \
+	if ((rtl) != (model)) { \
+		if (out) { \
+			fprintf(out, "  %-8s RTL " fmt "  model " fmt "\n", name, (unsigned)(rtl), (unsigned)(model)); \
+		} \
+		++bad; \
+	}
+
+	mop = m->mem[pc] | (m->mem[(uint16_t)(pc + 1)] << 8);
+	CHECK("PC", pc, m->pc, "%04x");
+	CHECK("opcode", op, mop, "%04x");
+	CHECK("SREG", r->ib16__DOT__reg_sreg, m->sreg, "%02x");
+	CHECK("SP", r->ib16__DOT__reg_sp, m->sp, "%03x");
+	CHECK("RI", r->ib16__DOT__reg_ri, m->ri, "%02x");
+	CHECK("WI", r->ib16__DOT__reg_wi, m->wi, "%02x");
+	CHECK("mask_irq", r->ib16__DOT__mask_irq, m->mask_irq, "%u");
+	bank = m->mask_irq << 4;
+	for (x = bank; x < bank + 16; x++) {
+		if (r->ib16__DOT__reg_rr[x] != m->r[x]) {
+			if (out) {
+				fprintf(out, "  r%-7d RTL %02x  model %02x\n", x & 15, r->ib16__DOT__reg_rr[x], m->r[x]);
+			}
+			++bad;
+		}
+	}
+#undef CHECK
+	return bad;
+}
+
+// RAM and the text buffer must match once the program is done
+static int compare_mem(struct lockstep *s)
+{
+	int x;
+
+	for (x = 0; x <= IB16_TEXT_MEM_TOP; x++) {
+		if ((x < s->m->ram_top || x >= IB16_TEXT_MEM_BOT) && s->mem[x] != s->m->mem[x]) {
+			fprintf(stderr, "  memory at %04x differs, RTL %02x model %02x\n", x, s->mem[x], s->m->mem[x]);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void diverged(struct lockstep *s, const char *why)
+{
+	fprintf(stderr, "\nib16_lockstep: %s at instruction %" PRIu64 " (RTL cycle %" PRIu64 ")\n", why, s->insns, s->rtl_cycles);
+}
+
+// run until the model halts or max_insns, returns 0 if the RTL kept up
+static int run(struct lockstep *s, uint64_t max_insns, unsigned irq_rate, uint64_t *seed)
+{
+	struct ib16_cpu *m = s->m;
+	uint16_t pc = 0, op = 0;
+	uint64_t irqs;
+	unsigned bank, rd;
+	int halted = 0;
+
+	reset_rtl(s);
+	for (;;) {
+		if (!next_fetch(s, &pc, &op)) {
+			diverged(s, "RTL stopped fetching");
+			dump_trace(s);
+			return 1;
+		}
+		if (!s->fuzz) {
+			s->irq_line = 0;
+		}
+		// both sides are now past the previous instruction (and IRQ entry)
+		record(s, pc, op);
+		if (compare(s, pc, op, NULL)) {
+			diverged(s, "state differs");
+			compare(s, pc, op, stderr);
+			dump_trace(s);
+			dump_regs(s);
+			return 1;
+		}
+		if (halted || s->insns >= max_insns) {
+			break;
+		}
+
+		if (s->fuzz && irq_rate && !(m->int_pending & IRQ_LINE) && !(rnd(seed) % irq_rate)) {
+			// level IRQ, stays up until the ISR acks it
+			m->int_pending |= IRQ_LINE;
+			s->irq_line |= IRQ_LINE;
+		}
+		bank = m->mask_irq << 4;
+		rd = (op >> 8) & 15;
+		irqs = m->irq_count;
+		switch (ib16_step(m)) {
+			case IB16_RUNNING:
+				break;
+			case IB16_HALT:
+				halted = 1;
+				break;
+			default:
+				fprintf(stderr, "ib16_lockstep: model stopped (%s at %04x) after %" PRIu64 " instructions\n",
+					ib16_stop_names[m->stop], m->stop_addr, s->insns);
+				return s->fuzz;
+		}
+		if ((op >> 12) == IB16_LDM) {
+			s->mmio_read = m->r[bank | rd];
+		}
+		if (m->irq_count != irqs) {
+			s->trace[s->insns % s->window].irq = 1;
+			++(s->irqs);
+			if (!s->fuzz) {
+				s->irq_line = IRQ_LINE;
+			}
+		}
+		++(s->insns);
+	}
+	if (compare_mem(s)) {
+		diverged(s, "memory differs");
+		dump_trace(s);
+		return 1;
+	}
+	return 0;
+}
+
+// fuzz program generator, everything is written as assembly so the opcodes
+// come from ib16_as's encoder
+
+struct gen {
+	FILE *f;
+	uint64_t rng;
+	int labels;
+	int pend[16], pend_left[16], npend;	// forward labels placed after pend_left more instructions
+	int isr, sub, loop;
+};
+
+static unsigned grnd(struct gen *g, unsigned n)
+{
+	return rnd(&g->rng) % n;
+}
+
+// r14 is the loop counter, nothing else writes it
+static unsigned dreg(struct gen *g)
+{
+	unsigned r = grnd(g, 15);
+	return r == 14 ? 15 : r;
+}
+
+static void place_labels(struct gen *g, int all)
+{
+	int x;
+
+	for (x = 0; x < g->npend; ) {
+		if (all || !g->pend_left[x]--) {
+			fprintf(g->f, ":FW%d\n", g->pend[x]);
+			g->pend[x] = g->pend[--g->npend];
+			g->pend_left[x] = g->pend_left[g->npend];
+		} else {
+			++x;
+		}
+	}
+}
+
+// emit a group of lines nothing may branch into the middle of
+static void emit(struct gen *g, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(g->f, fmt, ap);
+	va_end(ap);
+	place_labels(g, 0);
+}
+
+// branch to a label dist instructions further on
+static void forward(struct gen *g, const char *op, unsigned dist)
+{
+	if (g->npend == 16) {
+		place_labels(g, 1);
+	}
+	g->pend[g->npend] = g->labels;
+	g->pend_left[g->npend++] = dist;
+	emit(g, "\t%s FW%d\n", op, g->labels++);
+}
+
+static void gen_insn(struct gen *g)
+{
+	static const char *alu3[5] = { "ADD", "ADC", "XOR", "AND", "OR" };
+	static const char *alu2[11] = { "SHR", "SAR", "ROR", "ROL", "SWAP", "INC", "DEC", "NOT", "NEG", "ROLB", "RORB" };
+	static const char *cmp[3] = { "CMPLT", "CMPEQ", "CMPGT" };
+	static const char *jcc[5] = { "JMP", "JC", "JNC", "JZ", "JNZ" };
+	unsigned k = grnd(g, 100), d = dreg(g), a = grnd(g, 16), b = grnd(g, 16), x, ah, al;
+	int app = !g->isr && !g->sub;
+
+	if (k < 25) {
+		emit(g, "\t%s %u,%u,%u\n", alu3[grnd(g, 5)], d, a, b);
+	} else if (k < 33) {
+		emit(g, "\t%s %u,%u\n", cmp[grnd(g, 3)], a, b);
+	} else if (k < 48) {
+		x = grnd(g, 13);
+		if (x >= 11) {
+			emit(g, "\t%s %u\n", x == 11 ? "SCC" : "SNZ", d);
+		} else {
+			emit(g, "\t%s %u,%u\n", alu2[x], d, b);
+		}
+	} else if (k < 58) {
+		emit(g, "\tLDI %u,0x%02X\n", d, grnd(g, 256));
+	} else if (k < 70) {
+		// r13:r12 are loaded right before so the access stays on mapped memory
+		// even with RI/WI added on top
+		switch (grnd(g, 4)) {
+			case 0:
+			case 1: ah = 0x40 + grnd(g, 0xA0); al = grnd(g, 256); break;	// RAM past the code, below the ISR
+			case 2: ah = 0xE8 + grnd(g, 7); al = grnd(g, 256); break;		// text buffer
+			default: ah = 0xF0; al = 0; break;								// ROM
+		}
+		do {
+			d = dreg(g);
+		} while (d == 12 || d == 13);
+		emit(g, "\tLDI 13,0x%02X\n\tLDI 12,0x%02X\n\t%s %u,13,12\n", ah, al, grnd(g, 2) ? "LDM" : "STM", d);
+	} else if (k < 76 && app) {
+		emit(g, "\t%s %u\n", grnd(g, 2) ? "PUSH" : "POP", d);
+	} else if (k < 80 && app) {
+		// never bit 3/4 (boot), the W1C flag bits, IRQ bank and increments are fair game
+		emit(g, "\tSRES 0x%02X\n", grnd(g, 256) & 0xE7);
+	} else if (k < 90) {
+		forward(g, jcc[grnd(g, 5)], grnd(g, 9));
+	} else if (k < 93) {
+		x = g->labels++;
+		emit(g, "\tLDI 12,>AJ%u\n\tLDI 13,<AJ%u\n\t%s 13,12\n", x, x, app && grnd(g, 4) == 0 ? "AJMPR" : "AJMP");
+		for (k = grnd(g, 4); k; k--) {
+			emit(g, "\tLDI %u,0x%02X\n", dreg(g), grnd(g, 256));
+		}
+		emit(g, ":AJ%u\n", x);
+	} else if (k < 96 && app) {
+		emit(g, "\tLCALL SUB%u\n", grnd(g, FUZZ_SUBS));
+	} else if (app && !g->loop) {
+		// counted loop, DEC/JNZ go out together so nothing lands between them
+		x = g->labels++;
+		emit(g, "\tLDI 14,0x%02X\n:LP%u\n", 1 + grnd(g, 4), x);
+		g->loop = 1;
+		for (k = 1 + grnd(g, 10); k; k--) {
+			gen_insn(g);
+		}
+		g->loop = 0;
+		emit(g, "\tDEC 14,14\n\tJNZ LP%u\n", x);
+	} else {
+		emit(g, "\tINC %u,%u\n", d, b);
+	}
+}
+
+static void gen_program(const char *fname, uint64_t seed, int len, uint16_t irq_vector)
+{
+	struct gen g;
+	int x, y;
+
+	memset(&g, 0, sizeof g);
+	g.rng = seed * 0x9E3779B97F4A7C15ULL + 1;
+	g.f = fopen(fname, "w");
+	if (!g.f) {
+		fprintf(stderr, "Could not create '%s'\n", fname);
+		exit(-1);
+	}
+	// the image has to reach the ISR
+	fprintf(g.f, "; ib16_lockstep fuzz program, seed %" PRIu64 "\n.PROG_SIZE %X\n.ORG 0\n", seed, (irq_vector + 256) / 2);
+	for (x = 0; x < 16; x++) {
+		if (x != 14) {
+			fprintf(g.f, "\tLDI %d,0x%02X\n", x, grnd(&g, 256));
+		}
+	}
+	for (x = 0; x < len; x++) {
+		gen_insn(&g);
+	}
+	place_labels(&g, 1);
+	fprintf(g.f, ":END\n\tJMP END\n");
+
+	g.sub = 1;
+	for (y = 0; y < FUZZ_SUBS; y++) {
+		fprintf(g.f, ".ALIGN 8\n:SUB%d\n", y);
+		for (x = grnd(&g, 12); x; x--) {
+			gen_insn(&g);
+		}
+		place_labels(&g, 1);
+		fprintf(g.f, "\tRET\n");
+	}
+	g.sub = 0;
+
+	// the ISR runs in the IRQ bank, acks the harness' line and returns, SRES 4
+	// turns off the app's write increment so the ack lands on the register
+	g.isr = 1;
+	fprintf(g.f, ".ORG %04X\n", irq_vector);
+	for (x = grnd(&g, 8); x; x--) {
+		gen_insn(&g);
+	}
+	place_labels(&g, 1);
+	fprintf(g.f, "\tSRES 0x04\n\tLDI 1,0xFF\n\tLDI 2,0x%02X\n\tLDI 3,0x%02X\n\tSTM 3,1,2\n\tRETI\n",
+		IB16_INT_ADDR & 0xFF, IRQ_LINE);
+	fclose(g.f);
+}
+
+static void setup(struct lockstep *s, const struct ib16_config *cfg, const char *rom)
+{
+	ib16_init(s->m, cfg);
+	if (rom) {
+		ib16_load_image(s->m, rom, strstr(rom, ".hex") != NULL, cfg->boot_rom_addr);
+	} else {
+		s->m->mem[cfg->boot_rom_addr] = ROM_STUB & 0xFF;
+		s->m->mem[cfg->boot_rom_addr + 1] = ROM_STUB >> 8;
+	}
+	s->irq_line = 0;
+	s->mmio_read = 0;
+	s->insns = 0;
+	s->rtl_cycles = 0;
+}
+
+int main(int argc, char **argv)
+{
+	static struct lockstep s;
+	struct ib16_config cfg;
+	uint64_t max_insns = 10000000, seed = 1, rng, total = 0;
+	unsigned irq_rate = 50;
+	int i, rc = 0, fuzz = 0, len = 400;
+	const char *bin = NULL, *rom = NULL, *uart_in = NULL, *as = "./ib16_as";
+	uint8_t *rx = NULL;
+	size_t rx_len = 0;
+	char cmd[512];
+	FILE *f;
+
+	s.window = 16;
+	ib16_default_config(&cfg);
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 >= argc) {
+			fprintf(stderr, "%s requires a parameter\n", argv[i]);
+			exit(-1);
+		}
+		if (!strcmp(argv[i], "--bin")) {
+			bin = argv[++i];
+		} else if (!strcmp(argv[i], "--rom")) {
+			rom = argv[++i];
+		} else if (!strcmp(argv[i], "--uart-in")) {
+			uart_in = argv[++i];
+		} else if (!strcmp(argv[i], "--insns")) {
+			max_insns = strtoull(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "--fuzz")) {
+			fuzz = strtol(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "--seed")) {
+			seed = strtoull(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "--len")) {
+			len = strtol(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "--irq-rate")) {
+			irq_rate = strtoul(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "--as")) {
+			as = argv[++i];
+		} else if (!strcmp(argv[i], "--window")) {
+			s.window = strtol(argv[++i], NULL, 10);
+			if (s.window < 1 || s.window > MAX_WINDOW) {
+				fprintf(stderr, "--window must be between 1 and %d\n", MAX_WINDOW);
+				exit(-1);
+			}
+		} else {
+			fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+			exit(-1);
+		}
+	}
+	if (!bin && !fuzz) {
+		fprintf(stderr, "usage: %s --bin app.bin [--rom rom.bin] [--uart-in file] [--insns n]\n"
+			"       %s --fuzz n [--seed s] [--len n] [--irq-rate n (0 for none)] [--as ./ib16_as]\n", argv[0], argv[0]);
+		exit(-1);
+	}
+
+	s.ctx = new VerilatedContext;
+	s.ctx->commandArgs(argc, argv);
+	s.top = new Vib16(s.ctx);
+	s.m = (struct ib16_cpu *)calloc(1, sizeof *s.m);
+
+	if (!fuzz) {
+		setup(&s, &cfg, rom);
+		ib16_load_image(s.m, bin, strstr(bin, ".hex") != NULL, 0);
+		if (uart_in) {
+			f = fopen(uart_in, "rb");
+			if (!f) {
+				fprintf(stderr, "Could not open UART input file '%s'\n", uart_in);
+				exit(-1);
+			}
+			fseek(f, 0, SEEK_END);
+			rx_len = ftell(f);
+			fseek(f, 0, SEEK_SET);
+			rx = (uint8_t *)malloc(rx_len + 1);
+			rx_len = fread(rx, 1, rx_len, f);
+			fclose(f);
+			ib16_set_rx(s.m, rx, rx_len, 0);
+		}
+		memcpy(s.mem, s.m->mem, sizeof s.mem);
+		rc = run(&s, max_insns, 0, &seed);
+		printf("ib16_lockstep: %s after %" PRIu64 " instructions, %" PRIu64 " IRQs, %" PRIu64 " RTL cycles\n",
+			rc ? "FAILED" : "in step", s.insns, s.irqs, s.rtl_cycles);
+	} else {
+		s.fuzz = 1;
+		for (i = 0; i < fuzz && !rc; i++) {
+			setup(&s, &cfg, NULL);
+			gen_program(FUZZ_NAME, seed + i, len, s.m->cfg.irq_vector);
+			sprintf(cmd, "%s %s --bin %s.bin > /dev/null", as, FUZZ_NAME, FUZZ_NAME);
+			if (system(cmd)) {
+				fprintf(stderr, "ib16_as failed on %s (seed %" PRIu64 ")\n", FUZZ_NAME, seed + i);
+				exit(-1);
+			}
+			ib16_load_image(s.m, FUZZ_NAME ".bin", 0, 0);
+			s.m->int_enable = IRQ_LINE;
+			memcpy(s.mem, s.m->mem, sizeof s.mem);
+			rng = (seed + i) * 0x9E3779B97F4A7C15ULL + 1;
+			rc = run(&s, max_insns, irq_rate, &rng);
+			total += s.insns;
+			if (rc) {
+				fprintf(stderr, "program kept in %s, rerun with --fuzz 1 --seed %" PRIu64 "\n", FUZZ_NAME, seed + i);
+			}
+		}
+		printf("ib16_lockstep: %d programs, %" PRIu64 " instructions, %" PRIu64 " IRQs, %s\n",
+			i, total, s.irqs, rc ? "FAILED" : "all in step");
+	}
+
+	s.top->final();
+	delete s.top;
+	delete s.ctx;
+	free(s.m);
+	free(rx);
+	return rc;
+}
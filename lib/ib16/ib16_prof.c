@@ -0,0 +1,412 @@
+/* IttyBitty (ib16) instruction level profiler, see ib16_prof.h */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include "ib16_prof.h"
+
+struct ib16_prof *ib16_prof_new(void)
+{
+	struct ib16_prof *p;
+
+	p = calloc(1, sizeof *p);
+	if (!p) {
+		fprintf(stderr, "Out of memory for the profiler\n");
+		exit(-1);
+	}
+	return p;
+}
+
+void ib16_prof_free(struct ib16_prof *p)
+{
+	int x;
+
+	for (x = 0; x < 65536; x++) {
+		free(p->label[x]);
+	}
+	for (x = 0; x < p->nfuncs; x++) {
+		if (!p->label[p->funcs[x].addr]) {
+			free((char *)p->funcs[x].name);
+		}
+	}
+	free(p->nodes);
+	free(p->funcs);
+	free(p);
+}
+
+// parse the "[LABEL           0xADDR]: 0xWORD ; ..." lines, returns the address or -1
+static int parse_list_line(const char *line, char *name, int size)
+{
+	const char *s;
+	unsigned addr;
+	int n;
+
+	name[0] = 0;
+	if (line[0] != '[') {
+		return -1;
+	}
+	s = line + 1;
+	if (*s != ' ') {
+		for (n = 0; *s && *s != ' ' && n < size - 1; n++) {
+			name[n] = *s++;
+		}
+		name[n] = 0;
+	}
+	while (*s == ' ') {
+		++s;
+	}
+	if (sscanf(s, "0x%x]", &addr) != 1 || addr > 0xFFFF) {
+		name[0] = 0;
+		return -1;
+	}
+	return addr;
+}
+
+// read the labels out of an ib16_as --list file, the file is annotated by ib16_prof_write()
+void ib16_prof_listing(struct ib16_prof *p, const char *fname)
+{
+	FILE *f;
+	char line[512], name[256];
+	int addr;
+
+	if (p->nlists == IB16_PROF_MAX_LISTS) {
+		fprintf(stderr, "Too many listings to profile (max %d)\n", IB16_PROF_MAX_LISTS);
+		exit(-1);
+	}
+	f = fopen(fname, "r");
+	if (!f) {
+		fprintf(stderr, "Could not open listing '%s'\n", fname);
+		exit(-1);
+	}
+	p->lists[p->nlists++] = fname;
+	while (fgets(line, sizeof line, f)) {
+		addr = parse_list_line(line, name, sizeof name);
+		if (addr >= 0 && name[0]) {
+			free(p->label[addr]);
+			p->label[addr] = strdup(name);
+		}
+	}
+	fclose(f);
+}
+
+static int prof_func(struct ib16_prof *p, uint16_t addr)
+{
+	struct ib16_prof_func *fn;
+	char buf[16];
+
+	if (p->func_at[addr]) {
+		return p->func_at[addr] - 1;
+	}
+	if (p->nfuncs == p->maxfuncs) {
+		p->maxfuncs = p->maxfuncs ? p->maxfuncs * 2 : 256;
+		p->funcs = realloc(p->funcs, p->maxfuncs * sizeof *p->funcs);
+	}
+	fn = &p->funcs[p->nfuncs];
+	memset(fn, 0, sizeof *fn);
+	fn->addr = addr;
+	if (p->label[addr]) {
+		fn->name = p->label[addr];
+	} else {
+		sprintf(buf, "sub_%04X", addr);
+		fn->name = strdup(buf);
+	}
+	p->func_at[addr] = ++(p->nfuncs);
+	return p->nfuncs - 1;
+}
+
+// the node for func called from parent, calls are rare next to instructions so a sibling list will do
+static int prof_node(struct ib16_prof *p, int parent, int func)
+{
+	struct ib16_prof_node *n;
+	int x;
+
+	for (x = p->nodes[parent].child; x; x = p->nodes[x].sibling) {
+		if (p->nodes[x].func == func) {
+			return x;
+		}
+	}
+	if (p->nnodes == p->maxnodes) {
+		p->maxnodes *= 2;
+		p->nodes = realloc(p->nodes, p->maxnodes * sizeof *p->nodes);
+	}
+	x = p->nnodes++;
+	n = &p->nodes[x];
+	memset(n, 0, sizeof *n);
+	n->parent = parent;
+	n->func = func;
+	n->sibling = p->nodes[parent].child;
+	p->nodes[parent].child = x;
+	return x;
+}
+
+static void prof_push(struct ib16_prof *p, uint16_t addr, uint16_t sp, int irq, uint64_t t)
+{
+	struct ib16_prof_frame *fr;
+	int func;
+
+	if (p->depth == IB16_PROF_MAX_DEPTH) {
+		++(p->lost);
+		return;
+	}
+	func = prof_func(p, addr);
+	fr = &p->stack[p->depth];
+	fr->node = prof_node(p, p->depth ? p->stack[p->depth - 1].node : 0, func);
+	fr->irq = irq;
+	fr->sp = sp;
+	fr->start = t;
+	++(p->depth);
+	++(p->funcs[func].calls);
+}
+
+static void prof_hook(struct ib16_cpu *m, uint16_t pc, unsigned isn, unsigned cyc)
+{
+	struct ib16_prof *p = m->hook_ctx;
+	uint16_t next;
+	uint64_t t;
+	int irq, x;
+
+	p->count[pc]++;
+	p->cycles[pc] += cyc;
+	p->bank_cycles[p->bank] += cyc;
+	p->nodes[p->stack[p->depth - 1].node].self += cyc;
+
+	// an IRQ taken right after this instruction already moved the PC to the vector
+	irq = m->irq_count != p->irq_seen;
+	next = irq ? m->irq_pc : m->pc;
+
+	switch (isn) {
+		case IB16_LCALL:
+			prof_push(p, next, (m->sp - 2) & m->sp_mask, 0, m->cycles);
+			break;
+		case IB16_RET:
+			// back to the frame that made the call, a RET that matches none is just a jump
+			for (x = p->depth - 1; x > 0 && !p->stack[x].irq; x--) {
+				if (p->stack[x].sp == m->sp) {
+					p->depth = x;
+					break;
+				}
+			}
+			break;
+		case IB16_RETI:
+			for (x = p->depth - 1; x > 0; x--) {
+				if (p->stack[x].irq) {
+					t = m->cycles - p->stack[x].start;
+					p->irq_cycles += t;
+					if (t > p->irq_max) {
+						p->irq_max = t;
+					}
+					p->depth = x;
+					break;
+				}
+			}
+			break;
+		case IB16_SRES:
+		case IB16_AJMP:
+			// booting the app/ROM (SRES 8/16) or AJMPR empty the stack, start over from the new entry point
+			if ((isn == IB16_SRES && (m->mem[pc] & 0x18)) || (isn == IB16_AJMP && (m->mem[(uint16_t)(pc + 1)] & 1))) {
+				p->depth = 0;
+				prof_push(p, next, 0, 0, m->cycles);
+			}
+			break;
+	}
+	if (irq) {
+		prof_push(p, m->pc, m->sp, 1, m->cycles);
+		++(p->irqs);
+		p->irq_seen = m->irq_count;
+	}
+	p->bank = m->mask_irq;
+}
+
+void ib16_prof_attach(struct ib16_prof *p, struct ib16_cpu *m)
+{
+	p->maxnodes = 256;
+	p->nodes = calloc(p->maxnodes, sizeof *p->nodes);
+	p->nnodes = 1;
+	p->depth = 0;
+	prof_push(p, m->pc, 0, 0, m->cycles);
+	p->irq_seen = m->irq_count;
+	p->bank = m->mask_irq;
+	m->hook = prof_hook;
+	m->hook_ctx = p;
+}
+
+// fold the call tree into per function self/total, recursion only counts the outermost call
+static void prof_totals(struct ib16_prof *p)
+{
+	int x, y;
+
+	for (x = 0; x < p->nfuncs; x++) {
+		p->funcs[x].self = p->funcs[x].total = 0;
+	}
+	for (x = 0; x < p->nnodes; x++) {
+		p->nodes[x].total = p->nodes[x].self;
+	}
+	// children are always created after their parent
+	for (x = p->nnodes - 1; x > 0; x--) {
+		p->nodes[p->nodes[x].parent].total += p->nodes[x].total;
+	}
+	for (x = 1; x < p->nnodes; x++) {
+		p->funcs[p->nodes[x].func].self += p->nodes[x].self;
+		for (y = p->nodes[x].parent; y && p->nodes[y].func != p->nodes[x].func; y = p->nodes[y].parent);
+		if (!y) {
+			p->funcs[p->nodes[x].func].total += p->nodes[x].total;
+		}
+	}
+}
+
+static int cmp_self(const void *a, const void *b)
+{
+	const struct ib16_prof_func *fa = a, *fb = b;
+
+	if (fa->self != fb->self) {
+		return fa->self < fb->self ? 1 : -1;
+	}
+	return fa->addr - fb->addr;
+}
+
+// nearest label at or below addr
+static void prof_where(struct ib16_prof *p, uint16_t addr, char *buf)
+{
+	int x;
+
+	for (x = addr; x >= 0 && !p->label[x]; x--);
+	if (x < 0) {
+		sprintf(buf, "%04X", addr);
+	} else if (x == addr) {
+		sprintf(buf, "%.40s", p->label[x]);
+	} else {
+		sprintf(buf, "%.40s+%d", p->label[x], addr - x);
+	}
+}
+
+void ib16_prof_report(struct ib16_prof *p, FILE *f, int top)
+{
+	struct ib16_prof_func *sorted;
+	uint64_t total, best;
+	int x, y, hot[16], nhot;
+	char where[64];
+
+	prof_totals(p);
+	total = p->bank_cycles[0] + p->bank_cycles[1];
+	if (!total) {
+		total = 1;
+	}
+	fprintf(f, "\nprofile: %d functions, %d call paths", p->nfuncs, p->nnodes - 1);
+	if (p->lost) {
+		fprintf(f, ", %" PRIu64 " calls past the %d deep shadow stack not tracked", p->lost, IB16_PROF_MAX_DEPTH);
+	}
+	fprintf(f, "\n  %" PRIu64 " IRQs, %" PRIu64 " cycles in ISRs (%.2f%%), %.1f cycles/IRQ, longest %" PRIu64 "\n",
+		p->irqs, p->irq_cycles, 100.0 * p->irq_cycles / total, p->irqs ? (double)p->irq_cycles / p->irqs : 0.0, p->irq_max);
+	fprintf(f, "  %" PRIu64 " cycles in the app bank, %" PRIu64 " in the IRQ bank (%.2f%%)\n",
+		p->bank_cycles[0], p->bank_cycles[1], 100.0 * p->bank_cycles[1] / total);
+
+	sorted = malloc((p->nfuncs + 1) * sizeof *sorted);
+	memcpy(sorted, p->funcs, p->nfuncs * sizeof *sorted);
+	qsort(sorted, p->nfuncs, sizeof *sorted, cmp_self);
+	fprintf(f, "\n  function                 addr        calls           self   %%self          total  %%total\n");
+	for (x = 0; x < p->nfuncs && x < top && sorted[x].self; x++) {
+		fprintf(f, "  %-24.24s %04X %12" PRIu64 " %14" PRIu64 " %6.2f%% %14" PRIu64 " %6.2f%%\n",
+			sorted[x].name, sorted[x].addr, sorted[x].calls, sorted[x].self, 100.0 * sorted[x].self / total,
+			sorted[x].total, 100.0 * sorted[x].total / total);
+	}
+	free(sorted);
+
+	// hottest instructions, a few passes over the PCs beats sorting 64K counters
+	nhot = top < 16 ? top : 16;
+	for (y = 0; y < nhot; y++) {
+		hot[y] = -1;
+		best = 0;
+		for (x = 0; x < 65536; x++) {
+			if (p->cycles[x] > best && (!y || p->cycles[x] < p->cycles[hot[y - 1]] ||
+				(p->cycles[x] == p->cycles[hot[y - 1]] && x > hot[y - 1]))) {
+				best = p->cycles[x];
+				hot[y] = x;
+			}
+		}
+		if (hot[y] < 0) {
+			break;
+		}
+	}
+	fprintf(f, "\n  instruction                       addr        count         cycles %%cycles\n");
+	for (x = 0; x < y; x++) {
+		prof_where(p, hot[x], where);
+		fprintf(f, "  %-32.32s %04X %12" PRIu64 " %14" PRIu64 " %6.2f%%\n",
+			where, hot[x], p->count[hot[x]], p->cycles[hot[x]], 100.0 * p->cycles[hot[x]] / total);
+	}
+}
+
+// name.lst -> name<ext>, anything else gets ext appended
+static char *prof_fname(const char *fname, const char *ext)
+{
+	char *s;
+	int n = strlen(fname);
+
+	s = malloc(n + strlen(ext) + 1);
+	strcpy(s, fname);
+	if (n > 4 && !strcmp(fname + n - 4, ".lst")) {
+		s[n - 4] = 0;
+	}
+	strcat(s, ext);
+	return s;
+}
+
+// write every listing back out with count/cycles/% columns as <name>.prof.lst and the
+// call stacks of the first as <name>.folded (flamegraph.pl's collapsed format, in cycles)
+void ib16_prof_write(struct ib16_prof *p, struct ib16_cpu *m)
+{
+	FILE *in, *out;
+	char line[512], name[256], *fname;
+	int x, y, addr, path[IB16_PROF_MAX_DEPTH + 1];
+	uint64_t total = p->bank_cycles[0] + p->bank_cycles[1];
+
+	for (x = 0; x < p->nlists; x++) {
+		in = fopen(p->lists[x], "r");
+		fname = prof_fname(p->lists[x], ".prof.lst");
+		out = fopen(fname, "w");
+		if (!in || !out) {
+			fprintf(stderr, "Could not write '%s'\n", fname);
+			exit(-1);
+		}
+		fprintf(out, "# %" PRIu64 " instructions, %" PRIu64 " cycles\n", m->insns, m->cycles);
+		fprintf(out, "#      count       cycles %%cycles\n");
+		while (fgets(line, sizeof line, in)) {
+			addr = parse_list_line(line, name, sizeof name);
+			if (addr >= 0 && p->count[addr]) {
+				fprintf(out, "%12" PRIu64 " %12" PRIu64 " %6.2f%% %s", p->count[addr], p->cycles[addr],
+					total ? 100.0 * p->cycles[addr] / total : 0.0, line);
+			} else {
+				fprintf(out, "%34s%s", "", line);
+			}
+		}
+		fclose(in);
+		fclose(out);
+		fprintf(stderr, "  wrote %s\n", fname);
+		free(fname);
+	}
+
+	if (!p->nlists) {
+		return;
+	}
+	fname = prof_fname(p->lists[0], ".folded");
+	out = fopen(fname, "w");
+	if (!out) {
+		fprintf(stderr, "Could not write '%s'\n", fname);
+		exit(-1);
+	}
+	for (x = 1; x < p->nnodes; x++) {
+		if (!p->nodes[x].self) {
+			continue;
+		}
+		for (y = 0, addr = x; addr && y <= IB16_PROF_MAX_DEPTH; addr = p->nodes[addr].parent) {
+			path[y++] = addr;
+		}
+		while (y--) {
+			fprintf(out, "%s%s", p->funcs[p->nodes[path[y]].func].name, y ? ";" : "");
+		}
+		fprintf(out, " %" PRIu64 "\n", p->nodes[x].self);
+	}
+	fclose(out);
+	fprintf(stderr, "  wrote %s\n", fname);
+	free(fname);
+}
@@ -0,0 +1,73 @@
+// IttyBitty (ib16) instruction level profiler for ib16_sim
+//
+// Hooks ib16_cpu's switch engine and keeps per-PC execution counts/cycles
+// plus a shadow call stack that follows LCALL/RET (matched on the stack
+// pointer so code that pops its own return address does not desync it),
+// IRQ entry/RETI and the SRES/AJMPR resets.  Function names come from the
+// labels in ib16_as --list output.
+#ifndef IB16_PROF_H
+#define IB16_PROF_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "ib16_cpu.h"
+
+#define IB16_PROF_MAX_LISTS		8
+#define IB16_PROF_MAX_DEPTH		256
+
+// one node per distinct call path, node 0 is the root above the entry points
+struct ib16_prof_node {
+	int parent, child, sibling;
+	int func;
+	uint64_t self, total;
+};
+
+struct ib16_prof_func {
+	uint16_t addr;
+	const char *name;
+	uint64_t calls, self, total;
+};
+
+struct ib16_prof_frame {
+	int node;
+	int irq;						// entered by an IRQ, left by RETI
+	uint16_t sp;					// SP before the LCALL pushed its return address
+	uint64_t start;
+};
+
+struct ib16_prof {
+	// per-PC (byte address) counters
+	uint64_t count[65536], cycles[65536];
+
+	// labels from the listings, label[addr] is the last one placed there
+	char *label[65536];
+	const char *lists[IB16_PROF_MAX_LISTS];
+	int nlists;
+
+	// call tree
+	struct ib16_prof_node *nodes;
+	int nnodes, maxnodes;
+	struct ib16_prof_func *funcs;
+	int nfuncs, maxfuncs;
+	int func_at[65536];				// func index + 1, 0 == none yet
+
+	// shadow stack, stack[0] is the entry point we started from
+	struct ib16_prof_frame stack[IB16_PROF_MAX_DEPTH];
+	int depth;
+	uint64_t lost;					// frames dropped because the stack was full
+
+	// IRQ accounting
+	uint64_t irq_seen;				// m->irq_count the last time we looked
+	uint64_t irqs, irq_cycles, irq_max;
+	uint64_t bank_cycles[2];		// cycles spent in the app/IRQ register bank
+	uint8_t bank;
+};
+
+struct ib16_prof *ib16_prof_new(void);
+void ib16_prof_free(struct ib16_prof *p);
+void ib16_prof_listing(struct ib16_prof *p, const char *fname);
+void ib16_prof_attach(struct ib16_prof *p, struct ib16_cpu *m);
+void ib16_prof_report(struct ib16_prof *p, FILE *f, int top);
+void ib16_prof_write(struct ib16_prof *p, struct ib16_cpu *m);
+
+#endif
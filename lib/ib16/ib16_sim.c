@@ -0,0 +1,387 @@
+/* Cycle counting instruction set simulator for the ittybitty */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include "ib16_cpu.h"
+#include "ib16_prof.h"
+
+static double time_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// CRC16-CCITT (poly 1021, init FFFF) like the boot ROM and upload.c
+static uint16_t crc16(const uint8_t *p, int len)
+{
+	uint16_t crc = 0xFFFF;
+	int x;
+
+	while (len--) {
+		crc ^= *p++ << 8;
+		for (x = 0; x < 8; x++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+static uint8_t *read_file(const char *fname, size_t *len)
+{
+	FILE *f;
+	uint8_t *buf = NULL;
+	size_t n, size = 0;
+
+	f = strcmp(fname, "-") ? fopen(fname, "rb") : stdin;
+	if (!f) {
+		fprintf(stderr, "Could not open UART input file '%s'\n", fname);
+		exit(-1);
+	}
+	*len = 0;
+	do {
+		if (*len == size) {
+			size = size ? size * 2 : 4096;
+			buf = realloc(buf, size);
+		}
+		n = fread(buf + *len, 1, size - *len, f);
+		*len += n;
+	} while (n);
+	if (f != stdin) {
+		fclose(f);
+	}
+	return buf;
+}
+
+static void dump_screen(struct ib16_cpu *m)
+{
+	int x, y;
+	uint8_t ch;
+
+	printf("\n+--------------------------------------------------------------------------------+\n");
+	for (y = 0; y < 25; y++) {
+		printf("|");
+		for (x = 0; x < 80; x++) {
+			ch = m->mem[IB16_TEXT_MEM_BOT + y * 80 + x];
+			putchar((ch >= 0x20 && ch < 0x7F) ? ch : (ch ? '.' : ' '));
+		}
+		printf("|\n");
+	}
+	printf("+--------------------------------------------------------------------------------+\n");
+}
+
+static void print_stats(struct ib16_cpu *m, double t)
+{
+	int x;
+
+	fprintf(stderr, "\nib16_sim: %s at PC=%04x", ib16_stop_names[m->stop], m->pc);
+	if (m->stop == IB16_BUS_HANG || m->stop == IB16_RX_EMPTY) {
+		fprintf(stderr, " (address %04x)", m->stop_addr);
+	}
+	fprintf(stderr, "\n");
+	fprintf(stderr, "  %" PRIu64 " instructions, %" PRIu64 " cycles (%.3f ms at %d MHz), %.3f CPI\n",
+		m->insns, m->cycles, m->cycles / (m->cfg.freq_mhz * 1000.0), m->cfg.freq_mhz,
+		m->insns ? (double)m->cycles / m->insns : 0.0);
+	fprintf(stderr, "  host %.3f ms, %.1f M instructions/s\n", t, t > 0 ? m->insns / (t * 1000.0) : 0.0);
+	fprintf(stderr, "  %" PRIu64 " IRQs taken, %" PRIu64 " cycles stalled on the UART\n", m->irq_count, m->stall_cycles);
+	if (m->rx_dropped) {
+		fprintf(stderr, "  %" PRIu64 " UART RX bytes dropped, the %d byte FIFO was full\n", m->rx_dropped, IB16_UART_FIFO_DEPTH);
+	}
+	fprintf(stderr, "  SP=%03x SREG=%02x RI=%02x WI=%02x %s bank\n",
+		m->sp, m->sreg, m->ri, m->wi, m->mask_irq ? "IRQ" : "app");
+	fprintf(stderr, "\n  class       count         cycles   cyc/ins  %%cycles\n");
+	for (x = 0; x < 16; x++) {
+		if (m->class_count[x]) {
+			fprintf(stderr, "  %-6s %12" PRIu64 " %14" PRIu64 " %9.2f %7.2f%%\n",
+				ib16_opcode_names[x], m->class_count[x], m->class_cycles[x],
+				(double)m->class_cycles[x] / m->class_count[x],
+				100.0 * m->class_cycles[x] / m->cycles);
+		}
+	}
+}
+
+// command line, images are loaded in argv order so --org applies to the ones after it
+struct sim_options {
+	int argc;
+	char **argv;
+	struct ib16_config cfg;
+	int boot, legacy, boot_div, screen, quiet, bench, threaded, nprofile;
+	uint64_t max_insns, max_cycles;
+	double max_ms, rx_delay;
+	char *rom, *uart_in;
+	char *profile[IB16_PROF_MAX_LISTS];
+};
+
+// build a machine in its power on state, returns the UART input buffer
+static uint8_t *sim_setup(struct ib16_cpu *m, struct sim_options *o)
+{
+	int i, p, image_len = 0;
+	uint16_t org = 0, crc;
+	uint8_t *rx = NULL, *in;
+	size_t rx_len = 0, in_len;
+
+	ib16_init(m, &o->cfg);
+	if (o->rom) {
+		ib16_load_image(m, o->rom, strstr(o->rom, ".hex") != NULL, o->cfg.boot_rom_addr);
+	}
+	for (i = 1; i < o->argc; i++) {
+		if (!strcmp(o->argv[i], "--org")) {
+			org = strtol(o->argv[++i], NULL, 16);
+		} else if (!strcmp(o->argv[i], "--bin") || !strcmp(o->argv[i], "--hex")) {
+			image_len = ib16_load_image(m, o->argv[i+1], o->argv[i][2] == 'h', org);
+			++i;
+		}
+	}
+
+	if (o->boot) {
+		// run the boot ROM and feed it the app the way upload.c does, the host
+		// swallows the ROM's replies (ACK/NAK per frame or the legacy echo)
+		if (!m->rom_loaded) {
+			fprintf(stderr, "--boot requires a --rom image\n");
+			exit(-1);
+		}
+		image_len = (image_len + 255) & ~255;
+		if (o->legacy) {
+			rx_len = 2 + image_len;
+			rx = malloc(rx_len);
+			rx[0] = 0x5A;
+			rx[1] = image_len / 256;
+			memcpy(rx + 2, m->mem + org, image_len);
+			m->tx_skip = image_len < 256 ? image_len : 256;
+		} else {
+			// optionally switch the baud rate first, then every page in a frame with
+			// no errors so nothing is resent, then the boot frame
+			i = o->boot_div ? 4 : 0;
+			rx_len = i + (image_len / 256) * 261 + 3;
+			rx = malloc(rx_len);
+			if (o->boot_div) {
+				rx[0] = 0xB5;
+				rx[1] = o->boot_div;
+				rx[2] = 0x55;
+				rx[3] = 0xAA;
+			}
+			for (p = 0; p < image_len / 256; p++) {
+				rx[i + p * 261 + 0] = 0xA5;
+				rx[i + p * 261 + 1] = (org >> 8) + p;
+				rx[i + p * 261 + 2] = ~rx[i + p * 261 + 1];
+				memcpy(rx + i + p * 261 + 3, m->mem + org + p * 256, 256);
+				crc = crc16(m->mem + org + p * 256, 256);
+				rx[i + p * 261 + 259] = crc >> 8;
+				rx[i + p * 261 + 260] = crc & 0xFF;
+			}
+			rx[rx_len - 3] = 0xA5;
+			rx[rx_len - 2] = 0xFF;
+			rx[rx_len - 1] = 0x00;
+			m->tx_skip = i + 2 * (image_len / 256 + 1);
+		}
+		memset(m->mem + org, 0, image_len);
+		ib16_invalidate(m, org, image_len);
+	} else {
+		ib16_boot_app(m, org);
+	}
+	if (o->uart_in) {
+		in = read_file(o->uart_in, &in_len);
+		rx = realloc(rx, rx_len + in_len);
+		memcpy(rx + rx_len, in, in_len);
+		rx_len += in_len;
+		free(in);
+	}
+	ib16_set_rx(m, rx, rx_len, o->rx_delay * o->cfg.freq_mhz * 1000.0);
+	return rx;
+}
+
+static double sim_run(struct ib16_cpu *m, struct sim_options *o, int threaded)
+{
+	double t;
+
+	t = time_ms();
+	if (threaded) {
+		ib16_run_threaded(m, o->max_insns, o->max_cycles);
+	} else {
+		ib16_run(m, o->max_insns, o->max_cycles);
+	}
+	return time_ms() - t;
+}
+
+// run the same image on both engines, they must agree on every cycle
+static int sim_bench(struct sim_options *o)
+{
+	struct ib16_cpu *m[2];
+	uint8_t *rx[2];
+	double t[2];
+	int x, same;
+	static const char *names[2] = { "switch", "threaded" };
+
+	for (x = 0; x < 2; x++) {
+		m[x] = calloc(1, sizeof *m[x]);
+		rx[x] = sim_setup(m[x], o);
+		t[x] = sim_run(m[x], o, x);
+	}
+	same = m[0]->cycles == m[1]->cycles && m[0]->insns == m[1]->insns && m[0]->pc == m[1]->pc &&
+		m[0]->sp == m[1]->sp && m[0]->sreg == m[1]->sreg && m[0]->irq_count == m[1]->irq_count &&
+		m[0]->stop == m[1]->stop && !memcmp(m[0]->r, m[1]->r, sizeof m[0]->r) &&
+		!memcmp(m[0]->mem, m[1]->mem, sizeof m[0]->mem) &&
+		!memcmp(m[0]->class_cycles, m[1]->class_cycles, sizeof m[0]->class_cycles);
+
+	printf("engine        instructions          cycles     host ms   M instr/s\n");
+	for (x = 0; x < 2; x++) {
+		printf("%-10s %15" PRIu64 " %15" PRIu64 " %11.3f %11.1f\n", names[x], m[x]->insns, m[x]->cycles,
+			t[x], t[x] > 0 ? m[x]->insns / (t[x] * 1000.0) : 0.0);
+	}
+	printf("threaded is %.2fx the switch interpreter, final state %s (%s at PC=%04x)\n",
+		t[1] > 0 ? t[0] / t[1] : 0.0, same ? "matches" : "DIFFERS", ib16_stop_names[m[1]->stop], m[1]->pc);
+	for (x = 0; x < 2; x++) {
+		free(rx[x]);
+		free(m[x]);
+	}
+	return same ? 0 : 1;
+}
+
+static void usage(const char *name, int rc)
+{
+	fprintf(rc ? stderr : stdout,
+		"Usage: %s [options] [--org addr] --bin|--hex file ...\n"
+		"  --rom file          boot ROM image, loaded at F000\n"
+		"  --boot              start in the ROM and send the app over the UART framed like upload\n"
+		"  --boot-legacy       same with the old 0x5A stream\n"
+		"  --boot-div n        --boot after switching the UART to divisor n\n"
+		"  --uart-in file      bytes to receive ('-' for stdin)\n"
+		"  --uart-delay ms     before the first one arrives\n"
+		"  --ms, --cycles, --insns n   stop after that much simulated time/cycles/instructions\n"
+		"  --freq mhz, --blocks n, --irq-vector addr   SoC config\n"
+		"  --screen            print the text buffer when done\n"
+		"  --quiet             no stats\n"
+		"  --engine threaded|switch, --bench   pick the engine or run both and compare them\n"
+		"  --profile file.lst  per function cycle profile (can be given more than once)\n",
+		name);
+	exit(rc);
+}
+
+int main(int argc, char **argv)
+{
+	int i, rc;
+	double t;
+	struct sim_options o;
+	struct ib16_cpu *m;
+	struct ib16_prof *prof = NULL;
+	uint8_t *rx;
+
+	memset(&o, 0, sizeof o);
+	o.argc = argc;
+	o.argv = argv;
+	o.threaded = 1;
+	o.max_insns = o.max_cycles = UINT64_MAX;
+	ib16_default_config(&o.cfg);
+
+	if (argc < 2) {
+		usage(argv[0], -1);
+	}
+
+	// options pass
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h")) {
+			usage(argv[0], 0);
+		} else if (!strcmp(argv[i], "--boot")) {
+			o.boot = 1;
+			continue;
+		} else if (!strcmp(argv[i], "--boot-legacy")) {
+			o.boot = o.legacy = 1;
+			continue;
+		} else if (!strcmp(argv[i], "--screen")) {
+			o.screen = 1;
+			continue;
+		} else if (!strcmp(argv[i], "--quiet")) {
+			o.quiet = 1;
+			continue;
+		} else if (!strcmp(argv[i], "--bench")) {
+			o.bench = 1;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			fprintf(stderr, "%s requires a parameter\n", argv[i]);
+			exit(-1);
+		}
+		if (!strcmp(argv[i], "--freq")) {
+			o.cfg.freq_mhz = strtol(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "--blocks")) {
+			o.cfg.blocks = strtol(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "--irq-vector")) {
+			o.cfg.irq_vector = strtol(argv[++i], NULL, 16);
+		} else if (!strcmp(argv[i], "--boot-div")) {
+			o.boot = 1;
+			o.boot_div = strtol(argv[++i], NULL, 0) & 0xFF;
+		} else if (!strcmp(argv[i], "--rom")) {
+			o.rom = argv[++i];
+		} else if (!strcmp(argv[i], "--uart-in")) {
+			o.uart_in = argv[++i];
+		} else if (!strcmp(argv[i], "--uart-delay")) {
+			o.rx_delay = strtod(argv[++i], NULL);
+		} else if (!strcmp(argv[i], "--insns")) {
+			o.max_insns = strtoull(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "--cycles")) {
+			o.max_cycles = strtoull(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "--ms")) {
+			o.max_ms = strtod(argv[++i], NULL);
+		} else if (!strcmp(argv[i], "--profile")) {
+			if (o.nprofile == IB16_PROF_MAX_LISTS) {
+				fprintf(stderr, "Too many --profile listings (max %d)\n", IB16_PROF_MAX_LISTS);
+				exit(-1);
+			}
+			o.profile[o.nprofile++] = argv[++i];
+		} else if (!strcmp(argv[i], "--engine")) {
+			++i;
+			if (!strcmp(argv[i], "switch")) {
+				o.threaded = 0;
+			} else if (strcmp(argv[i], "threaded")) {
+				fprintf(stderr, "--engine is either 'switch' or 'threaded'\n");
+				exit(-1);
+			}
+		} else if (strcmp(argv[i], "--bin") && strcmp(argv[i], "--hex") && strcmp(argv[i], "--org")) {
+			fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+			exit(-1);
+		} else {
+			++i;
+		}
+	}
+	// after the loop so --freq applies wherever it is
+	if (o.max_ms > 0) {
+		o.max_cycles = o.max_ms * o.cfg.freq_mhz * 1000.0;
+	}
+
+	if (o.bench) {
+		return sim_bench(&o);
+	}
+
+	m = calloc(1, sizeof *m);
+	rx = sim_setup(m, &o);
+	m->tx = stdout;
+	if (o.nprofile) {
+		// the profiler rides on the switch engine's per instruction hook
+		prof = ib16_prof_new();
+		for (i = 0; i < o.nprofile; i++) {
+			ib16_prof_listing(prof, o.profile[i]);
+		}
+		ib16_prof_attach(prof, m);
+	}
+	t = sim_run(m, &o, o.threaded);
+	fflush(stdout);
+
+	if (o.screen) {
+		dump_screen(m);
+	}
+	if (!o.quiet) {
+		print_stats(m, t);
+	}
+	if (prof) {
+		ib16_prof_report(prof, stderr, 20);
+		ib16_prof_write(prof, m);
+		ib16_prof_free(prof);
+	}
+	rc = (m->stop == IB16_BUS_HANG || m->stop == IB16_REBOOT) ? 1 : 0;
+	free(rx);
+	free(m);
+	return rc;
+}
@@ -7,7 +7,7 @@
 :lrgSetMode
 .IREG mode
 .REG vf_hi
-.reg vf_lo
+.REG vf_lo
 .PUSHREGS
 
 	LDI vf_hi,<VIDEO_FLAG_ADDR
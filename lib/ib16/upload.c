@@ -1,3 +1,16 @@
+// ECP5 boot loader upload
+//
+// upload <port> <file> [--baud rate] [--freq mhz] [--window n] [--legacy]
+//
+// By default the file is sent in 256 byte pages framed as [A5][page][~page][data][CRC hi][CRC lo]
+// (see boot_rom_ecp5.s).  Up to --window frames are streamed ahead of the [06/15][page] replies,
+// only pages that are NAK'ed (or time out) are sent again, and a final page FF frame boots the app.
+// --legacy uses the old 0x5A stream which echoes and checks the first page only.
+//
+// --baud first asks the ROM to switch its UART to F_CLK/divisor with [B5][divisor], which it echoes
+// at 230.4K, then both ends move to the new rate and the [55][AA] sync has to come back.  If either
+// step fails both ends go back to 230.4K and the upload carries on at that rate.  Divisors below
+// MIN_DIV (2M at 50 MHz) overrun the ROM's 64 byte RX FIFO and are refused.
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -6,8 +19,32 @@
 #include <fcntl.h>
 #include <termios.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
 
-static int set_interface_attribs(int fd, int speed) {
+#define BAUD B230400
+#define BAUD_RATE 230400
+#define PAGE_SIZE 256
+#define MAX_PAGES 0xE8					// the ROM only loads pages below the text buffer
+#define FRAME_SIZE (3 + PAGE_SIZE + 2)
+#define ACK 0x06
+#define NAK 0x15
+#define TIMEOUT_MS 500
+#define MAX_TIMEOUTS 10
+#define FREQ_MHZ 50						// ECP5 demo SoC clock, the divisor is F_CLK/baud
+#define SYNC_TIMEOUT_MS 200
+#define MIN_DIV 25						// ib16_sim --boot-div drops RX bytes below 23, the ROM's copy loop can't keep up
+
+static const struct {
+	int rate;
+	speed_t speed;
+} bauds[] = {
+	{ 230400, B230400 }, { 460800, B460800 }, { 500000, B500000 }, { 576000, B576000 },
+	{ 921600, B921600 }, { 1000000, B1000000 }, { 1152000, B1152000 }, { 1500000, B1500000 },
+	{ 2000000, B2000000 }, { 2500000, B2500000 }, { 3000000, B3000000 },
+};
+
+static int set_interface_attribs(int fd, int speed, int vmin, int vtime) {
     struct termios tty;
     if (tcgetattr(fd, &tty) != 0) return -1;
 
@@ -23,28 +60,248 @@ static int set_interface_attribs(int fd, int speed) {
     tty.c_cflag &= ~CSIZE & ~HUPCL;
     tty.c_cflag |= CS8 | CREAD | CLOCAL;
 
-    // Setup timing: non-blocking read with 0.5s timeout
-    tty.c_cc[VMIN]  = 100;
-    tty.c_cc[VTIME] = 100;
+    // Setup timing
+    tty.c_cc[VMIN]  = vmin;
+    tty.c_cc[VTIME] = vtime;
 
     if (tcsetattr(fd, TCSANOW, &tty) != 0) return -1;
     return 0;
 }
 
-int main(int argc, char **argv)
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void write_all(int fd, const uint8_t *buf, int len)
+{
+	while (len > 0) {
+		int r = write(fd, buf, len);
+		if (r < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			printf("\nError writing to UART\n");
+			exit(-1);
+		}
+		buf += r;
+		len -= r;
+	}
+}
+
+// CRC16-CCITT, poly 1021, init FFFF (same as the ROM)
+static uint16_t crc16(const uint8_t *buf, int len)
+{
+	uint16_t crc = 0xFFFF;
+	int x, y;
+	for (x = 0; x < len; x++) {
+		crc ^= (uint16_t)buf[x] << 8;
+		for (y = 0; y < 8; y++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+		}
+	}
+	return crc;
+}
+
+static void send_frame(int fd, int page, const uint8_t *data)
+{
+	uint8_t frame[FRAME_SIZE];
+	uint16_t crc;
+
+	frame[0] = 0xA5;
+	frame[1] = page;
+	frame[2] = ~page;
+	if (data) {
+		memcpy(&frame[3], data, PAGE_SIZE);
+		crc = crc16(data, PAGE_SIZE);
+		frame[3 + PAGE_SIZE] = crc >> 8;
+		frame[4 + PAGE_SIZE] = crc & 0xFF;
+		write_all(fd, frame, FRAME_SIZE);
+	} else {
+		write_all(fd, frame, 3);		// the boot frame has no payload
+	}
+}
+
+// read exactly len bytes, returns 0 on timeout
+static int read_bytes(int fd, uint8_t *buf, int len, int timeout_ms)
+{
+	struct pollfd pfd;
+	int r;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (len > 0) {
+		if (poll(&pfd, 1, timeout_ms) <= 0) {
+			return 0;
+		}
+		r = read(fd, buf, len);
+		if (r > 0) {
+			buf += r;
+			len -= r;
+		}
+	}
+	return 1;
+}
+
+// ask the ROM to switch to rate, returns the rate both ends ended up at
+static int negotiate_baud(int fd, int rate, int freq_mhz)
+{
+	uint8_t buf[2];
+	int div, x;
+	speed_t speed = 0;
+
+	for (x = 0; x < (int)(sizeof bauds / sizeof bauds[0]); x++) {
+		if (bauds[x].rate == rate) {
+			speed = bauds[x].speed;
+		}
+	}
+	div = ((long)freq_mhz * 1000000 + rate / 2) / rate;
+	if (!speed || div < 1 || div > 255) {
+		fprintf(stderr, "Unsupported baud rate %d at %d MHz\n", rate, freq_mhz);
+		exit(-1);
+	}
+	if (div < MIN_DIV) {
+		fprintf(stderr, "%d baud at %d MHz is too fast for the boot ROM, %d is the most it keeps up with\n", rate, freq_mhz, freq_mhz * 1000000 / MIN_DIV);
+		exit(-1);
+	}
+	x = (long)freq_mhz * 1000000 / div;
+	if (abs(x - rate) * 50 > rate) {
+		printf("Warning: divisor %d gives %d baud (%.1f%% off)\n", div, x, 100.0 * (x - rate) / rate);
+	}
+
+	buf[0] = 0xB5;
+	buf[1] = div;
+	write_all(fd, buf, 2);
+	if (!read_bytes(fd, buf, 2, TIMEOUT_MS) || buf[0] != 0xB5 || buf[1] != div) {
+		printf("No reply to the baud request, staying at %d baud\n", BAUD_RATE);
+		tcflush(fd, TCIOFLUSH);
+		return BAUD_RATE;
+	}
+
+	// the ROM switches 2ms after the echo
+	usleep(10000);
+	set_interface_attribs(fd, speed, 0, 0);
+	buf[0] = 0x55;
+	buf[1] = 0xAA;
+	write_all(fd, buf, 2);
+	if (read_bytes(fd, buf, 2, SYNC_TIMEOUT_MS) && buf[0] == 0x55 && buf[1] == 0xAA) {
+		return rate;
+	}
+
+	// the ROM gives up 100ms after switching
+	printf("No sync at %d baud, falling back to %d baud\n", rate, BAUD_RATE);
+	set_interface_attribs(fd, BAUD, 0, 0);
+	usleep(150000);
+	tcflush(fd, TCIOFLUSH);
+	return BAUD_RATE;
+}
+
+// read one [ACK/NAK][page] reply, returns 0 on timeout
+static int read_reply(int fd, int timeout_ms, uint8_t *code, uint8_t *page)
+{
+	static uint8_t reply[2];
+	static int have = 0;
+	struct pollfd pfd;
+	uint8_t b;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	for (;;) {
+		if (poll(&pfd, 1, timeout_ms) <= 0) {
+			return 0;
+		}
+		if (read(fd, &b, 1) != 1) {
+			continue;
+		}
+		if (!have && b != ACK && b != NAK) {
+			continue;			// resync on the reply code
+		}
+		reply[have++] = b;
+		if (have == 2) {
+			have = 0;
+			*code = reply[0];
+			*page = reply[1];
+			return 1;
+		}
+	}
+}
+
+static int upload_framed(int fd, const uint8_t *image, int npages, int window)
+{
+	// per page: 0 == waiting to be sent, 1 == in flight, 2 == acked
+	uint8_t state[MAX_PAGES];
+	int acked = 0, inflight = 0, retries = 0, timeouts = 0;
+	int x;
+	uint8_t code, page;
+
+	memset(state, 0, sizeof state);
+	while (acked < npages) {
+		// fill the window, lowest page first so retried pages go out before new ones
+		for (x = 0; x < npages && inflight < window; x++) {
+			if (state[x] == 0) {
+				send_frame(fd, x, &image[x * PAGE_SIZE]);
+				state[x] = 1;
+				++inflight;
+			}
+		}
+		if (!read_reply(fd, TIMEOUT_MS, &code, &page)) {
+			// lost a byte or a reply, send everything that's in flight again
+			if (++timeouts > MAX_TIMEOUTS) {
+				printf("\nUpload timed out with %d of %d pages acked\n", acked, npages);
+				return -1;
+			}
+			for (x = 0; x < npages; x++) {
+				if (state[x] == 1) {
+					state[x] = 0;
+					++retries;
+				}
+			}
+			inflight = 0;
+			continue;
+		}
+		timeouts = 0;
+		if (page >= npages || state[page] == 0 || (code == ACK && state[page] == 2)) {
+			continue;			// stale reply for a page we've already resent
+		}
+		if (code == ACK) {
+			state[page] = 2;
+			--inflight;
+			++acked;
+			printf(".");
+			fflush(stdout);
+		} else {
+			// a NAK for an acked page means a later (resent or falsely matched) frame for it went bad, send it again
+			if (state[page] == 2) {
+				--acked;
+			} else {
+				--inflight;
+			}
+			state[page] = 0;
+			++retries;
+			printf("!");
+			fflush(stdout);
+		}
+	}
+
+	// boot
+	for (x = 0; x < MAX_TIMEOUTS; x++) {
+		send_frame(fd, 0xFF, NULL);
+		if (read_reply(fd, TIMEOUT_MS, &code, &page) && code == ACK && page == 0xFF) {
+			return retries;
+		}
+	}
+	printf("\nNo ACK for the boot frame\n");
+	return -1;
+}
+
+static int upload_legacy(int fd, FILE *f, int size)
 {
-	FILE *f;
 	int ch;
 	int bytes = 0;
-	int size;
 	uint8_t buf;
-	
-    int fd = open(argv[1], O_RDWR | O_NOCTTY);
-    if (fd < 0) { perror("Open port"); return 1; }
-    set_interface_attribs(fd, B230400);
-	tcflush(fd, TCIOFLUSH);
-	usleep(50000);
-	
+
 	// send magic byte
 	buf = 0x5A;
 	if (write(fd, &buf, 1) != 1) {
@@ -53,11 +310,6 @@ int main(int argc, char **argv)
 	}
 	tcdrain(fd);
 
-	f = fopen(argv[2], "r");
-	fseek(f, 0, SEEK_END);
-	size = ftell(f);
-	fseek(f, 0, SEEK_SET);
-
 	// send # of pages to program
 	buf = size/256;
 	if (write(fd, &buf, 1) != 1) {
@@ -96,9 +348,90 @@ int main(int argc, char **argv)
 			break;
 		}
 	}
-	printf("\nDone\n");
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f;
+	int size, npages, retries, sent;
+	int legacy = 0, window = 8, rate = BAUD_RATE, freq_mhz = FREQ_MHZ;
+	int x;
+	uint8_t *image;
+	double t;
+
+	if (argc < 3) {
+		printf("Usage: %s <port> <file> [--baud rate] [--freq mhz] [--window n] [--legacy]\n", argv[0]);
+		return 1;
+	}
+	for (x = 3; x < argc; x++) {
+		if (!strcmp(argv[x], "--legacy")) {
+			legacy = 1;
+		} else if (!strcmp(argv[x], "--baud") && x + 1 < argc) {
+			rate = strtoul(argv[++x], NULL, 0);
+		} else if (!strcmp(argv[x], "--freq") && x + 1 < argc) {
+			freq_mhz = strtoul(argv[++x], NULL, 0);
+		} else if (!strcmp(argv[x], "--window") && x + 1 < argc) {
+			window = strtoul(argv[++x], NULL, 0);
+			if (window < 1) {
+				window = 1;
+			}
+		} else {
+			fprintf(stderr, "Unknown option: %s\n", argv[x]);
+			return 1;
+		}
+	}
+
+	int fd = open(argv[1], O_RDWR | O_NOCTTY);
+	if (fd < 0) { perror("Open port"); return 1; }
+	if (legacy) {
+		set_interface_attribs(fd, BAUD, 100, 100);
+	} else {
+		set_interface_attribs(fd, BAUD, 0, 0);		// reads are paced by poll()
+	}
+	tcflush(fd, TCIOFLUSH);
+	usleep(50000);
+
+	f = fopen(argv[2], "r");
+	if (!f) {
+		perror("Open file");
+		return 1;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	t = now();
+	if (!legacy && rate != BAUD_RATE) {
+		rate = negotiate_baud(fd, rate, freq_mhz);
+	}
+	if (legacy) {
+		upload_legacy(fd, f, size);
+		retries = 0;
+		sent = size;
+	} else {
+		npages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+		if (npages > MAX_PAGES) {
+			fprintf(stderr, "%s is too large (%d bytes, max %d)\n", argv[2], size, MAX_PAGES * PAGE_SIZE);
+			exit(-1);
+		}
+		image = calloc(npages ? npages : 1, PAGE_SIZE);
+		if (fread(image, 1, size, f) != (size_t)size) {
+			fprintf(stderr, "Error reading %s\n", argv[2]);
+			exit(-1);
+		}
+		retries = upload_framed(fd, image, npages, window);
+		free(image);
+		if (retries < 0) {
+			exit(-1);
+		}
+		sent = npages * PAGE_SIZE;
+	}
+	tcdrain(fd);
+	t = now() - t;
+	printf("\nDone: %d bytes in %.2f s, %.0f bytes/s effective (line rate %d bytes/s), %d retries\n",
+		sent, t, t > 0 ? sent / t : 0.0, rate / 10, retries);
 	fclose(f);
 	close(fd);
 	return 0;
 }
-	
@@ -501,6 +501,7 @@ begin
 					PC <= PC + 12'd2;
 					mem_addr <= PC + 12'd2;
 					mem_addr_next <= PC + 12'd3;
+					state <= FETCH;
 				end else begin
 					// not skipping
 					instruct <= instruct_imm;
@@ -0,0 +1,18 @@
+; SBIT test for useq_sim (make test_sim.pass), pushes 05 06 06 into the FIFO
+; covering a skip, a not taken skip (the next byte runs from the SBIT's fetch)
+; and two skips back to back
+.ORG 0
+	LDI 05
+	SBIT 0, 1			; A[0] is 1, skip the INC
+	INC
+	ST F				; 05
+	SBIT 1, 1			; A[1] is 0, the INC runs
+	INC
+	ST F				; 06
+	SBIT 1, 1			; A[1] is 1, skip the NOT
+	NOT
+	SBIT 7, 0			; A[7] is 0, skip the CLR
+	CLR
+	ST F				; 06
+:DONE
+	JMP DONE
@@ -7,33 +7,75 @@
 
 #define PROG_SIZE 4096
 
-// the entire program can only be upto PROG_SIZE bytes so just make a simple map here
-struct {
-	uint8_t opcode;
-	char label[64];
-	char tgt[64];
-	int use_top_half;
-	int use_bottom_half;
-	int line_number;
+// strings (labels, targets, source lines) are carved out of a chunked arena
+// that is freed along with the compiler state once a file has been emitted
+#define ARENA_CHUNK 16384
+struct arena {
+	struct arena *next;
+	size_t used, size;
+	char data[];
+};
+
+// a symbol (.EQU/--define constant or a program label)
+struct symbol {
+	char *label;
+	uint16_t value;			// constant value (symbols) or address (labels)
+};
+
+// an open addressed (linear probe) hash table of symbols keyed on the label,
+// entries live in syms[] so their index is stable across rehashing
+#define SYM_EMPTY	-1
+struct symtab {
+	struct symbol *syms;
+	int nsyms, maxsyms;
+	int *hash;
+	int hsize;				// power of 2
+};
+
+// a byte whose value depends on a label or symbol, patched by resolve_labels()
+#define HALF_NONE	0
+#define HALF_TOP	1		// '<' the target >> 8
+#define HALF_BOTTOM	2		// '>' the target & 0xFF
+struct reloc {
+	uint16_t addr;
 	int opidx;
-	char line[512];
-} program[PROG_SIZE];
+	int half;
+	char *tgt;
+	char *fname;
+	int line_number;
+};
 
-struct {
-	char label[64];
-	uint8_t value;
-} symbols[PROG_SIZE];
+// everything about assembling one program, each input file gets a fresh one
+struct compiler_state {
+	char *cur_filename;
+	int line_number;
+	uint16_t PC;
+	uint16_t bin_start;
 
-int line_number = 1;
-uint16_t PC = 0;
-uint16_t bin_start = 0;
+	uint8_t image[PROG_SIZE];
+	int line_of[PROG_SIZE];		// line that programmed the byte, -1 if free
+	char *file_of[PROG_SIZE];
+	char *text_of[PROG_SIZE];	// source line of an opcode, only kept for --list
+
+	struct reloc *relocs;
+	int nrelocs, maxrelocs;
+
+	struct symtab symbols;		// .EQU/--define constants
+	struct symtab labels;		// ':' labels
+
+	struct arena *arena;
+	int keep_text;
+	int inc_depth;
+};
+
+void compile_file(struct compiler_state *state, char *fname);
 
 /* bare bones assembler, allows whitespace and comments with ';'
- * 
+ *
  * a line starts with either ".ORG %x" to reset the orgiin or
  * ":%s" to denote a label or anything else to denote an instruction
- * 
- * There's three types of opcodes Xr where r is a 4-bit imm, 
+ *
+ * There's three types of opcodes Xr where r is a 4-bit imm,
  * or Xsb where s is a 3-bit imm and b is a 1-bit imm,
  * or XX where it's just a full byte with no operands
  */
@@ -56,11 +98,11 @@ const struct {
 	{ "LD", 0x00, E1_OP_FMT_R },
 	{ "ST", 0x10, E1_OP_FMT_R },
 	{ "SETB", 0x20, E1_OP_FMT_SB },
-	{ "ADD", 0x30, E1_OP_FMT_R }, 
-	{ "SUB", 0x40, E1_OP_FMT_R }, 
-	{ "EOR", 0x50, E1_OP_FMT_R }, 
-	{ "AND", 0x60, E1_OP_FMT_R }, 
-	{ "OR" , 0x70, E1_OP_FMT_R }, 
+	{ "ADD", 0x30, E1_OP_FMT_R },
+	{ "SUB", 0x40, E1_OP_FMT_R },
+	{ "EOR", 0x50, E1_OP_FMT_R },
+	{ "AND", 0x60, E1_OP_FMT_R },
+	{ "OR" , 0x70, E1_OP_FMT_R },
 
 	{ "LDI", 0x80, E1_OP_FMT_IMM },
 	{ "ADDI", 0x81, E1_OP_FMT_IMM },
@@ -78,7 +120,7 @@ const struct {
 	{ "LDM", 0x8D, E1_OP_FMT_FULL },
 	{ "STM", 0x8E, E1_OP_FMT_FULL },
 	{ "LDMIND", 0x8F, E1_OP_FMT_FULL },
-		
+
 	{ "INC", 0x90, E1_OP_FMT_FULL },
 	{ "DEC", 0x91, E1_OP_FMT_FULL },
 	{ "ASL", 0x92, E1_OP_FMT_FULL },
@@ -95,7 +137,7 @@ const struct {
 	{ "SIEQ", 0x9D, E1_OP_FMT_FULL },
 	{ "SILT", 0x9E, E1_OP_FMT_FULL },
 	{ "NOP", 0x9F, E1_OP_FMT_FULL },
-	
+
 	{ "JMP", 0xA0, E1_OP_FMT_IMM12 },
 	{ "CALL", 0xB0, E1_OP_FMT_IMM12 },
 	{ "JZ", 0xC0, E1_OP_FMT_IMM12 },
@@ -146,113 +188,281 @@ void consume_label(char *dest, char **s)
 	*dest++ = 0;
 }
 
-void compile_exec1(char *line)
+void consume_fname(char *dest, char **s)
 {
-	int x;
+	while (isalnum(**s) || **s == '/' || **s == '.' || **s == '_' || **s == '-') {
+		*dest++ = *((*s)++);
+	}
+	*dest++ = 0;
+}
+
+// copy len characters of s (plus a NUL) into the arena
+char *arena_strdup(struct compiler_state *state, const char *s, int len)
+{
+	struct arena *a = state->arena;
+	char *r;
+
+	if (!a || a->used + len + 1 > a->size) {
+		size_t size = (len + 1) > ARENA_CHUNK ? (len + 1) : ARENA_CHUNK;
+		a = malloc(sizeof *a + size);
+		if (!a) {
+			fprintf(stderr, "Out of memory for arena\n");
+			exit(-1);
+		}
+		a->next = state->arena;
+		a->used = 0;
+		a->size = size;
+		state->arena = a;
+	}
+	r = &a->data[a->used];
+	memcpy(r, s, len);
+	r[len] = 0;
+	a->used += len + 1;
+	return r;
+}
+
+// FNV-1a over the label
+static uint32_t hash_label(const char *s)
+{
+	uint32_t h = 2166136261UL;
+	while (*s) {
+		h = (h ^ (uint8_t)*s++) * 16777619UL;
+	}
+	return h;
+}
+
+static void symtab_rehash(struct symtab *t, int hsize)
+{
+	int x, y;
+	free(t->hash);
+	t->hsize = hsize;
+	t->hash = malloc(hsize * sizeof *t->hash);
+	if (!t->hash) {
+		fprintf(stderr, "Out of memory for symbol table\n");
+		exit(-1);
+	}
+	for (x = 0; x < hsize; x++) {
+		t->hash[x] = SYM_EMPTY;
+	}
+	// re-insert in declaration order so the first declared duplicate is still found first
+	for (x = 0; x < t->nsyms; x++) {
+		y = hash_label(t->syms[x].label) & (hsize - 1);
+		while (t->hash[y] != SYM_EMPTY) {
+			y = (y + 1) & (hsize - 1);
+		}
+		t->hash[y] = x;
+	}
+}
+
+// the first declared symbol called label
+struct symbol *symtab_find(struct symtab *t, const char *label)
+{
+	int y, idx;
+	if (!t->hsize) {
+		return NULL;
+	}
+	y = hash_label(label) & (t->hsize - 1);
+	while ((idx = t->hash[y]) != SYM_EMPTY) {
+		if (!strcmp(t->syms[idx].label, label)) {
+			return &t->syms[idx];
+		}
+		y = (y + 1) & (t->hsize - 1);
+	}
+	return NULL;
+}
+
+// append a new symbol, duplicates are allowed but only the first declared one is found by symtab_find
+struct symbol *symtab_insert(struct compiler_state *state, struct symtab *t, const char *label, uint16_t value)
+{
+	int y, idx;
+	if (t->nsyms == t->maxsyms) {
+		t->maxsyms = t->maxsyms ? t->maxsyms * 2 : 64;
+		t->syms = realloc(t->syms, t->maxsyms * sizeof *t->syms);
+		if (!t->syms) {
+			fprintf(stderr, "Out of memory for symbol table\n");
+			exit(-1);
+		}
+	}
+	// keep the load under 50%
+	if ((t->nsyms + 1) * 2 > t->hsize) {
+		symtab_rehash(t, t->hsize ? t->hsize * 2 : 128);
+	}
+	idx = t->nsyms++;
+	t->syms[idx].label = arena_strdup(state, label, strlen(label));
+	t->syms[idx].value = value;
+
+	// new entries go at the end of their probe chain so an earlier declared duplicate keeps precedence
+	y = hash_label(label) & (t->hsize - 1);
+	while (t->hash[y] != SYM_EMPTY) {
+		y = (y + 1) & (t->hsize - 1);
+	}
+	t->hash[y] = idx;
+	return &t->syms[idx];
+}
+
+// a fresh compiler state with the --define's applied
+struct compiler_state *new_state(int argc, char **argv, int keep_text)
+{
+	struct compiler_state *state;
+	char label[256], *p;
+	uint16_t v;
+	int i, x;
+
+	state = calloc(1, sizeof *state);
+	if (!state) {
+		fprintf(stderr, "Out of memory for compiler state\n");
+		exit(-1);
+	}
+	for (x = 0; x < PROG_SIZE; x++) {
+		state->image[x] = 0x9F; // NOP
+		state->line_of[x] = -1;
+	}
+	state->line_number = 1;
+	state->keep_text = keep_text;
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--define")) {
+			if (i + 2 < argc) {
+				p = argv[i+1];
+				consume_label(label, &p);
+				sscanf(argv[i+2], "%"SCNx16, &v);
+				symtab_insert(state, &state->symbols, label, v);
+				i += 2;
+			} else {
+				fprintf(stderr, "--define requires two parameters\n");
+				exit(-1);
+			}
+		}
+	}
+	return state;
+}
+
+void free_state(struct compiler_state *state)
+{
+	struct arena *a, *n;
+
+	for (a = state->arena; a; a = n) {
+		n = a->next;
+		free(a);
+	}
+	free(state->symbols.syms);
+	free(state->symbols.hash);
+	free(state->labels.syms);
+	free(state->labels.hash);
+	free(state->relocs);
+	free(state);
+}
+
+// the opcode byte at PC was programmed by the current line
+static void claim_byte(struct compiler_state *state, uint16_t addr)
+{
+	state->line_of[addr] = state->line_number;
+	state->file_of[addr] = state->cur_filename;
+}
+
+// an operand that's a label or symbol ('<' for the top half, '>' for the bottom) is patched later
+static int consume_target(struct compiler_state *state, uint16_t addr, int opidx, char **line)
+{
+	struct reloc *r;
+	char label[256];
+
+	if (!islabel(*line)) {
+		return 0;
+	}
+	if (state->nrelocs == state->maxrelocs) {
+		state->maxrelocs = state->maxrelocs ? state->maxrelocs * 2 : 256;
+		state->relocs = realloc(state->relocs, state->maxrelocs * sizeof *state->relocs);
+		if (!state->relocs) {
+			fprintf(stderr, "Out of memory for relocations\n");
+			exit(-1);
+		}
+	}
+	r = &state->relocs[state->nrelocs++];
+	r->addr = addr;
+	r->opidx = opidx;
+	r->half = HALF_NONE;
+	if (**line == '<') {
+		r->half = HALF_TOP;
+		++(*line);
+	} else if (**line == '>') {
+		r->half = HALF_BOTTOM;
+		++(*line);
+	}
+	consume_label(label, line);
+	r->tgt = arena_strdup(state, label, strlen(label));
+	r->fname = state->cur_filename;
+	r->line_number = state->line_number;
+	return 1;
+}
+
+void compile_exec1(struct compiler_state *state, char *line)
+{
+	int x, n;
+	uint16_t PC = state->PC, PC1 = (state->PC + 1) & (PROG_SIZE - 1);
+
 	for (x = 0; e1_opcodes[x].opname; x++) {
-		if (!memcmp(line, e1_opcodes[x].opname, strlen(e1_opcodes[x].opname)) && iswhitespace(&line[strlen(e1_opcodes[x].opname)])) {
+		n = strlen(e1_opcodes[x].opname);
+		if (n && !memcmp(line, e1_opcodes[x].opname, n) && (!line[n] || iswhitespace(&line[n]))) {
 			// matched an opcode
-			line += strlen(e1_opcodes[x].opname);
+			line += n;
 			consume_whitespace(&line);
-			program[PC].opcode = e1_opcodes[x].opcode;
-			program[PC].opidx = x;
-			if (program[PC].line_number == -1) {
-				program[PC].line_number = line_number;
+			state->image[PC] = e1_opcodes[x].opcode;
+			if (state->line_of[PC] == -1) {
+				claim_byte(state, PC);
 			} else {
-				printf("line %d: byte location %x already was programmed on line %d\n", line_number, PC, program[PC].line_number);
+				printf("%s:%d: byte location %x already was programmed on line %d\n", state->cur_filename, state->line_number, PC, state->line_of[PC]);
 				exit(-1);
 			}
 			switch (e1_opcodes[x].fmt) {
 				case E1_OP_FMT_IMMS: // 12 => 8-bit imm
-					program[PC+1].line_number = line_number;
-					if (islabel(line)) {
-						// it's a label
-						if (*line == '<') {
-							program[PC].use_top_half = 1;
-							++line;
-						} else if (*line == '>') {
-							program[PC].use_bottom_half = 1;
-							++line;
-						}
-						consume_label(program[PC].tgt, &line);
-					} else {
+					claim_byte(state, PC1);
+					if (!consume_target(state, PC, x, &line)) {
 						uint16_t r;
 						// it's a value
 						sscanf(line, "%"SCNx16, &r);
-						program[PC+1].opcode = r >> 4;
+						state->image[PC1] = r >> 4;
 					}
 					++PC;
 					break;
 
 				case E1_OP_FMT_IMM12: // 12-bit imm
-					program[PC+1].line_number = line_number;
-					if (islabel(line)) {
-						// it's a label
-						if (*line == '<') {
-							program[PC].use_top_half = 1;
-							++line;
-						} else if (*line == '>') {
-							program[PC].use_bottom_half = 1;
-							++line;
-						}
-						consume_label(program[PC].tgt, &line);
-					} else {
+					claim_byte(state, PC1);
+					if (!consume_target(state, PC, x, &line)) {
 						uint16_t r;
 						// it's a value
 						sscanf(line, "%"SCNx16, &r);
-						program[PC].opcode |= (r >> 8);
-						program[PC+1].opcode = r&0xFF;
+						state->image[PC] |= (r >> 8) & 0xF;
+						state->image[PC1] = r & 0xFF;
 					}
 					++PC;
 					break;
 
 				case E1_OP_FMT_IMM:
-					program[PC+1].line_number = line_number;
-					if (islabel(line)) {
-						// it's a label
-						if (*line == '<') {
-							program[PC].use_top_half = 1;
-							++line;
-						} else if (*line == '>') {
-							program[PC].use_bottom_half = 1;
-							++line;
-						}
-						consume_label(program[PC].tgt, &line);
-					} else {
+					claim_byte(state, PC1);
+					if (!consume_target(state, PC, x, &line)) {
 						uint8_t r;
 						// it's a value
 						sscanf(line, "%"SCNx8, &r);
-						program[PC+1].opcode = r;
+						state->image[PC1] = r;
 					}
 					++PC;
 					break;
 				case E1_OP_FMT_R:
-					if (islabel(line)) {
-						// it's a label
-						if (*line == '<') {
-							program[PC].use_top_half = 1;
-							++line;
-						} else if (*line == '>') {
-							program[PC].use_bottom_half = 1;
-							++line;
-						}
-						consume_label(program[PC].tgt, &line);
-					} else {
+					if (!consume_target(state, PC, x, &line)) {
 						uint8_t r;
 						// it's a value
 						sscanf(line, "%"SCNx8, &r);
 						if (r > 0xF) {
-							printf("line %d: 4-bit r value out of range %x\n", program[PC].line_number, r);
+							printf("%s:%d: 4-bit r value out of range %x\n", state->cur_filename, state->line_number, r);
 							exit(-1);
 						}
-						program[PC].opcode |= (r & 0xF);
+						state->image[PC] |= (r & 0xF);
 					}
 					break;
 				case E1_OP_FMT_SB:
 					{
 						int s, b;
 						sscanf(line, "%d, %d", &s, &b);
-						program[PC].opcode |= ((s & 7) << 1) | (b & 1);
+						state->image[PC] |= ((s & 7) << 1) | (b & 1);
 					}
 					break;
 				case E1_OP_FMT_FULL:
@@ -261,21 +471,21 @@ void compile_exec1(char *line)
 			break;
 		}
 	}
-	
-	++PC;
-	PC &= 0x3FF;
-	if (!PC) {
-		printf("Warning line %d: We've wrapped PC around back to 0\n", program[PC].line_number);
-	}
 	if (!e1_opcodes[x].opname) {
-		printf("Line %d: Malformed line: '%s'\n", line_number, line);
+		printf("%s:%d: Malformed line: '%s'\n", state->cur_filename, state->line_number, line);
 		exit(-1);
 	}
-}	
 
-void compile(char *line)
+	state->PC = (PC + 1) & (PROG_SIZE - 1);
+	if (!state->PC) {
+		printf("Warning %s:%d: We've wrapped PC around back to 0\n", state->cur_filename, state->line_number);
+	}
+}
+
+void compile(struct compiler_state *state, char *line)
 {
-	strcpy(program[PC].line, line);
+	char *text = line;
+
 	// skip leading white space
 	consume_whitespace(&line);
 	if (!*line || *line == ';') {
@@ -285,265 +495,349 @@ void compile(char *line)
 	// is it .ORG ?
 	if (!memcmp(line, ".ORG ", 5)) {
 		line += 5;
-		sscanf(line, "%"SCNx16, &PC);
+		sscanf(line, "%"SCNx16, &state->PC);
+		state->PC &= PROG_SIZE - 1;
 	} else 	if (!memcmp(line, ".BIN_START ", 11)) {
 		line += 11;
-		sscanf(line, "%"SCNx16, &bin_start);
+		sscanf(line, "%"SCNx16, &state->bin_start);
+		state->bin_start &= PROG_SIZE - 1;
 	} else if (!memcmp(line, ".EQU ", 5)) {
-		int x;
+		char label[256];
+		uint16_t v = 0;
 		line += 5;
 		consume_whitespace(&line);
-		for (x = 0; x < PROG_SIZE; x++) {
-			if (symbols[x].label[0] == 0) {
-				consume_label(symbols[x].label, &line);
-				consume_whitespace(&line);
-				sscanf(line, "%"SCNx8, &symbols[x].value);
-				break;
-			}
+		consume_label(label, &line);
+		consume_whitespace(&line);
+		sscanf(line, "%"SCNx16, &v);
+		symtab_insert(state, &state->symbols, label, v);
+	} else if (!memcmp(line, ".INC ", 5)) {
+		char *tmpfname = state->cur_filename;
+		int tmpln = state->line_number;
+		char newfname[512];
+
+		line += 5;
+		consume_whitespace(&line);
+		consume_fname(newfname, &line);
+		if (++(state->inc_depth) > 16) {
+			printf("%s:%d: .INC nested too deeply (recursive include?)\n", state->cur_filename, state->line_number);
+			exit(-1);
 		}
+		compile_file(state, newfname);
+		--(state->inc_depth);
+
+		// resume parent file
+		state->cur_filename = tmpfname;
+		state->line_number = tmpln;
 	} else if (!memcmp(line, ".ALIGN ", 7)) {
 		uint8_t x;
 		line += 7;
 		consume_whitespace(&line);
 		sscanf(line, "%"SCNx8, &x);
 		if (!x) {
-			printf("Line %d: Invalid alignment %x specified\n", line_number, x);
+			printf("%s:%d: Invalid alignment %x specified\n", state->cur_filename, state->line_number, x);
 			exit(-1);
 		}
-		while (PC % x) {
-			++PC;
+		while (state->PC % x) {
+			++(state->PC);
 		}
+		state->PC &= PROG_SIZE - 1;
 	} else if (!memcmp(line, ".DB ", 4)) {
-		if (program[PC].line_number == -1) {
+		if (state->line_of[state->PC] == -1) {
 			line += 4;
 			consume_whitespace(&line);
-			if (islabel(line)) {
-				// it's a label
-				if (*line == '<') {
-					program[PC].use_top_half = 1;
-					++line;
-				} else if (*line == '>') {
-					program[PC].use_bottom_half = 1;
-					++line;
-				}
-				consume_label(program[PC].tgt, &line);
-			} else {
+			if (!consume_target(state, state->PC, 0, &line)) {
 				uint8_t r;
 				// it's a value
 				sscanf(line, "%"SCNx8, &r);
-				program[PC].opcode = r;
+				state->image[state->PC] = r;
+			}
+			claim_byte(state, state->PC);
+			if (state->keep_text) {
+				state->text_of[state->PC] = arena_strdup(state, text, strlen(text));
 			}
-			program[PC].line_number = line_number;
-			program[PC].opidx = 0;
-			++PC;
+			state->PC = (state->PC + 1) & (PROG_SIZE - 1);
 		} else {
-			printf("Line %d: .DB directive on address that was already programmed on line %d\n", line_number, program[PC].line_number);
+			printf("%s:%d: .DB directive on address that was already programmed on line %d\n", state->cur_filename, state->line_number, state->line_of[state->PC]);
 			exit(-1);
 		}
 	} else if (line[0] == ':') {
 		// it's a label
+		char label[256];
 		++line;
-		consume_label(program[PC].label, &line);
+		consume_label(label, &line);
+		symtab_insert(state, &state->labels, label, state->PC);
 	} else {
-		compile_exec1(line);
+		if (state->keep_text) {
+			state->text_of[state->PC] = arena_strdup(state, text, strlen(text));
+		}
+		compile_exec1(state, line);
 	}
 }
 
-int find_target(int x)
+void compile_file(struct compiler_state *state, char *fname)
 {
-	int y;
-	uint8_t d;
+	FILE *f;
+	char linebuf[512];
+	int n;
 
-	for (y = 0; y < PROG_SIZE; y++) {
-		if (!strcmp(program[y].label, program[x].tgt)) {
-			return y;
-		}
+	f = fopen(fname, "r");
+	if (!f) {
+		printf("File '%s' not found!\n", fname);
+		exit(-1);
 	}
-	for (y = 0; y < PROG_SIZE; y++) {
-		if (!strcmp(symbols[y].label, program[x].tgt)) {
-			return symbols[y].value;
+	state->line_number = 1;
+	state->cur_filename = arena_strdup(state, fname, strlen(fname));
+	while (fgets(linebuf, sizeof(linebuf) - 2, f)) {
+		n = strlen(linebuf) - 1;
+		while (n >= 0 && (linebuf[n] == '\r' || linebuf[n] == '\n')) {
+			linebuf[n--] = 0;
 		}
+		compile(state, linebuf);
+		++(state->line_number);
+	}
+	fclose(f);
+}
+
+// labels first, then .EQU symbols, then a plain hex value
+int find_target(struct compiler_state *state, struct reloc *r)
+{
+	struct symbol *sym;
+	uint8_t d;
+
+	if ((sym = symtab_find(&state->labels, r->tgt)) || (sym = symtab_find(&state->symbols, r->tgt))) {
+		return sym->value;
 	}
-	if (sscanf(program[x].tgt, "%"SCNx8, &d) == 1) {
+	if (sscanf(r->tgt, "%"SCNx8, &d) == 1) {
 		return d;
 	}
-	printf("Line %d: Target '%s' not found!\n", program[x].line_number, program[x].tgt);
+	printf("%s:%d: Target '%s' not found!\n", r->fname, r->line_number, r->tgt);
 	exit(-1);
 }
 
-void resolve_exec1(int x)
+void resolve_exec1(struct compiler_state *state, struct reloc *r)
 {
+	int x = r->addr, x1 = (r->addr + 1) & (PROG_SIZE - 1);
 	int y;
-	switch (e1_opcodes[program[x].opidx].fmt) {
+
+	y = find_target(state, r);
+	if (r->half == HALF_TOP) {
+		y >>= 8;
+	} else if (r->half == HALF_BOTTOM) {
+		y &= 0xFF;
+	}
+	switch (e1_opcodes[r->opidx].fmt) {
 		case E1_OP_FMT_R:
-			if (program[x].tgt[0]) {
-				y = find_target(x);
-				if (program[x].use_top_half) {
-					y >>= 8;
-				} else if (program[x].use_bottom_half) {
-					y &= 0xFF;
-				}
-				if (y > 15) {
-					printf("line %d: Invalid 4-bit r-value %x at program offset %2x\n", program[x].line_number, y, x);
-					exit(-1);
-				} 
-				program[x].opcode |= y & 0xF;
+			if (y > 15) {
+				printf("%s:%d: Invalid 4-bit r-value %x at program offset %2x\n", r->fname, r->line_number, y, x);
+				exit(-1);
 			}
+			state->image[x] |= y & 0xF;
 			break;
 		case E1_OP_FMT_IMM12: // relocations (JMP/CALL/etc)
-			if (program[x].tgt[0]) {
-				// jumping to a target 
-				y = find_target(x);
-				if (program[x].use_top_half) {
-					y >>= 8;
-				} else if (program[x].use_bottom_half) {
-					y &= 0xFF;
-				}
-				program[x].opcode |= (y >> 12);
-				program[x+1].opcode = (y & 0xFF);
-			}
+			state->image[x] |= (y >> 8) & 0xF;
+			state->image[x1] = (y & 0xFF);
 			break;
 		case E1_OP_FMT_IMMS: // 12 => 8-bit immediates
-			if (program[x].tgt[0]) {
-				// jumping to a target 
-				y = find_target(x);
-				if (program[x].use_top_half) {
-					y >>= 8;
-				} else if (program[x].use_bottom_half) {
-					y &= 0xFF;
-				}
-				if (y & 0xF) {
-					printf("line %d: Invalid SAI target %x\n", program[x].line_number, y);
-					exit(-1);
-				}
-				program[x+1].opcode = y >> 4;
+			if (y & 0xF) {
+				printf("%s:%d: Invalid SAI target %x\n", r->fname, r->line_number, y);
+				exit(-1);
 			}
+			state->image[x1] = y >> 4;
 			break;
 		case E1_LITERAL:
-			if (program[x].tgt[0]) {
-				// jumping to a target 
-				y = find_target(x);
-				if (program[x].use_top_half) {
-					y >>= 8;
-				} else if (program[x].use_bottom_half) {
-					y &= 0xFF;
-				}
-				program[x].opcode = y;
-			}
+			state->image[x] = y;
 			break;
 		case E1_OP_FMT_IMM: // imm
-			if (program[x].tgt[0]) {
-				// jumping to a target 
-				y = find_target(x);
-				if (program[x].use_top_half) {
-					y >>= 8;
-				} else if (program[x].use_bottom_half) {
-					y &= 0xFF;
-				}
-				program[x+1].opcode = y;
-			}
-			break;
-		case E1_OP_FMT_FULL: // no operand
-		case E1_OP_FMT_SB: //  s,b format
+			state->image[x1] = y;
 			break;
 	}
 }
 
-void resolve_labels(void)
+void resolve_labels(struct compiler_state *state)
 {
 	int x;
-	
-	for (x = 0; x < PROG_SIZE; x++) {
-		resolve_exec1(x);
+
+	for (x = 0; x < state->nrelocs; x++) {
+		resolve_exec1(state, &state->relocs[x]);
 	}
 }
 
-int main(int argc, char **argv)
+void emit_binfile(struct compiler_state *state, char *fname)
 {
-	char outname[128];
-	char linebuf[256];
 	FILE *f;
-	int x, y;
-	
-	if (argc != 2) {
-		printf("Usage: %s input.s\n", argv[0]);
-		return 0;
-	}
-	sprintf(outname, "%s.hex", argv[1]);
-	memset(&program, 0, sizeof program);
-	memset(&symbols, 0, sizeof symbols);
-	
-	for (x = 0; x < PROG_SIZE; x++) {
-		program[x].opcode = 0x9F; // NOP
-		program[x].line_number = -1;
-	}
-	
-	f = fopen(argv[1], "r");
-	if (f) {
-		while (fgets(linebuf, sizeof(linebuf) - 2, f)) {
-			compile(linebuf);
-			++line_number;
-		}
-		fclose(f);
+	int x;
+
+	f = fopen(fname, "wb");
+	if (!f) {
+		printf("Could not open the bin output file '%s'\n", fname);
+		exit(-1);
 	}
-	resolve_labels();
-	sprintf(outname, "%s.bin", argv[1]);
-	f = fopen(outname, "w");
-	for (x = bin_start; x < PROG_SIZE; x++) {
-		fputc(program[x].opcode, f);
+	for (x = state->bin_start; x < PROG_SIZE; x++) {
+		fputc(state->image[x], f);
 	}
 	fclose(f);
-	
-	sprintf(outname, "%s.hex", argv[1]);
-	f = fopen(outname, "w");
+}
+
+void emit_hexfile(struct compiler_state *state, char *fname)
+{
+	FILE *f;
+	int x;
+
+	f = fopen(fname, "w");
+	if (!f) {
+		printf("Could not open the hex output file '%s'\n", fname);
+		exit(-1);
+	}
 	fprintf(f, "#File_format=Hex\n#Address_depth=%d\n#Data_width=8\n", PROG_SIZE);
 	for (x = 0; x < PROG_SIZE; x++) {
-		fprintf(f, "%02X\n", program[x].opcode);
+		fprintf(f, "%02X\n", state->image[x]);
 	}
 	fclose(f);
+}
 
-	for (x = y = 0; x < PROG_SIZE; x++) {
-		if (program[x].line_number != -1) {
-			++y;
-		}
+// the symbols and labels as .EQU lines so another core's program can .INC them
+void emit_symfile(struct compiler_state *state, char *fname)
+{
+	FILE *f;
+	int x;
+
+	f = fopen(fname, "w");
+	if (!f) {
+		printf("Could not open the symbol output file '%s'\n", fname);
+		exit(-1);
 	}
-	printf("%s created, used %d (%d%%) out of %d bytes.\n", outname, y, (y * 100) / (PROG_SIZE - bin_start), PROG_SIZE - bin_start);
-	if (y > (PROG_SIZE-(PROG_SIZE/10)) && y != PROG_SIZE) {
-		// find the user some space
-		printf("Limited free space here's a map of free space:\n");
-		for (x = 0; x < PROG_SIZE; x++) {
-			if (program[x].line_number == -1) {
-				printf("ROM[%x] is free\n", x);
-			}
-		}
+	fprintf(f, "; symbols\n");
+	for (x = 0; x < state->symbols.nsyms; x++) {
+		fprintf(f, ".EQU %s %X\n", state->symbols.syms[x].label, state->symbols.syms[x].value);
 	}
-	printf("Symbols: \n");
-	for (x = 0; x < PROG_SIZE; x++) {
-		if (symbols[x].label[0]) {
-			printf("Symbol %s == %x\n", symbols[x].label, symbols[x].value);
-		}
+	fprintf(f, "; labels\n");
+	for (x = 0; x < state->labels.nsyms; x++) {
+		fprintf(f, ".EQU %s %03X\n", state->labels.syms[x].label, state->labels.syms[x].value);
+	}
+	fclose(f);
+}
+
+void emit_lstfile(struct compiler_state *state, char *fname)
+{
+	FILE *f;
+	int x, y;
+	char linebuf[32];
+	char *labels[PROG_SIZE];
+
+	f = fopen(fname, "w");
+	if (!f) {
+		printf("Could not open the listing output file '%s'\n", fname);
+		exit(-1);
+	}
+
+	// the last label placed at an address is the one listed
+	memset(labels, 0, sizeof labels);
+	for (x = 0; x < state->labels.nsyms; x++) {
+		labels[state->labels.syms[x].value & (PROG_SIZE - 1)] = state->labels.syms[x].label;
 	}
-	printf("Listing: \n");
 	for (x = 0; x < PROG_SIZE; x++) {
-		if (program[x].line_number != -1) {
-			if (program[x].label[0]) {
-				printf("[%-15s ", program[x].label);
+		if (state->line_of[x] != -1) {
+			if (labels[x]) {
+				fprintf(f, "[%-15s ", labels[x]);
 			} else {
-				printf("[%16s", "");
+				fprintf(f, "[%16s", "");
+			}
+			linebuf[0] = 0;
+			if (state->text_of[x]) {
+				strncpy(linebuf, state->text_of[x], 20);
+				linebuf[20] = 0;
 			}
-			strcpy(linebuf, program[x].line);
-			linebuf[20] = 0;
 			for (y = 0; linebuf[y]; y++) {
-				if (linebuf[y] == '\r' || linebuf[y] == '\n') {
-					linebuf[y] = 0;
-					break;
-				}
 				if (linebuf[y] == '\t') {
 					linebuf[y] = ' ';
 				}
 			}
-			printf("0x%02X]: 0x%02X ; %-20s (%s:%d)\n", x, program[x].opcode, linebuf, argv[1], program[x].line_number);
+			fprintf(f, "0x%02X]: 0x%02X ; %-20s (%s:%d)\n", x, state->image[x], linebuf, state->file_of[x], state->line_of[x]);
+		}
+	}
+	fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+	char outname[512];
+	struct compiler_state *state;
+	int i, x, y, nsrc = 0;
+	int bin = 0, hex = 0, list = 0, sym = 0;
+
+	// options pass
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--bin")) {
+			bin = 1;
+		} else if (!strcmp(argv[i], "--hex")) {
+			hex = 1;
+		} else if (!strcmp(argv[i], "--list")) {
+			list = 1;
+		} else if (!strcmp(argv[i], "--sym")) {
+			sym = 1;
+		} else if (!strcmp(argv[i], "--define")) {
+			i += 2;
+		} else if (argv[i][0] == '-') {
+			printf("Unknown option '%s'\n", argv[i]);
+			exit(-1);
+		} else {
+			++nsrc;
+		}
+	}
+	if (!nsrc) {
+		printf("Usage: %s [--bin] [--hex] [--list] [--sym] [--define NAME VALUE] input.s [input2.s ...]\n", argv[0]);
+		printf("Writes input.s.bin and input.s.hex (or just the outputs asked for), .lst for --list and .sym for --sym\n");
+		return 0;
+	}
+	if (!bin && !hex && !list && !sym) {
+		bin = hex = 1;
+	}
+
+	// every source file is its own program, e.g. one per core
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--define")) {
+			i += 2;
+			continue;
+		} else if (argv[i][0] == '-') {
+			continue;
+		}
+		state = new_state(argc, argv, list);
+		compile_file(state, argv[i]);
+		resolve_labels(state);
+
+		if (bin) {
+			snprintf(outname, sizeof outname, "%s.bin", argv[i]);
+			emit_binfile(state, outname);
+		}
+		if (hex) {
+			snprintf(outname, sizeof outname, "%s.hex", argv[i]);
+			emit_hexfile(state, outname);
+		}
+		if (list) {
+			snprintf(outname, sizeof outname, "%s.lst", argv[i]);
+			emit_lstfile(state, outname);
+		}
+		if (sym) {
+			snprintf(outname, sizeof outname, "%s.sym", argv[i]);
+			emit_symfile(state, outname);
+		}
+
+		for (x = y = 0; x < PROG_SIZE; x++) {
+			if (state->line_of[x] != -1) {
+				++y;
+			}
+		}
+		printf("%s assembled, used %d (%d%%) out of %d bytes.\n", argv[i], y, (y * 100) / (PROG_SIZE - state->bin_start), PROG_SIZE - state->bin_start);
+		if (y > (PROG_SIZE-(PROG_SIZE/10)) && y != PROG_SIZE) {
+			// find the user some space
+			printf("Limited free space here's a map of free space:\n");
+			for (x = 0; x < PROG_SIZE; x++) {
+				if (state->line_of[x] == -1) {
+					printf("ROM[%x] is free\n", x);
+				}
+			}
 		}
+		free_state(state);
 	}
 	return 0;
 }
@@ -0,0 +1,536 @@
+/* MicroSequencer (useq) core model, see useq_cpu.h */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include "useq_cpu.h"
+
+const char *useq_state_names[8] = {
+	"FETCH", "DECODE", "EXECUTE", "LOADA", "LOADA_REG", "STOREA", "LOADIND", "LOADIND_REG"
+};
+
+// mnemonics for the trace, the encodings are useq_as.c's e1_opcodes table
+static const char *op_8x[16] = {
+	"LDI", "ADDI", "SUBI", "EORI", "ANDI", "ORI", "LDIR0", "LDIR1",
+	"LDIR11", "LDIR12", "LDIR13", "LDIR14", "MUL", "LDM", "STM", "LDMIND"
+};
+static const char *op_9x[16] = {
+	"INC", "DEC", "ASL", "LSR", "ASR", "SWAP", "ROL", "ROR",
+	"SWAPR0", "SWAPR1", "NOT", "CLR", "SIGT", "SIEQ", "SILT", "NOP"
+};
+static const char *op_ex[16] = {
+	"OUT", "OUTBIT", "TGLBIT", "IN", "INBIT", "NEG", "PUSHA", "SEI",
+	"SAI", "POPA", "RET", "RTI", "WAIT0", "WAIT1", "WAITF", "WAITA"
+};
+static const char *op_r[8] = { "LD", "ST", "SETB", "ADD", "SUB", "EOR", "AND", "OR" };
+static const char *op_jmp[4] = { "JMP", "CALL", "JZ", "JNZ" };
+
+const char *useq_disasm(uint8_t op, uint8_t imm, char *buf)
+{
+	switch (op >> 4) {
+		case 0x2:
+			sprintf(buf, "SETB %d, %d", (op >> 1) & 7, op & 1);
+			break;
+		case 0x8:
+			if ((op & 15) < 12) {
+				sprintf(buf, "%s %02X", op_8x[op & 15], imm);
+			} else {
+				strcpy(buf, op_8x[op & 15]);
+			}
+			break;
+		case 0x9:
+			strcpy(buf, op_9x[op & 15]);
+			break;
+		case 0xA: case 0xB: case 0xC: case 0xD:
+			sprintf(buf, "%s %03X", op_jmp[(op >> 4) - 0xA], ((op & 15) << 8) | imm);
+			break;
+		case 0xE:
+			if ((op & 15) == 7) {
+				sprintf(buf, "SEI %02X", imm);
+			} else if ((op & 15) == 8) {
+				sprintf(buf, "SAI %03X", imm << 4);
+			} else {
+				strcpy(buf, op_ex[op & 15]);
+			}
+			break;
+		case 0xF:
+			sprintf(buf, "SBIT %d, %d", (op >> 1) & 7, op & 1);
+			break;
+		default:
+			sprintf(buf, "%s %X", op_r[op >> 4], op & 15);
+			break;
+	}
+	return buf;
+}
+
+static int is_pow2(int x)
+{
+	return x > 0 && !(x & (x - 1));
+}
+
+void useq_default_config(struct useq_config *cfg)
+{
+	memset(cfg, 0, sizeof *cfg);
+	cfg->fifo_depth            = USEQ_FIFO_DEPTH;
+	cfg->stack_depth           = USEQ_STACK_DEPTH;
+	cfg->isr_vect              = USEQ_ISR_VECT;
+	cfg->enable_irq            = 1;
+	cfg->enable_host_fifo_ctrl = 1;
+}
+
+void useq_init(struct useq_cpu *m, const struct useq_config *cfg)
+{
+	memset(m, 0, sizeof *m);
+	m->cfg = *cfg;
+	// the FIFO pointers wrap at the depth and R[15] has to be able to hold it
+	if (!is_pow2(m->cfg.fifo_depth) || m->cfg.fifo_depth < 2 || m->cfg.fifo_depth > 128) {
+		fprintf(stderr, "FIFO_DEPTH must be a power of 2 between 2 and 128\n");
+		exit(-1);
+	}
+	if (!is_pow2(m->cfg.stack_depth) || m->cfg.stack_depth < 2 || m->cfg.stack_depth > 256) {
+		fprintf(stderr, "STACK_DEPTH must be a power of 2 between 2 and 256\n");
+		exit(-1);
+	}
+	m->cfg.isr_vect &= 0xFFF;
+	useq_reset(m);
+}
+
+// rst_n low, the memory keeps its contents
+void useq_reset(struct useq_cpu *m)
+{
+	if (m->cfg.enable_irq) {
+		m->tA = m->tR[0] = m->tR[1] = 0;
+		m->tT = 0;
+		m->ILR = 0;
+		m->int_mask = 0;
+		m->int_enable = 0;
+		m->isr_vect = m->cfg.isr_vect;
+	}
+	m->A = 0;
+	m->PC = 0;
+	m->T = 0;
+	m->state = USEQ_FETCH;
+	m->l_i_port = 0;
+	m->o_port = 0xFF;
+	m->instruct = 0xE6;
+	m->instruct_imm = 0;
+	m->mem_addr = 0;
+	m->mem_addr_next = 1;
+	m->wren = 0;
+	m->o_port_pulse = 0;
+	memset(m->R, 0, sizeof m->R);
+	memset(m->FIFO, 0, sizeof m->FIFO);
+	m->SP = 0;
+	memset(m->LR, 0, sizeof m->LR);
+	m->fifo_rptr = m->fifo_wptr = 0;
+	m->fifo_out = 0;
+	m->douta = m->doutb = 0;
+	m->new_insn = 0;
+}
+
+// .hex is useq_as's output (one byte per line, '#' header lines are skipped),
+// .bin is raw bytes from addr on (useq_as writes it from .BIN_START)
+int useq_load_image(struct useq_cpu *m, const char *fname, int hex, uint16_t addr)
+{
+	FILE *f;
+	char line[256];
+	int n, a, v;
+
+	f = fopen(fname, hex ? "r" : "rb");
+	if (!f) {
+		fprintf(stderr, "Could not open image file '%s'\n", fname);
+		exit(-1);
+	}
+	a = addr;
+	if (!hex) {
+		n = fread(m->mem + a, 1, USEQ_MEM_SIZE - a, f);
+		a += n;
+	} else {
+		while (fgets(line, sizeof line, f)) {
+			if (line[0] == '#' || !isxdigit((unsigned char)line[0])) {
+				continue;
+			}
+			if (a >= USEQ_MEM_SIZE) {
+				fprintf(stderr, "Image '%s' does not fit at %03x\n", fname, addr);
+				exit(-1);
+			}
+			sscanf(line, "%x", &v);
+			m->mem[a++] = v & 0xFF;
+		}
+	}
+	fclose(f);
+	return a - addr;
+}
+
+// PC += n and point the memory at the opcode after it
+static inline void advance(struct useq_cpu *m, int n)
+{
+	m->PC = (m->PC + n) & 0xFFF;
+	m->mem_addr = m->PC;
+	m->mem_addr_next = (m->PC + 1) & 0xFFF;
+	m->state = USEQ_FETCH;
+}
+
+static inline void jump(struct useq_cpu *m, uint16_t target)
+{
+	m->PC = target & 0xFFF;
+	m->mem_addr = m->PC;
+	m->mem_addr_next = (m->PC + 1) & 0xFFF;
+	m->state = USEQ_FETCH;
+}
+
+// the EXECUTE state, exec1_top.v.  Everything reads the registers as they
+// were before the edge (the RTL's non-blocking assignments), the few places
+// where a register is read after an earlier line changed it keep a copy.
+static void execute(struct useq_cpu *m)
+{
+	uint8_t op = m->instruct, imm = m->instruct_imm;
+	uint8_t d = op & 15, s = (op >> 1) & 7, b = op & 1;
+	uint16_t target = ((op & 15) << 8) | imm;
+	unsigned depth_mask = m->cfg.stack_depth - 1;
+	unsigned fifo_mask = m->cfg.fifo_depth - 1;
+	uint8_t a = m->A;
+	uint16_t p, w;
+
+	switch (op >> 4) {
+		case 0x0: // LD R[r], R[15] pops the FIFO
+			if (d != 15) {
+				m->A = m->R[d];
+			} else if (m->R[15]) {
+				m->A = m->FIFO[m->fifo_rptr];
+				--(m->R[15]);
+				m->fifo_rptr = (m->fifo_rptr + 1) & fifo_mask;
+			} else {
+				m->A = 0;
+			}
+			advance(m, 1);
+			break;
+		case 0x1: // ST R[r], R[15] pushes the FIFO
+			if (d != 15) {
+				m->R[d] = a;
+			} else if (m->R[15] != m->cfg.fifo_depth) {
+				m->FIFO[m->fifo_wptr] = a;
+				m->fifo_wptr = (m->fifo_wptr + 1) & fifo_mask;
+				++(m->R[15]);
+			}
+			advance(m, 1);
+			break;
+		case 0x2: // SETB s, b
+			m->A = (a & ~(1 << s)) | (b << s);
+			advance(m, 1);
+			break;
+		case 0x3: m->A = a + m->R[d]; advance(m, 1); break;		// ADD
+		case 0x4: m->A = a - m->R[d]; advance(m, 1); break;		// SUB
+		case 0x5: m->A = a ^ m->R[d]; advance(m, 1); break;		// EOR
+		case 0x6: m->A = a & m->R[d]; advance(m, 1); break;		// AND
+		case 0x7: m->A = a | m->R[d]; advance(m, 1); break;		// OR
+		case 0x8: // immediates and the memory ops
+			switch (d) {
+				case 0x0: m->A = imm; break;						// LDI
+				case 0x1: m->A = a + imm; break;					// ADDI
+				case 0x2: m->A = a - imm; break;					// SUBI
+				case 0x3: m->A = a ^ imm; break;					// EORI
+				case 0x4: m->A = a & imm; break;					// ANDI
+				case 0x5: m->A = a | imm; break;					// ORI
+				case 0x6: m->R[0] = imm; break;						// LDIR0
+				case 0x7: m->R[1] = imm; break;						// LDIR1
+				case 0x8: m->R[11] = imm; break;					// LDIR11
+				case 0x9: m->R[12] = imm; break;					// LDIR12
+				case 0xA: m->R[13] = imm; break;					// LDIR13
+				case 0xB: m->R[14] = imm; break;					// LDIR14
+				case 0xC: // MUL
+					w = a * m->R[0];
+					m->A = w & 0xFF;
+					m->R[0] = w >> 8;
+					advance(m, 1);
+					return;
+				case 0xD: // LDM, A = MEM[R14:R13++] two states later
+					m->mem_addr = ((m->R[14] & 15) << 8) | m->R[13];
+					p = (((uint16_t)m->R[14] << 8) | m->R[13]) + 1;
+					m->R[13] = p & 0xFF;
+					m->R[14] = p >> 8;
+					m->PC = (m->PC + 1) & 0xFFF;
+					m->state = USEQ_LOADA;
+					return;
+				case 0xE: // STM, MEM[R12:R11++] = A
+					m->mem_out = a;
+					m->mem_addr = ((m->R[12] & 15) << 8) | m->R[11];
+					m->wren = 1;
+					p = ((((uint16_t)m->R[12] << 8) | m->R[11]) + 1) & 0xFFF;
+					m->R[11] = p & 0xFF;
+					m->R[12] = p >> 8;
+					m->PC = (m->PC + 1) & 0xFFF;
+					m->state = USEQ_STOREA;
+					return;
+				case 0xF: // LDMIND, R14:R13 = MEM16[R14:R13 + A*2]
+					p = ((m->R[14] & 15) << 8) | m->R[13];
+					m->mem_addr = (p + (a << 1)) & 0xFFF;
+					m->mem_addr_next = (p + (a << 1) + 1) & 0xFFF;
+					m->PC = (m->PC + 1) & 0xFFF;
+					m->state = USEQ_LOADIND;
+					return;
+			}
+			advance(m, 2);
+			break;
+		case 0x9: // ALU
+			switch (d) {
+				case 0x0: m->A = a + 1; break;						// INC
+				case 0x1: m->A = a - 1; break;						// DEC
+				case 0x2: m->A = a << 1; break;						// ASL
+				case 0x3: m->A = a >> 1; break;						// LSR
+				case 0x4: m->A = (a & 0x80) | (a >> 1); break;		// ASR
+				case 0x5: m->A = (a << 4) | (a >> 4); break;		// SWAP
+				case 0x6: m->A = (a << 1) | (a >> 7); break;		// ROL
+				case 0x7: m->A = (a << 7) | (a >> 1); break;		// ROR
+				case 0x8: m->A = m->R[0]; m->R[0] = a; break;		// SWAPR0
+				case 0x9: m->A = m->R[1]; m->R[1] = a; break;		// SWAPR1
+				case 0xA: m->A = ~a; break;							// NOT
+				case 0xB: m->A = 0; break;							// CLR
+				case 0xC: m->A = a > m->R[0]; break;				// SIGT
+				case 0xD: m->A = a == m->R[0]; break;				// SIEQ
+				case 0xE: m->A = a < m->R[0]; break;				// SILT
+				case 0xF: break;									// NOP
+			}
+			advance(m, 1);
+			break;
+		case 0xA: // JMP
+			jump(m, target);
+			break;
+		case 0xB: // CALL, a full stack drops the return address
+			if (m->SP != (unsigned)m->cfg.stack_depth) {
+				m->LR[m->SP & depth_mask] = (m->PC + 2) & 0xFFF;
+				++(m->SP);
+			}
+			jump(m, target);
+			break;
+		case 0xC: // JZ
+			if (!a) {
+				jump(m, target);
+			} else {
+				advance(m, 2);
+			}
+			break;
+		case 0xD: // JNZ
+			if (a) {
+				jump(m, target);
+			} else {
+				advance(m, 2);
+			}
+			break;
+		case 0xE: // I/O
+			switch (d) {
+				case 0x0: // OUT
+					m->o_port = a;
+					m->o_port_pulse ^= 1;
+					advance(m, 1);
+					break;
+				case 0x1: // OUTBIT, o_port[R0[2:0]] = A[0]
+					s = m->R[0] & 7;
+					m->o_port = (m->o_port & ~(1 << s)) | ((a & 1) << s);
+					m->o_port_pulse ^= 1;
+					advance(m, 1);
+					break;
+				case 0x2: // TGLBIT, o_port[R0[5:3]] ^= 1
+					m->o_port ^= 1 << ((m->R[0] >> 3) & 7);
+					m->o_port_pulse ^= 1;
+					advance(m, 1);
+					break;
+				case 0x3: // IN
+					m->A = m->l_i_port;
+					advance(m, 1);
+					break;
+				case 0x4: // INBIT, only A[0] changes and the pin is R0[5:3]
+					m->A = (a & 0xFE) | ((m->l_i_port >> ((m->R[0] >> 3) & 7)) & 1);
+					advance(m, 1);
+					break;
+				case 0x5: // NEG
+					m->A = -a;
+					advance(m, 1);
+					break;
+				case 0x6: // PUSHA
+					if (m->SP < (unsigned)m->cfg.stack_depth) {
+						m->LR[m->SP & depth_mask] = a;
+						++(m->SP);
+					}
+					advance(m, 1);
+					break;
+				case 0x7: // SEI, without IRQs the core sits on it for good
+					if (m->cfg.enable_irq) {
+						m->int_mask = imm;
+						m->int_enable = imm != 0;
+						advance(m, 2);
+					}
+					break;
+				case 0x8: // SAI
+					m->isr_vect = imm << 4;
+					advance(m, 2);
+					break;
+				case 0x9: // POPA
+					if (m->SP > 0) {
+						m->A = m->LR[(m->SP - 1) & depth_mask] & 0xFF;
+						--(m->SP);
+					}
+					advance(m, 1);
+					break;
+				case 0xA: // RET, an empty stack refetches from mem_addr (the RET again)
+					if (m->SP > 0) {
+						p = m->LR[(m->SP - 1) & depth_mask];
+						--(m->SP);
+						jump(m, p);
+					} else {
+						m->state = USEQ_FETCH;
+					}
+					break;
+				case 0xB: // RTI
+					if (m->cfg.enable_irq) {
+						m->int_enable = 1;
+						m->A = m->tA;
+						m->R[0] = m->tR[0];
+						m->R[1] = m->tR[1];
+						m->T = m->tT;
+						jump(m, m->ILR);
+					} else {
+						advance(m, 1);
+					}
+					break;
+				case 0xC: // WAIT0, pin R0[5:3]
+					if (!((m->l_i_port >> ((m->R[0] >> 3) & 7)) & 1)) {
+						advance(m, 1);
+					} else {
+						++(m->wait_cycles);
+					}
+					break;
+				case 0xD: // WAIT1
+					if ((m->l_i_port >> ((m->R[0] >> 3) & 7)) & 1) {
+						advance(m, 1);
+					} else {
+						++(m->wait_cycles);
+					}
+					break;
+				case 0xE: // WAITF, wait for at least A bytes in the FIFO
+					if (m->R[15] >= a) {
+						advance(m, 1);
+					} else {
+						++(m->wait_cycles);
+					}
+					break;
+				case 0xF: // WAITA, A counts down a clock at a time then comes back from T
+					if (!a) {
+						if (m->T & 0x100) {
+							m->A = m->T & 0xFF;
+						}
+						m->T = 0;
+						advance(m, 1);
+					} else {
+						if (!(m->T & 0x100)) {
+							m->T = 0x100 | a;
+						}
+						m->A = a - 1;
+						++(m->wait_cycles);
+					}
+					break;
+			}
+			break;
+		case 0xF: // SBIT, a skip is a flat PC+2, otherwise the next byte runs in this state next clock
+			if (((a >> s) & 1) == b) {
+				advance(m, 2);
+			} else {
+				m->instruct = imm;
+				m->PC = (m->PC + 1) & 0xFFF;
+				m->mem_addr = m->PC;
+				m->mem_addr_next = (m->PC + 1) & 0xFFF;
+				m->new_insn = 1;
+				m->exec_pc = m->PC;
+				++(m->insns);
+			}
+			break;
+	}
+}
+
+// one posedge of clk for the core and useq_tb.v's memory
+void useq_clock(struct useq_cpu *m, const struct useq_pins *p)
+{
+	uint16_t addr = m->mem_addr, addr_next = m->mem_addr_next;
+	uint8_t wren = m->wren, mem_out = m->mem_out;
+	uint8_t mem_lo = m->douta, mem_hi = m->doutb;
+	unsigned fifo_mask = m->cfg.fifo_depth - 1;
+	int host = m->cfg.enable_host_fifo_ctrl && (p->read_fifo ^ p->write_fifo);
+
+	m->new_insn = 0;
+	++(m->cycles);
+	if (host) {
+		// the host owns the FIFO this clock and the core holds still
+		++(m->stall_cycles);
+		if (p->read_fifo) {
+			if (m->R[15]) {
+				m->fifo_out = m->FIFO[m->fifo_rptr];
+				m->fifo_rptr = (m->fifo_rptr + 1) & fifo_mask;
+				--(m->R[15]);
+			} else {
+				m->o_port = 0;				// useq.v zeroes o_port (not fifo_out) on an empty read
+			}
+		} else if (m->R[15] != m->cfg.fifo_depth) {
+			m->FIFO[m->fifo_wptr] = p->fifo_in;
+			m->fifo_wptr = (m->fifo_wptr + 1) & fifo_mask;
+			++(m->R[15]);
+		}
+	} else {
+		if (m->cfg.enable_irq && m->int_enable && ((p->i_port & ~m->l_i_port) & m->int_mask)) {
+			// posedge on an enabled pin, whatever state we're in
+			m->int_enable = 0;
+			m->ILR = m->PC;
+			m->tA = m->A;
+			m->tR[0] = m->R[0];
+			m->tR[1] = m->R[1];
+			m->tT = m->T;
+			jump(m, m->isr_vect);
+			++(m->irqs);
+		} else {
+			switch (m->state) {
+				case USEQ_FETCH:
+					m->state = USEQ_DECODE;
+					break;
+				case USEQ_DECODE:
+					m->instruct = mem_lo;
+					m->instruct_imm = mem_hi;
+					m->state = USEQ_EXECUTE;
+					m->new_insn = 1;
+					m->exec_pc = m->PC;
+					++(m->insns);
+					break;
+				case USEQ_EXECUTE:
+					execute(m);
+					break;
+				case USEQ_LOADA:
+					m->state = USEQ_LOADA_REG;
+					break;
+				case USEQ_LOADA_REG:
+					m->A = mem_lo;
+					advance(m, 0);
+					break;
+				case USEQ_STOREA:
+					m->wren = 0;
+					advance(m, 0);
+					break;
+				case USEQ_LOADIND:
+					m->state = USEQ_LOADIND_REG;
+					break;
+				case USEQ_LOADIND_REG:
+					m->R[13] = mem_lo;
+					m->R[14] = mem_hi;
+					advance(m, 0);
+					break;
+			}
+		}
+		m->l_i_port = p->i_port;
+	}
+
+	// the BRAM, written from port A or read on both ports
+	if (wren) {
+		m->mem[addr & 0xFFF] = mem_out;
+	} else {
+		m->douta = m->mem[addr & 0xFFF];
+		m->doutb = m->mem[addr_next & 0xFFF];
+	}
+}
@@ -0,0 +1,89 @@
+// MicroSequencer (useq) core model used by useq_sim
+//
+// Follows useq.v/exec1_top.v a clock at a time: the FETCH/DECODE/EXECUTE
+// state machine, the one cycle BRAM of useq_tb.v (mem_data is what the
+// memory latched from mem_addr/mem_addr_next on the previous edge), the FIFO
+// with its host side read_fifo/write_fifo stall, the SEI posedge IRQs on
+// i_port and the A/R0/R1/T save.  Anything outside the core (what drives
+// i_port, who pulses the FIFO) is up to the caller so several cores can be
+// clocked together.
+#ifndef USEQ_CPU_H
+#define USEQ_CPU_H
+
+#include <stdint.h>
+
+#define USEQ_MEM_SIZE			4096
+
+// useq.v parameter defaults
+#define USEQ_FIFO_DEPTH			16
+#define USEQ_STACK_DEPTH		16
+#define USEQ_ISR_VECT			0xFE0
+
+// FSM states, same numbering as useq.v
+enum {
+	USEQ_FETCH = 0, USEQ_DECODE, USEQ_EXECUTE, USEQ_LOADA,
+	USEQ_LOADA_REG, USEQ_STOREA, USEQ_LOADIND, USEQ_LOADIND_REG
+};
+
+struct useq_config {
+	int fifo_depth;					// power of 2, 2..128
+	int stack_depth;				// power of 2, 2..256
+	uint16_t isr_vect;
+	int enable_irq;
+	int enable_host_fifo_ctrl;
+};
+
+// what the parent module drives into the core for one clock
+struct useq_pins {
+	uint8_t i_port;
+	uint8_t read_fifo, write_fifo;
+	uint8_t fifo_in;
+};
+
+struct useq_cpu {
+	struct useq_config cfg;
+
+	// registers, named after useq.v
+	uint8_t A, tA, tR[2];
+	uint16_t T, tT;					// 9 bits
+	uint16_t PC, ILR, isr_vect;
+	uint16_t LR[256];
+	unsigned SP;
+	uint8_t instruct, instruct_imm;
+	uint8_t R[16];
+	uint8_t l_i_port, int_mask, int_enable;
+	uint8_t FIFO[128];
+	unsigned fifo_rptr, fifo_wptr;
+	uint8_t fifo_out;
+	uint8_t state;
+	uint16_t mem_addr, mem_addr_next;
+	uint8_t wren, mem_out;
+	uint8_t o_port, o_port_pulse;
+
+	// useq_tb.v's memory, mem_data is {douta_reg, doutb_reg}
+	uint8_t mem[USEQ_MEM_SIZE];
+	uint8_t douta, doutb;
+
+	// accounting
+	uint64_t cycles, insns, irqs;
+	uint64_t stall_cycles;			// clocks the host FIFO access held the core
+	uint64_t wait_cycles;			// clocks spent spinning in WAIT0/WAIT1/WAITF/WAITA
+	int new_insn;					// the last clock started executing an instruction at exec_pc
+	uint16_t exec_pc;
+};
+
+extern const char *useq_state_names[8];
+
+void useq_default_config(struct useq_config *cfg);
+void useq_init(struct useq_cpu *m, const struct useq_config *cfg);
+void useq_reset(struct useq_cpu *m);
+int useq_load_image(struct useq_cpu *m, const char *fname, int hex, uint16_t addr);
+void useq_clock(struct useq_cpu *m, const struct useq_pins *p);
+const char *useq_disasm(uint8_t op, uint8_t imm, char *buf);
+
+static inline int useq_fifo_count(const struct useq_cpu *m)
+{
+	return m->R[15];
+}
+
+#endif
@@ -0,0 +1,591 @@
+/* Cycle exact simulator for one or more MicroSequencer cores wired together */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include "useq_cpu.h"
+
+#define MAX_CORES		16
+#define MAX_LINKS		64
+
+// C.oB / C.iB names bit B of core C's o_port/i_port, C.o/C.i the whole port
+struct pin {
+	int core;
+	char port;
+	int bit;						// -1 for all 8
+};
+
+struct wire {
+	struct pin src, dst;
+};
+
+// square wave on an input pin, e.g. a timer for the SEI IRQs
+struct clock_src {
+	struct pin dst;
+	uint64_t half;
+};
+
+// 8N1 decoder on an output pin, bit is in cycles per bit
+struct uart_tx {
+	struct pin src;
+	double bit;
+	int busy, last;
+	double next;
+	int n;
+	unsigned sr;
+};
+
+// 8N1 generator on an input pin from a file, gap idle bits between characters
+struct uart_rx {
+	struct pin dst;
+	double bit;
+	int gap;
+	uint8_t *data;
+	size_t len, pos;
+	double start;
+	int level;
+};
+
+// the parent module moving bytes from one core's FIFO to another's, a
+// read_fifo clock on src and a write_fifo clock on dst the clock after
+struct pipe {
+	int src, dst;
+	int have;
+	uint8_t byte;
+};
+
+struct core {
+	struct useq_cpu m;
+	uint8_t in_default;
+	int trace;
+	uint16_t mark[16];
+	int nmark;
+	uint64_t last_mark;
+	int stop_pc;
+	uint8_t *feed;					// bytes the parent writes into the FIFO
+	size_t feed_len, feed_pos;
+	int drain;						// parent reads the FIFO and prints it
+	int draining;
+};
+
+static struct core cores[MAX_CORES];
+static int ncores;
+static struct wire wires[MAX_LINKS];
+static int nwires;
+static struct clock_src clocks[MAX_LINKS];
+static int nclocks;
+static struct uart_tx txs[MAX_LINKS];
+static int ntxs;
+static struct uart_rx rxs[MAX_LINKS];
+static int nrxs;
+static struct pipe pipes[MAX_LINKS];
+static int npipes;
+
+static uint8_t *read_file(const char *fname, size_t *len)
+{
+	FILE *f;
+	uint8_t *buf = NULL;
+	size_t n, size = 0;
+
+	f = strcmp(fname, "-") ? fopen(fname, "rb") : stdin;
+	if (!f) {
+		fprintf(stderr, "Could not open input file '%s'\n", fname);
+		exit(-1);
+	}
+	*len = 0;
+	do {
+		if (*len == size) {
+			size = size ? size * 2 : 4096;
+			buf = realloc(buf, size);
+		}
+		n = fread(buf + *len, 1, size - *len, f);
+		*len += n;
+	} while (n);
+	if (f != stdin) {
+		fclose(f);
+	}
+	return buf;
+}
+
+static int parse_core(const char *s, char **end)
+{
+	long c;
+
+	c = strtol(s, end, 10);
+	if (*end == s || c < 0 || c >= MAX_CORES) {
+		fprintf(stderr, "Invalid core number in '%s' (0..%d)\n", s, MAX_CORES - 1);
+		exit(-1);
+	}
+	if (c >= ncores) {
+		ncores = c + 1;
+	}
+	return c;
+}
+
+// "C.oB", "C.iB", "C.o" or "C.i", returns what follows it
+static char *parse_pin(char *s, struct pin *p, char want)
+{
+	char *e;
+
+	p->core = parse_core(s, &e);
+	if (e[0] != '.' || e[1] != want) {
+		fprintf(stderr, "Expected a pin like %d.%c3 or %d.%c in '%s'\n", p->core, want, p->core, want, s);
+		exit(-1);
+	}
+	p->port = want;
+	e += 2;
+	if (*e >= '0' && *e <= '7') {
+		p->bit = *e++ - '0';
+	} else {
+		p->bit = -1;
+	}
+	return e;
+}
+
+static char *expect(char *s, char c, const char *opt)
+{
+	if (*s != c) {
+		fprintf(stderr, "Malformed %s parameter near '%s'\n", opt, s);
+		exit(-1);
+	}
+	return s + 1;
+}
+
+static uint8_t pin_value(struct pin *p)
+{
+	uint8_t v = cores[p->core].m.o_port;
+	return p->bit < 0 ? v : ((v >> p->bit) & 1) ? 0xFF : 0x00;
+}
+
+// drive bits of an input port, more than one driver on a pin is a wired AND
+// (the open drain/pullup style the README suggests for I2C and shared TX lines)
+static void drive(uint8_t *val, uint8_t *mask, struct pin *p, uint8_t v)
+{
+	uint8_t m = p->bit < 0 ? 0xFF : (1 << p->bit);
+
+	val[p->core] &= (v & m) | ~m;
+	mask[p->core] |= m;
+}
+
+static void uart_tx_sample(struct uart_tx *u, uint64_t cycle)
+{
+	int v = (cores[u->src.core].m.o_port >> (u->src.bit < 0 ? 0 : u->src.bit)) & 1;
+
+	if (!u->busy) {
+		if (u->last && !v) {
+			// start bit, sample the middle of each data bit
+			u->busy = 1;
+			u->n = 0;
+			u->sr = 0;
+			u->next = cycle + u->bit * 1.5;
+		}
+	} else if (cycle >= u->next) {
+		if (u->n < 8) {
+			u->sr |= v << u->n;
+			++(u->n);
+			u->next += u->bit;
+		} else {
+			if (v) {
+				putchar(u->sr);
+			} else {
+				fprintf(stderr, "[core %d.o%d framing error at cycle %" PRIu64 "]\n", u->src.core, u->src.bit, cycle);
+			}
+			u->busy = 0;
+		}
+	}
+	u->last = v;
+}
+
+static int uart_rx_level(struct uart_rx *u, uint64_t cycle)
+{
+	double t;
+	int bit;
+
+	if (u->pos >= u->len || cycle < u->start) {
+		return 1;
+	}
+	t = (cycle - u->start) / u->bit;
+	bit = (int)t;
+	if (bit >= 10 + u->gap) {
+		++(u->pos);
+		u->start += (10 + u->gap) * u->bit;
+		return uart_rx_level(u, cycle);
+	}
+	if (bit == 0) {
+		return 0;
+	} else if (bit <= 8) {
+		return (u->data[u->pos] >> (bit - 1)) & 1;
+	}
+	return 1;
+}
+
+static void trace(int c, struct useq_cpu *m)
+{
+	char buf[32];
+	int x;
+
+	printf("%10" PRIu64 " core %d PC=%03X %02X %-12s A=%02X SP=%2u ILR=%03X IM=%02X IP=%02X OP=%02X FC=%2d R=[",
+		m->cycles, c, m->exec_pc, m->instruct, useq_disasm(m->instruct, m->instruct_imm, buf),
+		m->A, m->SP, m->ILR, m->int_mask, m->l_i_port, m->o_port, m->R[15]);
+	for (x = 0; x < 16; x++) {
+		printf("%02X%s", m->R[x], x < 15 ? " " : "]\n");
+	}
+}
+
+// one clock for every core, returns the core that hit its --stop-pc or -1
+static int clock_all(uint64_t cycle)
+{
+	struct useq_pins pins[MAX_CORES];
+	uint8_t val[MAX_CORES], mask[MAX_CORES];
+	int moved[MAX_LINKS];				// 1 == the pipe wrote its byte, -1 == it read a new one
+	int x, c, hit = -1;
+	struct core *k;
+
+	// everything the parent drives is worked out from the registers before the edge
+	memset(pins, 0, sizeof pins);
+	memset(moved, 0, sizeof moved);
+	memset(mask, 0, sizeof mask);
+	memset(val, 0xFF, sizeof val);
+	for (x = 0; x < nwires; x++) {
+		drive(val, mask, &wires[x].dst, pin_value(&wires[x].src));
+	}
+	for (x = 0; x < nclocks; x++) {
+		drive(val, mask, &clocks[x].dst, ((cycle / clocks[x].half) & 1) ? 0xFF : 0x00);
+	}
+	for (x = 0; x < nrxs; x++) {
+		drive(val, mask, &rxs[x].dst, uart_rx_level(&rxs[x], cycle) ? 0xFF : 0x00);
+	}
+	for (c = 0; c < ncores; c++) {
+		pins[c].i_port = (cores[c].in_default & ~mask[c]) | (val[c] & mask[c]);
+	}
+	// a core takes one read_fifo or one write_fifo a clock (both at once does neither), so in a
+	// chain or with --fifo-in/--fifo-out the writes of bytes already in hand go first and
+	// anything that would clash waits for a later clock
+	for (x = 0; x < npipes; x++) {
+		c = pipes[x].dst;
+		moved[x] = pipes[x].have && !pins[c].write_fifo && !pins[c].read_fifo &&
+			useq_fifo_count(&cores[c].m) < cores[c].m.cfg.fifo_depth;
+		if (moved[x]) {
+			pins[c].write_fifo = 1;
+			pins[c].fifo_in = pipes[x].byte;
+		}
+	}
+	for (c = 0; c < ncores; c++) {
+		k = &cores[c];
+		if (k->feed_pos < k->feed_len && !pins[c].write_fifo && !pins[c].read_fifo &&
+				useq_fifo_count(&k->m) < k->m.cfg.fifo_depth) {
+			pins[c].write_fifo = 1;
+			pins[c].fifo_in = k->feed[k->feed_pos++];
+		}
+	}
+	for (x = 0; x < npipes; x++) {
+		c = pipes[x].src;
+		if (!pipes[x].have && !pins[c].write_fifo && !pins[c].read_fifo && useq_fifo_count(&cores[c].m) &&
+				useq_fifo_count(&cores[pipes[x].dst].m) < cores[pipes[x].dst].m.cfg.fifo_depth) {
+			pins[c].read_fifo = 1;
+			moved[x] = -1;
+		}
+	}
+	for (c = 0; c < ncores; c++) {
+		k = &cores[c];
+		k->draining = k->drain && !pins[c].write_fifo && !pins[c].read_fifo && useq_fifo_count(&k->m);
+		if (k->draining) {
+			pins[c].read_fifo = 1;
+		}
+	}
+
+	for (c = 0; c < ncores; c++) {
+		useq_clock(&cores[c].m, &pins[c]);
+	}
+
+	// what the parent sees after the edge
+	for (x = 0; x < npipes; x++) {
+		if (moved[x] > 0) {
+			pipes[x].have = 0;
+		} else if (moved[x] < 0) {
+			pipes[x].have = 1;
+			pipes[x].byte = cores[pipes[x].src].m.fifo_out;
+		}
+	}
+	for (x = 0; x < ntxs; x++) {
+		uart_tx_sample(&txs[x], cycle + 1);
+	}
+	for (c = 0; c < ncores; c++) {
+		k = &cores[c];
+		if (k->draining) {
+			printf("[core %d FIFO %02X]\n", c, k->m.fifo_out);
+		}
+		if (!k->m.new_insn) {
+			continue;
+		}
+		if (k->trace) {
+			trace(c, &k->m);
+		}
+		for (x = 0; x < k->nmark; x++) {
+			if (k->mark[x] == k->m.exec_pc) {
+				printf("[core %d mark %03X at cycle %" PRIu64 ", +%" PRIu64 "]\n",
+					c, k->m.exec_pc, k->m.cycles, k->m.cycles - k->last_mark);
+				k->last_mark = k->m.cycles;
+			}
+		}
+		if (k->stop_pc == k->m.exec_pc) {
+			hit = c;
+		}
+	}
+	return hit;
+}
+
+// The README's delay loop (LDI n, WAITA, DEC, JNZ) on a core of its own,
+// cycles from the WAITA starting to the opcode after the JNZ starting
+static uint64_t delay_cycles(int n)
+{
+	struct useq_config cfg;
+	struct useq_cpu *m;
+	struct useq_pins pins;
+	static const uint8_t prog[] = { 0x80, 0x00, 0xEF, 0x91, 0xD0, 0x02, 0x9F };
+	uint64_t start = 0, t;
+
+	m = calloc(1, sizeof *m);
+	useq_default_config(&cfg);
+	useq_init(m, &cfg);
+	memcpy(m->mem, prog, sizeof prog);
+	m->mem[1] = n;
+	memset(&pins, 0, sizeof pins);
+	for (;;) {
+		useq_clock(m, &pins);
+		if (m->new_insn && m->exec_pc == 2 && !start) {
+			start = m->cycles;
+		} else if (m->new_insn && m->exec_pc == 6) {
+			break;
+		}
+	}
+	t = m->cycles - start;
+	free(m);
+	return t;
+}
+
+// C = (n^2 + 19n) / 2, see "Delays" in README.MD
+static double delay_formula(int n)
+{
+	return (n * n + 19.0 * n) / 2.0;
+}
+
+static int delay_n(double c)
+{
+	return (int)((sqrt(8.0 * c + 361.0) - 19.0) / 2.0 + 0.5);
+}
+
+static int delay_check(double mhz)
+{
+	static const int bauds[] = { 115200, 57600, 19200, 9600, 0 };
+	uint64_t c;
+	int n, bad = 0;
+	double want;
+
+	for (n = 1; n < 256; n++) {
+		c = delay_cycles(n);
+		if (c != (uint64_t)delay_formula(n) || delay_n(c) != n) {
+			printf("n=%3d: %" PRIu64 " cycles, formula says %.1f (inverse gives n=%d)\n", n, c, delay_formula(n), delay_n(c));
+			++bad;
+		}
+	}
+	printf("delay loop: n=1 is %" PRIu64 " cycles, n=255 is %" PRIu64 ", %s\n",
+		delay_cycles(1), delay_cycles(255), bad ? "formula DIFFERS" : "formula matches for n=1..255");
+	for (n = 0; bauds[n]; n++) {
+		want = mhz * 1e6 / bauds[n];
+		c = delay_cycles(delay_n(want));
+		printf("%6d baud at %g MHz: %.1f cycles per bit, n=%d gives %" PRIu64 " (%+.2f%%)\n",
+			bauds[n], mhz, want, delay_n(want), c, 100.0 * (c - want) / want);
+	}
+	return bad ? 1 : 0;
+}
+
+static void usage(const char *name)
+{
+	printf(
+		"usage: %s [options]\n"
+		"  --core C               following image/core options apply to core C (default 0)\n"
+		"  --hex FILE             load a useq_as .hex image at --org\n"
+		"  --bin FILE             load a raw image (e.g. a .BIN_START .bin) at --org\n"
+		"  --org ADDR             load address for the next images (hex, default 0)\n"
+		"  --in HH                i_port bits nothing else drives (hex, default 00)\n"
+		"  --trace                print every instruction the core starts\n"
+		"  --mark ADDR            print the cycle each time the core starts the opcode at ADDR\n"
+		"  --stop-pc ADDR         stop when the core starts the opcode at ADDR\n"
+		"  --fifo-in FILE         the parent writes FILE into the core's FIFO as space frees up\n"
+		"  --fifo-out             the parent reads the core's FIFO and prints what it gets\n"
+		"  --wire C.oB=D.iB       drive core D's i_port bit from core C's o_port bit (C.o=D.i for all 8)\n"
+		"  --clock D.iB=HALF      square wave with HALF cycles high and low\n"
+		"  --uart-tx C.oB=BIT     decode 8N1 on an o_port pin, BIT cycles per bit, to stdout\n"
+		"  --uart-rx D.iB=BIT,GAP,FILE  send FILE as 8N1 with GAP idle bits between characters\n"
+		"  --pipe C=D             the parent moves bytes from core C's FIFO to core D's\n"
+		"  --fifo-depth N, --stack-depth N, --isr-vect ADDR, --no-irq, --no-host-fifo\n"
+		"                         useq.v parameters for all cores\n"
+		"  --cycles N             stop after N cycles (default 10000000)\n"
+		"  --delay-check MHZ      check the README delay loop formula and print baud rate n's\n",
+		name);
+}
+
+int main(int argc, char **argv)
+{
+	struct useq_config cfg;
+	uint64_t max_cycles = 10000000, cycle;
+	int i, c, cur = 0, hit = -1;
+	uint16_t org = 0;
+	char *e;
+
+	useq_default_config(&cfg);
+	for (c = 0; c < MAX_CORES; c++) {
+		cores[c].stop_pc = -1;
+	}
+	ncores = 1;
+
+	// useq.v parameters first, they're needed before any image is loaded
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--no-irq")) {
+			cfg.enable_irq = 0;
+		} else if (!strcmp(argv[i], "--no-host-fifo")) {
+			cfg.enable_host_fifo_ctrl = 0;
+		} else if (i + 1 < argc && !strcmp(argv[i], "--fifo-depth")) {
+			cfg.fifo_depth = strtol(argv[++i], NULL, 10);
+		} else if (i + 1 < argc && !strcmp(argv[i], "--stack-depth")) {
+			cfg.stack_depth = strtol(argv[++i], NULL, 10);
+		} else if (i + 1 < argc && !strcmp(argv[i], "--isr-vect")) {
+			cfg.isr_vect = strtol(argv[++i], NULL, 16);
+		} else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h")) {
+			usage(argv[0]);
+			return 0;
+		} else if (i + 1 < argc && !strcmp(argv[i], "--delay-check")) {
+			return delay_check(strtod(argv[i + 1], NULL));
+		}
+	}
+	for (c = 0; c < MAX_CORES; c++) {
+		useq_init(&cores[c].m, &cfg);
+	}
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--trace")) {
+			cores[cur].trace = 1;
+			continue;
+		} else if (!strcmp(argv[i], "--fifo-out")) {
+			cores[cur].drain = 1;
+			continue;
+		} else if (!strcmp(argv[i], "--no-irq") || !strcmp(argv[i], "--no-host-fifo")) {
+			continue;
+		}
+		if (i + 1 >= argc) {
+			fprintf(stderr, "%s requires a parameter\n", argv[i]);
+			exit(-1);
+		}
+		if (!strcmp(argv[i], "--core")) {
+			cur = parse_core(argv[++i], &e);
+		} else if (!strcmp(argv[i], "--org")) {
+			org = strtol(argv[++i], NULL, 16) & 0xFFF;
+		} else if (!strcmp(argv[i], "--hex") || !strcmp(argv[i], "--bin")) {
+			useq_load_image(&cores[cur].m, argv[i + 1], argv[i][2] == 'h', org);
+			++i;
+		} else if (!strcmp(argv[i], "--in")) {
+			cores[cur].in_default = strtol(argv[++i], NULL, 16);
+		} else if (!strcmp(argv[i], "--mark")) {
+			if (cores[cur].nmark == 16) {
+				fprintf(stderr, "Too many --mark addresses for core %d (max 16)\n", cur);
+				exit(-1);
+			}
+			cores[cur].mark[cores[cur].nmark++] = strtol(argv[++i], NULL, 16) & 0xFFF;
+		} else if (!strcmp(argv[i], "--stop-pc")) {
+			cores[cur].stop_pc = strtol(argv[++i], NULL, 16) & 0xFFF;
+		} else if (!strcmp(argv[i], "--fifo-in")) {
+			cores[cur].feed = read_file(argv[++i], &cores[cur].feed_len);
+		} else if (!strcmp(argv[i], "--cycles")) {
+			max_cycles = strtoull(argv[++i], NULL, 10);
+		} else if (nwires == MAX_LINKS || nclocks == MAX_LINKS || ntxs == MAX_LINKS || nrxs == MAX_LINKS || npipes == MAX_LINKS) {
+			fprintf(stderr, "Too many connections (max %d of each)\n", MAX_LINKS);
+			exit(-1);
+		} else if (!strcmp(argv[i], "--wire")) {
+			e = parse_pin(argv[++i], &wires[nwires].src, 'o');
+			e = expect(e, '=', argv[i - 1]);
+			e = parse_pin(e, &wires[nwires].dst, 'i');
+			if ((wires[nwires].src.bit < 0) != (wires[nwires].dst.bit < 0)) {
+				fprintf(stderr, "--wire connects a pin to a pin or a port to a port: '%s'\n", argv[i]);
+				exit(-1);
+			}
+			++nwires;
+		} else if (!strcmp(argv[i], "--clock")) {
+			e = parse_pin(argv[++i], &clocks[nclocks].dst, 'i');
+			e = expect(e, '=', argv[i - 1]);
+			clocks[nclocks].half = strtoull(e, NULL, 10);
+			if (!clocks[nclocks].half) {
+				fprintf(stderr, "--clock needs a half period of at least 1 cycle\n");
+				exit(-1);
+			}
+			++nclocks;
+		} else if (!strcmp(argv[i], "--uart-tx")) {
+			e = parse_pin(argv[++i], &txs[ntxs].src, 'o');
+			e = expect(e, '=', argv[i - 1]);
+			txs[ntxs].bit = strtod(e, NULL);
+			txs[ntxs].last = 1;
+			++ntxs;
+		} else if (!strcmp(argv[i], "--uart-rx")) {
+			e = parse_pin(argv[++i], &rxs[nrxs].dst, 'i');
+			e = expect(e, '=', argv[i - 1]);
+			rxs[nrxs].bit = strtod(e, &e);
+			e = expect(e, ',', argv[i - 1]);
+			rxs[nrxs].gap = strtol(e, &e, 10);
+			e = expect(e, ',', argv[i - 1]);
+			rxs[nrxs].data = read_file(e, &rxs[nrxs].len);
+			rxs[nrxs].start = 10 * rxs[nrxs].bit;		// a character time of idle first
+			++nrxs;
+		} else if (!strcmp(argv[i], "--pipe")) {
+			pipes[npipes].src = parse_core(argv[++i], &e);
+			e = expect(e, '=', argv[i - 1]);
+			pipes[npipes].dst = parse_core(e, &e);
+			++npipes;
+		} else if (!strcmp(argv[i], "--fifo-depth") || !strcmp(argv[i], "--stack-depth") ||
+				!strcmp(argv[i], "--isr-vect")) {
+			++i;
+		} else {
+			fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+			exit(-1);
+		}
+	}
+
+	// the parent can arbitrate a read against a write on one core, not two producers or two consumers
+	for (i = 0; i < npipes; i++) {
+		if (pipes[i].src == pipes[i].dst) {
+			fprintf(stderr, "--pipe %d=%d pipes a core into itself\n", pipes[i].src, pipes[i].dst);
+			exit(-1);
+		}
+		if (cores[pipes[i].dst].feed) {
+			fprintf(stderr, "Core %d can't have --fifo-in and be fed by --pipe %d=%d\n", pipes[i].dst, pipes[i].src, pipes[i].dst);
+			exit(-1);
+		}
+		if (cores[pipes[i].src].drain) {
+			fprintf(stderr, "Core %d can't have --fifo-out and be read by --pipe %d=%d\n", pipes[i].src, pipes[i].src, pipes[i].dst);
+			exit(-1);
+		}
+		for (c = 0; c < i; c++) {
+			if (pipes[c].src == pipes[i].src || pipes[c].dst == pipes[i].dst) {
+				fprintf(stderr, "--pipe %d=%d and --pipe %d=%d share a %s\n", pipes[c].src, pipes[c].dst, pipes[i].src, pipes[i].dst,
+					pipes[c].src == pipes[i].src ? "source" : "destination");
+				exit(-1);
+			}
+		}
+	}
+
+	for (cycle = 0; cycle < max_cycles && hit < 0; cycle++) {
+		hit = clock_all(cycle);
+	}
+	fflush(stdout);
+
+	fprintf(stderr, "\nuseq_sim: %s after %" PRIu64 " cycles\n",
+		hit >= 0 ? "stop PC reached" : "cycle limit", cycle);
+	for (c = 0; c < ncores; c++) {
+		struct useq_cpu *m = &cores[c].m;
+		fprintf(stderr, "  core %d: PC=%03X %s A=%02X SP=%u FIFO=%d, %" PRIu64 " instructions, %" PRIu64 " IRQs, "
+			"%" PRIu64 " cycles waiting, %" PRIu64 " stalled on the host FIFO\n",
+			c, m->PC, useq_state_names[m->state], m->A, m->SP, m->R[15], m->insns, m->irqs, m->wait_cycles, m->stall_cycles);
+	}
+	return 0;
+}
@@ -116,6 +116,15 @@ module useq_tb();
 			if (fifo_empty) read_fifo = 0;
 		end
 */
+		$display("Trying out SBIT...");
+		$readmemh("sbit_clean.hex", mem);
+		reset_cpu();
+		repeat(60) step_cpu();
+		if (useq_dut.R[15] != 3 || useq_dut.FIFO[0] != 8'h05 || useq_dut.FIFO[1] != 8'h06 || useq_dut.FIFO[2] != 8'h06) begin
+			$display("SBIT: FIFO=%d [%2h %2h %2h] expected 3 [05 06 06]", useq_dut.R[15], useq_dut.FIFO[0], useq_dut.FIFO[1], useq_dut.FIFO[2]);
+			$fatal(1);
+		end
+
 		$display("Trying out uart demo...");
 //		$readmemh("simple_clean.hex", mem);
 		$readmemh("uart_clean.hex", mem);
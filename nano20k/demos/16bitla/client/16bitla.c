@@ -1,12 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <termios.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#ifdef LA_FST
+#include "fstapi.h"
+#endif
 
 // FPGA clock in Hz
 // normal system clock
@@ -15,6 +24,30 @@
 // Using PLL
 #define FPGA_CLOCK 148500000ULL
 
+// UART link to the FPGA, must match UART_BAUDDIV in top.v
+#define LA_BAUD 230400
+#define LA_BAUD_FLAG B230400
+
+// streaming switches the link to this unless --baud says otherwise (divider 98, exact)
+#define STREAM_BAUD 1500000
+
+// stream records with a zero run are markers followed by a 32-bit parameter
+#define STREAM_MARK_OVERFLOW 1
+#define STREAM_MARK_END 2
+
+// the capture is a 2 byte write pointer followed by 64KB of sample memory
+#define CAPTURE_BYTES 65538
+
+// trigger mode 4 is the sequencer in top.v, each stage is 8 bytes sent after the command frame
+#define TRIGGER_SEQ 4
+#define SEQ_STAGES 4
+// clocks from the sample that completes a sequence to the timer FSM seeing it, seq_sample -> seq_match ->
+// seq_fire -> timer_trigger_latch, the capture's trigger is the last sample taken before then
+#define SEQ_PIPE_CLOCKS 3
+
+// "decode ..." lines in the config
+#define MAX_DECODERS 8
+
 #define NS_PER_SAMPLE (((uint64_t)((uint64_t)prescale + 1ULL) * 1000000000ULL) / (double)FPGA_CLOCK)
 
 static int set_interface_attribs(int fd, int speed) {
@@ -45,16 +78,59 @@ uint8_t prescale, post_trigger, lut4mode;
 uint16_t trigger_mask, trigger_pol;
 char names[16][256];
 uint16_t WPTR;
-uint8_t outbuf[65538];
-uint16_t samples[65536];
+
+struct seq_stage {
+	uint16_t mask, value;		// the stage matches when (sample & mask) == (value & mask)
+	unsigned count;				// matches to complete it (1..32767)
+	unsigned within;			// samples it has to complete in (0 == no limit)
+	int edge;					// only count samples that match when the previous one didn't
+} seq[SEQ_STAGES];
+int seq_stages;
+uint8_t rxbuf[CAPTURE_BYTES];
+const uint8_t *sample_data = rxbuf + 2;		// samples are decoded in place from here
 int la_channels = 0;
 unsigned la_samples;
 
+// sample x of the capture, 1 byte per sample in 8 channel mode and 2 (little endian) in 16
+static inline uint16_t sample_at(unsigned x)
+{
+	if (la_channels == 8) {
+		return sample_data[x];
+	}
+	return (uint16_t)sample_data[x + x] | ((uint16_t)sample_data[x + x + 1] << 8);
+}
+
+static double time_s(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu_s(void)
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+
+static void parse_decoder(char *line);
+
+static const char *trigger_name(void)
+{
+	switch (lut4mode & 0x0F) {
+		case 0: return "edge";
+		case TRIGGER_SEQ: return "sequencer";
+		default: return "LUT4";
+	}
+}
 
 static void read_config(char *fname)
 {
 	FILE *f;
-	int x;
+	char line[256], kind[16];
+	int x, have;
 	
 	f = fopen(fname, "r");
 	if (f) {
@@ -70,7 +146,7 @@ static void read_config(char *fname)
 			fprintf(stderr, "ERROR: Expecting trigger mask hex value\n");
 			exit(-1);
 		}
-		if (trigger_mask == 0) {
+		if (trigger_mask == 0 && (lut4mode & 0x0F) != TRIGGER_SEQ) {
 			fprintf(stderr, "ERROR: trigger mask cannot be zero (it would never trigger)\n");
 			exit(-1);
 		}
@@ -91,13 +167,50 @@ static void read_config(char *fname)
 			la_samples = 65536;
 		}
 
+		// in sequencer mode "stage MASK VALUE COUNT WITHIN [edge|level]" lines come before the names
+		have = fgets(line, sizeof line, f) != NULL;
+		if ((lut4mode & 0x0F) == TRIGGER_SEQ) {
+			for (seq_stages = 0; have && !strncmp(line, "stage", 5); have = fgets(line, sizeof line, f) != NULL) {
+				if (seq_stages == SEQ_STAGES) {
+					fprintf(stderr, "ERROR: At most %d sequencer stages\n", SEQ_STAGES);
+					exit(-1);
+				}
+				strcpy(kind, "level");
+				if (sscanf(line, "stage %"SCNx16" %"SCNx16" %u %u %15s", &seq[seq_stages].mask, &seq[seq_stages].value,
+						&seq[seq_stages].count, &seq[seq_stages].within, kind) < 4) {
+					fprintf(stderr, "ERROR: Expecting 'stage MASK VALUE COUNT WITHIN [edge|level]' not '%s'\n", line);
+					exit(-1);
+				}
+				if (seq[seq_stages].count < 1 || seq[seq_stages].count > 32767 || seq[seq_stages].within > 65535) {
+					fprintf(stderr, "ERROR: stage %d count must be 1..32767 and within 0..65535\n", seq_stages);
+					exit(-1);
+				}
+				if (strcmp(kind, "edge") && strcmp(kind, "level")) {
+					fprintf(stderr, "ERROR: stage %d must be 'edge' or 'level' not '%s'\n", seq_stages, kind);
+					exit(-1);
+				}
+				seq[seq_stages++].edge = !strcmp(kind, "edge");
+			}
+			if (!seq_stages) {
+				fprintf(stderr, "ERROR: Trigger mode %d needs at least one 'stage' line after the post trigger count\n", TRIGGER_SEQ);
+				exit(-1);
+			}
+		}
+
 		for (x = 0; x < la_channels; x++) {
-			if (fgets(names[x], sizeof(names[0]) - 1, f) == NULL) {
+			if (!have || !strncmp(line, "decode", 6)) {
 				sprintf(names[x], "unused%d", x);
 			} else {
-				if (names[x][strlen(names[x])-1] == '\n') {
-					names[x][strlen(names[x])-1] = 0;
-				}
+				line[strcspn(line, "\n")] = 0;
+				strcpy(names[x], line);
+				have = fgets(line, sizeof line, f) != NULL;
+			}
+		}
+
+		// protocol decoders to run on each capture, after the names since they refer to them
+		for (; have; have = fgets(line, sizeof line, f) != NULL) {
+			if (!strncmp(line, "decode", 6)) {
+				parse_decoder(line);
 			}
 		}
 	} else {
@@ -107,11 +220,11 @@ static void read_config(char *fname)
 	fclose(f);
 }
 
-static void program_and_read(int fd)
+static void send_command(int fd, uint8_t div)
 {
-	uint8_t cmd[8];
+	uint8_t cmd[8], stages[8 * SEQ_STAGES];
 	int x;
-	
+
 	cmd[0] = trigger_mask & 0xFF;
 	cmd[1] = trigger_mask >> 8;
 	cmd[2] = trigger_pol & 0xFF;
@@ -119,145 +232,1653 @@ static void program_and_read(int fd)
 	cmd[4] = prescale;
 	cmd[5] = post_trigger;
 	cmd[6] = lut4mode;
-	cmd[7] = 0;
-	
+	cmd[7] = div;
+
 	if (write(fd, cmd, 8) != 8) {
 		fprintf(stderr, "ERROR: Could not write command to logic analyzer...\n");
 		exit(-1);
 	}
+	if ((lut4mode & 0x0F) == TRIGGER_SEQ) {
+		// unused stages have a count of 0 which ends the sequence
+		memset(stages, 0, sizeof stages);
+		for (x = 0; x < seq_stages; x++) {
+			stages[8 * x + 0] = seq[x].mask & 0xFF;
+			stages[8 * x + 1] = seq[x].mask >> 8;
+			stages[8 * x + 2] = seq[x].value & 0xFF;
+			stages[8 * x + 3] = seq[x].value >> 8;
+			stages[8 * x + 4] = seq[x].count & 0xFF;
+			stages[8 * x + 5] = ((seq[x].count >> 8) & 0x7F) | (seq[x].edge << 7);
+			stages[8 * x + 6] = seq[x].within & 0xFF;
+			stages[8 * x + 7] = seq[x].within >> 8;
+		}
+		if (write(fd, stages, sizeof stages) != sizeof stages) {
+			fprintf(stderr, "ERROR: Could not write sequencer stages to logic analyzer...\n");
+			exit(-1);
+		}
+	}
 	tcdrain(fd);
+}
+
+static void program_and_read(int fd)
+{
+	struct pollfd pfd;
+	double t0 = 0, c0 = 0, t, c;
+	int x, n;
 	
-	printf("Reading waveform data...\n");
-	x = 0;
-	for (x = 0; x < 65538; ) {
-		if (!((x + 1) & 255)) { printf("Read: %5d bytes (%3d%%) so far...\r", x + 1,  ((x + 1) * 100) / 65536); fflush(stdout); }
-		if (read(fd, &cmd[0], 1) == 1) {
-			outbuf[x++] = cmd[0];
+	send_command(fd, 0);
+	
+	printf("Waiting for trigger...\n");
+	for (x = 0; x < CAPTURE_BYTES; ) {
+		// sleep in poll() until the FPGA sends something, then take whatever the driver has in one read
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		n = poll(&pfd, 1, 1000);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("poll");
+			exit(-1);
+		}
+		if (n == 0 || !(pfd.revents & POLLIN)) {
+			if (pfd.revents & (POLLERR | POLLHUP)) {
+				fprintf(stderr, "ERROR: serial port closed during capture\n");
+				exit(-1);
+			}
+			continue;
+		}
+		n = read(fd, rxbuf + x, CAPTURE_BYTES - x);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			perror("read");
+			exit(-1);
+		}
+		if (!x && n) {
+			// the first byte arrives once the capture has finished so time the transfer from here
+			t0 = time_s();
+			c0 = cpu_s();
+		}
+		x += n;
+		if ((x >> 12) != ((x - n) >> 12) || x == CAPTURE_BYTES) {
+			printf("Read: %5d bytes (%3d%%) so far...\r", x, (x * 100) / CAPTURE_BYTES); fflush(stdout);
 		}
 	}
+	t = time_s() - t0;
+	c = cpu_s() - c0;
 	printf("Done.                                       \n");
-	
-	// load write pointer
-	WPTR = ((uint16_t)outbuf[0]) | ((uint16_t)outbuf[1] << 8);
+	// 8N1 is 10 bits on the wire per byte
+	printf("Read %d bytes in %.3f s: %.0f bytes/s, %.1f%% of %d baud, %.1f%% CPU\n",
+		CAPTURE_BYTES, t, CAPTURE_BYTES / t, (CAPTURE_BYTES * 10.0 / t) * 100.0 / LA_BAUD, LA_BAUD, t > 0 ? (c * 100.0) / t : 0.0);
+
+	// load write pointer, the samples after it are used in place
+	WPTR = ((uint16_t)rxbuf[0]) | ((uint16_t)rxbuf[1] << 8);
 	if (la_channels == 16) {
 		WPTR >>= 1;				// divide the offset by 2 to get a sample index
 	}
-	memmove(outbuf, outbuf + 2, 65536);							// shift array down so 0..65535 is the buffer
-	
-	if (la_channels == 8) {
-		// direct copy
-		for (x = 0; x < la_samples; x++) {
-			samples[x] = outbuf[x] & 0xFF;
+}
+
+// buffered output for the VCD writer, one fwrite per OUTBUF_SIZE bytes
+#define OUTBUF_SIZE 65536
+#define OUTBUF_SAMPLE 128		// most one sample can add (time, bus and 16 pins)
+struct outbuf {
+	FILE *f;
+	size_t used;
+	uint64_t total;
+	char buf[OUTBUF_SIZE];
+};
+
+static void ob_flush(struct outbuf *o)
+{
+	if (o->used && fwrite(o->buf, 1, o->used, o->f) != o->used) {
+		fprintf(stderr, "ERROR: Could not write VCD output\n");
+		exit(-1);
+	}
+	o->total += o->used;
+	o->used = 0;
+}
+
+static inline void ob_reserve(struct outbuf *o, size_t n)
+{
+	if (o->used + n > OUTBUF_SIZE) {
+		ob_flush(o);
+	}
+}
+
+static inline void ob_putc(struct outbuf *o, char c)
+{
+	o->buf[o->used++] = c;
+}
+
+static void ob_puts(struct outbuf *o, const char *s)
+{
+	size_t n = strlen(s);
+	ob_reserve(o, n);
+	memcpy(o->buf + o->used, s, n);
+	o->used += n;
+}
+
+static inline void ob_putu64(struct outbuf *o, uint64_t v)
+{
+	char tmp[20];
+	int n = 0;
+	do {
+		tmp[n++] = '0' + (v % 10);
+		v /= 10;
+	} while (v);
+	while (n) {
+		o->buf[o->used++] = tmp[--n];
+	}
+}
+
+// the bus as a VCD binary value, leading zeros dropped as VCD allows
+static inline void ob_putbus(struct outbuf *o, uint16_t val)
+{
+	int b;
+	ob_putc(o, 'b');
+	for (b = la_channels - 1; b > 0 && !((val >> b) & 1); b--);
+	for (; b >= 0; b--) {
+		ob_putc(o, '0' + ((val >> b) & 1));
+	}
+	ob_putc(o, ' ');
+	ob_putc(o, '!');
+	ob_putc(o, '\n');
+}
+
+static uint64_t gcd64(uint64_t a, uint64_t b)
+{
+	while (b) {
+		uint64_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+// exact sample times in ps, t(i) = i * (prescale + 1) * 1e12 / FPGA_CLOCK rounded, each computed
+// from i so nothing accumulates over the capture
+struct sample_clock {
+	uint64_t num, den;
+};
+
+static void sample_clock_init(struct sample_clock *sc, uint16_t prescale_val)
+{
+	uint64_t g = gcd64(1000000000000ULL, FPGA_CLOCK);
+	sc->num = (1000000000000ULL / g) * ((uint64_t)prescale_val + 1);
+	sc->den = FPGA_CLOCK / g;
+}
+
+// split on den so i * num can't overflow even for streams billions of samples long
+static inline uint64_t sample_ps(const struct sample_clock *sc, uint64_t i)
+{
+	return (i / sc->den) * sc->num + ((i % sc->den) * sc->num + sc->den / 2) / sc->den;
+}
+
+// capture order starts at the oldest sample, la_samples - 1 - post_trigger_samples is the trigger
+static uint32_t first_sample(uint16_t wptr, uint32_t post_trigger_samples)
+{
+	return (wptr + post_trigger_samples) & (la_samples - 1);
+}
+
+static uint32_t post_trigger_samples_of(uint8_t post_trigger_val)
+{
+	return (uint32_t)post_trigger_val * (la_channels == 16 ? 128 : 256);
+}
+
+// VCD header, 1ps timescale so the sample times can be exact integers
+static void vcd_begin(struct outbuf *o, const char *filename)
+{
+	time_t now;
+	char line[256];
+	int b;
+
+	o->f = fopen(filename, "w");
+	if (!o->f) {
+		fprintf(stderr, "ERROR: Could not create '%s'\n", filename);
+		exit(-1);
+	}
+	o->used = 0;
+	o->total = 0;
+
+	now = time(NULL);
+	snprintf(line, sizeof line, "$date %s $end\n", ctime(&now));
+	ob_puts(o, line);
+	ob_puts(o, "$version 16-bit Logic Analyzer v1.2 $end\n");
+	ob_puts(o, "$timescale 1ps $end\n");
+	ob_puts(o, "$scope module top $end\n");
+	snprintf(line, sizeof line, "$var wire %d ! bus [%d:0] $end\n", la_channels, la_channels - 1);
+	ob_puts(o, line);
+	for (b = 0; b < la_channels; b++) {
+		snprintf(line, sizeof line, "$var wire 1 %c ", 'A' + b);
+		ob_puts(o, line);
+		ob_puts(o, names[b]);
+		ob_puts(o, " $end\n");
+	}
+	ob_puts(o, "$upscope $end\n$enddefinitions $end\n");
+}
+
+// initial values at time t
+static void vcd_dump(struct outbuf *o, uint64_t t, uint16_t val)
+{
+	int b;
+
+	ob_reserve(o, OUTBUF_SAMPLE + 32);
+	ob_putc(o, '#');
+	ob_putu64(o, t);
+	ob_puts(o, "\n$dumpvars\n");
+	ob_putbus(o, val);
+	for (b = 0; b < la_channels; b++) {
+		ob_putc(o, '0' + ((val >> b) & 1));
+		ob_putc(o, 'A' + b);
+		ob_putc(o, '\n');
+	}
+	ob_puts(o, "$end\n");
+}
+
+// the bus and only the pins in diff, the toggled pins come straight out of the XOR
+static inline void vcd_change(struct outbuf *o, uint64_t t, uint16_t val, uint16_t diff)
+{
+	int b;
+
+	ob_reserve(o, OUTBUF_SAMPLE);
+	ob_putc(o, '#');
+	ob_putu64(o, t);
+	ob_putc(o, '\n');
+	ob_putbus(o, val);
+	do {
+		b = __builtin_ctz(diff);
+		diff &= diff - 1;
+		ob_putc(o, '0' + ((val >> b) & 1));
+		ob_putc(o, 'A' + b);
+		ob_putc(o, '\n');
+	} while (diff);
+}
+
+// mark the end of the capture at t so viewers show the full length, returns the bytes written
+static uint64_t vcd_end(struct outbuf *o, uint64_t t)
+{
+	ob_reserve(o, OUTBUF_SAMPLE);
+	ob_putc(o, '#');
+	ob_putu64(o, t);
+	ob_putc(o, '\n');
+	ob_flush(o);
+	fclose(o->f);
+	o->f = NULL;
+	return o->total;
+}
+
+// returns the number of bytes written
+uint64_t emit_vcd(const char *filename, uint16_t wptr, uint8_t post_trigger_val, uint16_t prescale_val)
+{
+	static struct outbuf o;
+	struct sample_clock sc;
+	uint32_t i, idx, trig, post;
+	uint16_t val, prev, diff;
+
+	vcd_begin(&o, filename);
+
+	sample_clock_init(&sc, prescale_val);
+	post = post_trigger_samples_of(post_trigger_val);
+	trig = la_samples - post - 1;
+	idx = first_sample(wptr, post);
+
+	prev = sample_at(idx);
+	vcd_dump(&o, 0, prev);
+	for (i = 1; i < la_samples; i++) {
+		val = sample_at((idx + i) & (la_samples - 1));
+		diff = val ^ prev;
+		if (diff) {
+			vcd_change(&o, sample_ps(&sc, i), val, diff);
+			prev = val;
+		}
+		if (i == trig) {
+			ob_puts(&o, "$comment TRIGGER_EVENT $end\n");
+		}
+	}
+	return vcd_end(&o, sample_ps(&sc, la_samples));
+}
+
+#ifdef LA_FST
+// the same capture through GTKWave's fstapi, built with "make 16bitla_fst FST_DIR=..."
+static void *fst_begin(const char *filename, fstHandle *bus, fstHandle *pins)
+{
+	void *ctx;
+	time_t now;
+	int b;
+
+	ctx = fstWriterCreate(filename, 1);
+	if (!ctx) {
+		fprintf(stderr, "ERROR: Could not create '%s'\n", filename);
+		exit(-1);
+	}
+	now = time(NULL);
+	fstWriterSetDate(ctx, ctime(&now));
+	fstWriterSetVersion(ctx, "16-bit Logic Analyzer v1.2");
+	fstWriterSetTimescale(ctx, -12);
+	fstWriterSetScope(ctx, FST_ST_VCD_MODULE, "top", NULL);
+	*bus = fstWriterCreateVar(ctx, FST_VT_VCD_WIRE, FST_VD_IMPLICIT, la_channels, "bus", 0);
+	for (b = 0; b < la_channels; b++) {
+		pins[b] = fstWriterCreateVar(ctx, FST_VT_VCD_WIRE, FST_VD_IMPLICIT, 1, names[b], 0);
+	}
+	fstWriterSetUpscope(ctx);
+	return ctx;
+}
+
+static void fst_change(void *ctx, fstHandle bus, const fstHandle *pins, uint64_t t, uint16_t val, uint16_t diff)
+{
+	char bits[17];
+	int b;
+
+	fstWriterEmitTimeChange(ctx, t);
+	for (b = 0; b < la_channels; b++) {
+		bits[la_channels - 1 - b] = '0' + ((val >> b) & 1);
+	}
+	bits[la_channels] = 0;
+	fstWriterEmitValueChange(ctx, bus, bits);
+	do {
+		b = __builtin_ctz(diff);
+		diff &= diff - 1;
+		fstWriterEmitValueChange(ctx, pins[b], ((val >> b) & 1) ? "1" : "0");
+	} while (diff);
+}
+
+void emit_fst(const char *filename, uint16_t wptr, uint8_t post_trigger_val, uint16_t prescale_val)
+{
+	void *ctx;
+	fstHandle bus, pins[16];
+	struct sample_clock sc;
+	uint32_t i, idx, post;
+	uint16_t val, prev, diff;
+
+	ctx = fst_begin(filename, &bus, pins);
+	sample_clock_init(&sc, prescale_val);
+	post = post_trigger_samples_of(post_trigger_val);
+	idx = first_sample(wptr, post);
+
+	prev = ~sample_at(idx) & (la_channels == 16 ? 0xFFFF : 0x00FF);		// everything "changes" at time 0
+	for (i = 0; i < la_samples; i++) {
+		val = sample_at((idx + i) & (la_samples - 1));
+		diff = val ^ prev;
+		if (diff) {
+			fst_change(ctx, bus, pins, sample_ps(&sc, i), val, diff);
+			prev = val;
+		}
+	}
+	fstWriterEmitTimeChange(ctx, sample_ps(&sc, la_samples));
+	fstWriterClose(ctx);
+}
+#endif
+
+// link rates top.v's 8-bit stream divider can do, the tx bit time is (div + 1) FPGA clocks
+static const struct {
+	unsigned baud;
+	speed_t flag;
+} stream_bauds[] = {
+	{ 921600, B921600 }, { 1000000, B1000000 }, { 1152000, B1152000 }, { 1500000, B1500000 },
+	{ 2000000, B2000000 }, { 2500000, B2500000 }, { 3000000, B3000000 }, { 3500000, B3500000 },
+	{ 4000000, B4000000 },
+};
+
+// the command byte 7 divider for baud, exits if the UART can't get within 2% of it
+static uint8_t stream_div(unsigned baud, speed_t *flag)
+{
+	unsigned x, div;
+	double err;
+
+	for (x = 0; x < sizeof(stream_bauds) / sizeof(stream_bauds[0]); x++) {
+		if (stream_bauds[x].baud == baud) {
+			break;
 		}
+	}
+	if (x == sizeof(stream_bauds) / sizeof(stream_bauds[0])) {
+		fprintf(stderr, "ERROR: Unsupported stream baud rate %u (try 921600, 1000000, 1152000, 1500000, 2000000, 2500000, 3000000, 3500000 or 4000000)\n", baud);
+		exit(-1);
+	}
+	div = (FPGA_CLOCK + baud / 2) / baud - 1;
+	err = ((double)FPGA_CLOCK / (div + 1) - baud) * 100.0 / baud;
+	if (div < 1 || div > 255 || err > 2.0 || err < -2.0) {
+		fprintf(stderr, "ERROR: %u baud is %.2f%% off with a divider of %u\n", baud, err, div);
+		exit(-1);
+	}
+	*flag = stream_bauds[x].flag;
+	return div;
+}
+
+// live output for a stream, times are from the first sample after the trigger
+struct stream_out {
+	struct outbuf o;
+	struct sample_clock sc;
+	const char *base;
+	uint64_t roll_bytes;		// start a new VCD once one gets this big (0 == one file)
+	int file_no;
+	uint64_t vcd_bytes;			// bytes in the VCDs already closed
+	uint64_t pos;				// sample index of the next record
+	uint16_t prev;
+	int known;					// prev is valid (cleared by an overflow)
+	uint64_t records, overflows, lost;
+#ifdef LA_FST
+	void *fst;
+	fstHandle bus, pins[16];
+#endif
+};
+
+static void stream_open_vcd(struct stream_out *s, uint64_t t, uint16_t val)
+{
+	char fname[300];
+
+	if (s->roll_bytes) {
+		snprintf(fname, sizeof fname, "%s.%03d.vcd", s->base, s->file_no++);
 	} else {
-		// 2 bytes per sample
-		for (x = 0; x < la_samples; x++) {
-			samples[x] = ((uint16_t)outbuf[x+x+0]) | ((uint16_t)outbuf[x+x+1] << 8);
+		snprintf(fname, sizeof fname, "%s.vcd", s->base);
+	}
+	vcd_begin(&s->o, fname);
+	vcd_dump(&s->o, t, val);
+}
+
+// a run of identical samples starting at s->pos
+static void stream_run(struct stream_out *s, uint32_t run, uint16_t val)
+{
+	uint16_t mask = la_channels == 16 ? 0xFFFF : 0x00FF;
+	uint64_t t;
+
+	t = sample_ps(&s->sc, s->pos);
+	if (!s->o.f) {
+		stream_open_vcd(s, t, val);
+	} else if (!s->known || val != s->prev) {
+		if (s->roll_bytes && s->o.total + s->o.used >= s->roll_bytes) {
+			// close this file where the next one starts so they line up back to back
+			s->vcd_bytes += vcd_end(&s->o, t);
+			stream_open_vcd(s, t, val);
+		} else {
+			vcd_change(&s->o, t, val, s->known ? val ^ s->prev : mask);
 		}
 	}
+#ifdef LA_FST
+	if (s->fst && (!s->known || val != s->prev)) {
+		fst_change(s->fst, s->bus, s->pins, t, val, s->known ? val ^ s->prev : mask);
+	}
+#endif
+	s->prev = val;
+	s->known = 1;
+	s->pos += run;
+	++(s->records);
 }
 
-#include <time.h>
+// the FPGA dropped lost samples starting at s->pos, they show up as x
+static void stream_overflow(struct stream_out *s, uint32_t lost)
+{
+	char line[128];
+	uint64_t t;
+	int b;
 
-#include <time.h>
-#include <inttypes.h>
+	t = sample_ps(&s->sc, s->pos);
+	printf("\nOVERFLOW: lost %u samples at sample %llu (%.9f s)\n", lost, (unsigned long long)s->pos, t / 1e12);
+	if (s->o.f) {
+		ob_reserve(&s->o, OUTBUF_SAMPLE + sizeof line);
+		ob_putc(&s->o, '#');
+		ob_putu64(&s->o, t);
+		snprintf(line, sizeof line, "\n$comment OVERFLOW %u samples lost $end\nbx !\n", lost);
+		ob_puts(&s->o, line);
+		for (b = 0; b < la_channels; b++) {
+			ob_putc(&s->o, 'x');
+			ob_putc(&s->o, 'A' + b);
+			ob_putc(&s->o, '\n');
+		}
+	}
+#ifdef LA_FST
+	if (s->fst) {
+		char bits[17];
+		memset(bits, 'x', la_channels);
+		bits[la_channels] = 0;
+		fstWriterEmitTimeChange(s->fst, t);
+		fstWriterEmitValueChange(s->fst, s->bus, bits);
+		for (b = 0; b < la_channels; b++) {
+			fstWriterEmitValueChange(s->fst, s->pins[b], "x");
+		}
+	}
+#endif
+	s->known = 0;
+	s->pos += lost;
+	++(s->overflows);
+	s->lost += lost;
+}
+
+static volatile sig_atomic_t stream_sigint;
+
+static void stream_on_sigint(int sig)
+{
+	(void)sig;
+	stream_sigint = 1;
+}
+
+// mode bit 6: the FPGA sends run length records until we send it a byte, written out as they arrive
+static void stream_capture(int fd, const char *base, int fst, unsigned roll_mb, unsigned baud)
+{
+	static struct stream_out s;
+	struct sigaction sa;
+	struct pollfd pfd;
+	speed_t flag;
+	uint8_t div, stop = 0xFF;
+	uint32_t w, run, param;
+	uint64_t bytes = 0;
+	double t0 = 0, c0 = 0, t, c, tstat = 0, tstop = 0;
+	int n, len = 0, off, done = 0, stopping = 0;
+	char fname[300];
+
+	div = stream_div(baud, &flag);
+	s.base = base;
+	s.roll_bytes = (uint64_t)roll_mb << 20;
+	sample_clock_init(&s.sc, prescale);
+#ifdef LA_FST
+	if (fst) {
+		snprintf(fname, sizeof fname, "%s.fst", base);
+		s.fst = fst_begin(fname, &s.bus, s.pins);
+	}
+#else
+	(void)fname;
+	(void)fst;
+#endif
+
+	// the FPGA switches to the divider as soon as it has the command, nothing comes back until the trigger
+	send_command(fd, div);
+	set_interface_attribs(fd, flag);
+	tcflush(fd, TCIFLUSH);
+
+	// no SA_RESTART so poll() wakes up, a second ^C kills us
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = stream_on_sigint;
+	sa.sa_flags = SA_RESETHAND;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+
+	printf("Streaming at %u baud (divider %u), waiting for trigger, ^C to stop...\n", baud, div);
+	while (!done) {
+		if (stream_sigint && !stopping) {
+			// any byte stops the stream, the FPGA then sends its last run and the end marker
+			if (write(fd, &stop, 1) != 1) {
+				perror("write");
+				exit(-1);
+			}
+			stopping = 1;
+			tstop = time_s();
+			printf("\nStopping...\n");
+		}
+		if (stopping && time_s() - tstop > 5.0) {
+			fprintf(stderr, "ERROR: no end marker from the logic analyzer\n");
+			exit(-1);
+		}
+
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		n = poll(&pfd, 1, 100);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("poll");
+			exit(-1);
+		}
+		if (n > 0 && (pfd.revents & POLLIN)) {
+			n = read(fd, rxbuf + len, sizeof(rxbuf) - len);
+			if (n < 0) {
+				if (errno == EINTR || errno == EAGAIN) {
+					continue;
+				}
+				perror("read");
+				exit(-1);
+			}
+			if (!bytes && n) {
+				t0 = tstat = time_s();
+				c0 = cpu_s();
+			}
+			bytes += n;
+			len += n;
+
+			// records are 4 bytes LSB first, markers have their 4 byte parameter right after them
+			for (off = 0; len - off >= 4 && !done; ) {
+				w = (uint32_t)rxbuf[off] | ((uint32_t)rxbuf[off + 1] << 8) | ((uint32_t)rxbuf[off + 2] << 16) | ((uint32_t)rxbuf[off + 3] << 24);
+				run = la_channels == 16 ? (w >> 16) : (w >> 8);
+				if (run) {
+					stream_run(&s, run, w & (la_channels == 16 ? 0xFFFF : 0x00FF));
+					off += 4;
+					continue;
+				}
+				if (len - off < 8) {
+					break;
+				}
+				param = (uint32_t)rxbuf[off + 4] | ((uint32_t)rxbuf[off + 5] << 8) | ((uint32_t)rxbuf[off + 6] << 16) | ((uint32_t)rxbuf[off + 7] << 24);
+				off += 8;
+				switch (w) {
+					case STREAM_MARK_OVERFLOW:
+						stream_overflow(&s, param);
+						break;
+					case STREAM_MARK_END:
+						// the FPGA's count is 32 bits so compare modulo 2^32
+						if ((uint32_t)s.pos != param) {
+							fprintf(stderr, "WARNING: the logic analyzer took %u samples but %llu were decoded\n", param, (unsigned long long)s.pos);
+						}
+						done = 1;
+						break;
+					default:
+						fprintf(stderr, "ERROR: unknown stream marker %08x\n", w);
+						exit(-1);
+				}
+			}
+			memmove(rxbuf, rxbuf + off, len - off);
+			len -= off;
+		} else if (pfd.revents & (POLLERR | POLLHUP)) {
+			fprintf(stderr, "ERROR: serial port closed during capture\n");
+			exit(-1);
+		}
+
+		if (bytes && time_s() - tstat >= 1.0) {
+			tstat = time_s();
+			t = tstat - t0;
+			printf("%llu samples (%.3f s), %llu records, %.0f bytes/s (%.1f%% of link), %llu overflows, %.1f MB VCD   \r",
+				(unsigned long long)s.pos, sample_ps(&s.sc, s.pos) / 1e12, (unsigned long long)s.records,
+				bytes / t, (bytes * 10.0 / t) * 100.0 / baud, (unsigned long long)s.overflows,
+				(s.vcd_bytes + s.o.total + s.o.used) / 1048576.0);
+			fflush(stdout);
+		}
+	}
+	signal(SIGINT, SIG_DFL);
+	t = time_s() - t0;
+	c = cpu_s() - c0;
+
+	if (s.o.f) {
+		s.vcd_bytes += vcd_end(&s.o, sample_ps(&s.sc, s.pos));
+	}
+#ifdef LA_FST
+	if (s.fst) {
+		fstWriterEmitTimeChange(s.fst, sample_ps(&s.sc, s.pos));
+		fstWriterClose(s.fst);
+	}
+#endif
+
+	// top.v goes back to 230400 baud once its last byte is out
+	usleep(10000);
+	set_interface_attribs(fd, LA_BAUD_FLAG);
+	tcflush(fd, TCIOFLUSH);
 
-void emit_vcd(const char *filename, uint16_t *buffer, uint16_t wptr, uint8_t post_trigger_val, uint16_t prescale_val)
-{
-    FILE *f = fopen(filename, "w");
-    if (!f) return;
-
-    // 1. Header and Timescale
-    time_t now = time(NULL);
-    fprintf(f, "$date %s $end\n", ctime(&now));
-    fprintf(f, "$version 16-bit Logic Analyzer v1.1 $end\n");
-    
-    double ns_per_sample = (uint64_t)(prescale_val + 1) * 1000000000.0 / FPGA_CLOCK;
-    fprintf(f, "$timescale 1ns $end\n");
-
-    // 2. Variable Definitions
-    fprintf(f, "$scope module top $end\n");
-    fprintf(f, "$var wire %d ! bus [%d:0] $end\n", la_channels, la_channels - 1); 
-    for (int i = 0; i < la_channels; i++) {
-        fprintf(f, "$var wire 1 %c %s $end\n", 'A' + i, names[i]); 
-    }
-    fprintf(f, "$upscope $end\n");
-    fprintf(f, "$enddefinitions $end\n");
-
-    // 3. Logic to center the trigger
-    // Total buffer is 65536 samples.
-    // In FPGA, timer_post_cnt = post_trigger_val * 256.
-    uint32_t total_samples = la_samples;
-    uint32_t post_trigger_samples = (uint32_t)post_trigger_val * (la_channels == 16 ? 128 : 256);
-    
-    // 4. Initial Values
-    fprintf(f, "#0\n$dumpvars\nbxxxxxxxx !\n");
-    for (int i = 0; i < la_channels; i++) fprintf(f, "x%c\n", 'A' + i);
-
-    // 5. Data Dump
-    uint16_t prev_val = 0; 
-    double current_time = 0;
-
-	// we want to map 0..la_samples such that la_samples == wptr + post_trigger_samples
-    uint16_t idx = (wptr + post_trigger_samples) & (la_samples - 1);
-
-    for (uint32_t i = 0; i < total_samples; i++) {
-        uint16_t val = buffer[(idx++) & (la_samples - 1)];
-
-        // Force output on first sample, last sample, or any data change
-        if (i == 0 || i == (total_samples - 1) || val != prev_val) {
-            fprintf(f, "#%llu\n", (unsigned long long)current_time);
-            
-            // Output 8/16-bit Bus
-            fprintf(f, "b");
-            for (int b = la_channels - 1; b >= 0; b--) fprintf(f, "%d", (val >> b) & 1);
-            fprintf(f, " !\n");
-
-            // Output Individual Pins
-            for (int b = 0; b < la_channels; b++) {
-                if (i == 0 || i == (total_samples - 1) || ((val ^ prev_val) >> b) & 1) {
-                    fprintf(f, "%d%c\n", (val >> b) & 1, 'A' + b);
-                }
-            }
-            prev_val = val;
-        }
-
-        // Optional: Add a text marker in the VCD at the trigger point
-        if (i == (total_samples - post_trigger_samples - 1)) {
-            fprintf(f, "$comment TRIGGER_EVENT $end\n");
-        }
-
-        current_time += ns_per_sample;
-    }
-
-    fclose(f);
-    printf("VCD emitted. Trigger is %u samples before the end of the file.\n", post_trigger_samples);
+	printf("\nStreamed %llu samples (%.6f s) in %llu records, %llu overflows lost %llu samples\n",
+		(unsigned long long)s.pos, sample_ps(&s.sc, s.pos) / 1e12, (unsigned long long)s.records,
+		(unsigned long long)s.overflows, (unsigned long long)s.lost);
+	if (t > 0) {
+		printf("Read %llu bytes in %.3f s: %.0f bytes/s, %.1f%% of %u baud, %.1f%% CPU, %llu bytes of VCD in %d file%s\n",
+			(unsigned long long)bytes, t, bytes / t, (bytes * 10.0 / t) * 100.0 / baud, baud, (c * 100.0) / t,
+			(unsigned long long)s.vcd_bytes, s.roll_bytes ? s.file_no : 1, (s.roll_bytes && s.file_no != 1) ? "s" : "");
+	}
+}
+
+// load a .raw capture back into rxbuf, returns the post trigger byte it was taken with or -1 if the file predates it
+static int load_raw(const char *fname, uint16_t *wptr)
+{
+	FILE *f;
+	char line[64];
+	unsigned w, post, v, n;
+
+	f = fopen(fname, "r");
+	if (!f) {
+		fprintf(stderr, "ERROR: Could not open file '%s'\n", fname);
+		exit(-1);
+	}
+	if (!fgets(line, sizeof line, f) || sscanf(line, "WPTR == %x", &w) != 1) {
+		fprintf(stderr, "ERROR: '%s' doesn't start with a WPTR line\n", fname);
+		exit(-1);
+	}
+	if (sscanf(line, "WPTR == %*x POST == %x", &post) != 1) {
+		post = ~0u;
+	}
+	for (n = 0; n < la_samples && fscanf(f, "%x", &v) == 1; n++) {
+		if (la_channels == 8) {
+			rxbuf[2 + n] = v;
+		} else {
+			rxbuf[2 + n + n] = v & 0xFF;
+			rxbuf[3 + n + n] = v >> 8;
+		}
+	}
+	if (n != la_samples || fscanf(f, "%x", &v) == 1) {
+		fprintf(stderr, "ERROR: '%s' isn't a %d channel capture (%u samples)\n", fname, la_channels, la_samples);
+		exit(-1);
+	}
+	fclose(f);
+	*wptr = w;
+	return post == ~0u ? -1 : (int)post;
+}
+
+// post trigger samples of a .raw capture, from its header or this config for older files
+static uint32_t load_raw_post(const char *raw, uint16_t *wptr)
+{
+	int raw_post;
+
+	raw_post = load_raw(raw, wptr);
+	if (raw_post < 0) {
+		printf("'%s' has no POST in its header, assuming it was taken with this config's post trigger count\n", raw);
+		raw_post = post_trigger;
+	}
+	return post_trigger_samples_of(raw_post);
+}
+
+// replay the trigger over samples in time order the way top.v evaluates it, returns the sample it fires on or -1
+static long trigger_sim(const uint16_t *smp, unsigned n)
+{
+	unsigned i, stage = 0, count = 0, window = 0, shown = 0, timeouts = 0;
+	uint16_t addr, prev_match = ~0, match;
+	int x, hit, mode = lut4mode & 0x0F;
+
+	for (i = 0; i < n; i++) {
+		switch (mode) {
+			case 0:				// a masked pin changed to its polarity
+				if (i && (smp[i] ^ smp[i - 1]) & ~(smp[i] ^ trigger_pol) & trigger_mask) {
+					return i;
+				}
+				break;
+			case 1:				// LUT on io[3:0]
+			case 2:				// LUT on {io[1:0], previous io[1:0]}
+			case 3:				// LUT on {io[6:4], mask[io[3:0]]}
+				if (mode == 1) {
+					addr = smp[i] & 15;
+				} else if (mode == 2) {
+					addr = ((smp[i] & 3) << 2) | (i ? smp[i - 1] & 3 : 0);
+				} else {
+					addr = (((smp[i] >> 4) & 7) << 1) | ((trigger_mask >> (smp[i] & 15)) & 1);
+				}
+				if ((trigger_pol >> addr) & 1) {
+					return i;
+				}
+				break;
+			case TRIGGER_SEQ:
+				for (match = 0, x = 0; x < SEQ_STAGES; x++) {
+					if (x < seq_stages && !((smp[i] ^ seq[x].value) & seq[x].mask)) {
+						match |= 1 << x;
+					}
+				}
+				hit = ((match >> stage) & 1) && !(seq[stage].edge && ((prev_match >> stage) & 1));
+				prev_match = match;
+				if (hit && count + 1 == seq[stage].count) {
+					if (shown++ < 16) {
+						printf("  stage %u complete at sample %u\n", stage, i);
+					}
+					if (++stage == (unsigned)seq_stages) {
+						return i;
+					}
+					count = window = 0;
+				} else if (seq[stage].within && window + 1 == seq[stage].within) {
+					if (shown++ < 16) {
+						printf("  stage %u timed out at sample %u, back to stage 0\n", stage, i);
+					}
+					++timeouts;
+					stage = count = window = 0;
+				} else {
+					count += hit;
+					++window;
+				}
+				break;
+			default:
+				fprintf(stderr, "ERROR: Unknown trigger mode %d\n", mode);
+				exit(-1);
+		}
+	}
+	if (mode == TRIGGER_SEQ) {
+		printf("  stuck in stage %u with %u of %u matches, %u timeouts\n", stage, count, seq[stage].count, timeouts);
+	}
+	return -1;
+}
+
+// --simulate config.cfg capture.raw: would config.cfg's trigger have fired on this capture, and where
+static void simulate(const char *cfg, const char *raw)
+{
+	static uint16_t smp[65536];
+	struct sample_clock sc;
+	uint16_t wptr;
+	uint32_t i, idx, post;
+	long fire, lag;
+
+	read_config((char *)cfg);
+	post = load_raw_post(raw, &wptr);
+	idx = first_sample(wptr, post);
+	for (i = 0; i < la_samples; i++) {
+		smp[i] = sample_at((idx + i) & (la_samples - 1));
+	}
+	if ((lut4mode & 0x0F) != TRIGGER_SEQ && prescale) {
+		printf("Note: the FPGA evaluates this trigger every clock, only the samples (every %u clocks) can be replayed\n", prescale + 1);
+	}
+
+	sample_clock_init(&sc, prescale);
+	printf("Replaying %s trigger over %u samples of '%s' (its own trigger is at sample %u)\n",
+		trigger_name(), la_samples, raw, la_samples - post - 1);
+	fire = trigger_sim(smp, la_samples);
+	if (fire < 0) {
+		printf("Trigger would not fire.\n");
+		return;
+	}
+	printf("Trigger would fire at sample %ld (%.3f us)", fire, sample_ps(&sc, fire) / 1e6);
+	if ((lut4mode & 0x0F) == TRIGGER_SEQ) {
+		// samples keep coming while the sequencer's pipeline catches up
+		lag = SEQ_PIPE_CLOCKS / (prescale + 1);
+		fire += lag;
+		printf(", the FPGA records it %ld samples later at sample %ld (%u clock sequencer pipeline)", lag, fire, SEQ_PIPE_CLOCKS);
+	}
+	printf(", %ld samples %s the capture's trigger\n", labs(fire - (long)(la_samples - post - 1)),
+		fire < (long)(la_samples - post - 1) ? "before" : "after");
+}
+
+// protocol decoders, they run over one bit plane per channel so edges come out of a 64 sample word at a time
+enum { DEC_UART, DEC_SPI, DEC_I2C, DEC_SD };
+static const char *dec_types[] = { "uart", "spi", "i2c", "sd" };
+// the pins each decoder takes, by key in the config's decode line
+static const char *dec_keys[4][4] = {
+	{ "rx" },
+	{ "clk", "mosi", "miso", "cs" },
+	{ "scl", "sda" },
+	{ "clk", "mosi", "miso", "cs" },
+};
+
+struct decoder {
+	int type;
+	int ch[4];					// channel for each of dec_keys[type], -1 == not connected
+	unsigned baud;				// uart
+	int mode;					// spi CPOL << 1 | CPHA
+};
+struct decoder decoders[MAX_DECODERS];
+int num_decoders;
+
+static uint64_t planes[16][65536 / 64];
+static unsigned plane_words;
+static FILE *dec_out;
+static struct sample_clock dec_sc;
+
+static int channel_by_name(const char *name)
+{
+	int x;
+
+	for (x = 0; x < la_channels; x++) {
+		if (!strcmp(names[x], name)) {
+			return x;
+		}
+	}
+	fprintf(stderr, "ERROR: No channel named '%s' for the decoder\n", name);
+	exit(-1);
+}
+
+// "decode TYPE key=value ...", e.g. "decode spi clk=sck mosi=sio0 miso=sio1 cs=cs mode=0"
+static void parse_decoder(char *line)
+{
+	struct decoder *d;
+	char *tok, *val;
+	int x;
+
+	if (num_decoders == MAX_DECODERS) {
+		fprintf(stderr, "ERROR: At most %d decoders\n", MAX_DECODERS);
+		exit(-1);
+	}
+	d = &decoders[num_decoders++];
+	memset(d, 0, sizeof *d);
+	d->ch[0] = d->ch[1] = d->ch[2] = d->ch[3] = -1;
+	strtok(line, " \t\r\n");
+	tok = strtok(NULL, " \t\r\n");
+	for (d->type = 0; d->type < 4 && (!tok || strcmp(tok, dec_types[d->type])); d->type++);
+	if (d->type == 4) {
+		fprintf(stderr, "ERROR: Unknown decoder '%s' (uart, spi, i2c or sd)\n", tok ? tok : "");
+		exit(-1);
+	}
+	while ((tok = strtok(NULL, " \t\r\n"))) {
+		val = strchr(tok, '=');
+		if (!val) {
+			fprintf(stderr, "ERROR: Expecting key=value not '%s'\n", tok);
+			exit(-1);
+		}
+		*val++ = 0;
+		if (!strcmp(tok, "baud")) {
+			d->baud = strtoul(val, NULL, 10);
+			continue;
+		}
+		if (!strcmp(tok, "mode")) {
+			d->mode = strtoul(val, NULL, 10) & 3;
+			continue;
+		}
+		for (x = 0; x < 4 && (!dec_keys[d->type][x] || strcmp(tok, dec_keys[d->type][x])); x++);
+		if (x == 4) {
+			fprintf(stderr, "ERROR: The %s decoder has no '%s'\n", dec_types[d->type], tok);
+			exit(-1);
+		}
+		d->ch[x] = channel_by_name(val);
+	}
+	if ((d->type == DEC_UART && (d->ch[0] < 0 || !d->baud)) ||
+		(d->type == DEC_SPI && (d->ch[0] < 0 || (d->ch[1] < 0 && d->ch[2] < 0))) ||
+		(d->type == DEC_I2C && (d->ch[0] < 0 || d->ch[1] < 0)) ||
+		(d->type == DEC_SD && (d->ch[0] < 0 || d->ch[1] < 0 || d->ch[2] < 0 || d->ch[3] < 0))) {
+		fprintf(stderr, "ERROR: The %s decoder needs %s\n", dec_types[d->type],
+			d->type == DEC_UART ? "rx= and baud=" : d->type == DEC_SPI ? "clk= and mosi= or miso=" :
+			d->type == DEC_I2C ? "scl= and sda=" : "clk=, mosi=, miso= and cs=");
+		exit(-1);
+	}
+}
+
+// transpose the capture (in time order) into a bit plane per channel that a decoder uses
+static void build_planes(uint16_t wptr, uint32_t post, uint16_t used)
+{
+	uint64_t w[16];
+	uint32_t i, j, idx;
+	uint16_t v;
+	int b;
+
+	idx = first_sample(wptr, post);
+	plane_words = la_samples / 64;
+	for (i = 0; i < la_samples; i += 64) {
+		memset(w, 0, sizeof w);
+		for (j = 0; j < 64; j++) {
+			for (v = sample_at((idx + i + j) & (la_samples - 1)) & used; v; v &= v - 1) {
+				w[__builtin_ctz(v)] |= 1ULL << j;
+			}
+		}
+		for (b = 0; b < 16; b++) {
+			planes[b][i / 64] = w[b];
+		}
+	}
+}
+
+static inline int pin_at(int ch, uint32_t i)
+{
+	return (planes[ch][i >> 6] >> (i & 63)) & 1;
+}
+
+// the pin one sample earlier for each bit of word w (the first sample never changes)
+static inline uint64_t pin_prev(int ch, unsigned w)
+{
+	return (planes[ch][w] << 1) | (w ? planes[ch][w - 1] >> 63 : planes[ch][0] & 1);
+}
+
+static inline uint64_t pin_rise(int ch, unsigned w)
+{
+	return planes[ch][w] & ~pin_prev(ch, w);
+}
+
+static inline uint64_t pin_fall(int ch, unsigned w)
+{
+	return ~planes[ch][w] & pin_prev(ch, w);
+}
+
+static void dec_print(uint32_t i, const char *what, const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(dec_out, "%14.3f us  %-10s ", sample_ps(&dec_sc, i) / 1e6, what);
+	va_start(ap, fmt);
+	vfprintf(dec_out, fmt, ap);
+	va_end(ap);
+	fputc('\n', dec_out);
+}
+
+static void dec_hex(char *out, size_t size, const uint8_t *buf, unsigned n)
+{
+	unsigned x;
+
+	for (x = 0; x < n && size > 3; x++, out += 3, size -= 3) {
+		sprintf(out, "%02x ", buf[x]);
+	}
+	out[x ? -1 : 0] = 0;
+}
+
+static void uart_line(const char *name, uint32_t start, const uint8_t *buf, unsigned n, const char *note)
+{
+	char hex[64], ascii[17];
+	unsigned x;
+
+	if (!n) {
+		return;
+	}
+	dec_hex(hex, sizeof hex, buf, n);
+	for (x = 0; x < n; x++) {
+		ascii[x] = (buf[x] >= 32 && buf[x] < 127) ? buf[x] : '.';
+	}
+	ascii[n] = 0;
+	dec_print(start, name, "%-48s |%s|%s", hex, ascii, note);
+}
+
+// 8N1, a byte is the falling edge of the start bit then every bit sampled in its middle
+static unsigned dec_uart(const struct decoder *d)
+{
+	double spb, c, last = -1e9;
+	uint32_t i, next = 0, start = 0;
+	uint64_t m;
+	uint8_t buf[16], v;
+	unsigned w, k, n = 0, bytes = 0, rx = d->ch[0];
+
+	spb = (double)FPGA_CLOCK / (prescale + 1) / d->baud;
+	if (spb < 3.0) {
+		dec_print(0, names[rx], "%u baud is only %.1f samples per bit, lower the prescale", d->baud, spb);
+		return 0;
+	}
+	for (w = 0; w < plane_words; w++) {
+		for (m = pin_fall(rx, w); m; m &= m - 1) {
+			i = w * 64 + __builtin_ctzll(m);
+			if (i < next) {
+				continue;
+			}
+			// the edge is between samples i - 1 and i, c is the middle of the start bit
+			c = i - 0.5 + spb / 2;
+			if (c + 9 * spb + 0.5 >= la_samples) {
+				break;
+			}
+			if (pin_at(rx, (uint32_t)(c + 0.5))) {
+				continue;						// glitch
+			}
+			for (v = 0, k = 0; k < 8; k++) {
+				v |= pin_at(rx, (uint32_t)(c + (k + 1) * spb + 0.5)) << k;
+			}
+			// a new line every 16 bytes or once the line has been idle for a frame
+			if (n == 16 || (n && c - last > 10 * spb)) {
+				uart_line(names[rx], start, buf, n, "");
+				n = 0;
+			}
+			if (!n) {
+				start = i;
+			}
+			buf[n++] = v;
+			++bytes;
+			last = c + 9 * spb;
+			next = (uint32_t)last;
+			if (!pin_at(rx, (uint32_t)(last + 0.5))) {
+				uart_line(names[rx], start, buf, n, " FRAMING ERROR");
+				n = 0;
+			}
+		}
+	}
+	uart_line(names[rx], start, buf, n, "");
+	return bytes;
+}
+
+// SPI bytes in the capture, i is the sample of the first bit and start is set on the first byte after CS fell
+struct spi_byte {
+	uint32_t i;
+	uint8_t mosi, miso, start;
+};
+static struct spi_byte spi_bytes[65536 / 8 + 1];
+
+static unsigned spi_extract(const struct decoder *d, int mode)
+{
+	int clk = d->ch[0], mosi = d->ch[1], miso = d->ch[2], cs = d->ch[3];
+	int rising = ((mode >> 1) & 1) == (mode & 1);	// CPOL == CPHA samples on the rising edge
+	uint64_t m, sample, fall, rise;
+	uint32_t i, first = 0;
+	unsigned w, bits = 0, n = 0, start = 1;
+	uint8_t mo = 0, mi = 0;
+
+	for (w = 0; w < plane_words; w++) {
+		sample = rising ? pin_rise(clk, w) : pin_fall(clk, w);
+		fall = rise = 0;
+		if (cs >= 0) {
+			sample &= ~planes[cs][w];
+			fall = pin_fall(cs, w);
+			rise = pin_rise(cs, w);
+		}
+		for (m = sample | fall | rise; m; m &= m - 1) {
+			i = w * 64 + __builtin_ctzll(m);
+			if (((fall | rise) >> (i & 63)) & 1) {
+				bits = 0;						// a partial byte is dropped when CS moves
+				start = 1;
+			}
+			if (!((sample >> (i & 63)) & 1)) {
+				continue;
+			}
+			if (!bits) {
+				first = i;
+			}
+			mo = (mo << 1) | (mosi >= 0 ? pin_at(mosi, i) : 0);
+			mi = (mi << 1) | (miso >= 0 ? pin_at(miso, i) : 0);
+			if (++bits == 8) {
+				spi_bytes[n].i = first;
+				spi_bytes[n].mosi = mo;
+				spi_bytes[n].miso = mi;
+				spi_bytes[n].start = start;
+				start = bits = 0;
+				++n;
+			}
+		}
+	}
+	return n;
+}
+
+// one line per CS frame (or 16 bytes)
+static unsigned dec_spi(const struct decoder *d)
+{
+	uint8_t mo[16], mi[16];
+	char hmo[64], hmi[64];
+	unsigned x, n, k = 0, start = 0;
+
+	n = spi_extract(d, d->mode);
+	for (x = 0; x <= n; x++) {
+		if (k && (x == n || k == 16 || spi_bytes[x].start)) {
+			dec_hex(hmo, sizeof hmo, mo, k);
+			dec_hex(hmi, sizeof hmi, mi, k);
+			dec_print(spi_bytes[start].i, names[d->ch[0]], "%sMOSI %-48s MISO %s", spi_bytes[start].start ? "" : "+ ", d->ch[1] >= 0 ? hmo : "", d->ch[2] >= 0 ? hmi : "");
+			k = 0;
+		}
+		if (x < n) {
+			if (!k) {
+				start = x;
+			}
+			mo[k] = spi_bytes[x].mosi;
+			mi[k++] = spi_bytes[x].miso;
+		}
+	}
+	return n;
+}
+
+// START/STOP are SDA moving while SCL is high, bits are sampled on SCL rising, 9 bits to a byte with the ACK
+static unsigned dec_i2c(const struct decoder *d)
+{
+	int scl = d->ch[0], sda = d->ch[1];
+	char text[256];
+	uint64_t m, cond, clock;
+	uint32_t i, start = 0;
+	unsigned w, bits = 0, v = 0, len = 0, bytes = 0, active = 0, addr = 0;
+
+	for (w = 0; w < plane_words; w++) {
+		clock = pin_rise(scl, w);
+		cond = (pin_rise(sda, w) | pin_fall(sda, w)) & planes[scl][w] & pin_prev(scl, w);
+		for (m = clock | cond; m; m &= m - 1) {
+			i = w * 64 + __builtin_ctzll(m);
+			if ((cond >> (i & 63)) & 1) {
+				if (!pin_at(sda, i)) {
+					// START, or a repeated START in the middle of a transfer
+					if (!active) {
+						start = i;
+						len = 0;
+					}
+					len += snprintf(text + len, sizeof text - len, "%s", active ? " RESTART" : "START");
+					active = addr = 1;
+				} else if (active) {
+					snprintf(text + len, sizeof text - len, " STOP");
+					dec_print(start, names[scl], "%s", text);
+					active = 0;
+				}
+				bits = v = 0;
+				continue;
+			}
+			if (!active) {
+				continue;
+			}
+			v = (v << 1) | pin_at(sda, i);
+			if (++bits < 9) {
+				continue;
+			}
+			// v is the byte then the ACK (low) or NAK
+			if (addr) {
+				len += snprintf(text + len, sizeof text - len, " 0x%02x %c%s", v >> 2, (v & 2) ? 'R' : 'W', (v & 1) ? " NAK" : "");
+				addr = 0;
+			} else {
+				len += snprintf(text + len, sizeof text - len, " %02x%s", v >> 1, (v & 1) ? " NAK" : "");
+				++bytes;
+			}
+			bits = v = 0;
+			if (len > sizeof text - 32) {
+				dec_print(start, names[scl], "%s ...", text);
+				start = i;
+				len = snprintf(text, sizeof text, "...");
+			}
+		}
+	}
+	if (active) {
+		dec_print(start, names[scl], "%s (capture ends)", text);
+	}
+	return bytes;
+}
+
+static uint16_t crc16_ccitt(const struct spi_byte *b, unsigned n, int miso)
+{
+	uint16_t crc = 0;
+	unsigned x;
+	int k;
+
+	for (x = 0; x < n; x++) {
+		crc ^= (uint16_t)(miso ? b[x].miso : b[x].mosi) << 8;
+		for (k = 0; k < 8; k++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+static const char *sd_cmd_name(unsigned cmd, int app)
+{
+	if (app && cmd == 41) {
+		return "SD_SEND_OP_COND";
+	}
+	switch (cmd) {
+		case 0: return "GO_IDLE_STATE";
+		case 8: return "SEND_IF_COND";
+		case 9: return "SEND_CSD";
+		case 10: return "SEND_CID";
+		case 12: return "STOP_TRANSMISSION";
+		case 13: return "SEND_STATUS";
+		case 16: return "SET_BLOCKLEN";
+		case 17: return "READ_SINGLE_BLOCK";
+		case 18: return "READ_MULTIPLE_BLOCK";
+		case 24: return "WRITE_BLOCK";
+		case 25: return "WRITE_MULTIPLE_BLOCK";
+		case 55: return "APP_CMD";
+		case 58: return "READ_OCR";
+		case 59: return "CRC_ON_OFF";
+		default: return "";
+	}
+}
+
+// the spisddma.v state that handles the R1 for cmd, named as pc/log.c prints them
+static const char *sd_r1_state(unsigned cmd, int app)
+{
+	if (app && cmd == 41) {
+		return "INIT_ACMD41_R1";
+	}
+	switch (cmd) {
+		case 0: return "INIT_CMD0_R1";
+		case 8: return "INIT_CMD8_R1";
+		case 9: return "INIT_CMD9_R1";
+		case 10: return "INIT_CMD10_R1";
+		case 13: return "CMD13_R1";
+		case 16: return "INIT_CMD16_R16";
+		case 17: return "START_READ_RESP";
+		case 24: return "START_WRITE_RESP";
+		case 55: return "INIT_CMD55_R1";
+		case 58: return "INIT_CMD58_R1";
+		default: return "READ_R1";
+	}
+}
+
+static const char *sd_r1_flags(uint8_t r1, char *buf)
+{
+	static const char *flags[7] = { " idle", " erase_reset", " illegal_cmd", " crc_error", " erase_seq", " address_error", " param_error" };
+	int b;
+
+	buf[0] = 0;
+	for (b = 0; b < 7; b++) {
+		if ((r1 >> b) & 1) {
+			strcat(buf, flags[b]);
+		}
+	}
+	return buf;
+}
+
+// a data block from the card: [WAIT_TOKEN] for 0xFE then len bytes and the CRC16, returns the index after it
+static unsigned sd_read_block(const struct spi_byte *b, unsigned n, unsigned k, unsigned len, const char *data_state, const char *crc_state)
+{
+	char hex[64];
+	uint8_t buf[16];
+	unsigned x, skipped;
+	uint16_t crc;
+
+	for (skipped = 0; k < n && b[k].miso == 0xFF; k++, skipped++);
+	if (k == n) {
+		dec_print(b[n - 1].i, "SD", "[WAIT_TOKEN] (capture ends)");
+		return n;
+	}
+	if (b[k].miso != 0xFE) {
+		dec_print(b[k].i, "SD", "[WAIT_TOKEN] error token %02x after %u bytes", b[k].miso, skipped);
+		return k + 1;
+	}
+	dec_print(b[k].i, "SD", "[WAIT_TOKEN] token fe after %u bytes", skipped);
+	if (++k + len + 2 > n) {
+		dec_print(b[k - 1].i, "SD", "[%s] (capture ends)", data_state);
+		return n;
+	}
+	for (x = 0; x < 16 && x < len; x++) {
+		buf[x] = b[k + x].miso;
+	}
+	dec_hex(hex, sizeof hex, buf, x);
+	dec_print(b[k].i, "SD", "[%s] %u bytes: %s%s", data_state, len, hex, len > 16 ? "..." : "");
+	crc = ((uint16_t)b[k + len].miso << 8) | b[k + len + 1].miso;
+	dec_print(b[k + len].i, "SD", "[%s] crc=%04x %s", crc_state, crc, crc == crc16_ccitt(b + k, len, 1) ? "ok" : "BAD");
+	return k + len + 2;
+}
+
+// a block to the card: 0xFE then 512 bytes and the CRC16 on MOSI, the data response and busy on MISO
+static unsigned sd_write_block(const struct spi_byte *b, unsigned n, unsigned k)
+{
+	char hex[64];
+	uint8_t buf[16];
+	unsigned x, busy;
+	uint16_t crc;
+
+	for (; k < n && b[k].mosi == 0xFF; k++);
+	if (k == n) {
+		dec_print(b[n - 1].i, "SD", "[WRITE_SHIFT] (capture ends)");
+		return n;
+	}
+	if (b[k].mosi != 0xFE || ++k + 512 + 2 > n) {
+		dec_print(b[k - 1].i, "SD", "[WRITE_SHIFT] %s", b[k - 1].mosi != 0xFE ? "no start token" : "(capture ends)");
+		return k;
+	}
+	for (x = 0; x < 16; x++) {
+		buf[x] = b[k + x].mosi;
+	}
+	dec_hex(hex, sizeof hex, buf, x);
+	dec_print(b[k].i, "SD", "[WRITE_SHIFT] 512 bytes: %s...", hex);
+	crc = ((uint16_t)b[k + 512].mosi << 8) | b[k + 513].mosi;
+	dec_print(b[k + 512].i, "SD", "[WRITE_CRC] crc=%04x %s", crc, crc == crc16_ccitt(b + k, 512, 0) ? "ok" : "(not the data's CRC16)");
+	for (k += 514; k < n && (b[k].miso & 0x11) != 0x01; k++);
+	if (k == n) {
+		dec_print(b[n - 1].i, "SD", "[WRITE_BLOCK_RESP] (capture ends)");
+		return n;
+	}
+	dec_print(b[k].i, "SD", "[WRITE_BLOCK_RESP] %02x %s", b[k].miso,
+		(b[k].miso & 0x1F) == 0x05 ? "accepted" : (b[k].miso & 0x1F) == 0x0B ? "CRC error" : "write error");
+	x = ++k;
+	for (busy = 0; k < n && b[k].miso == 0x00; k++, busy++);
+	if (busy) {
+		dec_print(b[x].i, "SD", "[WRITE_WAIT] busy for %u bytes (%.3f us)%s", busy,
+			(sample_ps(&dec_sc, b[k < n ? k : n - 1].i) - sample_ps(&dec_sc, b[x].i)) / 1e6, k == n ? " (capture ends)" : "");
+	}
+	return k;
+}
+
+// SD cards in SPI mode: commands and responses labelled with the spisddma.v state that handles them
+static unsigned dec_sd(const struct decoder *d)
+{
+	const struct spi_byte *b = spi_bytes;
+	char flags[96];
+	unsigned n, k, j, cmd, app, prev = ~0u, cmds = 0;
+	uint32_t arg;
+	uint8_t r1;
+
+	n = spi_extract(d, 0);
+	for (k = 0; k + 6 <= n; ) {
+		if ((b[k].mosi & 0xC0) != 0x40) {
+			++k;
+			continue;
+		}
+		cmd = b[k].mosi & 0x3F;
+		app = prev == 55;
+		prev = cmd;
+		arg = ((uint32_t)b[k + 1].mosi << 24) | ((uint32_t)b[k + 2].mosi << 16) | ((uint32_t)b[k + 3].mosi << 8) | b[k + 4].mosi;
+		dec_print(b[k].i, "SD", "[SEND_CMD] %sCMD%u %s arg=%08x crc=%02x", app ? "A" : "", cmd, sd_cmd_name(cmd, app), arg, b[k + 5].mosi);
+		++cmds;
+
+		// R1 comes 1 to 8 bytes later
+		for (k += 6, j = 0; k < n && j < 9 && (b[k].miso & 0x80); k++, j++);
+		if (k == n || j == 9) {
+			dec_print(b[k < n ? k : n - 1].i, "SD", "[%s] %s", sd_r1_state(cmd, app), k == n ? "(capture ends)" : "no response");
+			continue;
+		}
+		r1 = b[k].miso;
+		dec_print(b[k].i, "SD", "[%s] R1=%02x%s", sd_r1_state(cmd, app), r1, sd_r1_flags(r1, flags));
+		++k;
+		if (app) {
+			continue;
+		}
+		switch (cmd) {
+			case 8:				// R7: voltage and the check pattern echoed back
+			case 58:			// OCR
+				if (r1 & 0x04) {
+					break;
+				}
+				if (k + 4 > n) {
+					dec_print(b[k - 1].i, "SD", "[%s] (capture ends)", cmd == 8 ? "INIT_CMD8_READ" : "INIT_CMD58_READ");
+					k = n;
+					break;
+				}
+				arg = ((uint32_t)b[k].miso << 24) | ((uint32_t)b[k + 1].miso << 16) | ((uint32_t)b[k + 2].miso << 8) | b[k + 3].miso;
+				if (cmd == 8) {
+					dec_print(b[k].i, "SD", "[INIT_CMD8_READ] R7=%08x voltage=%x check=%02x", arg, (arg >> 8) & 15, arg & 0xFF);
+				} else {
+					dec_print(b[k].i, "SD", "[INIT_CMD58_READ] OCR=%08x%s%s", arg, (arg & 0x80000000) ? " powered_up" : "", (arg & 0x40000000) ? " SDHC" : "");
+				}
+				k += 4;
+				break;
+			case 13:			// R2's second byte
+				if (k < n) {
+					dec_print(b[k].i, "SD", "[CMD13_R1] R2=%02x", b[k].miso);
+					++k;
+				}
+				break;
+			case 9:
+				if (!r1) {
+					k = sd_read_block(b, n, k, 16, "INIT_CMD9_RECV_CSD", "INIT_CMD9_CRC");
+				}
+				break;
+			case 10:
+				if (!r1) {
+					k = sd_read_block(b, n, k, 16, "INIT_CMD10_RECV_CID", "INIT_CMD10_CRC");
+				}
+				break;
+			case 17:
+				if (!r1) {
+					k = sd_read_block(b, n, k, 512, "READ_SHIFT", "READ_CRCCHK");
+				}
+				break;
+			case 24:
+				if (!r1) {
+					k = sd_write_block(b, n, k);
+				}
+				break;
+		}
+	}
+	return cmds;
+}
+
+// run every decoder in the config over the capture, out is stdout or a file next to the VCD
+static void run_decoders(FILE *out, uint16_t wptr, uint32_t post)
+{
+	static const char *what[4] = { "bytes", "bytes", "data bytes", "commands" };
+	uint16_t used = 0;
+	double t;
+	unsigned n;
+	int x, k;
+
+	if (!num_decoders) {
+		return;
+	}
+	t = time_s();
+	for (x = 0; x < num_decoders; x++) {
+		for (k = 0; k < 4; k++) {
+			if (decoders[x].ch[k] >= 0) {
+				used |= 1 << decoders[x].ch[k];
+			}
+		}
+	}
+	build_planes(wptr, post, used);
+	sample_clock_init(&dec_sc, prescale);
+	dec_out = out;
+	for (x = 0; x < num_decoders; x++) {
+		switch (decoders[x].type) {
+			case DEC_UART: n = dec_uart(&decoders[x]); break;
+			case DEC_SPI: n = dec_spi(&decoders[x]); break;
+			case DEC_I2C: n = dec_i2c(&decoders[x]); break;
+			default: n = dec_sd(&decoders[x]); break;
+		}
+		printf("%s decoder on %s: %u %s\n", dec_types[decoders[x].type], names[decoders[x].ch[0]], n, what[decoders[x].type]);
+	}
+	printf("Decoded in %.2f ms\n", (time_s() - t) * 1000.0);
+}
+
+// --decode config.cfg capture.raw: run the config's decoders over a saved capture
+static void decode_raw(const char *cfg, const char *raw)
+{
+	uint16_t wptr;
+	uint32_t post;
+
+	read_config((char *)cfg);
+	if (!num_decoders) {
+		fprintf(stderr, "ERROR: '%s' has no decode lines\n", cfg);
+		exit(-1);
+	}
+	post = load_raw_post(raw, &wptr);
+	run_decoders(stdout, wptr, post);
+}
+
+static double bench_run(const char *fname, const char *what, int channels, int fst)
+{
+	double t;
+	uint64_t bytes = 0;
+	int x, runs = 5;
+
+	la_channels = channels;
+	la_samples = channels == 16 ? 32768 : 65536;
+	t = time_s();
+	for (x = 0; x < runs; x++) {
+#ifdef LA_FST
+		if (fst) {
+			emit_fst(fname, 0, 0x80, 0);
+			continue;
+		}
+#endif
+		bytes = emit_vcd(fname, 0, 0x80, 0);
+	}
+	t = (time_s() - t) / runs;
+	if (fst) {
+		printf("%-24s %2dch FST: %8.2f ms\n", what, channels, t * 1000.0);
+	} else {
+		printf("%-24s %2dch VCD: %8.2f ms, %9llu bytes (%.1f MB/s)\n", what, channels, t * 1000.0,
+			(unsigned long long)bytes, bytes / t / 1e6);
+	}
+	unlink(fname);
+	return t;
+}
+
+// every decoder over the capture in rxbuf, the counter pattern gives them an edge on most samples
+static void bench_decoders(int channels)
+{
+	static const char *lines[] = {
+		"decode uart rx=ch0 baud=1000000",
+		"decode spi clk=ch0 mosi=ch1 miso=ch2 cs=ch7",
+		"decode i2c scl=ch1 sda=ch0",
+		"decode sd clk=ch0 mosi=ch1 miso=ch2 cs=ch7",
+	};
+	char line[64];
+	FILE *out;
+	double t;
+	int x;
+
+	out = fopen("/dev/null", "w");
+	num_decoders = 0;
+	for (x = 0; x < 4; x++) {
+		strcpy(line, lines[x]);
+		parse_decoder(line);
+	}
+	prescale = 0;
+	t = time_s();
+	run_decoders(out, 0, 0);
+	printf("%-24s %2dch decoders: %.2f ms\n", "counter", channels, (time_s() - t) * 1000.0);
+	num_decoders = 0;
+	fclose(out);
+}
+
+// --bench: emit a synthetic 64KB capture where every pin toggles every sample (the most the writer
+// ever has to do) and a counter (bit b toggles every 2^b samples, a typical bus)
+static void bench(int fst)
+{
+	int x, ch;
+
+	for (x = 0; x < 16; x++) {
+		sprintf(names[x], "ch%d", x);
+	}
+	for (ch = 8; ch <= 16; ch += 8) {
+		for (x = 0; x < 65536; x++) {
+			rxbuf[2 + x] = (x & (ch == 16 ? 2 : 1)) ? 0xFF : 0x00;
+		}
+		bench_run("bench.vcd", "all pins toggling", ch, 0);
+		if (fst) {
+			bench_run("bench.fst", "all pins toggling", ch, 1);
+		}
+		for (x = 0; x < 65536; x++) {
+			rxbuf[2 + x] = ch == 16 ? (x >> 1) >> ((x & 1) * 8) : x;
+		}
+		bench_run("bench.vcd", "counter", ch, 0);
+		if (fst) {
+			bench_run("bench.fst", "counter", ch, 1);
+		}
+		bench_decoders(ch);
+	}
 }
 
-	
 int main(int argc, char **argv)
 {
 	char outname[256];
 	FILE *f;
-	int x;
-	
+	int x, fst = 0;
+	unsigned baud = STREAM_BAUD, roll_mb = 0;
+
+	for (x = 3; x < argc && strcmp(argv[1], "--simulate") && strcmp(argv[1], "--decode"); x++) {
+		if (!strcmp(argv[x], "--fst")) {
+			fst = 1;
+		} else if (!strcmp(argv[x], "--baud") && x + 1 < argc) {
+			baud = strtoul(argv[++x], NULL, 10);
+		} else if (!strcmp(argv[x], "--roll") && x + 1 < argc) {
+			roll_mb = strtoul(argv[++x], NULL, 10);
+		} else {
+			fprintf(stderr, "ERROR: Unknown option '%s'\n", argv[x]);
+			exit(-1);
+		}
+	}
+	if (argc > 3 && !strcmp(argv[1], "--simulate")) {
+		simulate(argv[2], argv[3]);
+		return 0;
+	}
+	if (argc > 3 && !strcmp(argv[1], "--decode")) {
+		decode_raw(argv[2], argv[3]);
+		return 0;
+	}
+	if (argc > 1 && !strcmp(argv[1], "--bench")) {
+#ifdef LA_FST
+		bench(1);
+#else
+		bench(0);
+#endif
+		return 0;
+	}
+	if (argc < 3) {
+		printf("usage: %s port config.cfg [--fst] [--baud N] [--roll MB]\n       %s --simulate config.cfg capture.raw\n       %s --decode config.cfg capture.raw\n       %s --bench\n", argv[0], argv[0], argv[0], argv[0]);
+		return 0;
+	}
+#ifndef LA_FST
+	if (fst) {
+		fprintf(stderr, "ERROR: built without FST support, see the Makefile's 16bitla_fst target\n");
+		exit(-1);
+	}
+#endif
+
     int fd = open(argv[1], O_RDWR | O_NOCTTY);
     if (fd < 0) { perror("Open port"); return 1; }
-    set_interface_attribs(fd, B230400);
+    set_interface_attribs(fd, LA_BAUD_FLAG);
     usleep(500000);
 	tcflush(fd, TCIOFLUSH);
 	
 	read_config(argv[2]);
-	printf("Performing %d-channel sampling using a prescale of %u (%g ns per sample, %g kHz), mask=%04x, pol=%04x(%s triggered), post=%lu samples\nReady for trigger.\n", la_channels, prescale + 1, NS_PER_SAMPLE, (1000000000.0f / NS_PER_SAMPLE) / 1000.0, trigger_mask, trigger_pol, lut4mode ? "LUT4" : "edge", (unsigned long)post_trigger * (la_channels == 8 ? 256 : 128));
+	if (lut4mode & 0x40) {
+		printf("Streaming %d channels using a prescale of %u (%g ns per sample, %g kHz), mask=%04x, pol=%04x(%s triggered)\n", la_channels, prescale + 1, NS_PER_SAMPLE, (1000000000.0f / NS_PER_SAMPLE) / 1000.0, trigger_mask, trigger_pol, trigger_name());
+		stream_capture(fd, argv[2], fst, roll_mb, baud);
+		return 0;
+	}
+	printf("Performing %d-channel sampling using a prescale of %u (%g ns per sample, %g kHz), mask=%04x, pol=%04x(%s triggered), post=%lu samples\nReady for trigger.\n", la_channels, prescale + 1, NS_PER_SAMPLE, (1000000000.0f / NS_PER_SAMPLE) / 1000.0, trigger_mask, trigger_pol, trigger_name(), (unsigned long)post_trigger * (la_channels == 8 ? 256 : 128));
 	program_and_read(fd);
 	
 	sprintf(outname, "%s.raw", argv[2]);
 	f = fopen(outname, "w");
-	fprintf(f, "WPTR == %x\n", WPTR);
-	for (x = 0; x < la_samples; x++) {
-		fprintf(f, "%04x\n", samples[x]);
+	fprintf(f, "WPTR == %x POST == %x\n", WPTR, post_trigger);
+	for (x = 0; x < (int)la_samples; x++) {
+		fprintf(f, "%04x\n", sample_at(x));
 	}
-	sprintf(outname, "%s.vcd", argv[2]);
-	emit_vcd(outname, samples, WPTR, post_trigger, prescale);
 	fclose(f);
+	sprintf(outname, "%s.vcd", argv[2]);
+	emit_vcd(outname, WPTR, post_trigger, prescale);
+#ifdef LA_FST
+	if (fst) {
+		sprintf(outname, "%s.fst", argv[2]);
+		emit_fst(outname, WPTR, post_trigger, prescale);
+	}
+#endif
+	printf("VCD emitted. Trigger is %u samples before the end of the file.\n", post_trigger_samples_of(post_trigger));
+	if (num_decoders) {
+		sprintf(outname, "%s.txt", argv[2]);
+		f = fopen(outname, "w");
+		if (!f) {
+			fprintf(stderr, "ERROR: Could not create '%s'\n", outname);
+			exit(-1);
+		}
+		run_decoders(f, WPTR, post_trigger_samples_of(post_trigger));
+		fclose(f);
+		printf("Decoded transactions written to %s\n", outname);
+	}
+	return 0;
 }
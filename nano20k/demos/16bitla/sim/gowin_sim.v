@@ -0,0 +1,57 @@
+`timescale 1ns/1ps
+
+// Behavioural stand-ins for the Gowin IP in ../src so top.v simulates without the vendor's prim_sim.v.
+
+// the testbench drives the sample clock directly
+module Gowin_rPLL (clkout, clkin);
+output clkout;
+input clkin;
+
+    assign clkout = clkin;
+endmodule
+
+// 8x65536 true dual port, bypass (one cycle) reads, normal write mode
+module Gowin_DPB (douta, doutb, clka, ocea, cea, reseta, wrea, clkb, oceb, ceb, resetb, wreb, ada, dina, adb, dinb);
+output reg [7:0] douta;
+output reg [7:0] doutb;
+input clka;
+input ocea;
+input cea;
+input reseta;
+input wrea;
+input clkb;
+input oceb;
+input ceb;
+input resetb;
+input wreb;
+input [15:0] ada;
+input [7:0] dina;
+input [15:0] adb;
+input [7:0] dinb;
+
+    reg [7:0] mem[0:65535];
+
+    always @(posedge clka) begin
+        if (reseta) begin
+            douta <= 0;
+        end else if (cea) begin
+            if (wrea) begin
+                mem[ada] <= dina;
+            end else begin
+                douta <= mem[ada];
+            end
+        end
+    end
+
+    always @(posedge clkb) begin
+        if (resetb) begin
+            doutb <= 0;
+        end else if (ceb) begin
+            if (wreb) begin
+                mem[adb] <= dinb;
+            end else begin
+                doutb <= mem[adb];
+            end
+        end
+    end
+endmodule
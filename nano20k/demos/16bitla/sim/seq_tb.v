@@ -0,0 +1,275 @@
+`timescale 1ns/1ps
+
+// Loads a 3 stage sequence through the 40 byte mode 4 frame and steps io a sample at a time: a stage that only sees
+// level matches where it wants edges has to time out back to stage 0, the retry has to advance through every stage,
+// stage 3 (count 0) has to end the sequence and the trigger has to land SEQ_PIPE_CLOCKS (16bitla.c) after the sample
+// that completed it.  It's streamed so the capture doesn't take 64K bytes at 230.4K to come back.
+module seq_tb();
+	reg clk;
+	reg uart_rx;
+	reg [15:0] io;
+	wire uart_tx;
+	wire [3:0] led;
+
+	top dut(.clk(clk), .uart_tx(uart_tx), .uart_rx(uart_rx), .io(io), .led(led));
+
+    // Parameters
+    localparam CLK_PERIOD = 10;
+    localparam DEFAULT_DIV = 644;		// 148.5MHz / 230400
+    localparam STREAM_DIV = 15;
+    localparam PRESCALE = 3;			// 4 clocks a sample, room for the 3 clock pipeline between samples
+    localparam PIPE_CLOCKS = 3;			// SEQ_PIPE_CLOCKS in 16bitla.c
+
+    localparam
+        TIMER_STREAM_ARMED = 2,
+        TIMER_STREAMING = 3;
+    localparam
+        MARK_END = 2;
+
+    // Clock Generation
+    always #(CLK_PERIOD/2) clk = ~clk;
+
+    // io for sample s.  stage 0 wants a rising io[0], stage 1 3 rising io[1] within 10 samples, stage 2 io[2] high
+    // within 5 samples and stage 3 (io[3]) has a count of 0.  The first try holds io[1] high for 2 samples so it
+    // only gets 2 edges and times out on sample 15, the second try completes stage 1 on sample 26 and stage 2 on 29.
+    function [15:0] seq_io(input integer s);
+		begin
+			case (s)
+				0, 1, 2, 3, 4:		seq_io = 16'h0000;
+				5, 6, 9, 11:		seq_io = 16'h0001;
+				7, 8, 10:			seq_io = 16'h0003;
+				12, 13, 14, 15,
+				16, 17, 18, 19:		seq_io = 16'h0000;
+				20, 21, 23, 25,
+				27, 28:				seq_io = 16'h0001;
+				22, 24, 26:			seq_io = 16'h0003;
+				default:			seq_io = 16'h0005;
+			endcase
+		end
+	endfunction
+
+	// move io on to the next sample's value right after the sequencer takes one, once go is set
+	integer ticks;
+	reg go;
+	always @(posedge clk) begin
+		if (dut.timer_sample_tick && go) begin
+			ticks <= ticks + 1;
+			io    <= seq_io(ticks + 1);
+		end
+	end
+
+	// host side receiver, rx_div is the divider the host thinks the link runs at
+	integer rx_div;
+	reg [7:0] rx_buf[0:4095];
+	integer rx_wr;
+	integer rx_rd;
+	reg [7:0] rx_byte;
+	integer k;
+	always begin
+		@(negedge uart_tx);
+		repeat((rx_div + 1) / 2) @(posedge clk);
+		if (uart_tx !== 1'b0) begin
+			$display("ASSERTION FAILED: start bit glitch at div %0d", rx_div);
+			$fatal;
+		end
+		for (k = 0; k < 8; k = k + 1) begin
+			repeat(rx_div + 1) @(posedge clk);
+			rx_byte[k] = uart_tx;
+		end
+		repeat(rx_div + 1) @(posedge clk);
+		if (uart_tx !== 1'b1) begin
+			$display("ASSERTION FAILED: framing error at div %0d (byte %2h)", rx_div, rx_byte);
+			$fatal;
+		end
+		rx_buf[rx_wr[11:0]] = rx_byte;
+		rx_wr = rx_wr + 1;
+	end
+
+    // --- Test Logic ---
+    reg [7:0] cfg[0:31];
+    integer i;
+    reg [31:0] w;
+    reg [31:0] param;
+
+    initial begin
+        // Waveform setup
+        $dumpfile("seq.vcd");
+        $dumpvars(0, seq_tb);
+
+        // stages: mask, value, {edge, count}, within
+        set_stage(0, 16'h0001, 16'h0001, 16'h8001, 16'd0);
+        set_stage(1, 16'h0002, 16'h0002, 16'h8003, 16'd10);
+        set_stage(2, 16'h0004, 16'h0004, 16'h0001, 16'd5);
+        set_stage(3, 16'h0008, 16'h0008, 16'h0000, 16'd0);
+
+        // Initialize
+        clk = 0;
+        uart_rx = 1;
+        io = seq_io(0);
+        ticks = 0;
+        go = 0;
+        rx_div = DEFAULT_DIV;
+        rx_wr = 0;
+        rx_rd = 0;
+        repeat(16) @(posedge clk);
+
+		$display("Sending the 40 byte sequencer frame...");
+		send_byte(8'h00, DEFAULT_DIV);							// mask and pol aren't used
+		send_byte(8'h00, DEFAULT_DIV);
+		send_byte(8'h00, DEFAULT_DIV);
+		send_byte(8'h00, DEFAULT_DIV);
+		send_byte(PRESCALE, DEFAULT_DIV);
+		send_byte(8'h00, DEFAULT_DIV);
+		send_byte(8'hC4, DEFAULT_DIV);							// 16ch, stream, sequencer
+		send_byte(STREAM_DIV, DEFAULT_DIV);
+		for (i = 0; i < 32; i = i + 1) begin
+			if (i == 16 && dut.timer_state == TIMER_STREAM_ARMED) begin
+				$display("ASSERTION FAILED: armed after 24 bytes");
+				$fatal;
+			end
+			send_byte(cfg[i], DEFAULT_DIV);
+		end
+		i = 0;
+		while (dut.timer_state !== TIMER_STREAM_ARMED) begin
+			@(posedge clk);
+			i = i + 1;
+			if (i == 1000) begin
+				$display("ASSERTION FAILED: not armed after the 40th byte");
+				$fatal;
+			end
+		end
+		for (i = 0; i < 32; i = i + 1) begin
+			if (dut.seq_cfg[i] !== cfg[i]) begin
+				$display("ASSERTION FAILED: seq_cfg[%0d] (%2h) not the expected value (%2h)", i, dut.seq_cfg[i], cfg[i]);
+				$fatal;
+			end
+		end
+		if (dut.timer_trigger_mode !== 4 || dut.timer_prescale !== PRESCALE || dut.uart_bauddiv !== STREAM_DIV) begin
+			$display("ASSERTION FAILED: frame bytes 0..7 not applied (mode %0d, prescale %0d, div %0d)", dut.timer_trigger_mode, dut.timer_prescale, dut.uart_bauddiv);
+			$fatal;
+		end
+		rx_div = STREAM_DIV;
+		// it arms in the middle of the 40th byte's stop bit so it's been sampling seq_io(0) for a while, which leaves
+		// stage 0 waiting for its edge.  Sample 0 is the next one.
+		@(posedge clk);
+		#1;
+		go = 1;
+		$display("PASSED");
+
+		$display("Level matches on an edge stage time out...");
+		check_stage(4, 0, 0);
+		check_stage(5, 1, 0);
+		check_stage(8, 1, 1);
+		check_stage(10, 1, 2);
+		check_stage(14, 1, 2);
+		check_stage(15, 0, 0);
+		check_stage(19, 0, 0);
+		$display("PASSED");
+
+		$display("Advancing through every stage...");
+		check_stage(20, 1, 0);
+		check_stage(25, 1, 2);
+		check_stage(26, 2, 0);
+		check_stage(28, 2, 0);
+		if (dut.seq_fire !== 1'b0 || dut.timer_state !== TIMER_STREAM_ARMED) begin
+			$display("ASSERTION FAILED: triggered before the last stage");
+			$fatal;
+		end
+		wait(ticks == 30);										// sample 29 completes stage 2, stage 3 has a count of 0
+		for (i = 1; i <= PIPE_CLOCKS; i = i + 1) begin
+			@(posedge clk);
+			#1;
+			if (dut.seq_fire !== (i >= PIPE_CLOCKS - 1) || dut.timer_trigger_latch !== (i == PIPE_CLOCKS)) begin
+				$display("ASSERTION FAILED: %0d clocks after the sample seq_fire == %0d, timer_trigger_latch == %0d", i, dut.seq_fire, dut.timer_trigger_latch);
+				$fatal;
+			end
+		end
+		@(posedge clk);
+		#1;
+		if (dut.timer_state !== TIMER_STREAMING) begin
+			$display("ASSERTION FAILED: the trigger didn't start the stream");
+			$fatal;
+		end
+		$display("PASSED");
+
+		$display("Stopping the stream...");
+		repeat(200) @(posedge clk);
+		send_byte(8'h00, STREAM_DIV);
+		get_word(w);
+		if (w[15:0] !== seq_io(30) || w[31:16] == 0) begin
+			$display("ASSERTION FAILED: first record %8h isn't a run of %4h", w, seq_io(30));
+			$fatal;
+		end
+		get_word(w);
+		get_word(param);
+		if (w != MARK_END) begin
+			$display("ASSERTION FAILED: expected the end marker, got %8h %8h", w, param);
+			$fatal;
+		end
+		$display("PASSED");
+		$finish;
+    end
+
+	// the whole run is about 300K clocks
+	initial begin
+		#(CLK_PERIOD * 2000000);
+		$display("ASSERTION FAILED: timeout");
+		$fatal;
+	end
+
+	task set_stage(input integer n, input [15:0] mask, input [15:0] value, input [15:0] count, input [15:0] within);
+		begin
+			cfg[8*n+0] = mask[7:0];
+			cfg[8*n+1] = mask[15:8];
+			cfg[8*n+2] = value[7:0];
+			cfg[8*n+3] = value[15:8];
+			cfg[8*n+4] = count[7:0];
+			cfg[8*n+5] = count[15:8];
+			cfg[8*n+6] = within[7:0];
+			cfg[8*n+7] = within[15:8];
+		end
+	endtask
+
+	// once sample s has stepped the sequencer (and before the next one does)
+	task check_stage(input integer s, input [1:0] stage, input [14:0] count);
+		begin
+			wait(ticks == s + 1);
+			repeat(PIPE_CLOCKS) @(posedge clk);
+			#1;
+			if (dut.seq_stage !== stage || dut.seq_count !== count) begin
+				$display("ASSERTION FAILED: after sample %0d stage %0d count %0d, expected stage %0d count %0d", s, dut.seq_stage, dut.seq_count, stage, count);
+				$fatal;
+			end
+		end
+	endtask
+
+	// host to FPGA, 8N1 at div + 1 clocks a bit
+	task send_byte(input [7:0] val, input integer div);
+		integer b;
+		begin
+			@(posedge clk);
+			#1;
+			uart_rx = 1'b0;
+			repeat(div + 1) @(posedge clk);
+			for (b = 0; b < 8; b = b + 1) begin
+				#1;
+				uart_rx = val[b];
+				repeat(div + 1) @(posedge clk);
+			end
+			#1;
+			uart_rx = 1'b1;
+			repeat(div + 1) @(posedge clk);
+		end
+	endtask
+
+	task get_word(output [31:0] val);
+		integer b;
+		begin
+			for (b = 0; b < 4; b = b + 1) begin
+				wait(rx_rd != rx_wr);
+				val = {rx_buf[rx_rd[11:0]], val[31:8]};
+				rx_rd = rx_rd + 1;
+			end
+		end
+	endtask
+endmodule
@@ -0,0 +1,283 @@
+`timescale 1ns/1ps
+
+// Streams a known io pattern through top.v and decodes what comes out of uart_tx like 16bitla.c does.  Every record
+// has to match the pattern sample for sample, the link has to overflow (and say how many samples it dropped), the end
+// marker has to be the last thing sent with the exact sample count and the UART has to be back at 230.4K afterwards.
+module stream_tb();
+	reg clk;
+	reg uart_rx;
+	reg [15:0] io;
+	wire uart_tx;
+	wire [3:0] led;
+
+	top dut(.clk(clk), .uart_tx(uart_tx), .uart_rx(uart_rx), .io(io), .led(led));
+
+    // Parameters
+    localparam CLK_PERIOD = 10;
+    localparam DEFAULT_DIV = 644;		// 148.5MHz / 230400
+    localparam STREAM_DIV = 15;			// 16 clocks a bit, 640 clocks a record
+    localparam PRESCALE = 99;			// 100 clocks a sample so short runs outpace the link
+    localparam STOP_AT = 700;			// samples before we ask it to stop
+
+    localparam
+        TIMER_IDLE = 0,
+        TIMER_STREAM_ARMED = 2,
+        TIMER_STREAMING = 3;
+    localparam
+        MARK_OVERFLOW = 1,
+        MARK_END = 2;
+
+    // Clock Generation
+    always #(CLK_PERIOD/2) clk = ~clk;
+
+    // io for sample s: runs of 20 down to 1 or 2 samples (no overflow), then a new value every sample for 200
+    // samples (overflows) and then one long run
+    function [15:0] pattern(input integer s);
+		begin
+			if (s < 100) begin
+				pattern = 16'h1001 | ((s * s / 400) << 4);
+			end else if (s < 300) begin
+				pattern = s[0] ? 16'h5555 : 16'hAAAB;
+			end else begin
+				pattern = 16'h00F1;
+			end
+		end
+	endfunction
+
+	// move io on to the next sample's value right after the timer FSM takes one
+	integer samples;
+	always @(posedge clk) begin
+		if (dut.timer_state == TIMER_STREAMING && !dut.stream_stop && dut.timer_prescale_cnt >= dut.timer_prescale) begin
+			samples <= samples + 1;
+			io      <= pattern(samples + 1);
+		end
+	end
+
+	// host side receiver, rx_div is the divider the host thinks the link runs at
+	integer rx_div;
+	reg [7:0] rx_buf[0:4095];
+	integer rx_wr;
+	integer rx_rd;
+	reg [7:0] rx_byte;
+	integer k;
+	always begin
+		@(negedge uart_tx);
+		repeat((rx_div + 1) / 2) @(posedge clk);
+		if (uart_tx !== 1'b0) begin
+			$display("ASSERTION FAILED: start bit glitch at div %0d", rx_div);
+			$fatal;
+		end
+		for (k = 0; k < 8; k = k + 1) begin
+			repeat(rx_div + 1) @(posedge clk);
+			rx_byte[k] = uart_tx;
+		end
+		repeat(rx_div + 1) @(posedge clk);
+		if (uart_tx !== 1'b1) begin
+			$display("ASSERTION FAILED: framing error at div %0d (byte %2h)", rx_div, rx_byte);
+			$fatal;
+		end
+		rx_buf[rx_wr[11:0]] = rx_byte;
+		rx_wr = rx_wr + 1;
+	end
+
+    // --- Test Logic ---
+    integer cursor;
+    integer records;
+    integer overflows;
+    integer i;
+    reg [31:0] w;
+    reg [31:0] param;
+    reg done;
+
+    initial begin
+        // Waveform setup
+        $dumpfile("stream.vcd");
+        $dumpvars(0, stream_tb);
+
+        // Initialize
+        clk = 0;
+        uart_rx = 1;
+        io = 0;
+        samples = 0;
+        rx_div = DEFAULT_DIV;
+        rx_wr = 0;
+        rx_rd = 0;
+        repeat(16) @(posedge clk);
+
+		$display("Starting a 16ch stream, rising edge on io[0] at div %0d...", STREAM_DIV);
+		send_frame(16'h0001, 16'h0001, PRESCALE, 8'h00, 8'hC0, STREAM_DIV);
+		wait_state(TIMER_STREAM_ARMED);
+		if (dut.uart_bauddiv !== STREAM_DIV) begin
+			$display("ASSERTION FAILED: uart_bauddiv (%0d) not switched to %0d", dut.uart_bauddiv, STREAM_DIV);
+			$fatal;
+		end
+		rx_div = STREAM_DIV;
+		repeat(50) @(posedge clk);
+		#1;
+		io = pattern(0);											// the trigger is the first sample
+		$display("PASSED");
+
+		$display("Decoding records...");
+		fork
+			begin
+				wait(samples >= STOP_AT);
+				$display("Stopping after %0d samples", samples);
+				send_byte(8'h00, STREAM_DIV);
+			end
+			begin
+				cursor = 0;
+				records = 0;
+				overflows = 0;
+				done = 0;
+				while (!done) begin
+					get_word(w);
+					if (w[31:16] != 0) begin
+						for (i = 0; i < w[31:16]; i = i + 1) begin
+							if (pattern(cursor + i) !== w[15:0]) begin
+								$display("ASSERTION FAILED: record %0d (%4h x %0d) doesn't match sample %0d (%4h)", records, w[15:0], w[31:16], cursor + i, pattern(cursor + i));
+								$fatal;
+							end
+						end
+						cursor = cursor + w[31:16];
+						records = records + 1;
+					end else begin
+						get_word(param);
+						if (w == MARK_OVERFLOW) begin
+							$display("overflow at sample %0d, %0d samples lost", cursor, param);
+							if (param == 0) begin
+								$display("ASSERTION FAILED: overflow marker without lost samples");
+								$fatal;
+							end
+							cursor = cursor + param;
+							overflows = overflows + 1;
+						end else if (w == MARK_END) begin
+							$display("end after %0d records, %0d samples", records, param);
+							if (param != cursor || param != samples) begin
+								$display("ASSERTION FAILED: end marker count %0d, decoded %0d, sampled %0d", param, cursor, samples);
+								$fatal;
+							end
+							done = 1;
+						end else begin
+							$display("ASSERTION FAILED: unknown marker %8h", w);
+							$fatal;
+						end
+					end
+				end
+			end
+		join
+		if (overflows == 0 || cursor <= 300) begin
+			$display("ASSERTION FAILED: the stream should overflow and recover (%0d overflows, %0d samples)", overflows, cursor);
+			$fatal;
+		end
+		if (led[3] !== 1'b0) begin
+			$display("ASSERTION FAILED: overflow LED is off");
+			$fatal;
+		end
+		$display("PASSED");
+
+		$display("Waiting for the UART to go back to 230.4K...");
+		if (dut.uart_bauddiv !== STREAM_DIV) begin
+			$display("ASSERTION FAILED: uart_bauddiv (%0d) changed before the drain", dut.uart_bauddiv);
+			$fatal;
+		end
+		i = 0;
+		while (dut.uart_bauddiv !== DEFAULT_DIV) begin
+			@(posedge clk);
+			i = i + 1;
+			if (i == 10000) begin
+				$display("ASSERTION FAILED: uart_bauddiv stuck at %0d", dut.uart_bauddiv);
+				$fatal;
+			end
+		end
+		rx_div = DEFAULT_DIV;
+		if (rx_rd != rx_wr) begin
+			$display("ASSERTION FAILED: %0d bytes after the end marker", rx_wr - rx_rd);
+			$fatal;
+		end
+		$display("PASSED");
+
+		// the first byte after the divider went back is what catches a stale bit timer in the UART
+		$display("Stopping an untriggered stream at 230.4K...");
+		send_frame(16'h0000, 16'h0000, 8'h00, 8'h00, 8'hC0, 8'h00);
+		wait_state(TIMER_STREAM_ARMED);
+		if (dut.uart_bauddiv !== DEFAULT_DIV) begin
+			$display("ASSERTION FAILED: divider 0 changed uart_bauddiv to %0d", dut.uart_bauddiv);
+			$fatal;
+		end
+		send_byte(8'h00, DEFAULT_DIV);
+		get_word(w);
+		get_word(param);
+		if (w != MARK_END || param != 0) begin
+			$display("ASSERTION FAILED: expected an empty end marker, got %8h %8h", w, param);
+			$fatal;
+		end
+		wait_state(TIMER_IDLE);
+		$display("PASSED");
+		$finish;
+    end
+
+	// the whole run is about 300K clocks
+	initial begin
+		#(CLK_PERIOD * 2000000);
+		$display("ASSERTION FAILED: timeout");
+		$fatal;
+	end
+
+	// host to FPGA, 8N1 at div + 1 clocks a bit
+	task send_byte(input [7:0] val, input integer div);
+		integer b;
+		begin
+			@(posedge clk);
+			#1;
+			uart_rx = 1'b0;
+			repeat(div + 1) @(posedge clk);
+			for (b = 0; b < 8; b = b + 1) begin
+				#1;
+				uart_rx = val[b];
+				repeat(div + 1) @(posedge clk);
+			end
+			#1;
+			uart_rx = 1'b1;
+			repeat(div + 1) @(posedge clk);
+		end
+	endtask
+
+	task send_frame(input [15:0] mask, input [15:0] pol, input [7:0] prescale, input [7:0] post, input [7:0] mode, input [7:0] div);
+		begin
+			send_byte(mask[7:0], DEFAULT_DIV);
+			send_byte(mask[15:8], DEFAULT_DIV);
+			send_byte(pol[7:0], DEFAULT_DIV);
+			send_byte(pol[15:8], DEFAULT_DIV);
+			send_byte(prescale, DEFAULT_DIV);
+			send_byte(post, DEFAULT_DIV);
+			send_byte(mode, DEFAULT_DIV);
+			send_byte(div, DEFAULT_DIV);
+		end
+	endtask
+
+	task get_word(output [31:0] val);
+		integer b;
+		begin
+			for (b = 0; b < 4; b = b + 1) begin
+				wait(rx_rd != rx_wr);
+				val = {rx_buf[rx_rd[11:0]], val[31:8]};
+				rx_rd = rx_rd + 1;
+			end
+		end
+	endtask
+
+	task wait_state(input [2:0] state);
+		integer t;
+		begin
+			t = 0;
+			while (dut.timer_state !== state) begin
+				@(posedge clk);
+				t = t + 1;
+				if (t == 100000) begin
+					$display("ASSERTION FAILED: timer_state (%0d) never got to %0d", dut.timer_state, state);
+					$fatal;
+				end
+			end
+		end
+	endtask
+endmodule
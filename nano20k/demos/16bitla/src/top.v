@@ -20,15 +20,22 @@ module top(
     assign led = ~ledv;                                         // LEDs are active low
 
     // UART
-    wire [15:0] uart_bauddiv = 148_500_000 / 230_400;           // bauddiv counter (230.4Kbaud)
+    localparam UART_BAUDDIV = 148_500_000 / 230_400;            // bauddiv counter (230.4Kbaud) for commands and one-shot captures
+    reg [15:0] uart_bauddiv;                                    // streaming switches this to the divider in the command frame
+    reg [15:0] uart_bauddiv_q;                                  // divider the UART was last reset with
     reg uart_tx_start;                                          // start a transmit of what is in uart_tx_data_in (this is edge triggered so you just toggle it to send)
     reg [7:0] uart_tx_data_in;                                  // data to send
     reg uart_rx_read;                                           // ack a read (toggle, edge triggered like uart_tx_start)
     wire uart_rx_ready;                                         // there's a byte to read
     wire [7:0] uart_rx_byte;                                    // the byte that is available to read
 
+    // tx_uart only reloads its bit timer at the end of a bit so the first start bit after a divider change would still be
+    // timed with the old one, reset the UART for a cycle when it changes (it's idle at both ends of a stream, the stop
+    // byte it drops would have been flushed anyway)
+    wire uart_rst_n = rst_n && uart_bauddiv_q == uart_bauddiv;
+
     uart #(.FIFO_DEPTH(16), .RX_ENABLE(1), .TX_ENABLE(1)) la_uart(
-        .clk(pll_clk), .rst_n(rst_n),
+        .clk(pll_clk), .rst_n(uart_rst_n),
         .baud_div(uart_bauddiv),
         .uart_tx_start(uart_tx_start),
         .uart_tx_data_in(uart_tx_data_in),
@@ -49,7 +56,7 @@ module top(
     reg [15:0] timer_mem_wptr;                  // saved WPTR when done sampling
     reg timer_mem_ce;                           // Clock enable for memory (wren(1), ce(0): turn clock off for both ports)
     reg timer_triggered;                        // have we triggered yet
-    reg timer_state;                            // timer FSM state id
+    reg [2:0] timer_state;                      // timer FSM state id
     reg [15:0] timer_io_latch;                  // latched io
     reg [15:0] timer_io_latch2;
     wire [7:0] timer_mem_data_out;              // memory output
@@ -63,6 +70,80 @@ module top(
     reg [3:0] timer_trigger_mode;
     reg timer_trigger_latch;                    // latched trigger reduces critical path but delays triggering by 1 cycle
 
+    // STREAM (continuous run length encoded capture, mode bit 6)
+    // Each run of identical samples is pushed into stream_fifo as a 32-bit record {run[15:0], value[15:0]} (16ch) or
+    // {run[23:0], value[7:0]} (8ch) and sent LSB first.  A record with run == 0 is a marker followed by a 32-bit
+    // parameter: 1 == overflow (parameter is the number of samples dropped), 2 == end (parameter is the total samples taken).
+    localparam STREAM_FIFO_DEPTH = 32;
+    localparam
+        STREAM_MARK_OVERFLOW = 32'd1,
+        STREAM_MARK_END      = 32'd2;
+    reg stream_mode;                            // stream records instead of a one-shot capture
+    reg stream_stop;                            // the host sent a byte asking us to stop
+    reg [15:0] stream_value;                    // value of the current run
+    reg [23:0] stream_run;                      // samples in the current run (0 == none yet)
+    reg stream_overflow;                        // the FIFO was full so we're dropping samples until it drains
+    reg [31:0] stream_lost;                     // samples dropped so far in this overflow
+    reg [31:0] stream_lost_q;                   // dropped count for the overflow marker in the FIFO
+    reg [31:0] stream_total;                    // samples taken since the trigger
+    reg stream_fifo_write;                      // combinational, see below
+    reg [31:0] stream_fifo_in;
+    reg stream_fifo_read;
+    wire [31:0] stream_fifo_out;
+    wire stream_fifo_empty;
+    wire stream_fifo_full;
+    reg [31:0] stream_tx_word;                  // record being sent
+    reg [31:0] stream_tx_param;                 // marker parameter sent after it
+    reg stream_tx_marker;
+    reg [3:0] stream_tx_i;                      // bytes of the record sent so far
+    reg [11:0] stream_drain_cnt;                // wait for the last byte to leave before switching baud back
+
+    wire [23:0] stream_run_max = timer_8ch_mode ? 24'hFFFFFF : 24'h00FFFF;
+    wire [15:0] stream_sample  = timer_8ch_mode ? {8'b0, timer_io_latch[7:0]} : timer_io_latch;
+    wire [31:0] stream_record  = timer_8ch_mode ? {stream_run, stream_value[7:0]} : {stream_run[15:0], stream_value};
+    wire stream_run_ends       = stream_run != 0 && (stream_sample != stream_value || stream_run == stream_run_max);
+
+    fifo #(.FIFO_DEPTH(STREAM_FIFO_DEPTH), .DATA_WIDTH(32)) stream_fifo(
+        .clk(pll_clk), .rst_n(rst_n),
+        .write(stream_fifo_write), .data_in(stream_fifo_in),
+        .read(stream_fifo_read), .data_out(stream_fifo_out),
+        .empty(stream_fifo_empty), .full(stream_fifo_full),
+        .flush(1'b0));
+
+    // SEQUENCER (trigger mode 4)
+    // Up to 4 stages, each 8 bytes after the command frame: mask[15:0], value[15:0], {edge, count[14:0]}, within[15:0].
+    // A stage matches a sample when (sample & mask) == (value & mask) (and the previous sample didn't if edge is set),
+    // completes after count matches and has to do so within "within" samples of the previous stage completing (0 == no
+    // limit) or the sequence starts over at stage 0.  The trigger fires when the last stage (or one before a stage with
+    // count == 0) completes.  It runs on the samples themselves (every prescale cycles) so the client can replay it.
+    localparam TRIGGER_SEQ = 4;
+    localparam SEQ_STAGES = 4;
+    reg [7:0] seq_cfg[8*SEQ_STAGES-1:0];        // stage config bytes in the order they're sent
+    wire timer_sample_tick;                     // a sample is taken this cycle
+    reg seq_tick;                               // seq_sample was taken last cycle
+    reg [15:0] seq_sample;
+    reg seq_step;                               // seq_match is for a new sample
+    reg [SEQ_STAGES-1:0] seq_match;             // the sample matches each stage's pattern
+    reg [SEQ_STAGES-1:0] seq_match_prev;        // ... and the sample before it did
+    reg [1:0] seq_stage;                        // stage we're waiting on
+    reg [14:0] seq_count;                       // matches so far in this stage
+    reg [15:0] seq_window;                      // samples so far in this stage
+    reg seq_fire;                               // sequence complete (sticky until the next capture)
+
+    wire [SEQ_STAGES-1:0] seq_hit;
+    genvar seq_i;
+    generate
+        for (seq_i = 0; seq_i < SEQ_STAGES; seq_i = seq_i + 1) begin : seq_gen
+            assign seq_hit[seq_i] = ~|((seq_sample ^ {seq_cfg[8*seq_i+3], seq_cfg[8*seq_i+2]}) & {seq_cfg[8*seq_i+1], seq_cfg[8*seq_i]});
+        end
+    endgenerate
+
+    wire seq_edge       = seq_cfg[{seq_stage, 3'd5}][7];
+    wire [14:0] seq_cnt = {seq_cfg[{seq_stage, 3'd5}][6:0], seq_cfg[{seq_stage, 3'd4}]};
+    wire [15:0] seq_win = {seq_cfg[{seq_stage, 3'd7}], seq_cfg[{seq_stage, 3'd6}]};
+    wire seq_last       = seq_stage == SEQ_STAGES - 1 || {seq_cfg[{seq_stage + 2'd1, 3'd5}][6:0], seq_cfg[{seq_stage + 2'd1, 3'd4}]} == 0;
+    wire seq_hit_now    = seq_match[seq_stage] && !(seq_edge && seq_match_prev[seq_stage]);
+
     // Address Mux for the LUT
     reg [3:0] lut_addr;
     always @(*) begin
@@ -80,7 +161,8 @@ module top(
     wire lut_trigger = timer_trigger_pol[lut_addr];                 // in LUT4 mode we use the polarity field as a 4-bit LUT
     wire [15:0] timer_trig_delta = ((io ^ timer_io_latch));         // did a pin change that we care about
     wire [15:0] timer_trig_value = (~(io ^ timer_trigger_pol));     // is the current bit equal to the value we wanted
-    wire timer_trigger_event = (ENABLE_LUT_TRIGGER == 1 && timer_trigger_mode != 0) ?          // are we using a LUT trigger or standard edge trigger?
+    wire timer_trigger_event = (timer_trigger_mode == TRIGGER_SEQ) ? seq_fire :                 // sequencer
+                                (ENABLE_LUT_TRIGGER == 1 && timer_trigger_mode != 0) ?          // are we using a LUT trigger or standard edge trigger?
                                     lut_trigger : 
                                         (|(timer_trig_delta & timer_trig_value & timer_trigger_mask));
 
@@ -105,16 +187,19 @@ module top(
     );
 
     // MAIN app
-    reg [7:0] main_rx_frame[7:0];           // each command is 8 bytes
-    reg [3:0] main_rx_frame_i;              // how many bytes have we read so far
+    reg [7:0] main_rx_frame[7:0];           // each command is 8 bytes (plus the sequencer stages in trigger mode 4)
+    reg [5:0] main_rx_frame_i;              // how many bytes have we read so far
     reg [7:0] main_tx_byte_buf;             // buffer holding byte to send for MAIN_TRANSMIT_WAIT
-    reg [3:0] main_state;                   // which state is the FSM in
-    reg [3:0] main_state_tag;               // tag system allows generic wait and what not
+    reg [4:0] main_state;                   // which state is the FSM in
+    reg [4:0] main_state_tag;               // tag system allows generic wait and what not
     reg [16:0] main_buf_i;                  // index into buffer to send
 
     localparam
         TIMER_IDLE = 0,                     // Timer FSM idling waiting for timer_start
-        TIMER_RUNNING = 1;                  // Timer FSM sampling waiting for a trigger and post_trigger samples to exhaust
+        TIMER_RUNNING = 1,                  // Timer FSM sampling waiting for a trigger and post_trigger samples to exhaust
+        TIMER_STREAM_ARMED = 2,             // streaming, waiting for the trigger
+        TIMER_STREAMING = 3,                // streaming, run length encoding samples into stream_fifo
+        TIMER_STREAM_STOP = 4;              // streaming, pushing the last run and the end marker
 
     localparam
         MAIN_INIT                   = 0,    // Init the main FSM
@@ -132,15 +217,49 @@ module top(
         MAIN_TRANSMIT_READ_MEM1     = 12,   // wait cycle for mem to respond to address
         MAIN_TRANSMIT_READ_MEM2     = 13,   // cycle to read memory output
         MAIN_PROGRAM_HALT           = 14,   // Halt main FSM waiting for timer to go idle
-        MAIN_PROGRAM_DELAYED_HALT   = 15;   // delay cycle to allow timer FSM to respond to timer_start going high
+        MAIN_PROGRAM_DELAYED_HALT   = 15,   // delay cycle to allow timer FSM to respond to timer_start going high
+        MAIN_STREAM                 = 16,   // streaming, pop the next record from stream_fifo
+        MAIN_STREAM_BYTE            = 17,   // streaming, send the record (and marker parameter) a byte at a time
+        MAIN_STREAM_DRAIN           = 18;   // streaming done, let the UART finish before going back to 230.4K
 
     localparam
         LED_WAITING_ON_RX      = 0,         // Waiting for the client to submit a command packet
         LED_WAITING_ON_SAMPLES = 1,         // Waiting on trigger
-        LED_WAITING_ON_TX      = 2;         // Waiting on transmitting the entire sample buffer over serial TX
+        LED_WAITING_ON_TX      = 2,         // Waiting on transmitting the entire sample buffer over serial TX
+        LED_STREAM_OVERFLOW    = 3;         // Streaming dropped samples since the last command
+
+    // the sequencer sees the same samples that go to memory (or would start the stream)
+    assign timer_sample_tick = timer_prescale_cnt >= timer_prescale && (timer_state == TIMER_RUNNING || timer_state == TIMER_STREAM_ARMED);
+
+    // what the timer FSM pushes into stream_fifo, combinational so back to back pushes see full/empty right
+    always @(*) begin
+        stream_fifo_write = 1'b0;
+        stream_fifo_in    = stream_record;
+        case (timer_state)
+            TIMER_STREAMING:
+                if (!stream_stop && timer_prescale_cnt >= timer_prescale) begin
+                    if (stream_overflow) begin
+                        stream_fifo_write = stream_fifo_empty;
+                        stream_fifo_in    = STREAM_MARK_OVERFLOW;
+                    end else begin
+                        stream_fifo_write = stream_run_ends && !stream_fifo_full;
+                    end
+                end
+            TIMER_STREAM_STOP:
+                if (stream_overflow) begin
+                    stream_fifo_write = stream_fifo_empty;
+                    stream_fifo_in    = STREAM_MARK_OVERFLOW;
+                end else begin
+                    stream_fifo_write = !stream_fifo_full;
+                    stream_fifo_in    = (stream_run != 0) ? stream_record : STREAM_MARK_END;
+                end
+            default: begin end
+        endcase
+    end
 
     always @(posedge pll_clk) begin
         rstcnt <= {rstcnt[2:0], 1'b1};
+        uart_bauddiv_q <= uart_bauddiv;
         if (!rst_n) begin
             // LEDs
             ledv                <= 0;       // all LEDs off
@@ -149,6 +268,7 @@ module top(
             uart_tx_start       <= 0;       // idle the UART FIFO
             uart_rx_read        <= 0;
             uart_tx_data_in     <= 0;
+            uart_bauddiv        <= UART_BAUDDIV;
 
             // reset timer FSM
             timer_state         <= TIMER_IDLE;
@@ -169,6 +289,18 @@ module top(
             timer_trigger_mode  <= 0;
             timer_trigger_latch <= 0;
 
+            // reset sequencer
+            seq_tick            <= 0;
+            seq_step            <= 0;
+            seq_fire            <= 0;
+
+            // reset stream
+            stream_mode         <= 0;
+            stream_stop         <= 0;
+            stream_run          <= 0;
+            stream_overflow     <= 0;
+            stream_fifo_read    <= 0;
+
             // reset main FSM
             main_state          <= MAIN_INIT;
             main_rx_frame_i     <= 0;
@@ -177,6 +309,34 @@ module top(
             // main code
             timer_io_latch      <= io;               // latch the IO pins
             timer_trigger_latch <= timer_trigger_event;
+
+            // sequencer pipeline: latch the sample, match it against every stage, then step the current stage
+            seq_tick <= timer_sample_tick;
+            if (timer_sample_tick) begin
+                seq_sample <= timer_8ch_mode ? {8'b0, timer_io_latch[7:0]} : timer_io_latch;
+            end
+            seq_step <= seq_tick;
+            if (seq_tick) begin
+                seq_match      <= seq_hit;
+                seq_match_prev <= seq_match;
+            end
+            if (seq_step && !seq_fire) begin
+                if (seq_hit_now && seq_count + 1'b1 == seq_cnt) begin
+                    // stage complete, the next one starts with the next sample
+                    seq_fire   <= seq_last;
+                    seq_stage  <= seq_stage + 1'b1;
+                    seq_count  <= 0;
+                    seq_window <= 0;
+                end else if (seq_win != 0 && seq_window + 1'b1 == seq_win) begin
+                    // took too long, start over
+                    seq_stage  <= 0;
+                    seq_count  <= 0;
+                    seq_window <= 0;
+                end else begin
+                    seq_count  <= seq_count + seq_hit_now;
+                    seq_window <= seq_window + 1'b1;
+                end
+            end
 /* This application uses two FSMs.  The timer FSM is IDLE when timer_start hasn't been asserted
 allows the "main" FSM to run.  The main FSM is what actually coordinates the device.  It flushes the RX buffer,
 waits for a frame (8 bytes) to program the timer, then asserts timer_start.
@@ -189,6 +349,12 @@ every prescale cycles we sample the next data and write it to memory.
 This means once TIMER_RUNNING is going it's constantly sampling to memory (every prescale cycles).  Once the trigger
 happens it runs for another post count.  This way you can change how much before/after the trigger you record.  It always
 returns 65536 samples.
+
+If bit 6 of the mode byte is set the timer FSM streams instead (TIMER_STREAM_ARMED -> TIMER_STREAMING).  Memory stays
+off, samples after the trigger are run length encoded into stream_fifo and MAIN_STREAM sends the records as fast as the
+UART (switched to the divider in byte 7 of the command) allows.  If the FIFO fills the timer FSM counts dropped samples
+until it drains and then pushes an overflow marker.  Any byte from the host stops the stream, the last run and an end
+marker holding the sample count are sent and MAIN_STREAM_DRAIN switches back to 230.4K.
 */
             // main FSM
             case (main_state)
@@ -199,6 +365,7 @@ returns 65536 samples.
                         ledv[LED_WAITING_ON_RX]      <= 1;                          // waiting for serial RX
                         ledv[LED_WAITING_ON_SAMPLES] <= 0;                          // not waiting for sampling
                         ledv[LED_WAITING_ON_TX]      <= 0;                          // not waiting for transmitting
+                        ledv[LED_STREAM_OVERFLOW]    <= 0;
                         main_state                   <= MAIN_FLUSH_RX;
                     end
                 MAIN_FLUSH_RX:                                                      // Flush any random bytes from the serial so we have a clean slate
@@ -217,7 +384,7 @@ returns 65536 samples.
                     end
                 MAIN_CMD_BYTES:                                                     // Main loop to receive command packet from client
                     begin
-                        if (main_rx_frame_i == 'd8) begin                           // read 8 bytes from serial
+                        if (main_rx_frame_i == (main_rx_frame[6][3:0] == TRIGGER_SEQ ? 6'd40 : 6'd8)) begin  // read 8 bytes from serial (40 with sequencer stages)
                             ledv[LED_WAITING_ON_RX]      <= 0;                      // not waiting for serial RX
                             ledv[LED_WAITING_ON_SAMPLES] <= 1;                      // waiting for sampling
                             main_state                   <= MAIN_PROGRAM_TIMER;
@@ -235,15 +402,28 @@ returns 65536 samples.
                     end
                 MAIN_READ_BYTE_DELAY2:                                              // Now we can read the data from the UART RX
                     begin
-                        main_rx_frame[main_rx_frame_i] <= uart_rx_byte;             // latch byte from UART RX
+                        if (main_rx_frame_i[5:3] == 0) begin
+                            main_rx_frame[main_rx_frame_i[2:0]] <= uart_rx_byte;    // latch byte from UART RX
+                        end else begin
+                            seq_cfg[main_rx_frame_i - 6'd8] <= uart_rx_byte;        // sequencer stages follow the frame
+                        end
                         main_rx_frame_i <= main_rx_frame_i + 1'b1;                  // increment the frame offset
                         main_state      <= MAIN_CMD_BYTES;
                     end
                 MAIN_PROGRAM_TIMER:
                     begin
-                        main_state         <= MAIN_PROGRAM_DELAYED_HALT;            // get ready for next main task which is sending the lower 8 bits
+                        if (main_rx_frame[6][6]) begin                              // streaming: no memory, switch to the stream baud and send records as they come
+                            main_state     <= MAIN_STREAM;
+                            if (main_rx_frame[7] != 0) begin
+                                uart_bauddiv <= {8'b0, main_rx_frame[7]};
+                            end
+                        end else begin
+                            main_state     <= MAIN_PROGRAM_DELAYED_HALT;            // get ready for next main task which is sending the lower 8 bits
+                        end
+                        stream_mode        <= main_rx_frame[6][6];
+                        stream_stop        <= 0;
                         timer_start        <= 1;                                    // start the timer
-                        timer_mem_ce       <= 1'b1;                                 // turn memory on
+                        timer_mem_ce       <= ~main_rx_frame[6][6];                 // turn memory on for a one-shot capture
                         timer_8ch_phase    <= 0;                                    // reset phase to 0 so wptr math will always work
                         timer_trigger_mask <= {main_rx_frame[1], main_rx_frame[0]}; // load mask
                         timer_trigger_pol  <= {main_rx_frame[3], main_rx_frame[2]}; // load pol
@@ -258,7 +438,7 @@ returns 65536 samples.
                                 timer_post_cnt     <= {1'b0, main_rx_frame[5], 7'b0}; // post_cnt * 128 samples (0..32640)
                             end
                         end
-                        timer_trigger_mode <= main_rx_frame[6][3:0];                // trigger mode (0=edge, 1+ == LUT)
+                        timer_trigger_mode <= main_rx_frame[6][3:0];                // trigger mode (0=edge, 1..3 == LUT, 4 == sequencer)
                     end
                 MAIN_PROGRAM_DELAYED_HALT:
                     begin
@@ -317,6 +497,57 @@ returns 65536 samples.
                         main_state       <= MAIN_TRANSMIT_WAIT;                     // wait to send byte to UART
                         main_buf_i       <= main_buf_i + 1'b1;
                     end
+                MAIN_STREAM:                                                        // pop the next record, the timer FSM fills the FIFO
+                    begin
+                        uart_tx_start <= 1'b0;
+                        if (uart_rx_ready) begin
+                            stream_stop <= 1'b1;                                    // any byte from the host stops the stream (MAIN_FLUSH_RX eats it)
+                        end
+                        if (!stream_fifo_empty) begin
+                            stream_tx_word   <= stream_fifo_out;
+                            stream_tx_marker <= (stream_fifo_out == STREAM_MARK_OVERFLOW || stream_fifo_out == STREAM_MARK_END);
+                            stream_tx_param  <= (stream_fifo_out == STREAM_MARK_END) ? stream_total : stream_lost_q;
+                            stream_tx_i      <= 0;
+                            stream_fifo_read <= 1'b1;                               // pop it
+                            main_state       <= MAIN_STREAM_BYTE;
+                        end else if (timer_state == TIMER_IDLE && stream_stop) begin
+                            stream_drain_cnt <= 12'hFFF;                            // the end marker went out
+                            main_state       <= MAIN_STREAM_DRAIN;
+                        end
+                    end
+                MAIN_STREAM_BYTE:                                                   // send the record then the parameter for markers
+                    begin
+                        stream_fifo_read <= 1'b0;
+                        uart_tx_start    <= 1'b0;
+                        if (uart_rx_ready) begin
+                            stream_stop <= 1'b1;
+                        end
+                        if (stream_tx_i == (stream_tx_marker ? 4'd8 : 4'd4)) begin
+                            main_state <= MAIN_STREAM;
+                        end else begin
+                            if (stream_tx_i[2]) begin
+                                main_tx_byte_buf <= stream_tx_param[7:0];
+                                stream_tx_param  <= {8'b0, stream_tx_param[31:8]};
+                            end else begin
+                                main_tx_byte_buf <= stream_tx_word[7:0];
+                                stream_tx_word   <= {8'b0, stream_tx_word[31:8]};
+                            end
+                            stream_tx_i    <= stream_tx_i + 1'b1;
+                            main_state_tag <= MAIN_STREAM_BYTE;
+                            main_state     <= MAIN_TRANSMIT_WAIT;
+                        end
+                    end
+                MAIN_STREAM_DRAIN:                                                  // the UART FIFO is empty once the last byte started, give it 10 bit times at the slowest divider
+                    begin
+                        if (uart_tx_fifo_empty) begin
+                            if (stream_drain_cnt == 0) begin
+                                uart_bauddiv <= UART_BAUDDIV;
+                                main_state   <= MAIN_INIT;
+                            end else begin
+                                stream_drain_cnt <= stream_drain_cnt - 1'b1;
+                            end
+                        end
+                    end
                 default: begin end
             endcase
 
@@ -329,7 +560,81 @@ returns 65536 samples.
                             timer_mem_ptr       <= 0;                                   // start at address 0
                             timer_triggered     <= 0;                                   // reset triggered stats
                             timer_trigger_latch <= 0;                                   // reset trigger latch
-                            timer_state         <= TIMER_RUNNING;
+                            seq_stage           <= 0;                                   // reset sequencer
+                            seq_count           <= 0;
+                            seq_window          <= 0;
+                            seq_fire            <= 0;
+                            seq_match           <= {SEQ_STAGES{1'b1}};                  // so the first sample isn't an edge
+                            seq_match_prev      <= {SEQ_STAGES{1'b1}};
+                            timer_state         <= stream_mode ? TIMER_STREAM_ARMED : TIMER_RUNNING;
+                        end
+                    end
+                TIMER_STREAM_ARMED:                                                     // stream starts with the sample after the trigger
+                    begin
+                        stream_run      <= 0;
+                        stream_total    <= 0;
+                        stream_overflow <= 0;
+                        if (stream_stop) begin
+                            timer_state <= TIMER_STREAM_STOP;
+                        end else if (timer_trigger_latch) begin
+                            timer_prescale_cnt <= timer_prescale;                       // sample right away
+                            timer_state        <= TIMER_STREAMING;
+                        end else if (timer_prescale_cnt >= timer_prescale) begin        // keep the sample clock going for the sequencer
+                            timer_prescale_cnt <= 0;
+                        end else begin
+                            timer_prescale_cnt <= timer_prescale_cnt + 1'b1;
+                        end
+                    end
+                TIMER_STREAMING:                                                        // every prescale cycles extend the run or push it and start a new one
+                    begin
+                        if (stream_stop) begin
+                            timer_state <= TIMER_STREAM_STOP;
+                        end else if (timer_prescale_cnt >= timer_prescale) begin
+                            timer_prescale_cnt <= 0;
+                            stream_total       <= stream_total + 1'b1;
+                            if (stream_overflow) begin
+                                if (stream_fifo_empty) begin
+                                    // caught up, the overflow marker is pushed and this sample starts a new run
+                                    stream_lost_q     <= stream_lost;
+                                    stream_overflow   <= 1'b0;
+                                    stream_value      <= stream_sample;
+                                    stream_run        <= 1;
+                                end else begin
+                                    stream_lost <= stream_lost + 1'b1;
+                                end
+                            end else if (stream_run_ends) begin
+                                if (!stream_fifo_full) begin
+                                    stream_value      <= stream_sample;         // the finished run is pushed
+                                    stream_run        <= 1;
+                                end else begin
+                                    // the link can't keep up, the run we couldn't push and this sample are lost
+                                    stream_overflow           <= 1'b1;
+                                    stream_lost               <= stream_run + 1'b1;
+                                    stream_run                <= 0;
+                                    ledv[LED_STREAM_OVERFLOW] <= 1'b1;
+                                end
+                            end else begin
+                                stream_value <= stream_sample;
+                                stream_run   <= stream_run + 1'b1;
+                            end
+                        end else begin
+                            timer_prescale_cnt <= timer_prescale_cnt + 1'b1;
+                        end
+                    end
+                TIMER_STREAM_STOP:                                                      // flush what we have then the end marker
+                    begin
+                        if (stream_overflow) begin
+                            if (stream_fifo_empty) begin
+                                stream_lost_q   <= stream_lost;
+                                stream_overflow <= 1'b0;
+                            end
+                        end else if (!stream_fifo_full) begin
+                            if (stream_run != 0) begin
+                                stream_run  <= 0;
+                            end else begin
+                                timer_start <= 0;
+                                timer_state <= TIMER_IDLE;
+                            end
                         end
                     end
                 TIMER_RUNNING:                                                          // This state records a new sample every timer_prescale cycles
@@ -0,0 +1,452 @@
+// FAT16 benchmark and stress test for the boot loader's library (lib/cf/cf/lib/fat16.c)
+//
+// bench [-c] [-x] [-s seed] [-n iters] [-w table] [-b table] image
+//
+// Walks every directory of the image, then times (in sector_op() calls and sectors, the
+// only thing that costs anything on the SD card) fat16_wpath(), fat16_fopen() and
+// fat16_fread() with sequential, small and random reads over every file.  Everything read
+// is checked against what mtools (mcopy) says is in the file.
+//   -c          give the volume a fat16_fatbuf() FAT sector cache
+//   -x          don't run mtools, check reads against a whole file read instead
+//   -s seed     random seed for the random reads/lookups (default 1)
+//   -n iters    random reads and missing lookups (default 2000)
+//   -w table    save the results
+//   -b table    compare against saved results, any op that needs more card commands or
+//               sectors than before is flagged and the exit status is 2
+#include "cf/lib/fat16.h"
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define MAX_FILES	1024
+#define MAX_OPS		32
+#define MAX_DEPTH	16
+
+FILE *f;
+unsigned long cmds, sectors;
+
+uint16_t sector_op(uint16_t sector[2], uint8_t *data, uint16_t wr_en)
+{
+	uint32_t addr = ((uint32_t)sector[1] << 16) | sector[0];
+
+	++cmds;
+	++sectors;
+	if (wr_en || fseek(f, (long)addr << 9, SEEK_SET) || fread(data, 1, 512, f) != 512) {
+		return 0xFFFF;
+	}
+	return 0;
+}
+
+#ifdef FAT16_MULTI
+// one CMD18 for the whole run on the card
+uint16_t sector_rdmulti(uint16_t sector[2], uint8_t *data, uint16_t count)
+{
+	uint32_t addr = ((uint32_t)sector[1] << 16) | sector[0];
+
+	++cmds;
+	sectors += count;
+	if (fseek(f, (long)addr << 9, SEEK_SET) || fread(data, 512, count, f) != count) {
+		return 0xFFFF;
+	}
+	return 0;
+}
+#endif
+
+struct file {
+	char path[128];
+	uint32_t size;
+	int depth;
+	int extents;					// runs of contiguous clusters
+	uint8_t *ref;
+};
+
+struct op {
+	char name[24];
+	unsigned long calls, cmds, sectors, bytes;
+};
+
+struct fat16_volinfo fv;
+uint8_t secbuf[512], fatbuf[512];
+struct file files[MAX_FILES];
+int nfiles;
+struct op ops[MAX_OPS];
+int nops;
+char *image;
+
+// find (or add) an op by name
+struct op *get_op(char *name)
+{
+	int x;
+
+	for (x = 0; x < nops; x++) {
+		if (!strcmp(ops[x].name, name)) {
+			return &ops[x];
+		}
+	}
+	if (nops == MAX_OPS) {
+		fprintf(stderr, "Too many ops\n");
+		exit(-1);
+	}
+	strcpy(ops[nops].name, name);
+	return &ops[nops++];
+}
+
+// charge the card traffic since c0/s0 to op
+void charge(char *name, unsigned long c0, unsigned long s0, unsigned long bytes)
+{
+	struct op *o = get_op(name);
+
+	++(o->calls);
+	o->cmds    += cmds - c0;
+	o->sectors += sectors - s0;
+	o->bytes   += bytes;
+}
+
+// count the runs of contiguous clusters in a chain, off the books (and without the FAT
+// reads disturbing the directory sector in secbuf)
+int count_extents(uint16_t cluster)
+{
+	unsigned long c0 = cmds, s0 = sectors;
+	uint8_t savebuf[512];
+	uint16_t next;
+	int n;
+
+	memcpy(savebuf, secbuf, 512);
+	for (n = 1; ; cluster = next) {
+		next = fat16_n_c(&fv, cluster);
+		if (next < 2 || next >= 0xFFF8) {
+			break;
+		}
+		n += next != cluster + 1;
+	}
+	memcpy(secbuf, savebuf, 512);
+	cmds = c0;
+	sectors = s0;
+	return n;
+}
+
+// collect every file under the directory at 'cluster', the walk itself is the "walk" op
+void walk(uint16_t cluster, char *path, int depth)
+{
+	struct fat16_volinfo save, *v = &fv;
+	uint8_t savebuf[512];
+	char name[13], sub[128];
+	unsigned long c0, s0;
+	int x, y;
+
+	c0 = cmds; s0 = sectors;
+	fat16_opendir(&fv, cluster);
+	for (;;) {
+		x = fat16_nextdir(&fv);
+		charge("walk", c0, s0, 0);
+		if (x) {
+			break;
+		}
+		if (D_FNAME(v)[0] == '.' || (D_ATTRIB(v) & 0x0A)) {
+			// dot entries, volume label, long names and hidden stuff
+			c0 = cmds; s0 = sectors;
+			continue;
+		}
+
+		// 8.3 back to a name
+		for (x = y = 0; x < 8 && D_FNAME(v)[x] != ' '; x++) {
+			name[y++] = D_FNAME(v)[x];
+		}
+		if (D_EXT(v)[0] != ' ') {
+			name[y++] = '.';
+			for (x = 0; x < 3 && D_EXT(v)[x] != ' '; x++) {
+				name[y++] = D_EXT(v)[x];
+			}
+		}
+		name[y] = 0;
+		snprintf(sub, sizeof(sub), "%s/%s", path, name);
+
+		if (D_ATTRIB(v) & 0x10) {
+			if (depth + 1 < MAX_DEPTH) {
+				save = fv;
+				memcpy(savebuf, secbuf, 512);
+				walk(fat16_sc2dc(v, D_CLUSTER(v)), sub, depth + 1);
+#ifndef FAT16_TINY
+				// fatbuf still holds whatever the sub directory left in it
+				save.fat_sec = fv.fat_sec;
+#endif
+				fv = save;
+				memcpy(secbuf, savebuf, 512);
+			}
+		} else if (nfiles < MAX_FILES) {
+			strcpy(files[nfiles].path, sub);
+			files[nfiles].size = ((uint32_t)D_FZ1(v) << 16) | D_FZ0(v);
+			files[nfiles].depth = depth + 1;
+			files[nfiles].extents = D_CLUSTER(v) ? count_extents(D_CLUSTER(v)) : 0;
+			++nfiles;
+		}
+		c0 = cmds; s0 = sectors;
+	}
+}
+
+// what's in a file according to mtools
+uint8_t *mtools_read(struct file *fi)
+{
+	char cmd[512];
+	uint8_t *buf;
+	size_t n;
+	FILE *p;
+
+	snprintf(cmd, sizeof(cmd), "mcopy -n -i '%s' '::%s' -", image, fi->path);
+	p = popen(cmd, "r");
+	if (!p) {
+		fprintf(stderr, "Can't run mcopy\n");
+		exit(-1);
+	}
+	buf = calloc(1, fi->size + 1);
+	n = fread(buf, 1, fi->size + 1, p);
+	if (pclose(p) || n != fi->size) {
+		fprintf(stderr, "%s: mcopy gave %lu bytes (exit status set?), the dirent says %lu\n", fi->path, (unsigned long)n, (unsigned long)fi->size);
+		exit(-1);
+	}
+	return buf;
+}
+
+// open a file as op "fopen"
+void open_file(struct file *fi)
+{
+	unsigned long c0 = cmds, s0 = sectors;
+
+	if (fat16_fopen(&fv, fi->path)) {
+		fprintf(stderr, "%s: fat16_fopen() failed\n", fi->path);
+		exit(-1);
+	}
+	charge("fopen", c0, s0, 0);
+	if (fv.f_size[0] != (fi->size & 0xFFFF) || fv.f_size[1] != (fi->size >> 16)) {
+		fprintf(stderr, "%s: fat16_fopen() size is wrong\n", fi->path);
+		exit(-1);
+	}
+}
+
+// read len bytes at pos as op 'name' and check them against the reference
+void read_at(char *name, struct file *fi, uint32_t pos, uint16_t len)
+{
+	static uint8_t buf[65536];
+	unsigned long c0, s0;
+	uint32_t want;
+	uint16_t r;
+
+	fv.f_pos[0] = pos;
+	fv.f_pos[1] = pos >> 16;
+	c0 = cmds; s0 = sectors;
+	r = fat16_fread(&fv, buf, len);
+	charge(name, c0, s0, r);
+
+	want = pos >= fi->size ? 0 : fi->size - pos;
+	if (want > len) {
+		want = len;
+	}
+	if (r != want || memcmp(buf, fi->ref + pos, r)) {
+		fprintf(stderr, "%s: %s read of %u bytes at %lu gave %u bytes, wanted %lu, or they differ\n", fi->path, name, len, (unsigned long)pos, r, (unsigned long)want);
+		exit(-1);
+	}
+}
+
+// read a file front to back in 'chunk' sized reads
+void read_seq(char *name, struct file *fi, uint16_t chunk)
+{
+	uint32_t pos;
+
+	open_file(fi);
+	for (pos = 0; pos < fi->size; pos += chunk) {
+		read_at(name, fi, pos, chunk);
+	}
+}
+
+// save the table
+void save_ops(char *fname)
+{
+	FILE *o;
+	int x;
+
+	o = fopen(fname, "w");
+	if (!o) {
+		fprintf(stderr, "Can't write %s\n", fname);
+		exit(-1);
+	}
+	for (x = 0; x < nops; x++) {
+		fprintf(o, "%s %lu %lu %lu %lu\n", ops[x].name, ops[x].calls, ops[x].cmds, ops[x].sectors, ops[x].bytes);
+	}
+	fclose(o);
+}
+
+// compare against a saved table, returns the # of ops that got worse
+int compare_ops(char *fname)
+{
+	char name[64];
+	unsigned long calls, c, s, b;
+	struct op *o;
+	int bad;
+	FILE *in;
+
+	in = fopen(fname, "r");
+	if (!in) {
+		printf("(no baseline %s)\n", fname);
+		return 0;
+	}
+	bad = 0;
+	printf("\nagainst %s:\n", fname);
+	while (fscanf(in, "%63s %lu %lu %lu %lu", name, &calls, &c, &s, &b) == 5) {
+		o = get_op(name);
+		if (o->calls != calls || o->bytes != b) {
+			printf("%-14s workload changed (%lu calls/%lu bytes, was %lu/%lu)\n", name, o->calls, o->bytes, calls, b);
+		} else if (o->cmds > c || o->sectors > s) {
+			printf("%-14s REGRESSION cmds %lu -> %lu, sectors %lu -> %lu\n", name, c, o->cmds, s, o->sectors);
+			++bad;
+		} else if (o->cmds < c || o->sectors < s) {
+			printf("%-14s better     cmds %lu -> %lu, sectors %lu -> %lu\n", name, c, o->cmds, s, o->sectors);
+		}
+	}
+	fclose(in);
+	return bad;
+}
+
+int main(int argc, char **argv)
+{
+	char *save, *base, path[160];
+	int x, c, cache, use_mtools, iters, depth, frag;
+	unsigned long c0, s0;
+	struct file *fi;
+	uint32_t pos;
+
+	cache = 0;
+	use_mtools = 1;
+	iters = 2000;
+	save = base = NULL;
+	srand(1);
+	while ((c = getopt(argc, argv, "cxs:n:w:b:")) != -1) {
+		switch (c) {
+			case 'c': cache = 1; break;
+			case 'x': use_mtools = 0; break;
+			case 's': srand(strtoul(optarg, NULL, 0)); break;
+			case 'n': iters = strtoul(optarg, NULL, 0); break;
+			case 'w': save = optarg; break;
+			case 'b': base = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-c] [-x] [-s seed] [-n iters] [-w table] [-b table] image\n", argv[0]);
+				return -1;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "No image given\n");
+		return -1;
+	}
+	image = argv[optind];
+	f = fopen(image, "rb");
+	if (!f) {
+		fprintf(stderr, "Can't open %s\n", image);
+		return -1;
+	}
+
+	if (fat16_initvol(&fv, secbuf)) {
+		fprintf(stderr, "fat16_initvol() failed\n");
+		return -1;
+	}
+	if (cache) {
+#ifdef FAT16_TINY
+		fprintf(stderr, "No FAT cache with FAT16_TINY\n");
+		return -1;
+#else
+		fat16_fatbuf(&fv, fatbuf);
+#endif
+	}
+
+	// find everything and what should be in it
+	walk(0, "", 0);
+	for (x = frag = 0; x < nfiles; x++) {
+		fi = &files[x];
+		if (use_mtools) {
+			fi->ref = mtools_read(fi);
+		} else {
+			fi->ref = calloc(1, fi->size + 65536);
+			open_file(fi);
+			for (pos = 0; pos < fi->size; pos += 32768) {
+				fat16_fread(&fv, fi->ref + pos, 32768);
+			}
+		}
+		frag += fi->extents > 1;
+	}
+	memset(ops, 0, sizeof(ops));
+	nops = 0;
+	printf("%s: %u sectors/cluster, %d files (%d fragmented), FAT cache %s%s%s\n",
+		image, fv.sec_cluster, nfiles, frag, cache ? "on" : "off",
+#ifdef FAT16_TINY
+		", FAT16_TINY",
+#else
+		"",
+#endif
+#ifdef FAT16_MULTI
+		", FAT16_MULTI"
+#else
+		""
+#endif
+		);
+
+	// the walk again now the table is clear, then every path by depth
+	x = nfiles;
+	nfiles = 0;
+	walk(0, "", 0);
+	nfiles = x;
+	for (x = 0; x < nfiles; x++) {
+		fi = &files[x];
+		snprintf(path, sizeof(path), "wpath/%d", fi->depth);
+		c0 = cmds; s0 = sectors;
+		if (fat16_wpath(&fv, fi->path)) {
+			fprintf(stderr, "%s: fat16_wpath() failed\n", fi->path);
+			return -1;
+		}
+		charge(path, c0, s0, 0);
+	}
+
+	// names that aren't there, the last character of a real path bumped
+	for (x = 0; x < iters / 4; x++) {
+		fi = &files[rand() % nfiles];
+		strcpy(path, fi->path);
+		depth = strlen(path) - 1;
+		path[depth] = path[depth] == 'Z' ? '_' : 'Z';
+		for (c = 0; c < nfiles && strcmp(files[c].path, path); c++);
+		c0 = cmds; s0 = sectors;
+		if (!fat16_wpath(&fv, path) && c == nfiles) {
+			fprintf(stderr, "%s: fat16_wpath() found a file that isn't there\n", path);
+			return -1;
+		}
+		charge("wpath/miss", c0, s0, 0);
+	}
+
+	// sequential, small and random reads
+	for (x = 0; x < nfiles; x++) {
+		read_seq("fread/seq16k", &files[x], 16384);
+		read_seq("fread/seq512", &files[x], 512);
+		read_seq("fread/small32", &files[x], 32);
+	}
+	for (x = 0; x < iters; x++) {
+		fi = &files[rand() % nfiles];
+		open_file(fi);
+		// a few reads per open at random spots, forwards and backwards
+		for (c = 0; c < 4; c++) {
+			pos = fi->size ? ((uint32_t)rand() << 8 ^ rand()) % fi->size : 0;
+			read_at("fread/rand", fi, pos, 1 + rand() % 4096);
+		}
+	}
+
+	printf("%-14s %8s %8s %9s %10s %9s %9s\n", "op", "calls", "cmds", "sectors", "bytes", "cmds/call", "card/user");
+	for (x = 0; x < nops; x++) {
+		printf("%-14s %8lu %8lu %9lu %10lu %9.2f %9.2f\n", ops[x].name, ops[x].calls, ops[x].cmds, ops[x].sectors, ops[x].bytes,
+			(double)ops[x].cmds / ops[x].calls, ops[x].bytes ? (double)ops[x].sectors * 512 / ops[x].bytes : 0.0);
+	}
+
+	if (save) {
+		save_ops(save);
+	}
+	if (base && compare_ops(base)) {
+		return 2;
+	}
+	return 0;
+}
@@ -1,10 +1,11 @@
-#include "fat16.h"
+#include "cf/lib/fat16.h"
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 
 FILE *f;
+unsigned long rd_ops, wr_ops;
 uint16_t sector_op(uint16_t sector[2], uint8_t *data, uint16_t wr_en)
 {
 	// here we can use 32-bit because this is just a PC demo
@@ -15,9 +16,15 @@ uint16_t sector_op(uint16_t sector[2], uint8_t *data, uint16_t wr_en)
 		return 0xFFFF;
 	}
 	if (wr_en) {
-		fwrite(data, 1, 512, f);
+		++wr_ops;
+		if (fwrite(data, 1, 512, f) != 512) {
+			return 0xFFFF;
+		}
 	} else {
-		fread(data, 1, 512, f);
+		++rd_ops;
+		if (fread(data, 1, 512, f) != 512) {
+			return 0xFFFF;
+		}
 	}
 	return 0;
 }
@@ -50,6 +57,7 @@ void dump_file(struct fat16_volinfo *fv, uint16_t cluster)
 void walk_directory(struct fat16_volinfo *fv, uint16_t cluster)
 {
 	unsigned char tmpbuf[512];
+	struct fat16_volinfo tmpfv;
 	fat16_opendir(fv, cluster);
 	while ((!fat16_nextdir(fv))) {
 		char buf[16];
@@ -71,16 +79,127 @@ void walk_directory(struct fat16_volinfo *fv, uint16_t cluster)
 			//directory
 			printf("Walking into directory...\n");
 			memcpy(tmpbuf, fv->secbuf, 512);
+			tmpfv = *fv;
 			walk_directory(fv, fat16_sc2dc(fv, D_CLUSTER(fv)));
+			*fv = tmpfv;
 			memcpy(fv->secbuf, tmpbuf, 512);
 		}
 	}
 }
 
+// read a whole file back and compare it against what we think is in it
+int check_file(struct fat16_volinfo *fv, char *path, uint8_t *ref, uint16_t len)
+{
+	uint8_t buf[16384];
+	uint16_t r;
+	
+	if (fat16_fopen(fv, path)) {
+		printf("Couldn't open %s...\n", path);
+		return -1;
+	}
+	r = fat16_fread(fv, buf, sizeof(buf));
+	if (r != len || memcmp(buf, ref, len)) {
+		printf("%s: read %u bytes back, expected %u, or the contents differ\n", path, r, len);
+		return -1;
+	}
+	return 0;
+}
+
+// create/append/overwrite, run with and without the FAT cache
+int write_test(struct fat16_volinfo *fv, uint8_t *RNDBIN)
+{
+	uint8_t ref[16384];
+	char name[32];
+	uint16_t x, n;
+	unsigned long rd, wr;
+	
+	// append 37 byte records to a new file, the FAT and dirent are only written on flush
+	rd = rd_ops; wr = wr_ops;
+	if (fat16_fcreate(fv, "/LOG.TXT")) {
+		printf("Couldn't create /LOG.TXT\n");
+		return -1;
+	}
+	for (x = n = 0; x < 300; x++) {
+		sprintf((char *)ref + n, "record %5u of the append test..\r\n", x);
+		if (fat16_fwrite(fv, ref + n, 37) != 37) {
+			printf("Short write on /LOG.TXT\n");
+			return -1;
+		}
+		n += 37;
+	}
+	fat16_fflush(fv);
+	printf("append 300x37 bytes: %lu sector reads, %lu sector writes\n", rd_ops - rd, wr_ops - wr);
+	if (check_file(fv, "/LOG.TXT", ref, n)) {
+		return -1;
+	}
+	
+	// reopen and add some more on the end
+	if (fat16_fappend(fv, "/LOG.TXT") || fat16_fwrite(fv, RNDBIN, 1000) != 1000) {
+		printf("Couldn't append to /LOG.TXT\n");
+		return -1;
+	}
+	memcpy(ref + n, RNDBIN, 1000);
+	n += 1000;
+	if (check_file(fv, "/LOG.TXT", ref, n)) {
+		return -1;
+	}
+	
+	// a copy of RND.BIN in a sub directory, then overwrite the middle of it
+	if (fat16_fcreate(fv, "/SUBDIR/NEW.BIN") || fat16_fwrite(fv, RNDBIN, 8192) != 8192) {
+		printf("Couldn't write /SUBDIR/NEW.BIN\n");
+		return -1;
+	}
+	if (fat16_fopen(fv, "/SUBDIR/NEW.BIN")) {
+		printf("Couldn't reopen /SUBDIR/NEW.BIN\n");
+		return -1;
+	}
+	fv->f_pos[0] = 1000;
+	if (fat16_fwrite(fv, ref, 3000) != 3000) {
+		printf("Short overwrite on /SUBDIR/NEW.BIN\n");
+		return -1;
+	}
+	memcpy(ref + 4000, RNDBIN, 8192);
+	memcpy(ref + 4000 + 1000, ref, 3000);
+	if (check_file(fv, "/SUBDIR/NEW.BIN", ref + 4000, 8192)) {
+		return -1;
+	}
+	
+	// truncate it by creating it again
+	if (fat16_fcreate(fv, "/SUBDIR/NEW.BIN") || fat16_fwrite(fv, (uint8_t *)"short", 5) != 5) {
+		printf("Couldn't recreate /SUBDIR/NEW.BIN\n");
+		return -1;
+	}
+	if (check_file(fv, "/SUBDIR/NEW.BIN", (uint8_t *)"short", 5)) {
+		return -1;
+	}
+	
+	// enough files to make the sub directory grow a cluster or two
+	for (x = 0; x < 80; x++) {
+		sprintf(name, "/SUBDIR/F%u.TXT", x);
+		if (fat16_fcreate(fv, name) || fat16_fwrite(fv, (uint8_t *)name, strlen(name)) != strlen(name)) {
+			printf("Couldn't write %s\n", name);
+			return -1;
+		}
+	}
+	for (x = 0; x < 80; x++) {
+		sprintf(name, "/SUBDIR/F%u.TXT", x);
+		if (check_file(fv, name, (uint8_t *)name, strlen(name))) {
+			return -1;
+		}
+	}
+	
+	// no directory or an empty name
+	if (!fat16_fcreate(fv, "/NODIR/X.TXT") || !fat16_fcreate(fv, "/SUBDIR/")) {
+		printf("Created a file where it shouldn't\n");
+		return -1;
+	}
+	return fat16_fflush(fv);
+}
+
 int main(void)
 {
 	struct fat16_volinfo fv;
-	uint8_t secbuf[512], RNDBIN[8192];
+	uint8_t secbuf[512], fatbuf[512], RNDBIN[8192];
 	FILE *rnd;
 	
 	// load rnd
@@ -95,7 +214,11 @@ int main(void)
 	}
 	fclose(rnd);
 	
-	f = fopen("test.fs", "rb");
+	f = fopen("test.fs", "r+b");
+	if (!f) {
+		printf("test.fs isn't there\n");
+		return -1;
+	}
 	
 	fat16_initvol(&fv, secbuf);
 	
@@ -133,4 +256,18 @@ int main(void)
 		}
 	}
 
+	
+	// writing, first straight through to the FAT then with it cached
+	if (write_test(&fv, RNDBIN)) {
+		return -1;
+	}
+#ifndef FAT16_TINY
+	fat16_fatbuf(&fv, fatbuf);
+	if (write_test(&fv, RNDBIN)) {
+		return -1;
+	}
+#endif
+	printf("Write tests passed.\n");
+	fclose(f);
+	return 0;
 }
@@ -0,0 +1,77 @@
+#!/bin/bash
+# mkimg.sh <image> <sectors per cluster>
+#
+# Builds a FAT16 image for bench with mkfs.fat and fills it with mtools:
+#   /ROOT.TXT, /SMALL.BIN, /CONT.BIN              plain files in the root
+#   /D1/D2/.../D8/FILE.BIN                        a directory 8 deep with a file at each level
+#   /MANY/Fnnn.TXT                                enough entries to spread the directory over clusters
+#   /FRAG/FRAG1.BIN, /FRAG/FRAG2.BIN              fragmented files, see below
+#
+# Every mtools run starts allocating at the first free cluster, so freeing every other
+# filler cluster and then copying in a file leaves it in one cluster pieces.
+set -e
+
+IMG=$1
+SPC=$2
+if [ -z "${IMG}" ] || [ -z "${SPC}" ]; then
+	echo "usage: $0 <image> <sectors per cluster>"
+	exit 1
+fi
+
+# about 16K clusters, fat16.c wants the root directory to fill whole clusters
+SIZE=$((SPC * 8))M
+ROOT=$((SPC * 16))
+if [ ${ROOT} -lt 512 ]; then
+	ROOT=512
+fi
+CLUSTER=$((SPC * 512))
+
+TMP=`mktemp -d`
+trap "rm -rf ${TMP}" EXIT
+
+rm -f ${IMG}
+truncate --size ${SIZE} ${IMG}
+mkfs.fat -F 16 -s ${SPC} -R ${SPC} -r ${ROOT} -n BENCH ${IMG} > /dev/null
+
+# root
+echo "root file" > ${TMP}/ROOT.TXT
+head -c 100 /dev/urandom > ${TMP}/SMALL.BIN
+head -c 200000 /dev/urandom > ${TMP}/CONT.BIN
+mcopy -i ${IMG} ${TMP}/ROOT.TXT ${TMP}/SMALL.BIN ${TMP}/CONT.BIN ::/
+
+# deep directories
+P=
+for d in 1 2 3 4 5 6 7 8; do
+	P=${P}/D${d}
+	mmd -i ${IMG} ::${P}
+	head -c $((d * 3000)) /dev/urandom > ${TMP}/FILE.BIN
+	mcopy -i ${IMG} ${TMP}/FILE.BIN ::${P}/
+done
+
+# a big directory
+mkdir ${TMP}/many
+for n in `seq 0 299`; do
+	echo "file ${n}" > ${TMP}/many/F${n}.TXT
+done
+mmd -i ${IMG} ::/MANY
+mcopy -i ${IMG} ${TMP}/many/* ::/MANY/
+
+# fragmented files, one cluster fillers with every other one freed
+mkdir ${TMP}/fill
+for n in `seq 0 199`; do
+	head -c ${CLUSTER} /dev/zero > ${TMP}/fill/X${n}.BIN
+done
+mmd -i ${IMG} ::/FRAG
+mcopy -i ${IMG} ${TMP}/fill/* ::/FRAG/
+for n in `seq 1 2 199`; do
+	mdel -i ${IMG} ::/FRAG/X${n}.BIN
+done
+head -c $((CLUSTER * 60 + 123)) /dev/urandom > ${TMP}/FRAG1.BIN
+mcopy -i ${IMG} ${TMP}/FRAG1.BIN ::/FRAG/
+for n in `seq 0 2 199`; do
+	mdel -i ${IMG} ::/FRAG/X${n}.BIN
+done
+head -c $((CLUSTER * 150 + 77)) /dev/urandom > ${TMP}/FRAG2.BIN
+mcopy -i ${IMG} ${TMP}/FRAG2.BIN ::/FRAG/
+
+fsck.fat -n ${IMG} > /dev/null